@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include "bakedfont.h"
+
+Font BakedFont_load(const BakedFont *baked)
+{
+    Font font = {0};
+
+    int alpha_size;
+    unsigned char *alpha = DecompressData(baked->alpha, baked->alpha_size, &alpha_size);
+    if (alpha == NULL)
+        return font;
+
+    size_t pixels = (size_t) baked->width * baked->height;
+    if ((size_t) alpha_size != pixels) {
+        MemFree(alpha);
+        return font;
+    }
+
+    // The atlas only stores coverage, but text is
+    // drawn by blending the alpha channel, so it's
+    // expanded to white plus alpha like raylib does.
+    unsigned char *data = malloc(2 * pixels);
+    GlyphInfo *glyphs = calloc(baked->glyph_count, sizeof(GlyphInfo));
+    Rectangle *recs = malloc(baked->glyph_count * sizeof(Rectangle));
+    if (data == NULL || glyphs == NULL || recs == NULL) {
+        free(data);
+        free(glyphs);
+        free(recs);
+        MemFree(alpha);
+        return font;
+    }
+    for (size_t i = 0; i < pixels; i++) {
+        data[2*i+0] = 255;
+        data[2*i+1] = alpha[i];
+    }
+    MemFree(alpha);
+
+    Image atlas = {
+        .data = data,
+        .width = baked->width,
+        .height = baked->height,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA,
+    };
+    font.texture = LoadTextureFromImage(atlas);
+    free(data);
+
+    // Glyph images are left empty since they're
+    // only used when drawing text on CPU images.
+    for (int i = 0; i < baked->glyph_count; i++) {
+        glyphs[i].value    = baked->glyphs[i].value;
+        glyphs[i].offsetX  = baked->glyphs[i].offset_x;
+        glyphs[i].offsetY  = baked->glyphs[i].offset_y;
+        glyphs[i].advanceX = baked->glyphs[i].advance_x;
+        recs[i] = baked->glyphs[i].rec;
+    }
+    font.baseSize = baked->size;
+    font.glyphCount = baked->glyph_count;
+    font.glyphPadding = baked->padding;
+    font.glyphs = glyphs;
+    font.recs = recs;
+    return font;
+}
@@ -0,0 +1,33 @@
+#ifndef SNBPAD_BAKEDFONT_H
+#define SNBPAD_BAKEDFONT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <raylib.h>
+
+/* A font atlas rasterized at build time by the 
+ * fontbaker tool. Loading it at runtime only 
+ * means inflating the atlas and uploading it,
+ * instead of parsing and rasterizing a TTF. */
+
+typedef struct {
+    int value;
+    int offset_x;
+    int offset_y;
+    int advance_x;
+    Rectangle rec;
+} BakedGlyph;
+
+typedef struct {
+    int size;
+    int padding;
+    int glyph_count;
+    const BakedGlyph *glyphs;
+    int width;
+    int height;
+    const unsigned char *alpha; // DEFLATE compressed, one byte per pixel
+    size_t               alpha_size;
+} BakedFont;
+
+Font BakedFont_load(const BakedFont *baked);
+#endif
@@ -0,0 +1,94 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include "dircrawl.h"
+
+// make crawl_bench
+//
+// Measures how long crawling the directory given
+// as first argument takes with 1, 2, 4.. threads
+// up to the number of cores, or up to the second
+// argument, both from scratch and revalidating a
+// previous index. Only the first run starts with
+// a cold cache, so it's repeated once before
+// timing.
+
+static sem_t crawled;
+
+static void notify(void)
+{
+    sem_post(&crawled);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static FileIndex *crawl(const char *path, size_t num_threads,
+                        const FileIndex *previous)
+{
+    DirCrawler *crawler = DirCrawler_start(path, num_threads, NULL, previous, NULL, notify);
+    if (crawler == NULL)
+        return NULL;
+    sem_wait(&crawled);
+    FileIndex *index = DirCrawler_poll(crawler);
+    DirCrawler_stop(crawler);
+    return index;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path> [max threads]\n", argv[0]);
+        return -1;
+    }
+    const char *path = argv[1];
+
+    size_t max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 2)
+        max_threads = strtoul(argv[2], NULL, 10);
+    max_threads = (max_threads > 0) ? max_threads : 1;
+
+    sem_init(&crawled, 0, 0);
+
+    FileIndex *previous = crawl(path, max_threads, NULL);
+    if (previous == NULL) {
+        fprintf(stderr, "Error: Couldn't crawl \"%s\"\n", path);
+        return -1;
+    }
+    uint32_t expected = previous->num_entries;
+    fprintf(stdout, "%u entries, %u files\n", previous->num_entries, previous->num_files);
+    fprintf(stdout, "%-8s %12s %14s %16s\n", "threads", "crawl ms", "entries/s", "revalidate ms");
+
+    for (size_t n = 1; ; n = (2 * n < max_threads) ? 2 * n : max_threads) {
+
+        double elapsed[2];
+        for (int revalidate = 0; revalidate < 2; revalidate++) {
+            double start = now();
+            FileIndex *index = crawl(path, n, revalidate ? previous : NULL);
+            elapsed[revalidate] = now() - start;
+
+            if (index == NULL || index->num_entries != expected) {
+                fprintf(stderr, "Error: Crawling with %zu threads gave different results\n", n);
+                if (index != NULL)
+                    FileIndex_free(index);
+                FileIndex_free(previous);
+                return -1;
+            }
+            FileIndex_free(index);
+        }
+        fprintf(stdout, "%-8zu %12.1f %14.0f %16.1f\n", n, elapsed[0] * 1000,
+                expected / elapsed[0], elapsed[1] * 1000);
+        if (n == max_threads)
+            break;
+    }
+    FileIndex_free(previous);
+    sem_destroy(&crawled);
+    return 0;
+}
@@ -0,0 +1,808 @@
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <raylib.h>
+#include "utils.h"
+#include "dircrawl.h"
+
+#define NAME_BLOCK_SIZE (64 * 1024)
+#define DENTS_BUFFER_SIZE (32 * 1024)
+#define MAX_IGNORE_FILE_SIZE (1024 * 1024)
+
+// A directory modified this close to the start of
+// the crawl may be modified again without its
+// mtime changing, so its mtime isn't trusted.
+#define RACY_MTIME_NS 2000000000LL
+
+typedef struct CrawlDir CrawlDir;
+
+typedef struct {
+    const char *name; // Zero-terminated
+    CrawlDir   *child;
+    uint8_t     name_len;
+    uint8_t     type;
+    bool        ignored;
+} CrawlEntry;
+
+/* A directory keeps its descriptor open until
+ * all of its subdirectories were opened through
+ * it, which is what [refs] counts. The rules of
+ * its .gitignore are a layer of the states of
+ * all of its subdirectories, so they stay until
+ * the crawl is over. */
+struct CrawlDir {
+    CrawlDir   *parent;
+    const char *name;
+    uint32_t    previous; // Entry in the previous index
+    int         fd;
+    atomic_int  refs;
+    bool        failed;
+    bool        has_ignore_file;
+    int64_t     mtime;    // 0 if it's not to be trusted
+    IgnoreState ignore;   // Until it's listed
+    IgnoreLayer layer;
+    IgnoreRules *rules;   // Of its .gitignore, or NULL
+    CrawlEntry *entries;
+    uint32_t    num_entries;
+    uint32_t    max_entries;
+};
+
+typedef struct NameBlock NameBlock;
+struct NameBlock {
+    NameBlock *next;
+    size_t     used;
+    char       data[NAME_BLOCK_SIZE];
+};
+
+/* The owner of a queue takes directories from
+ * its end, so that it goes depth first and few
+ * descriptors are open at once, while the other
+ * workers steal from its start, where the bigger
+ * subtrees are. */
+typedef struct {
+    DirCrawler *crawler;
+    pthread_t   thread;
+    pthread_mutex_t lock;
+    CrawlDir  **queue;
+    size_t      first;
+    size_t      count;
+    size_t      capacity;
+    NameBlock  *names; // Stay until the index is built
+    size_t      num_entries;
+    size_t      names_size;
+} CrawlWorker;
+
+struct DirCrawler {
+    pthread_t    thread;
+    char        *path;
+    size_t       path_len;
+    char        *snapshot; // Where the index is saved, or NULL
+    const FileIndex *previous;
+    IgnoreLayer  exclude; // Below the .gitignore files
+    int64_t      start_time;
+    CrawlDir    *root;
+    CrawlWorker *workers;
+    size_t       num_workers;
+    atomic_bool  stop;
+    atomic_size_t pending; // Directories queued or being listed
+    atomic_size_t queued;
+    atomic_size_t idle;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    bool       done;
+    FileIndex *index;
+    void (*notify)(void);
+};
+
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+static CrawlDir *newDir(CrawlDir *parent, const char *name, uint32_t previous)
+{
+    CrawlDir *dir = malloc(sizeof(CrawlDir));
+    if (dir != NULL) {
+        dir->parent = parent;
+        dir->name = name;
+        dir->previous = previous;
+        dir->fd = -1;
+        atomic_init(&dir->refs, 0);
+        dir->failed = false;
+        dir->has_ignore_file = false;
+        dir->mtime = 0;
+        dir->ignore = (IgnoreState) { 0 };
+        dir->rules = NULL;
+        dir->entries = NULL;
+        dir->num_entries = 0;
+        dir->max_entries = 0;
+    }
+    return dir;
+}
+
+/* Called once a subdirectory was opened through
+ * the descriptor of [dir]. */
+static void releaseDir(CrawlDir *dir)
+{
+    if (atomic_fetch_sub(&dir->refs, 1) == 1) {
+        close(dir->fd);
+        dir->fd = -1;
+    }
+}
+
+static const char *copyName(CrawlWorker *worker, const char *name, size_t len)
+{
+    NameBlock *block = worker->names;
+    if (block == NULL || NAME_BLOCK_SIZE - block->used < len + 1) {
+        block = malloc(sizeof(NameBlock));
+        if (block == NULL)
+            return NULL;
+        block->next = worker->names;
+        block->used = 0;
+        worker->names = block;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    block->used += len + 1;
+    return copy;
+}
+
+static bool appendEntry(CrawlWorker *worker, CrawlDir *dir,
+                        const char *name, size_t len,
+                        DirEntryType type)
+{
+    if (dir->num_entries == dir->max_entries) {
+        uint32_t max_entries = MAX(2 * dir->max_entries, 16);
+        CrawlEntry *entries = realloc(dir->entries, max_entries * sizeof(CrawlEntry));
+        if (entries == NULL)
+            return false;
+        dir->entries = entries;
+        dir->max_entries = max_entries;
+    }
+    const char *copy = copyName(worker, name, len);
+    if (copy == NULL)
+        return false;
+
+    CrawlEntry *entry = &dir->entries[dir->num_entries++];
+    entry->name = copy;
+    entry->child = NULL;
+    entry->name_len = len;
+    entry->type = type;
+    entry->ignored = false;
+    worker->num_entries++;
+    worker->names_size += len;
+    return true;
+}
+
+static int compareEntries(const void *a, const void *b)
+{
+    const CrawlEntry *x = a;
+    const CrawlEntry *y = b;
+    return FileIndex_compareNames(x->name, x->name_len, y->name, y->name_len);
+}
+
+static DirEntryType getEntryType(int fd, const struct linux_dirent64 *ent)
+{
+    switch (ent->d_type) {
+        case DT_DIR: return DirEntryType_DIR;
+        case DT_REG: return DirEntryType_FILE;
+        case DT_UNKNOWN: break;
+        default: return DirEntryType_OTHER;
+    }
+
+    // The filesystem doesn't report types
+    struct stat buffer;
+    if (fstatat(fd, ent->d_name, &buffer, AT_SYMLINK_NOFOLLOW))
+        return DirEntryType_OTHER;
+
+    switch (buffer.st_mode & S_IFMT) {
+        case S_IFDIR: return DirEntryType_DIR;
+        case S_IFREG: return DirEntryType_FILE;
+    }
+    return DirEntryType_OTHER;
+}
+
+static bool pushDirs(CrawlWorker *worker, CrawlDir **dirs, size_t count)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (worker->first > 0 && worker->first + worker->count + count > worker->capacity) {
+        memmove(worker->queue, worker->queue + worker->first,
+                worker->count * sizeof(CrawlDir*));
+        worker->first = 0;
+    }
+    if (worker->count + count > worker->capacity) {
+        size_t capacity = MAX(2 * worker->capacity, worker->count + count);
+        capacity = MAX(capacity, 64);
+        CrawlDir **queue = realloc(worker->queue, capacity * sizeof(CrawlDir*));
+        if (queue == NULL) {
+            pthread_mutex_unlock(&worker->lock);
+            return false;
+        }
+        worker->queue = queue;
+        worker->capacity = capacity;
+    }
+    memcpy(worker->queue + worker->first + worker->count,
+           dirs, count * sizeof(CrawlDir*));
+    worker->count += count;
+    DirCrawler *crawler = worker->crawler;
+    atomic_fetch_add(&crawler->queued, count);
+    pthread_mutex_unlock(&worker->lock);
+
+    if (atomic_load(&crawler->idle) > 0) {
+        pthread_mutex_lock(&crawler->lock);
+        pthread_cond_broadcast(&crawler->wake);
+        pthread_mutex_unlock(&crawler->lock);
+    }
+    return true;
+}
+
+static CrawlDir *popDir(CrawlWorker *worker)
+{
+    CrawlDir *dir = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count > 0) {
+        worker->count--;
+        dir = worker->queue[worker->first + worker->count];
+        atomic_fetch_sub(&worker->crawler->queued, 1);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return dir;
+}
+
+/* Gives up on directories that couldn't be
+ * queued, as if they couldn't be opened. */
+static void dropDirs(DirCrawler *crawler, CrawlDir **dirs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        dirs[i]->failed = true;
+        releaseDir(dirs[i]->parent);
+    }
+    atomic_fetch_sub(&crawler->pending, count);
+}
+
+/* Takes half of the queue of the first worker
+ * that has something queued. */
+static CrawlDir *stealDir(CrawlWorker *thief)
+{
+    DirCrawler *crawler = thief->crawler;
+    size_t self = thief - crawler->workers;
+    for (size_t i = 1; i < crawler->num_workers; i++) {
+        CrawlWorker *victim = &crawler->workers[(self + i) % crawler->num_workers];
+
+        CrawlDir *stolen[64];
+        size_t count = 0;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->count > 0) {
+            count = MIN((victim->count + 1) / 2, sizeof(stolen) / sizeof(stolen[0]));
+            memcpy(stolen, victim->queue + victim->first, count * sizeof(CrawlDir*));
+            victim->first += count;
+            victim->count -= count;
+            atomic_fetch_sub(&crawler->queued, count);
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (count > 0) {
+            if (count > 1 && !pushDirs(thief, stolen + 1, count - 1))
+                dropDirs(crawler, stolen + 1, count - 1);
+            return stolen[0];
+        }
+    }
+    return NULL;
+}
+
+/* Returns false once every directory was listed
+ * or the crawl was stopped. */
+static bool waitForWork(DirCrawler *crawler)
+{
+    pthread_mutex_lock(&crawler->lock);
+    atomic_fetch_add(&crawler->idle, 1);
+    while (!atomic_load(&crawler->stop)
+        && atomic_load(&crawler->pending) > 0
+        && atomic_load(&crawler->queued) == 0)
+        pthread_cond_wait(&crawler->wake, &crawler->lock);
+    atomic_fetch_sub(&crawler->idle, 1);
+    bool more = !atomic_load(&crawler->stop)
+              && atomic_load(&crawler->pending) > 0;
+    pthread_mutex_unlock(&crawler->lock);
+    return more;
+}
+
+static void queueDirs(CrawlWorker *worker, CrawlDir **dirs, size_t count)
+{
+    DirCrawler *crawler = worker->crawler;
+    atomic_fetch_add(&crawler->pending, count);
+    if (count > 0 && !pushDirs(worker, dirs, count))
+        dropDirs(crawler, dirs, count);
+}
+
+static int openDir(DirCrawler *crawler, CrawlDir *dir)
+{
+    if (dir->parent == NULL)
+        return open(crawler->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    int fd = openat(dir->parent->fd, dir->name,
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    releaseDir(dir->parent);
+    return fd;
+}
+
+static void readEntries(CrawlWorker *worker, CrawlDir *dir, int fd)
+{
+    DirCrawler *crawler = worker->crawler;
+    char dents[DENTS_BUFFER_SIZE] __attribute__((aligned(8)));
+    // A listing that couldn't be completed is
+    // dropped as a whole, so it stops there.
+    while (!dir->failed && !atomic_load(&crawler->stop)) {
+        long num = syscall(SYS_getdents64, fd, dents, sizeof(dents));
+        if (num <= 0) {
+            if (num < 0)
+                dir->failed = true;
+            break;
+        }
+        for (long off = 0; off < num; ) {
+            struct linux_dirent64 *ent = (struct linux_dirent64*) (dents + off);
+            off += ent->d_reclen;
+
+            const char *name = ent->d_name;
+            if (name[0] == '.') {
+                if (!strcmp(name, ".gitignore"))
+                    dir->has_ignore_file = true;
+                continue;
+            }
+
+            DirEntryType type = getEntryType(fd, ent);
+            if (!appendEntry(worker, dir, name, strlen(name), type)) {
+                dir->failed = true;
+                break;
+            }
+        }
+    }
+    if (dir->num_entries > 1)
+        qsort(dir->entries, dir->num_entries, sizeof(CrawlEntry), compareEntries);
+}
+
+/* Takes the entries of [dir] from the previous
+ * index if it wasn't modified since. */
+static bool reuseEntries(CrawlWorker *worker, CrawlDir *dir, int64_t mtime)
+{
+    const FileIndex *previous = worker->crawler->previous;
+    if (previous == NULL || dir->previous == FILEINDEX_NONE)
+        return false;
+
+    // Ignored directories weren't listed
+    const FileIndexEntry *e = &previous->entries[dir->previous];
+    if (e->type != DirEntryType_DIR || e->failed || e->ignored
+     || e->mtime == 0 || e->mtime != mtime)
+        return false;
+
+    for (uint32_t i = 0; i < e->num_children; i++) {
+        const FileIndexEntry *child = &previous->entries[e->children + i];
+        const char *name = previous->names + child->name_off;
+        if (!appendEntry(worker, dir, name, child->name_len, child->type)) {
+            // Read after all
+            dir->num_entries = 0;
+            return false;
+        }
+    }
+    // The rules may have changed even if the
+    // directory didn't, so they're read again.
+    dir->has_ignore_file = e->has_ignore_file;
+    return true;
+}
+
+/* Adds the rules of the .gitignore of [dir] to
+ * those it inherited. */
+static void loadIgnoreFile(CrawlDir *dir, int fd)
+{
+    int file = openat(fd, ".gitignore", O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+        return;
+
+    struct stat buffer;
+    char *text = NULL;
+    ssize_t len = -1;
+    if (fstat(file, &buffer) == 0 && S_ISREG(buffer.st_mode)
+     && buffer.st_size <= MAX_IGNORE_FILE_SIZE) {
+        text = malloc(MAX(buffer.st_size, 1));
+        if (text != NULL)
+            len = read(file, text, buffer.st_size);
+    }
+    close(file);
+
+    if (len >= 0) {
+        dir->rules = IgnoreRules_compile(text, len);
+        if (dir->rules != NULL) {
+            dir->layer.rules = dir->rules;
+            IgnoreState_push(&dir->ignore, &dir->layer);
+        }
+    }
+    free(text);
+}
+
+static void listDir(CrawlWorker *worker, CrawlDir *dir)
+{
+    DirCrawler *crawler = worker->crawler;
+
+    int fd = openDir(crawler, dir);
+    if (fd < 0) {
+        dir->failed = true;
+        return;
+    }
+
+    int64_t mtime = 0;
+    struct stat buffer;
+    if (fstat(fd, &buffer) == 0)
+        mtime = (int64_t) buffer.st_mtim.tv_sec * 1000000000 + buffer.st_mtim.tv_nsec;
+    if (mtime < crawler->start_time - RACY_MTIME_NS)
+        dir->mtime = mtime;
+
+    bool reused = reuseEntries(worker, dir, mtime);
+    if (!reused)
+        readEntries(worker, dir, fd);
+
+    if (dir->parent == NULL && crawler->exclude.rules != NULL)
+        IgnoreState_push(&dir->ignore, &crawler->exclude);
+    if (dir->has_ignore_file)
+        loadIgnoreFile(dir, fd);
+
+    // Ignored entries are kept, but ignored
+    // directories aren't entered.
+    int refs = 0;
+    for (uint32_t i = 0; i < dir->num_entries; i++) {
+        CrawlEntry *entry = &dir->entries[i];
+        bool is_dir = (entry->type == DirEntryType_DIR);
+        entry->ignored = IgnoreState_match(&dir->ignore, entry->name,
+                                           entry->name_len, is_dir);
+        if (is_dir && !entry->ignored)
+            refs++;
+    }
+
+    // Subdirectories are opened through [fd], so
+    // it's kept until they all were.
+    CrawlDir *children[64];
+    size_t num_children = 0;
+    dir->fd = fd;
+    atomic_store(&dir->refs, refs + 1);
+
+    for (uint32_t i = 0; i < dir->num_entries; i++) {
+        CrawlEntry *entry = &dir->entries[i];
+        if (entry->type != DirEntryType_DIR || entry->ignored)
+            continue;
+
+        // Reused entries are in the same order as
+        // in the previous index.
+        uint32_t previous = FILEINDEX_NONE;
+        if (reused)
+            previous = crawler->previous->entries[dir->previous].children + i;
+        else if (crawler->previous != NULL && dir->previous != FILEINDEX_NONE)
+            previous = FileIndex_findChild(crawler->previous, dir->previous,
+                                           entry->name, entry->name_len);
+
+        CrawlDir *child = newDir(dir, entry->name, previous);
+        if (child != NULL && !IgnoreState_enter(&dir->ignore, entry->name,
+                                                entry->name_len, &child->ignore)) {
+            free(child);
+            child = NULL;
+        }
+        if (child == NULL)
+            releaseDir(dir);
+        else {
+            entry->child = child;
+            children[num_children++] = child;
+        }
+
+        if (num_children == sizeof(children) / sizeof(children[0])) {
+            queueDirs(worker, children, num_children);
+            num_children = 0;
+        }
+    }
+    IgnoreState_free(&dir->ignore);
+    queueDirs(worker, children, num_children);
+    releaseDir(dir);
+}
+
+static void *runWorker(void *arg)
+{
+    CrawlWorker *worker = arg;
+    DirCrawler *crawler = worker->crawler;
+    for (;;) {
+        CrawlDir *dir = popDir(worker);
+        if (dir == NULL)
+            dir = stealDir(worker);
+        if (dir == NULL) {
+            if (!waitForWork(crawler))
+                break;
+            continue;
+        }
+        listDir(worker, dir);
+
+        if (atomic_fetch_sub(&crawler->pending, 1) == 1) {
+            pthread_mutex_lock(&crawler->lock);
+            pthread_cond_broadcast(&crawler->wake);
+            pthread_mutex_unlock(&crawler->lock);
+        }
+    }
+    return NULL;
+}
+
+static void freeDir(CrawlDir *dir)
+{
+    IgnoreState_free(&dir->ignore);
+    if (dir->rules != NULL)
+        IgnoreRules_free(dir->rules);
+    free(dir->entries);
+    free(dir);
+}
+
+/* Lays the crawled directories out breadth first
+ * so that the children of each one end up next
+ * to each other, freeing them on the way. */
+static FileIndex *buildIndex(DirCrawler *crawler)
+{
+    size_t num_entries = 1;
+    size_t names_size = 0;
+    for (size_t i = 0; i < crawler->num_workers; i++) {
+        num_entries += crawler->workers[i].num_entries;
+        names_size += crawler->workers[i].names_size;
+    }
+    if (num_entries >= FILEINDEX_NONE)
+        return NULL;
+
+    FileIndex *index = malloc(sizeof(FileIndex));
+    char      *root  = malloc(crawler->path_len + 1);
+    CrawlDir **dirs  = malloc(num_entries * sizeof(CrawlDir*));
+    FileIndexEntry *entries = malloc(num_entries * sizeof(FileIndexEntry));
+    char *names = malloc(MAX(names_size, 1));
+    if (index == NULL || root == NULL || dirs == NULL || entries == NULL || names == NULL) {
+        free(index);
+        free(root);
+        free(dirs);
+        free(entries);
+        free(names);
+        return NULL;
+    }
+    memcpy(root, crawler->path, crawler->path_len + 1);
+
+    entries[0] = (FileIndexEntry) {
+        .parent = FILEINDEX_NONE,
+        .type = DirEntryType_DIR,
+    };
+    dirs[0] = crawler->root;
+    crawler->root = NULL;
+
+    uint32_t used = 1;
+    uint32_t num_files = 0;
+    size_t names_used = 0;
+    for (uint32_t i = 0; i < used; i++) {
+        CrawlDir *dir = dirs[i];
+        if (dir == NULL)
+            continue;
+
+        entries[i].mtime = dir->mtime;
+        entries[i].failed = dir->failed;
+        entries[i].has_ignore_file = dir->has_ignore_file;
+        entries[i].children = used;
+        entries[i].num_children = dir->num_entries;
+        for (uint32_t j = 0; j < dir->num_entries; j++) {
+            CrawlEntry *entry = &dir->entries[j];
+            memcpy(names + names_used, entry->name, entry->name_len);
+            entries[used] = (FileIndexEntry) {
+                .parent = i,
+                .name_off = names_used,
+                .name_len = entry->name_len,
+                .type = entry->type,
+                .ignored = entry->ignored,
+            };
+            dirs[used] = entry->child;
+            names_used += entry->name_len;
+            if (entry->type == DirEntryType_FILE && !entry->ignored)
+                num_files++;
+            used++;
+        }
+        freeDir(dir);
+    }
+    free(dirs);
+
+    index->root = root;
+    index->root_len = crawler->path_len;
+    index->entries = entries;
+    index->num_entries = used;
+    index->num_files = num_files;
+    index->names = names;
+    index->names_size = names_used;
+    index->mapping = NULL;
+    index->mapping_size = 0;
+    return index;
+}
+
+static void freeDirs(CrawlDir *root)
+{
+    if (root == NULL)
+        return;
+    for (uint32_t i = 0; i < root->num_entries; i++)
+        freeDirs(root->entries[i].child);
+    if (root->fd >= 0)
+        close(root->fd);
+    freeDir(root);
+}
+
+static void *runCrawler(void *arg)
+{
+    DirCrawler *crawler = arg;
+
+    // Workers that couldn't be started have
+    // nothing to be stolen, so they're just
+    // skipped.
+    size_t started = 0;
+    for (size_t i = 0; i < crawler->num_workers; i++)
+        if (pthread_create(&crawler->workers[i].thread, NULL,
+                           runWorker, &crawler->workers[i]) == 0)
+            started++;
+        else
+            break;
+    if (started == 0)
+        runWorker(&crawler->workers[0]);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(crawler->workers[i].thread, NULL);
+
+    FileIndex *index = NULL;
+    if (!atomic_load(&crawler->stop)) {
+        index = buildIndex(crawler);
+        if (index == NULL)
+            TraceLog(LOG_WARNING, "Couldn't index \"%s\"", crawler->path);
+        else if (crawler->snapshot != NULL)
+            FileIndex_save(index, crawler->snapshot);
+    }
+    freeDirs(crawler->root);
+    crawler->root = NULL;
+
+    pthread_mutex_lock(&crawler->lock);
+    crawler->index = index;
+    crawler->done = true;
+    pthread_mutex_unlock(&crawler->lock);
+
+    if (index != NULL && crawler->notify != NULL)
+        crawler->notify();
+    return NULL;
+}
+
+/* Starts crawling [path] on [num_threads], or one
+ * per core if 0. Entries matching [exclude] or a
+ * .gitignore are marked as ignored, and ignored
+ * directories aren't entered. [exclude] and
+ * [previous] may be NULL, and must stay around
+ * until the crawl is over. If [snapshot] isn't
+ * NULL, the index is saved there. [notify] is
+ * called from the crawling thread once the index
+ * is ready. */
+DirCrawler *DirCrawler_start(const char *path, size_t num_threads,
+                             const IgnoreRules *exclude,
+                             const FileIndex *previous, const char *snapshot,
+                             void (*notify)(void))
+{
+    if (num_threads == 0) {
+        long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (num_cores > 0) ? (size_t) num_cores : 1;
+    }
+
+    DirCrawler  *crawler = malloc(sizeof(DirCrawler));
+    CrawlWorker *workers = malloc(num_threads * sizeof(CrawlWorker));
+    char        *copy    = strdup(path);
+    char        *snapshot_copy = (snapshot != NULL) ? strdup(snapshot) : NULL;
+    CrawlDir    *root    = newDir(NULL, NULL, (previous != NULL) ? 0 : FILEINDEX_NONE);
+    if (crawler == NULL || workers == NULL || copy == NULL || root == NULL
+     || (snapshot != NULL && snapshot_copy == NULL)) {
+        free(crawler);
+        free(workers);
+        free(copy);
+        free(snapshot_copy);
+        free(root);
+        return NULL;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    for (size_t i = 0; i < num_threads; i++) {
+        CrawlWorker *worker = &workers[i];
+        worker->crawler = crawler;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->queue = NULL;
+        worker->first = 0;
+        worker->count = 0;
+        worker->capacity = 0;
+        worker->names = NULL;
+        worker->num_entries = 0;
+        worker->names_size = 0;
+    }
+
+    crawler->path = copy;
+    crawler->path_len = strlen(copy);
+    crawler->snapshot = snapshot_copy;
+    crawler->previous = previous;
+    crawler->exclude = (IgnoreLayer) { NULL, exclude };
+    crawler->start_time = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    crawler->root = root;
+    crawler->workers = workers;
+    crawler->num_workers = num_threads;
+    atomic_init(&crawler->stop, false);
+    atomic_init(&crawler->pending, 1);
+    atomic_init(&crawler->queued, 0);
+    atomic_init(&crawler->idle, 0);
+    pthread_mutex_init(&crawler->lock, NULL);
+    pthread_cond_init(&crawler->wake, NULL);
+    crawler->done = false;
+    crawler->index = NULL;
+    crawler->notify = notify;
+
+    if (!pushDirs(&workers[0], &root, 1)
+     || pthread_create(&crawler->thread, NULL, runCrawler, crawler)) {
+        crawler->workers = NULL;
+        DirCrawler_stop(crawler);
+        for (size_t i = 0; i < num_threads; i++) {
+            pthread_mutex_destroy(&workers[i].lock);
+            free(workers[i].queue);
+        }
+        free(workers);
+        return NULL;
+    }
+    return crawler;
+}
+
+/* Abandons the crawl if it's still going, and
+ * frees the index if it wasn't polled. */
+void DirCrawler_stop(DirCrawler *crawler)
+{
+    if (crawler->workers != NULL) {
+        pthread_mutex_lock(&crawler->lock);
+        atomic_store(&crawler->stop, true);
+        pthread_cond_broadcast(&crawler->wake);
+        pthread_mutex_unlock(&crawler->lock);
+        pthread_join(crawler->thread, NULL);
+
+        for (size_t i = 0; i < crawler->num_workers; i++) {
+            CrawlWorker *worker = &crawler->workers[i];
+            while (worker->names != NULL) {
+                NameBlock *block = worker->names;
+                worker->names = block->next;
+                free(block);
+            }
+            pthread_mutex_destroy(&worker->lock);
+            free(worker->queue);
+        }
+        free(crawler->workers);
+    }
+    freeDirs(crawler->root);
+    if (crawler->index != NULL)
+        FileIndex_free(crawler->index);
+    pthread_mutex_destroy(&crawler->lock);
+    pthread_cond_destroy(&crawler->wake);
+    free(crawler->path);
+    free(crawler->snapshot);
+    free(crawler);
+}
+
+/* Returns the index once the crawl is over, only
+ * once, and NULL until then. */
+FileIndex *DirCrawler_poll(DirCrawler *crawler)
+{
+    pthread_mutex_lock(&crawler->lock);
+    FileIndex *index = NULL;
+    if (crawler->done) {
+        index = crawler->index;
+        crawler->index = NULL;
+    }
+    pthread_mutex_unlock(&crawler->lock);
+    return index;
+}
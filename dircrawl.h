@@ -0,0 +1,27 @@
+#ifndef SNBPAD_DIRCRAWL_H
+#define SNBPAD_DIRCRAWL_H
+
+#include <stddef.h>
+#include "ignore.h"
+#include "fileindex.h"
+
+/* Walks a whole directory tree on a pool of
+ * threads and builds a FileIndex of it. Each
+ * directory is opened relative to its parent's
+ * descriptor, so no path is ever built, and
+ * idle threads steal directories queued by the
+ * busy ones. Given a previous index, directories
+ * that weren't modified since are taken from it
+ * instead of being read again. Ignore rules are
+ * matched as directories are listed, so ignored
+ * subtrees are never opened. */
+
+typedef struct DirCrawler DirCrawler;
+
+DirCrawler *DirCrawler_start(const char *path, size_t num_threads,
+                             const IgnoreRules *exclude,
+                             const FileIndex *previous, const char *snapshot,
+                             void (*notify)(void));
+void        DirCrawler_stop(DirCrawler *crawler);
+FileIndex  *DirCrawler_poll(DirCrawler *crawler);
+#endif
@@ -0,0 +1,331 @@
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "dirscan.h"
+
+typedef struct DirScanJob DirScanJob;
+struct DirScanJob {
+    DirScanJob *next;
+    void  *userp;
+    size_t path_len;
+    char   path[];
+};
+
+struct DirScanner {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    bool            stop;
+    DirScanJob   *jobs_head;
+    DirScanJob   *jobs_tail;
+    DirScanBatch *done_head;
+    DirScanBatch *done_tail;
+    void (*notify)(void);
+};
+
+static DirScanBatch *newBatch(void *userp)
+{
+    DirScanBatch *batch = malloc(sizeof(DirScanBatch));
+    if (batch != NULL) {
+        batch->next = NULL;
+        batch->userp = userp;
+        batch->done = false;
+        batch->failed = false;
+        batch->count = 0;
+        batch->names = NULL;
+        batch->names_used = 0;
+        batch->names_size = 0;
+    }
+    return batch;
+}
+
+void DirScanBatch_free(DirScanBatch *batch)
+{
+    free(batch->names);
+    free(batch);
+}
+
+static bool appendEntry(DirScanBatch *batch, const char *name,
+                        size_t name_len, DirEntryType type)
+{
+    if (batch->names_size - batch->names_used < name_len) {
+        size_t new_size = MAX(2 * batch->names_size, batch->names_used + name_len);
+        new_size = MAX(new_size, 4096);
+        char *new_names = realloc(batch->names, new_size);
+        if (new_names == NULL)
+            return false;
+        batch->names = new_names;
+        batch->names_size = new_size;
+    }
+    memcpy(batch->names + batch->names_used, name, name_len);
+
+    DirEntry *entry = &batch->entries[batch->count++];
+    entry->type = type;
+    entry->name_off = batch->names_used;
+    entry->name_len = name_len;
+    batch->names_used += name_len;
+    return true;
+}
+
+/* Hands a batch to the UI thread. Returns false
+ * if the scanner is stopping and the scan should
+ * be abandoned. */
+static bool postBatch(DirScanner *scanner, DirScanBatch *batch)
+{
+    pthread_mutex_lock(&scanner->lock);
+    bool stop = scanner->stop;
+    if (!stop) {
+        if (scanner->done_tail == NULL)
+            scanner->done_head = batch;
+        else
+            scanner->done_tail->next = batch;
+        scanner->done_tail = batch;
+    }
+    pthread_mutex_unlock(&scanner->lock);
+
+    if (stop)
+        DirScanBatch_free(batch);
+    else if (scanner->notify != NULL)
+        scanner->notify();
+    return !stop;
+}
+
+static DirEntryType getEntryType(DIR *dir, struct dirent *ent)
+{
+    switch (ent->d_type) {
+        case DT_DIR: return DirEntryType_DIR;
+        case DT_REG: return DirEntryType_FILE;
+        case DT_UNKNOWN: break;
+        default: return DirEntryType_OTHER;
+    }
+
+    // The filesystem doesn't report types
+    struct stat buffer;
+    if (fstatat(dirfd(dir), ent->d_name, &buffer, AT_SYMLINK_NOFOLLOW))
+        return DirEntryType_OTHER;
+
+    switch (buffer.st_mode & S_IFMT) {
+        case S_IFDIR: return DirEntryType_DIR;
+        case S_IFREG: return DirEntryType_FILE;
+    }
+    return DirEntryType_OTHER;
+}
+
+static void scanDirectory(DirScanner *scanner, DirScanJob *job)
+{
+    DirScanBatch *batch = newBatch(job->userp);
+    if (batch == NULL)
+        return;
+
+    DIR *dir = opendir(job->path);
+    if (dir == NULL) {
+        batch->done = true;
+        batch->failed = true;
+        postBatch(scanner, batch);
+        return;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+
+        const char *name = ent->d_name;
+        if (name[0] == '.')
+            continue;
+
+        if (batch->count == DIRSCAN_BATCH_SIZE) {
+            if (!postBatch(scanner, batch)) {
+                closedir(dir);
+                return;
+            }
+            batch = newBatch(job->userp);
+            if (batch == NULL) {
+                closedir(dir);
+                return;
+            }
+        }
+
+        DirEntryType type = getEntryType(dir, ent);
+        if (!appendEntry(batch, name, strlen(name), type))
+            break;
+    }
+    closedir(dir);
+
+    batch->done = true;
+    postBatch(scanner, batch);
+}
+
+static void *runScanner(void *arg)
+{
+    DirScanner *scanner = arg;
+    for (;;) {
+        pthread_mutex_lock(&scanner->lock);
+        while (!scanner->stop && scanner->jobs_head == NULL)
+            pthread_cond_wait(&scanner->wake, &scanner->lock);
+
+        if (scanner->stop) {
+            pthread_mutex_unlock(&scanner->lock);
+            break;
+        }
+
+        DirScanJob *job = scanner->jobs_head;
+        scanner->jobs_head = job->next;
+        if (scanner->jobs_head == NULL)
+            scanner->jobs_tail = NULL;
+        pthread_mutex_unlock(&scanner->lock);
+
+        scanDirectory(scanner, job);
+        free(job);
+    }
+    return NULL;
+}
+
+/* [notify] is called from the scanning thread
+ * every time a batch is ready. */
+DirScanner *DirScanner_start(void (*notify)(void))
+{
+    DirScanner *scanner = malloc(sizeof(DirScanner));
+    if (scanner == NULL)
+        return NULL;
+
+    scanner->stop = false;
+    scanner->jobs_head = NULL;
+    scanner->jobs_tail = NULL;
+    scanner->done_head = NULL;
+    scanner->done_tail = NULL;
+    scanner->notify = notify;
+    pthread_mutex_init(&scanner->lock, NULL);
+    pthread_cond_init(&scanner->wake, NULL);
+
+    if (pthread_create(&scanner->thread, NULL, runScanner, scanner)) {
+        pthread_mutex_destroy(&scanner->lock);
+        pthread_cond_destroy(&scanner->wake);
+        free(scanner);
+        return NULL;
+    }
+    return scanner;
+}
+
+/* Waits for the directory being read to be done
+ * with and drops everything else. */
+void DirScanner_stop(DirScanner *scanner)
+{
+    pthread_mutex_lock(&scanner->lock);
+    scanner->stop = true;
+    pthread_cond_signal(&scanner->wake);
+    pthread_mutex_unlock(&scanner->lock);
+
+    pthread_join(scanner->thread, NULL);
+
+    while (scanner->jobs_head != NULL) {
+        DirScanJob *job = scanner->jobs_head;
+        scanner->jobs_head = job->next;
+        free(job);
+    }
+    while (scanner->done_head != NULL) {
+        DirScanBatch *batch = scanner->done_head;
+        scanner->done_head = batch->next;
+        DirScanBatch_free(batch);
+    }
+    pthread_mutex_destroy(&scanner->lock);
+    pthread_cond_destroy(&scanner->wake);
+    free(scanner);
+}
+
+/* Urgent requests, like directories the user
+ * just opened, skip ahead of the prefetches. */
+bool DirScanner_request(DirScanner *scanner, const char *path,
+                        size_t path_len, void *userp, bool urgent)
+{
+    DirScanJob *job = malloc(sizeof(DirScanJob) + path_len + 1);
+    if (job == NULL)
+        return false;
+    job->next = NULL;
+    job->userp = userp;
+    job->path_len = path_len;
+    memcpy(job->path, path, path_len);
+    job->path[path_len] = '\0';
+
+    pthread_mutex_lock(&scanner->lock);
+    if (scanner->jobs_head == NULL) {
+        scanner->jobs_head = job;
+        scanner->jobs_tail = job;
+    } else if (urgent) {
+        job->next = scanner->jobs_head;
+        scanner->jobs_head = job;
+    } else {
+        scanner->jobs_tail->next = job;
+        scanner->jobs_tail = job;
+    }
+    pthread_cond_signal(&scanner->wake);
+    pthread_mutex_unlock(&scanner->lock);
+    return true;
+}
+
+/* Moves a queued request to the front. Returns
+ * false if it was already picked up. */
+bool DirScanner_promote(DirScanner *scanner, void *userp)
+{
+    pthread_mutex_lock(&scanner->lock);
+    DirScanJob *prev = NULL;
+    DirScanJob *job = scanner->jobs_head;
+    while (job != NULL && job->userp != userp) {
+        prev = job;
+        job = job->next;
+    }
+    if (job != NULL && prev != NULL) {
+        prev->next = job->next;
+        if (scanner->jobs_tail == job)
+            scanner->jobs_tail = prev;
+        job->next = scanner->jobs_head;
+        scanner->jobs_head = job;
+    }
+    pthread_mutex_unlock(&scanner->lock);
+    return job != NULL;
+}
+
+/* Drops a queued request. Returns false if it
+ * was already picked up, in which case its
+ * batches will still come. */
+bool DirScanner_cancel(DirScanner *scanner, void *userp)
+{
+    pthread_mutex_lock(&scanner->lock);
+    DirScanJob *prev = NULL;
+    DirScanJob *job = scanner->jobs_head;
+    while (job != NULL && job->userp != userp) {
+        prev = job;
+        job = job->next;
+    }
+    if (job != NULL) {
+        if (prev == NULL)
+            scanner->jobs_head = job->next;
+        else
+            prev->next = job->next;
+        if (scanner->jobs_tail == job)
+            scanner->jobs_tail = prev;
+    }
+    pthread_mutex_unlock(&scanner->lock);
+
+    bool found = (job != NULL);
+    free(job);
+    return found;
+}
+
+/* Returns the oldest batch that's ready, or NULL
+ * without waiting if there is none. */
+DirScanBatch *DirScanner_poll(DirScanner *scanner)
+{
+    pthread_mutex_lock(&scanner->lock);
+    DirScanBatch *batch = scanner->done_head;
+    if (batch != NULL) {
+        scanner->done_head = batch->next;
+        if (scanner->done_head == NULL)
+            scanner->done_tail = NULL;
+        batch->next = NULL;
+    }
+    pthread_mutex_unlock(&scanner->lock);
+    return batch;
+}
@@ -0,0 +1,49 @@
+#ifndef SNBPAD_DIRSCAN_H
+#define SNBPAD_DIRSCAN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Lists directories on a background thread so
+ * that the UI never waits on the filesystem.
+ * Entries are handed back in batches as they're
+ * read, each carrying the pointer that was given
+ * with the request. */
+
+#define DIRSCAN_BATCH_SIZE 256
+
+typedef struct DirScanner DirScanner;
+typedef struct DirScanBatch DirScanBatch;
+
+typedef enum {
+    DirEntryType_DIR,
+    DirEntryType_FILE,
+    DirEntryType_OTHER,
+} DirEntryType;
+
+typedef struct {
+    DirEntryType type;
+    size_t name_off; // Into the names of the batch
+    size_t name_len;
+} DirEntry;
+
+struct DirScanBatch {
+    DirScanBatch *next;
+    void    *userp;
+    bool     done;   // Last batch of the directory
+    bool     failed; // The directory couldn't be opened
+    size_t   count;
+    DirEntry entries[DIRSCAN_BATCH_SIZE];
+    char    *names;
+    size_t   names_used;
+    size_t   names_size;
+};
+
+DirScanner   *DirScanner_start(void (*notify)(void));
+void          DirScanner_stop(DirScanner *scanner);
+bool          DirScanner_request(DirScanner *scanner, const char *path, size_t path_len, void *userp, bool urgent);
+bool          DirScanner_promote(DirScanner *scanner, void *userp);
+bool          DirScanner_cancel(DirScanner *scanner, void *userp);
+DirScanBatch *DirScanner_poll(DirScanner *scanner);
+void          DirScanBatch_free(DirScanBatch *batch);
+#endif
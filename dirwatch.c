@@ -0,0 +1,214 @@
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <raylib.h>
+#include "utils.h"
+#include "dirwatch.h"
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                  | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+struct DirWatcher {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int inotify_fd;
+    int stop_fd;
+    DirEventBatch *pending; // NULL when nothing happened
+    void (*notify)(void);
+};
+
+void DirEventBatch_free(DirEventBatch *batch)
+{
+    free(batch->events);
+    free(batch->names);
+    free(batch);
+}
+
+static bool appendEvent(DirEventBatch *batch, int wd, DirEventType type,
+                        bool is_dir, const char *name, size_t name_len)
+{
+    if (batch->count == batch->capacity) {
+        size_t capacity = MAX(2 * batch->capacity, 64);
+        DirEvent *events = realloc(batch->events, capacity * sizeof(DirEvent));
+        if (events == NULL)
+            return false;
+        batch->events = events;
+        batch->capacity = capacity;
+    }
+    if (batch->names_size - batch->names_used < name_len) {
+        size_t size = MAX(2 * batch->names_size, batch->names_used + name_len);
+        size = MAX(size, 1024);
+        char *names = realloc(batch->names, size);
+        if (names == NULL)
+            return false;
+        batch->names = names;
+        batch->names_size = size;
+    }
+    if (name_len > 0)
+        memcpy(batch->names + batch->names_used, name, name_len);
+
+    DirEvent *event = &batch->events[batch->count++];
+    event->wd = wd;
+    event->type = type;
+    event->is_dir = is_dir;
+    event->name_off = batch->names_used;
+    event->name_len = name_len;
+    batch->names_used += name_len;
+    return true;
+}
+
+/* Must be called with the lock held. */
+static bool queueEvent(DirWatcher *watcher, const struct inotify_event *event)
+{
+    if (watcher->pending == NULL) {
+        watcher->pending = calloc(1, sizeof(DirEventBatch));
+        if (watcher->pending == NULL)
+            return false;
+    }
+    DirEventBatch *batch = watcher->pending;
+
+    if (event->mask & IN_Q_OVERFLOW)
+        return appendEvent(batch, -1, DirEventType_OVERFLOW, false, NULL, 0);
+
+    if (event->mask & IN_IGNORED)
+        return appendEvent(batch, event->wd, DirEventType_IGNORED, false, NULL, 0);
+
+    // Hidden entries are never listed
+    if (event->len == 0 || event->name[0] == '.')
+        return true;
+    const char *name = event->name;
+    size_t name_len = strlen(name);
+
+    bool is_dir = event->mask & IN_ISDIR;
+    DirEventType type;
+    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+        type = DirEventType_CREATED;
+    else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+        type = DirEventType_DELETED;
+    else
+        return true;
+    return appendEvent(batch, event->wd, type, is_dir, name, name_len);
+}
+
+static void *runWatcher(void *arg)
+{
+    DirWatcher *watcher = arg;
+
+    char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = watcher->inotify_fd, .events = POLLIN },
+            { .fd = watcher->stop_fd,    .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents)
+            break;
+
+        ssize_t num = read(watcher->inotify_fd, buffer, sizeof(buffer));
+        if (num <= 0) {
+            if (num < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            break;
+        }
+
+        bool lost = false;
+        pthread_mutex_lock(&watcher->lock);
+        for (char *p = buffer; p < buffer + num; ) {
+            struct inotify_event *event = (struct inotify_event*) p;
+            if (!queueEvent(watcher, event))
+                lost = true;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        if (lost) {
+            // Report what couldn't be queued as an
+            // overflow, so it's recovered by listing
+            // the directories again.
+            struct inotify_event overflow = { .wd = -1, .mask = IN_Q_OVERFLOW };
+            queueEvent(watcher, &overflow);
+        }
+        pthread_mutex_unlock(&watcher->lock);
+
+        if (watcher->notify != NULL)
+            watcher->notify();
+    }
+    return NULL;
+}
+
+/* [notify] is called from the watching thread
+ * every time new events are ready. */
+DirWatcher *DirWatcher_start(void (*notify)(void))
+{
+    DirWatcher *watcher = malloc(sizeof(DirWatcher));
+    if (watcher == NULL)
+        return NULL;
+
+    watcher->pending = NULL;
+    watcher->notify = notify;
+    watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watcher->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (watcher->inotify_fd < 0 || watcher->stop_fd < 0) {
+        if (watcher->inotify_fd >= 0) close(watcher->inotify_fd);
+        if (watcher->stop_fd >= 0) close(watcher->stop_fd);
+        free(watcher);
+        return NULL;
+    }
+    pthread_mutex_init(&watcher->lock, NULL);
+
+    if (pthread_create(&watcher->thread, NULL, runWatcher, watcher)) {
+        pthread_mutex_destroy(&watcher->lock);
+        close(watcher->inotify_fd);
+        close(watcher->stop_fd);
+        free(watcher);
+        return NULL;
+    }
+    return watcher;
+}
+
+void DirWatcher_stop(DirWatcher *watcher)
+{
+    uint64_t one = 1;
+    if (write(watcher->stop_fd, &one, sizeof(one)) < 0)
+        TraceLog(LOG_WARNING, "Failed to stop the directory watcher");
+    pthread_join(watcher->thread, NULL);
+
+    if (watcher->pending != NULL)
+        DirEventBatch_free(watcher->pending);
+    pthread_mutex_destroy(&watcher->lock);
+    close(watcher->inotify_fd);
+    close(watcher->stop_fd);
+    free(watcher);
+}
+
+/* Returns the watch descriptor of [path], which
+ * is the same for every path of a directory, or
+ * -1 on failure. */
+int DirWatcher_add(DirWatcher *watcher, const char *path)
+{
+    return inotify_add_watch(watcher->inotify_fd, path, WATCH_MASK);
+}
+
+void DirWatcher_remove(DirWatcher *watcher, int wd)
+{
+    inotify_rm_watch(watcher->inotify_fd, wd);
+}
+
+/* Returns every event since the last call, or
+ * NULL if there were none. */
+DirEventBatch *DirWatcher_poll(DirWatcher *watcher)
+{
+    pthread_mutex_lock(&watcher->lock);
+    DirEventBatch *batch = watcher->pending;
+    watcher->pending = NULL;
+    pthread_mutex_unlock(&watcher->lock);
+    return batch;
+}
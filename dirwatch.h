@@ -0,0 +1,45 @@
+#ifndef SNBPAD_DIRWATCH_H
+#define SNBPAD_DIRWATCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Watches directories for entries being added
+ * or removed through inotify. Events are read on
+ * a background thread and accumulate until they
+ * are polled, so that the UI can apply all the
+ * ones of a frame at once. */
+
+typedef struct DirWatcher DirWatcher;
+
+typedef enum {
+    DirEventType_CREATED,  // Also the new name of a renamed entry
+    DirEventType_DELETED,  // Also the old name of a renamed entry
+    DirEventType_IGNORED,  // The watch was removed
+    DirEventType_OVERFLOW, // Events were lost, [wd] is -1
+} DirEventType;
+
+typedef struct {
+    int    wd;
+    bool   is_dir;
+    DirEventType type;
+    size_t name_off; // Into the names of the batch
+    size_t name_len;
+} DirEvent;
+
+typedef struct {
+    DirEvent *events;
+    size_t    count;
+    size_t    capacity;
+    char     *names;
+    size_t    names_used;
+    size_t    names_size;
+} DirEventBatch;
+
+DirWatcher    *DirWatcher_start(void (*notify)(void));
+void           DirWatcher_stop(DirWatcher *watcher);
+int            DirWatcher_add(DirWatcher *watcher, const char *path);
+void           DirWatcher_remove(DirWatcher *watcher, int wd);
+DirEventBatch *DirWatcher_poll(DirWatcher *watcher);
+void           DirEventBatch_free(DirEventBatch *batch);
+#endif
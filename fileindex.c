@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <raylib.h>
+#include "utils.h"
+#include "fileindex.h"
+
+#define SNAPSHOT_MAGIC "SNBINDEX"
+#define SNAPSHOT_VERSION 2
+
+/* A snapshot is this header, followed by the
+ * root's path, the entries starting at the next
+ * multiple of 8 and then the names. */
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t num_files;
+    uint32_t root_len;
+    uint64_t names_size;
+} SnapshotHeader;
+
+void FileIndex_free(FileIndex *index)
+{
+    if (index->mapping != NULL)
+        munmap(index->mapping, index->mapping_size);
+    else {
+        free(index->root);
+        free(index->entries);
+        free(index->names);
+    }
+    free(index);
+}
+
+const char *FileIndex_getName(const FileIndex *index, uint32_t entry, size_t *len)
+{
+    const FileIndexEntry *e = &index->entries[entry];
+    *len = e->name_len;
+    return index->names + e->name_off;
+}
+
+/* Writes the path of [entry] in [dst] if it fits
+ * in [max] bytes along with the zero terminator.
+ * Either way, returns its length, so that a big
+ * enough buffer can be allocated when it didn't. */
+size_t FileIndex_getPath(const FileIndex *index, uint32_t entry, char *dst, size_t max)
+{
+    size_t len = index->root_len;
+    for (uint32_t curr = entry; curr != 0; curr = index->entries[curr].parent)
+        len += index->entries[curr].name_len + 1;
+    if (len >= max)
+        return len;
+
+    size_t w = len; // Written from the end
+    dst[w] = '\0';
+    for (uint32_t curr = entry; curr != 0; curr = index->entries[curr].parent) {
+        size_t name_len;
+        const char *name = FileIndex_getName(index, curr, &name_len);
+        w -= name_len;
+        memcpy(dst + w, name, name_len);
+        dst[--w] = '/';
+    }
+    memcpy(dst, index->root, index->root_len);
+    return len;
+}
+
+/* The order of the children of a directory. */
+int FileIndex_compareNames(const char *a, size_t a_len,
+                           const char *b, size_t b_len)
+{
+    int res = memcmp(a, b, MIN(a_len, b_len));
+    if (res == 0)
+        res = (a_len > b_len) - (a_len < b_len);
+    return res;
+}
+
+/* Returns the child of [dir] called [name], or
+ * FILEINDEX_NONE. */
+uint32_t FileIndex_findChild(const FileIndex *index, uint32_t dir,
+                             const char *name, size_t len)
+{
+    const FileIndexEntry *e = &index->entries[dir];
+    uint32_t lo = e->children;
+    uint32_t hi = e->children + e->num_children;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        size_t mid_len;
+        const char *mid_name = FileIndex_getName(index, mid, &mid_len);
+        int res = FileIndex_compareNames(name, len, mid_name, mid_len);
+        if (res == 0)
+            return mid;
+        if (res < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return FILEINDEX_NONE;
+}
+
+/* Snapshots go in the cache directory, named
+ * after the hash of their root's path. */
+bool FileIndex_getSnapshotPath(const char *root, char *dst, size_t max)
+{
+    char cache[1024];
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int len;
+    if (xdg_cache != NULL && xdg_cache[0] != '\0')
+        len = snprintf(cache, sizeof(cache), "%s/snbpad", xdg_cache);
+    else if (home != NULL && home[0] != '\0') {
+        len = snprintf(cache, sizeof(cache), "%s/.cache", home);
+        if (len > 0 && (size_t) len < sizeof(cache))
+            mkdir(cache, 0700);
+        len = snprintf(cache, sizeof(cache), "%s/.cache/snbpad", home);
+    } else
+        return false;
+    if (len < 0 || (size_t) len >= sizeof(cache))
+        return false;
+    if (mkdir(cache, 0700) && errno != EEXIST)
+        return false;
+
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (const char *p = root; *p != '\0'; p++) {
+        hash ^= (unsigned char) *p;
+        hash *= 1099511628211ULL;
+    }
+    len = snprintf(dst, max, "%s/%016llx.index", cache, (unsigned long long) hash);
+    return len > 0 && (size_t) len < max;
+}
+
+static size_t getEntriesOffset(size_t root_len)
+{
+    return (sizeof(SnapshotHeader) + root_len + 7) & ~(size_t) 7;
+}
+
+/* Writes the snapshot next to [file] and moves
+ * it in place, so that a mapping of the previous
+ * one stays valid. The temporary file has a name
+ * of its own so that instances saving the same
+ * root don't write over each other. */
+bool FileIndex_save(const FileIndex *index, const char *file)
+{
+    char temp[1024];
+    int len = snprintf(temp, sizeof(temp), "%s.XXXXXX", file);
+    if (len < 0 || (size_t) len >= sizeof(temp))
+        return false;
+
+    int fd = mkstemp(temp);
+    if (fd < 0)
+        return false;
+
+    FILE *stream = fdopen(fd, "wb");
+    if (stream == NULL) {
+        close(fd);
+        unlink(temp);
+        return false;
+    }
+
+    SnapshotHeader header = {
+        .version = SNAPSHOT_VERSION,
+        .num_entries = index->num_entries,
+        .num_files = index->num_files,
+        .root_len = index->root_len,
+        .names_size = index->names_size,
+    };
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+
+    static const char padding[8];
+    size_t padding_size = getEntriesOffset(index->root_len) - sizeof(header) - index->root_len;
+
+    bool ok = fwrite(&header, sizeof(header), 1, stream) == 1
+           && fwrite(index->root, 1, index->root_len, stream) == index->root_len
+           && fwrite(padding, 1, padding_size, stream) == padding_size
+           && fwrite(index->entries, sizeof(FileIndexEntry), index->num_entries, stream) == index->num_entries
+           && fwrite(index->names, 1, index->names_size, stream) == index->names_size;
+    ok = (fclose(stream) == 0) && ok;
+
+    if (!ok || rename(temp, file)) {
+        TraceLog(LOG_WARNING, "Couldn't save the snapshot \"%s\"", file);
+        unlink(temp);
+        return false;
+    }
+    return true;
+}
+
+/* Checks that following the entries of a mapped
+ * snapshot can't go out of it. */
+static bool isConsistent(const FileIndex *index)
+{
+    const FileIndexEntry *entries = index->entries;
+    if (index->num_entries == 0
+     || entries[0].parent != FILEINDEX_NONE
+     || entries[0].type != DirEntryType_DIR)
+        return false;
+
+    for (uint32_t i = 0; i < index->num_entries; i++) {
+        const FileIndexEntry *e = &entries[i];
+        if (i > 0 && e->parent >= i)
+            return false;
+        if (e->name_off > index->names_size || e->name_len > index->names_size - e->name_off)
+            return false;
+        if (e->num_children > 0 && (e->children <= i || e->children > index->num_entries
+                                 || e->num_children > index->num_entries - e->children))
+            return false;
+    }
+    return true;
+}
+
+/* Maps the snapshot of [root] saved in [file].
+ * Returns NULL if there is none, or if it's of
+ * another directory or damaged. */
+FileIndex *FileIndex_load(const char *file, const char *root)
+{
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat buffer;
+    if (fstat(fd, &buffer) || (size_t) buffer.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = buffer.st_size;
+
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return NULL;
+
+    const SnapshotHeader *header = mapping;
+    size_t root_len = strlen(root);
+    size_t entries_off = getEntriesOffset(header->root_len);
+    bool valid = !memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic))
+              && header->version == SNAPSHOT_VERSION
+              && header->root_len == root_len
+              && entries_off <= size
+              && !memcmp((char*) mapping + sizeof(SnapshotHeader), root, root_len)
+              && (size - entries_off) / sizeof(FileIndexEntry) >= header->num_entries
+              && size - entries_off - header->num_entries * sizeof(FileIndexEntry) == header->names_size;
+
+    FileIndex *index = valid ? malloc(sizeof(FileIndex)) : NULL;
+    if (index == NULL) {
+        munmap(mapping, size);
+        return NULL;
+    }
+    index->root = (char*) mapping + sizeof(SnapshotHeader);
+    index->root_len = root_len;
+    index->entries = (FileIndexEntry*) ((char*) mapping + entries_off);
+    index->num_entries = header->num_entries;
+    index->num_files = header->num_files;
+    index->names = (char*) (index->entries + header->num_entries);
+    index->names_size = header->names_size;
+    index->mapping = mapping;
+    index->mapping_size = size;
+
+    if (!isConsistent(index)) {
+        TraceLog(LOG_WARNING, "Ignoring the damaged snapshot \"%s\"", file);
+        FileIndex_free(index);
+        return NULL;
+    }
+    return index;
+}
@@ -0,0 +1,53 @@
+#ifndef SNBPAD_FILEINDEX_H
+#define SNBPAD_FILEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dirscan.h"
+
+/* Every entry below a directory, as found by the
+ * crawler. Entries are referred to by index with
+ * the root at 0, and the children of a directory
+ * are contiguous and sorted by name. Only the
+ * root's path is stored, so paths of any length
+ * can be rebuilt from the names.
+ *
+ * An index can be saved as a snapshot, which is
+ * mapped as it is when loaded. */
+
+#define FILEINDEX_NONE UINT32_MAX
+
+typedef struct {
+    uint32_t parent;       // FILEINDEX_NONE for the root
+    uint32_t name_off;     // Into the names of the index
+    uint32_t children;     // Directories only
+    uint32_t num_children;
+    int64_t  mtime;        // Directories only, in nanoseconds
+    uint8_t  name_len;
+    uint8_t  type;         // A DirEntryType
+    bool     failed;       // The directory couldn't be listed
+    bool     ignored;      // Ignored directories aren't listed
+    bool     has_ignore_file;
+} FileIndexEntry;
+
+typedef struct {
+    char    *root;    // Not zero-terminated
+    size_t   root_len;
+    FileIndexEntry *entries;
+    uint32_t num_entries;
+    uint32_t num_files;
+    char    *names;
+    size_t   names_size;
+    void    *mapping; // Of the snapshot, or NULL
+    size_t   mapping_size;
+} FileIndex;
+
+void        FileIndex_free(FileIndex *index);
+const char *FileIndex_getName(const FileIndex *index, uint32_t entry, size_t *len);
+size_t      FileIndex_getPath(const FileIndex *index, uint32_t entry, char *dst, size_t max);
+uint32_t    FileIndex_findChild(const FileIndex *index, uint32_t dir, const char *name, size_t len);
+int         FileIndex_compareNames(const char *a, size_t a_len, const char *b, size_t b_len);
+bool        FileIndex_getSnapshotPath(const char *root, char *dst, size_t max);
+bool        FileIndex_save(const FileIndex *index, const char *file);
+FileIndex  *FileIndex_load(const char *file, const char *root);
+#endif
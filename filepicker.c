@@ -0,0 +1,830 @@
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "dirscan.h"
+#include "fileindex.h"
+#include "filepicker.h"
+#include "textrenderutils.h"
+
+#define MAX_PATH 4096
+#define MAX_CACHED_DIRS 32
+
+// Row that stands for the parent directory
+#define PARENT_ROW UINT32_MAX
+
+typedef struct {
+    DirEntryType type;
+    const char  *name; // Set once the listing is complete
+    size_t name_off;
+    size_t name_len;
+} Entry;
+
+typedef struct {
+    Entry  *entries;
+    size_t  num_entries;
+    size_t  max_entries;
+    char   *names;
+    size_t  names_used;
+    size_t  names_size;
+} EntryList;
+
+/* A directory that was listed or is being listed.
+ * Scan requests carry its id instead of a pointer
+ * to it, since it may be evicted before they're
+ * done with. */
+typedef struct {
+    uint32_t  id; // 0 when the slot is free
+    char     *path;
+    size_t    path_len;
+    EntryList listed;   // What's shown
+    EntryList pending;  // What's being read
+    bool      complete; // [listed] is a whole listing
+    bool      scanning;
+    bool      failed;
+    uint64_t  last_used;
+} CachedDir;
+
+typedef struct {
+    GUIElement base;
+    const FilePickerStyle *style;
+    FontMetrics *font;
+    DirScanner  *scanner;
+    CachedDir cache[MAX_CACHED_DIRS];
+    uint32_t  next_id;
+    uint64_t  last_used;
+    CachedDir *dir; // The one being browsed
+    bool save;
+    bool confirm;    // The next Enter overwrites the file
+    bool row_chosen; // The selection moved since the input changed
+    char   input[256];
+    size_t input_len;
+    char   came_from[256]; // Entry to select once [dir] is listed
+    size_t came_from_len;
+    uint32_t *rows; // Entries of [dir] that match the input
+    size_t num_rows;
+    size_t max_rows;
+    size_t selected;
+    size_t first_row;
+    void (*callback)(const char*, size_t, void*);
+    void *userp;
+} FilePicker;
+
+static void freeEntryList(EntryList *list)
+{
+    free(list->entries);
+    free(list->names);
+    memset(list, 0, sizeof(EntryList));
+}
+
+static bool appendEntry(EntryList *list, DirEntryType type,
+                        const char *name, size_t len)
+{
+    if (list->num_entries == list->max_entries) {
+        size_t max = MAX(2 * list->max_entries, 64);
+        Entry *entries = realloc(list->entries, max * sizeof(Entry));
+        if (entries == NULL)
+            return false;
+        list->entries = entries;
+        list->max_entries = max;
+    }
+    if (list->names_size - list->names_used < len) {
+        size_t size = MAX(2 * list->names_size, list->names_used + len);
+        size = MAX(size, 1024);
+        char *names = realloc(list->names, size);
+        if (names == NULL)
+            return false;
+        list->names = names;
+        list->names_size = size;
+    }
+    memcpy(list->names + list->names_used, name, len);
+
+    Entry *entry = &list->entries[list->num_entries++];
+    entry->type = type;
+    entry->name = NULL;
+    entry->name_off = list->names_used;
+    entry->name_len = len;
+    list->names_used += len;
+    return true;
+}
+
+// Directories go first
+static int compareEntries(const void *a, const void *b)
+{
+    const Entry *x = a;
+    const Entry *y = b;
+    bool x_dir = (x->type == DirEntryType_DIR);
+    bool y_dir = (y->type == DirEntryType_DIR);
+    if (x_dir != y_dir)
+        return y_dir - x_dir;
+    return FileIndex_compareNames(x->name, x->name_len, y->name, y->name_len);
+}
+
+static void finishEntryList(EntryList *list)
+{
+    if (list->num_entries == 0)
+        return;
+    for (size_t i = 0; i < list->num_entries; i++)
+        list->entries[i].name = list->names + list->entries[i].name_off;
+    qsort(list->entries, list->num_entries, sizeof(Entry), compareEntries);
+}
+
+/* Writes [dir]/[name] into [dst] and returns its
+ * length, or 0 if it doesn't fit. */
+static size_t joinPath(const char *dir, size_t dir_len,
+                       const char *name, size_t name_len,
+                       char *dst, size_t max)
+{
+    bool slash = (dir_len > 0 && dir[dir_len-1] != '/');
+    size_t len = dir_len + slash + name_len;
+    if (len >= max)
+        return 0;
+    memcpy(dst, dir, dir_len);
+    if (slash)
+        dst[dir_len] = '/';
+    memcpy(dst + dir_len + slash, name, name_len);
+    dst[len] = '\0';
+    return len;
+}
+
+/* Drops the "." and ".." components and repeated
+ * slashes of an absolute path, in place. */
+static size_t normalizePath(char *path, size_t len)
+{
+    size_t out = 0;
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && path[i] == '/')
+            i++;
+        size_t start = i;
+        while (i < len && path[i] != '/')
+            i++;
+        size_t n = i - start;
+
+        if (n == 0 || (n == 1 && path[start] == '.'))
+            continue;
+
+        if (n == 2 && path[start] == '.' && path[start+1] == '.') {
+            while (out > 0 && path[out-1] != '/')
+                out--;
+            if (out > 0)
+                out--;
+            continue;
+        }
+        path[out++] = '/';
+        memmove(path + out, path + start, n);
+        out += n;
+    }
+    if (out == 0)
+        path[out++] = '/';
+    path[out] = '\0';
+    return out;
+}
+
+static bool isDirectory(const char *path)
+{
+    struct stat buffer;
+    return stat(path, &buffer) == 0 && S_ISDIR(buffer.st_mode);
+}
+
+static bool containsIgnoringCase(const char *str, size_t len,
+                                 const char *sub, size_t sub_len)
+{
+    for (size_t i = 0; i + sub_len <= len; i++) {
+        size_t j = 0;
+        while (j < sub_len && tolower((unsigned char) str[i+j]) == tolower((unsigned char) sub[j]))
+            j++;
+        if (j == sub_len)
+            return true;
+    }
+    return false;
+}
+
+static void freeCachedDir(CachedDir *cd)
+{
+    free(cd->path);
+    freeEntryList(&cd->listed);
+    freeEntryList(&cd->pending);
+    memset(cd, 0, sizeof(CachedDir));
+}
+
+static CachedDir *findCachedDir(FilePicker *fp, uint32_t id)
+{
+    for (size_t i = 0; i < MAX_CACHED_DIRS; i++)
+        if (fp->cache[i].id != 0 && fp->cache[i].id == id)
+            return &fp->cache[i];
+    return NULL;
+}
+
+/* Returns the slot of [path], taking a free one or
+ * the least recently used one if it's not there. */
+static CachedDir *cacheDir(FilePicker *fp, const char *path, size_t len)
+{
+    CachedDir *victim = NULL;
+    for (size_t i = 0; i < MAX_CACHED_DIRS; i++) {
+        CachedDir *cd = &fp->cache[i];
+        if (cd->id != 0 && cd->path_len == len && !memcmp(cd->path, path, len))
+            return cd;
+        if (cd == fp->dir)
+            continue;
+        if (victim == NULL || (victim->id != 0 && (cd->id == 0 || cd->last_used < victim->last_used)))
+            victim = cd;
+    }
+
+    char *copy = malloc(len + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+
+    if (victim->id != 0) {
+        if (victim->scanning)
+            DirScanner_cancel(fp->scanner, (void*) (uintptr_t) victim->id);
+        freeCachedDir(victim);
+    }
+    if (++fp->next_id == 0)
+        fp->next_id++;
+    victim->id = fp->next_id;
+    victim->path = copy;
+    victim->path_len = len;
+    return victim;
+}
+
+static void selectRow(FilePicker *fp, size_t row)
+{
+    if (row >= fp->num_rows)
+        return;
+    fp->selected = row;
+    if (fp->selected < fp->first_row)
+        fp->first_row = fp->selected;
+    if (fp->selected >= fp->first_row + fp->style->max_rows)
+        fp->first_row = fp->selected - fp->style->max_rows + 1;
+    GUIElement_invalidateAll(&fp->base);
+}
+
+static const Entry *getRowEntry(FilePicker *fp, size_t row)
+{
+    uint32_t i = fp->rows[row];
+    if (i == PARENT_ROW)
+        return NULL;
+    return &fp->dir->listed.entries[i];
+}
+
+/* Lists the entries of the directory that match
+ * the input, which is a filter unless it's a
+ * path. */
+static void filterRows(FilePicker *fp)
+{
+    fp->num_rows = 0;
+    fp->selected = 0;
+    fp->first_row = 0;
+    fp->row_chosen = false;
+    GUIElement_invalidateAll(&fp->base);
+
+    CachedDir *cd = fp->dir;
+    if (cd == NULL)
+        return;
+
+    size_t max = cd->listed.num_entries + 1;
+    if (max > fp->max_rows) {
+        uint32_t *rows = realloc(fp->rows, max * sizeof(uint32_t));
+        if (rows == NULL) {
+            TraceLog(LOG_WARNING, "Couldn't list the entries of \"%s\"", cd->path);
+            return;
+        }
+        fp->rows = rows;
+        fp->max_rows = max;
+    }
+
+    bool filter = fp->input_len > 0 && !memchr(fp->input, '/', fp->input_len);
+    if (!filter && cd->path_len > 1)
+        fp->rows[fp->num_rows++] = PARENT_ROW;
+
+    for (size_t i = 0; i < cd->listed.num_entries; i++) {
+        const Entry *entry = &cd->listed.entries[i];
+        if (!filter || containsIgnoringCase(entry->name, entry->name_len,
+                                            fp->input, fp->input_len))
+            fp->rows[fp->num_rows++] = i;
+    }
+
+    if (fp->came_from_len > 0 && cd->complete) {
+        for (size_t row = 0; row < fp->num_rows; row++) {
+            const Entry *entry = getRowEntry(fp, row);
+            if (entry != NULL && entry->name_len == fp->came_from_len
+                && !memcmp(entry->name, fp->came_from, entry->name_len)) {
+                selectRow(fp, row);
+                break;
+            }
+        }
+        fp->came_from_len = 0;
+    }
+}
+
+/* Browses [path], showing what's known of it until
+ * it's read again. [select] is the entry to select
+ * once it's listed, if any. */
+static void changeDir(FilePicker *fp, const char *path, size_t len,
+                      const char *select, size_t select_len)
+{
+    CachedDir *cd = cacheDir(fp, path, len);
+    if (cd == NULL) {
+        TraceLog(LOG_WARNING, "Couldn't browse \"%.*s\"", (int) len, path);
+        return;
+    }
+    cd->last_used = ++fp->last_used;
+
+    if (!cd->scanning) {
+        cd->pending.num_entries = 0;
+        cd->pending.names_used = 0;
+        if (DirScanner_request(fp->scanner, cd->path, cd->path_len,
+                               (void*) (uintptr_t) cd->id, true))
+            cd->scanning = true;
+        else
+            TraceLog(LOG_WARNING, "Couldn't list \"%s\"", cd->path);
+    }
+
+    fp->came_from_len = MIN(select_len, sizeof(fp->came_from));
+    if (select_len > 0)
+        memcpy(fp->came_from, select, fp->came_from_len);
+
+    fp->dir = cd;
+    fp->input_len = 0;
+    fp->confirm = false;
+    filterRows(fp);
+}
+
+static void goUp(FilePicker *fp)
+{
+    CachedDir *cd = fp->dir;
+    if (cd == NULL || cd->path_len < 2)
+        return;
+
+    size_t slash = cd->path_len - 1;
+    while (slash > 0 && cd->path[slash] != '/')
+        slash--;
+
+    char parent[MAX_PATH];
+    size_t parent_len = MAX(slash, 1);
+    memcpy(parent, cd->path, parent_len);
+
+    const char *name = cd->path + slash + 1;
+    size_t name_len = cd->path_len - slash - 1;
+    changeDir(fp, parent, parent_len, name, name_len);
+}
+
+static void pick(FilePicker *fp, const char *path, size_t len)
+{
+    fp->callback(path, len, fp->userp);
+}
+
+static void activateRow(FilePicker *fp, size_t row)
+{
+    const Entry *entry = getRowEntry(fp, row);
+    if (entry == NULL) {
+        goUp(fp);
+        return;
+    }
+
+    char path[MAX_PATH];
+    size_t len = joinPath(fp->dir->path, fp->dir->path_len,
+                          entry->name, entry->name_len, path, sizeof(path));
+    if (len == 0) {
+        TraceLog(LOG_WARNING, "Path is too long");
+        return;
+    }
+
+    // Other entries are mostly symlinks, which
+    // may point to a directory.
+    if (entry->type == DirEntryType_DIR
+        || (entry->type == DirEntryType_OTHER && isDirectory(path))) {
+        changeDir(fp, path, len, NULL, 0);
+        return;
+    }
+
+    if (fp->save) {
+        // The name goes in the input, and the next
+        // Enter overwrites the file.
+        size_t name_len = MIN(entry->name_len, sizeof(fp->input));
+        memcpy(fp->input, entry->name, name_len);
+        fp->input_len = name_len;
+        filterRows(fp);
+        fp->confirm = true;
+        return;
+    }
+    pick(fp, path, len);
+}
+
+/* Turns the input into an absolute path. It may be
+ * relative to the directory or to the home. */
+static size_t resolveInput(FilePicker *fp, char *dst, size_t max)
+{
+    const char *input = fp->input;
+    size_t input_len = fp->input_len;
+
+    size_t len;
+    if (input[0] == '/')
+        len = joinPath("", 0, input, input_len, dst, max);
+    else if (input_len > 1 && input[0] == '~' && input[1] == '/') {
+        const char *home = getenv("HOME");
+        if (home == NULL)
+            return 0;
+        len = joinPath(home, strlen(home), input + 2, input_len - 2, dst, max);
+    } else if (fp->dir != NULL)
+        len = joinPath(fp->dir->path, fp->dir->path_len, input, input_len, dst, max);
+    else
+        return 0;
+
+    if (len == 0 || dst[0] != '/')
+        return 0;
+    return normalizePath(dst, len);
+}
+
+static void inputChanged(FilePicker *fp)
+{
+    fp->confirm = false;
+    filterRows(fp);
+}
+
+static void freeCallback(GUIElement *elem)
+{
+    FilePicker *fp = (FilePicker*) elem;
+    DirScanner_stop(fp->scanner);
+    for (size_t i = 0; i < MAX_CACHED_DIRS; i++)
+        freeCachedDir(&fp->cache[i]);
+    free(fp->rows);
+    FontMetrics_unload(fp->font);
+    free(fp);
+}
+
+static void receiveBatch(FilePicker *fp, CachedDir *cd, DirScanBatch *batch)
+{
+    for (size_t i = 0; i < batch->count; i++) {
+        const DirEntry *entry = &batch->entries[i];
+        if (!appendEntry(&cd->pending, entry->type,
+                         batch->names + entry->name_off, entry->name_len)) {
+            TraceLog(LOG_WARNING, "Listing of \"%s\" is incomplete", cd->path);
+            break;
+        }
+    }
+    if (!batch->done)
+        return;
+
+    cd->scanning = false;
+    cd->failed = batch->failed;
+    if (batch->failed) {
+        cd->listed.num_entries = 0;
+        cd->listed.names_used = 0;
+        cd->complete = false;
+    } else {
+        EntryList temp = cd->listed;
+        cd->listed = cd->pending;
+        cd->pending = temp;
+        finishEntryList(&cd->listed);
+        cd->complete = true;
+    }
+    cd->pending.num_entries = 0;
+    cd->pending.names_used = 0;
+
+    if (cd == fp->dir) {
+        // Whatever was selected stays selected
+        if (fp->came_from_len == 0 && fp->selected < fp->num_rows) {
+            const Entry *entry = getRowEntry(fp, fp->selected);
+            if (entry != NULL) {
+                fp->came_from_len = MIN(entry->name_len, sizeof(fp->came_from));
+                memcpy(fp->came_from, entry->name, fp->came_from_len);
+            }
+        }
+        bool row_chosen = fp->row_chosen;
+        filterRows(fp);
+        fp->row_chosen = row_chosen;
+    }
+}
+
+static void tickCallback(GUIElement *elem, uint64_t time_in_ms)
+{
+    (void) time_in_ms;
+    FilePicker *fp = (FilePicker*) elem;
+
+    DirScanBatch *batch;
+    while ((batch = DirScanner_poll(fp->scanner)) != NULL) {
+        // Batches of evicted directories are dropped
+        CachedDir *cd = findCachedDir(fp, (uintptr_t) batch->userp);
+        if (cd != NULL && cd->scanning)
+            receiveBatch(fp, cd, batch);
+        DirScanBatch_free(batch);
+    }
+}
+
+/* Draws the path of the directory, dropping its
+ * first components when it doesn't fit. */
+static void renderDirPath(FilePicker *fp, int x, int y, float max_w)
+{
+    const FilePickerStyle *style = fp->style;
+    const char *path = fp->dir->path;
+    size_t len = fp->dir->path_len;
+
+    size_t skip = 0;
+    while (calculateStringRenderWidth(fp->font, style->font_size,
+                                      path + skip, len - skip) > max_w) {
+        const char *slash = memchr(path + skip + 1, '/', len - skip - 1);
+        if (slash == NULL)
+            break;
+        skip = slash - path;
+    }
+    if (skip > 0)
+        x += renderString(fp->font, "...", 3, x, y, style->font_size, style->hint_fgcolor);
+    renderString(fp->font, path + skip, len - skip, x, y, style->font_size, style->fgcolor);
+}
+
+static void drawCallback(GUIElement *elem)
+{
+    FilePicker *fp = (FilePicker*) elem;
+    const FilePickerStyle *style = fp->style;
+    Rectangle region = elem->region;
+
+    Rectangle damage;
+    GUIElement_takeDamage(elem, &damage);
+
+    BeginScissorMode(region.x, region.y, region.width, region.height);
+    DrawRectangleRec(region, style->bgcolor);
+
+    int x = region.x + style->padding;
+    int y = region.y + style->padding;
+    int text_y = (style->line_height - style->font_size) / 2;
+
+    const char *title = fp->save ? "Save as " : "Open ";
+    float title_w = renderString(fp->font, title, strlen(title), x, y + text_y,
+                                 style->font_size, style->hint_fgcolor);
+    if (fp->dir != NULL)
+        renderDirPath(fp, x + title_w, y + text_y,
+                      region.width - 2 * style->padding - title_w);
+
+    y += style->line_height;
+    float input_w = renderString(fp->font, fp->input, fp->input_len,
+                                 x, y + text_y, style->font_size, style->fgcolor);
+    DrawRectangle(x + input_w, y + text_y, 2, style->font_size, style->cursor_color);
+    if (fp->confirm) {
+        const char *message = "   exists, Enter to overwrite";
+        renderString(fp->font, message, strlen(message), x + input_w, y + text_y,
+                     style->font_size, style->hint_fgcolor);
+    }
+
+    y += style->line_height;
+    size_t last = MIN(fp->first_row + style->max_rows, fp->num_rows);
+    for (size_t i = fp->first_row; i < last; i++) {
+        int row_y = y + (i - fp->first_row) * style->line_height;
+        if (i == fp->selected)
+            DrawRectangle(region.x, row_y, region.width, style->line_height,
+                          style->selection_bgcolor);
+
+        const Entry *entry = getRowEntry(fp, i);
+        if (entry == NULL)
+            renderString(fp->font, "../", 3, x, row_y + text_y,
+                         style->font_size, style->dir_fgcolor);
+        else if (entry->type == DirEntryType_DIR) {
+            float name_w = renderString(fp->font, entry->name, entry->name_len, x, row_y + text_y,
+                                        style->font_size, style->dir_fgcolor);
+            renderString(fp->font, "/", 1, x + name_w, row_y + text_y,
+                         style->font_size, style->dir_fgcolor);
+        } else
+            renderString(fp->font, entry->name, entry->name_len, x, row_y + text_y,
+                         style->font_size, style->fgcolor);
+    }
+
+    if (fp->dir == NULL || !fp->dir->complete) {
+        const char *message = "Listing...";
+        if (fp->dir == NULL || fp->dir->failed)
+            message = "Couldn't list this directory";
+        int row_y = y + (last - fp->first_row) * style->line_height;
+        renderString(fp->font, message, strlen(message), x, row_y + text_y,
+                     style->font_size, style->hint_fgcolor);
+    }
+    EndScissorMode();
+}
+
+static GUIElement *onClickDownCallback(GUIElement *elem, int x, int y)
+{
+    (void) x;
+    FilePicker *fp = (FilePicker*) elem;
+    const FilePickerStyle *style = fp->style;
+
+    int rows_y = style->padding + 2 * style->line_height;
+    if (y >= rows_y) {
+        size_t row = fp->first_row + (y - rows_y) / style->line_height;
+        if (row < fp->first_row + style->max_rows && row < fp->num_rows) {
+            selectRow(fp, row);
+            activateRow(fp, row);
+        }
+    }
+    return elem;
+}
+
+static void moveSelection(FilePicker *fp, bool up)
+{
+    if (up && fp->selected == 0)
+        return;
+    selectRow(fp, up ? fp->selected - 1 : fp->selected + 1);
+    fp->row_chosen = true;
+    fp->confirm = false;
+}
+
+static void onMouseWheelCallback(GUIElement *elem, int y)
+{
+    if (y != 0)
+        moveSelection((FilePicker*) elem, y > 0);
+}
+
+static void onArrowUpDownCallback(GUIElement *elem)
+{
+    moveSelection((FilePicker*) elem, true);
+}
+
+static void onArrowDownDownCallback(GUIElement *elem)
+{
+    moveSelection((FilePicker*) elem, false);
+}
+
+static void onReturnDownCallback(GUIElement *elem)
+{
+    FilePicker *fp = (FilePicker*) elem;
+
+    if (fp->input_len == 0 || fp->row_chosen) {
+        if (fp->selected < fp->num_rows)
+            activateRow(fp, fp->selected);
+        return;
+    }
+
+    // The input names an entry or is a path
+    char path[MAX_PATH];
+    size_t len = resolveInput(fp, path, sizeof(path));
+    if (len == 0) {
+        TraceLog(LOG_WARNING, "Invalid path \"%.*s\"", (int) fp->input_len, fp->input);
+        return;
+    }
+
+    struct stat buffer;
+    bool exists = (stat(path, &buffer) == 0);
+    if (exists && S_ISDIR(buffer.st_mode)) {
+        changeDir(fp, path, len, NULL, 0);
+        return;
+    }
+
+    if (!fp->save) {
+        bool filter = !memchr(fp->input, '/', fp->input_len);
+        if (exists)
+            pick(fp, path, len);
+        else if (filter && fp->selected < fp->num_rows)
+            // It was just a filter
+            activateRow(fp, fp->selected);
+        else
+            TraceLog(LOG_WARNING, "No such file \"%s\"", path);
+        return;
+    }
+
+    if (exists && !fp->confirm) {
+        fp->confirm = true;
+        GUIElement_invalidateAll(elem);
+        return;
+    }
+    pick(fp, path, len);
+}
+
+static void onBackspaceDownCallback(GUIElement *elem)
+{
+    FilePicker *fp = (FilePicker*) elem;
+    if (fp->input_len == 0) {
+        goUp(fp);
+        return;
+    }
+
+    // Drops the whole last codepoint
+    do
+        fp->input_len--;
+    while (fp->input_len > 0 && (fp->input[fp->input_len] & 0xC0) == 0x80);
+    inputChanged(fp);
+}
+
+static void onTextInputCallback(GUIElement *elem, const char *str, size_t len)
+{
+    FilePicker *fp = (FilePicker*) elem;
+    if (len > sizeof(fp->input) - fp->input_len)
+        return;
+    memcpy(fp->input + fp->input_len, str, len);
+    fp->input_len += len;
+    inputChanged(fp);
+}
+
+static void onPasteCallback(GUIElement *elem)
+{
+    const char *text = GetClipboardText();
+    if (text == NULL)
+        return;
+
+    // Only up to the first line
+    size_t len = strcspn(text, "\r\n");
+    onTextInputCallback(elem, text, len);
+}
+
+static const GUIElementMethods methods = {
+    .free = freeCallback,
+    .tick = tickCallback,
+    .draw = drawCallback,
+    .onClickDown = onClickDownCallback,
+    .onMouseWheel = onMouseWheelCallback,
+    .onArrowUpDown = onArrowUpDownCallback,
+    .onArrowDownDown = onArrowDownDownCallback,
+    .onReturnDown = onReturnDownCallback,
+    .onBackspaceDown = onBackspaceDownCallback,
+    .onTextInput = onTextInputCallback,
+    .onPaste = onPasteCallback,
+};
+
+/* Returns how tall the box is with the path, the
+ * input and every row. */
+int FilePicker_getHeight(const FilePickerStyle *style)
+{
+    return 2 * style->padding + (style->max_rows + 2) * style->line_height;
+}
+
+/* Prepares the box to be shown again, for picking
+ * a file to open or to save to, starting from the
+ * directory it was left at. That is read again in
+ * case it changed. */
+void FilePicker_show(GUIElement *elem, bool save)
+{
+    FilePicker *fp = (FilePicker*) elem;
+    fp->save = save;
+    if (fp->dir != NULL)
+        changeDir(fp, fp->dir->path, fp->dir->path_len, NULL, 0);
+    else
+        changeDir(fp, "/", 1, NULL, 0);
+}
+
+/* [callback] is called with the absolute path of
+ * the file that was picked. Browsing starts from
+ * [dir], which must be absolute and is listed
+ * right away so that the box opens on it already
+ * listed. */
+GUIElement *FilePicker_new(Rectangle region,
+                           const char *name,
+                           const char *dir,
+                           void (*callback)(const char*, size_t, void*),
+                           const FilePickerStyle *style,
+                           void *userp)
+{
+    FilePicker *fp = malloc(sizeof(FilePicker));
+    if (fp == NULL)
+        return NULL;
+
+    fp->base.region = region;
+    fp->base.methods = &methods;
+    fp->base.dirty = false;
+    strncpy(fp->base.name, name, sizeof(fp->base.name));
+    fp->base.name[sizeof(fp->base.name)-1] = '\0';
+
+    fp->font = FontMetrics_load(loadFont(style->baked_font, style->font_data,
+                                         style->font_data_size, style->font_file,
+                                         style->font_size));
+    if (fp->font == NULL) {
+        free(fp);
+        return NULL;
+    }
+
+    fp->scanner = DirScanner_start(GUIElement_wakeUp);
+    if (fp->scanner == NULL) {
+        FontMetrics_unload(fp->font);
+        free(fp);
+        return NULL;
+    }
+
+    memset(fp->cache, 0, sizeof(fp->cache));
+    fp->next_id = 0;
+    fp->last_used = 0;
+    fp->dir = NULL;
+    fp->save = false;
+    fp->confirm = false;
+    fp->row_chosen = false;
+    fp->input_len = 0;
+    fp->came_from_len = 0;
+    fp->rows = NULL;
+    fp->num_rows = 0;
+    fp->max_rows = 0;
+    fp->selected = 0;
+    fp->first_row = 0;
+    fp->style = style;
+    fp->callback = callback;
+    fp->userp = userp;
+
+    char path[MAX_PATH];
+    size_t len = strlen(dir);
+    if (dir[0] == '/' && len < sizeof(path)) {
+        memcpy(path, dir, len + 1);
+        len = normalizePath(path, len);
+    } else {
+        strcpy(path, "/");
+        len = 1;
+    }
+    changeDir(fp, path, len, NULL, 0);
+    return (GUIElement*) fp;
+}
@@ -0,0 +1,44 @@
+#ifndef SNBPAD_FILEPICKER_H
+#define SNBPAD_FILEPICKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <raylib.h>
+#include "guielement.h"
+#include "bakedfont.h"
+
+/* A box for choosing the file to open or to save
+ * to, to be shown over the other elements. It
+ * browses one directory at a time, filtering it by
+ * the typed text. Directories are listed in the
+ * background and their listings are kept around,
+ * so the ones that were already visited show up
+ * straight away while they're read again. */
+
+typedef struct {
+    Color bgcolor;
+    Color fgcolor;
+    Color dir_fgcolor;
+    Color hint_fgcolor;
+    Color selection_bgcolor;
+    Color cursor_color;
+    const BakedFont     *baked_font;
+    const unsigned char *font_data;
+    size_t               font_data_size;
+    const char  *font_file;
+    unsigned int font_size;
+    size_t line_height;
+    size_t padding;
+    size_t max_rows;
+} FilePickerStyle;
+
+GUIElement *FilePicker_new(Rectangle region,
+                           const char *name,
+                           const char *dir,
+                           void (*callback)(const char*, size_t, void*),
+                           const FilePickerStyle *style,
+                           void *userp);
+void FilePicker_show(GUIElement *elem, bool save);
+int  FilePicker_getHeight(const FilePickerStyle *style);
+#endif
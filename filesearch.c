@@ -0,0 +1,657 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "regex.h"
+#include "literal.h"
+#include "newline.h"
+#include "mapguard.h"
+#include "filesearch.h"
+
+#define MAX_PATH 4096
+#define MAX_HITS 10000
+#define CHUNK_SIZE 16          // Files claimed at once
+#define WINDOW_SIZE (1 << 20)  // Scanned between checks for cancellation
+#define BINARY_PROBE 4096      // Files with a zero byte in here are skipped
+#define PREVIEW_CONTEXT 48     // Bytes of the line shown before the match
+
+typedef struct {
+    uint32_t dir;      // Into [dirs]
+    uint32_t name_off; // Into [strings]
+    uint32_t name_len;
+} SearchFile;
+
+typedef struct {
+    uint32_t path_off; // Into [strings], with a trailing slash
+    uint32_t path_len; // 0 for the root
+} SearchDir;
+
+/* A search is shared by the workers that picked
+ * it up, and freed by the last one to let go of it
+ * once it was replaced. */
+typedef struct {
+    uint64_t    generation;
+    size_t      refs; // Under the lock
+    atomic_uint next_chunk;
+    atomic_uint num_searched;
+    atomic_uint num_hits;
+    bool        regex;
+    size_t      pattern_len;
+    char        pattern[FILESEARCH_MAX_PATTERN];
+} SearchJob;
+
+typedef struct {
+    FileSearch *search;
+    pthread_t   thread;
+    FileSearchBatch *batch; // Being filled, or NULL
+    Regex *regex; // Compiled by each worker, since searching changes it
+    char path[MAX_PATH];
+} SearchWorker;
+
+struct FileSearch {
+    char       *root;
+    size_t      root_len;
+    char       *strings;
+    size_t      strings_len;
+    size_t      strings_max;
+    SearchDir  *dirs;
+    SearchFile *files;
+    uint32_t    num_files;
+
+    SearchWorker   *workers;
+    size_t          num_workers;
+    size_t          num_started;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    bool            quit;
+    SearchJob      *job; // NULL when there's no search
+    uint64_t        last_generation;
+    atomic_uint_fast64_t generation; // Of [job], read without the lock
+    FileSearchBatch *head; // Not polled yet
+    FileSearchBatch *tail;
+    void (*notify)(void);
+};
+
+static bool isCancelled(FileSearch *search, const SearchJob *job)
+{
+    return atomic_load_explicit(&search->generation, memory_order_relaxed) != job->generation;
+}
+
+/* Hands the hits of the worker over to the
+ * thread polling them. */
+static void postBatch(SearchWorker *worker, SearchJob *job)
+{
+    FileSearch *search = worker->search;
+    FileSearchBatch *batch = worker->batch;
+    if (batch == NULL || batch->num_hits == 0)
+        return;
+    worker->batch = NULL;
+
+    // The text is usually far from full
+    FileSearchBatch *shrunk = realloc(batch, sizeof(FileSearchBatch) + batch->text_len);
+    if (shrunk != NULL)
+        batch = shrunk;
+    batch->next = NULL;
+    batch->generation = job->generation;
+
+    pthread_mutex_lock(&search->lock);
+    bool stale = isCancelled(search, job);
+    if (!stale) {
+        if (search->tail == NULL)
+            search->head = batch;
+        else
+            search->tail->next = batch;
+        search->tail = batch;
+    }
+    pthread_mutex_unlock(&search->lock);
+
+    if (stale)
+        free(batch);
+    else
+        search->notify();
+}
+
+/* Returns false once the search found as many
+ * hits as it can hold. */
+static bool addHit(SearchWorker *worker, SearchJob *job, FileSearchHit hit,
+                   const char *preview)
+{
+    if (atomic_fetch_add(&job->num_hits, 1) >= MAX_HITS)
+        return false;
+
+    if (worker->batch != NULL && worker->batch->num_hits == FILESEARCH_BATCH_HITS)
+        postBatch(worker, job);
+
+    FileSearchBatch *batch = worker->batch;
+    if (batch == NULL) {
+        batch = malloc(sizeof(FileSearchBatch) + FILESEARCH_BATCH_HITS * FILESEARCH_MAX_PREVIEW);
+        if (batch == NULL)
+            return false;
+        batch->num_hits = 0;
+        batch->text_len = 0;
+        worker->batch = batch;
+    }
+
+    hit.preview_off = batch->text_len;
+    memcpy(batch->text + batch->text_len, preview, hit.preview_len);
+    batch->text_len += hit.preview_len;
+    batch->hits[batch->num_hits++] = hit;
+    return true;
+}
+
+static bool isContinuation(char c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
+/* Builds the hit at [off] with the part of its
+ * line that's around it, cut on whole codepoints
+ * and without the indentation. */
+static bool reportMatch(SearchWorker *worker, SearchJob *job, uint32_t file,
+                        const char *data, size_t size, size_t off, size_t len,
+                        uint32_t line)
+{
+    size_t lo = (off > PREVIEW_CONTEXT) ? off - PREVIEW_CONTEXT : 0;
+    const char *nl = Newline_findLast(data + lo, off - lo);
+    size_t start = (nl == NULL) ? lo : (size_t) (nl - data) + 1;
+
+    size_t hi = MIN(size, start + FILESEARCH_MAX_PREVIEW);
+    nl = Newline_find(data + off, hi - off);
+    size_t end = (nl == NULL) ? hi : (size_t) (nl - data);
+
+    if (nl == NULL && start == lo)
+        while (start < off && isContinuation(data[start]))
+            start++;
+    while (start < off && (data[start] == ' ' || data[start] == '\t'))
+        start++;
+    if (nl == NULL && end < size)
+        while (end > off && isContinuation(data[end]))
+            end--;
+    if (end > start && data[end-1] == '\r')
+        end--;
+
+    FileSearchHit hit = {
+        .file = file,
+        .line = line,
+        .offset = off,
+        .length = len,
+        .preview_len = end - start,
+        .match_off = off - start,
+    };
+    return addHit(worker, job, hit, data + start);
+}
+
+/* Both return false once no more hits can be held.
+ * Lines are counted up to each match from the
+ * previous one. */
+static bool searchLiteral(SearchWorker *worker, SearchJob *job, uint32_t file,
+                          const char *data, size_t size)
+{
+    const char *pattern = job->pattern;
+    size_t pattern_len = job->pattern_len;
+
+    bool more = true;
+    size_t counted = 0;
+    uint32_t line = 0;
+    size_t pos = 0;
+    while (more && size - pos >= pattern_len && !isCancelled(worker->search, job)) {
+        size_t window = MIN(size - pos, WINDOW_SIZE + pattern_len - 1);
+        const char *match = Literal_find(data + pos, window, pattern, pattern_len);
+        if (match == NULL) {
+            pos += window - pattern_len + 1;
+            postBatch(worker, job);
+            continue;
+        }
+        size_t off = match - data;
+        line += Newline_count(data + counted, off - counted);
+        counted = off;
+        more = reportMatch(worker, job, file, data, size, off, pattern_len, line);
+        pos = off + pattern_len;
+    }
+    return more;
+}
+
+/* Windows end on a line boundary since matches
+ * don't cross them. Empty matches are skipped. */
+static bool searchRegex(SearchWorker *worker, SearchJob *job, uint32_t file,
+                        const char *data, size_t size)
+{
+    bool more = true;
+    size_t counted = 0;
+    uint32_t line = 0;
+    size_t pos = 0;
+    while (more && pos < size && !isCancelled(worker->search, job)) {
+        size_t end = size;
+        if (size - pos > WINDOW_SIZE) {
+            const char *nl = Newline_find(data + pos + WINDOW_SIZE, size - pos - WINDOW_SIZE);
+            if (nl != NULL)
+                end = (size_t) (nl - data) + 1;
+        }
+        size_t off, len;
+        while (more && Regex_find(worker->regex, data, size, pos, end, &off, &len)) {
+            pos = off + MAX(len, 1);
+            if (len == 0)
+                continue;
+            line += Newline_count(data + counted, off - counted);
+            counted = off;
+            more = reportMatch(worker, job, file, data, size, off, len, line);
+        }
+        pos = MAX(pos, end);
+        postBatch(worker, job);
+    }
+    return more;
+}
+
+/* For when the file can't be mapped safely */
+static char *readFile(int fd, size_t size)
+{
+    char *data = malloc(size);
+    if (data == NULL)
+        return NULL;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, data + done, size - done, done);
+        if (n <= 0) {
+            free(data);
+            return NULL;
+        }
+        done += n;
+    }
+    return data;
+}
+
+/* Returns false once no more hits can be held. The
+ * file may be truncated while it's searched, which
+ * is why the mapping is guarded. */
+static bool searchFile(SearchWorker *worker, SearchJob *job, uint32_t file)
+{
+    FileSearch *search = worker->search;
+    size_t path_len = FileSearch_getPath(search, file, true, worker->path, sizeof(worker->path));
+    if (path_len >= sizeof(worker->path))
+        return true;
+
+    int fd = open(worker->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return true;
+    struct stat info;
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    size_t size = info.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    bool mapped = (data != MAP_FAILED);
+    if (mapped && !MapGuard_add(data, size)) {
+        munmap((void*) data, size);
+        mapped = false;
+    }
+    if (!mapped)
+        data = readFile(fd, size);
+    close(fd);
+    if (data == NULL)
+        return true;
+    if (mapped)
+        madvise((void*) data, size, MADV_SEQUENTIAL);
+
+    bool more = true;
+    if (memchr(data, '\0', MIN(size, BINARY_PROBE)) == NULL) {
+        if (worker->regex == NULL)
+            more = searchLiteral(worker, job, file, data, size);
+        else
+            more = searchRegex(worker, job, file, data, size);
+    }
+    if (mapped) {
+        MapGuard_remove(data);
+        munmap((void*) data, size);
+    } else
+        free((void*) data);
+    return more;
+}
+
+static void runJob(SearchWorker *worker, SearchJob *job)
+{
+    FileSearch *search = worker->search;
+    bool more = true;
+
+    // A regex that doesn't compile has no matches
+    if (job->regex) {
+        worker->regex = Regex_compile(job->pattern, job->pattern_len,
+                                      REGEX_NO_NEWLINE, NULL, 0);
+        more = (worker->regex != NULL);
+    }
+
+    for (;;) {
+        size_t first = (size_t) atomic_fetch_add(&job->next_chunk, 1) * CHUNK_SIZE;
+        if (first >= search->num_files)
+            break;
+        size_t last = MIN(first + CHUNK_SIZE, search->num_files);
+
+        // Once the hits are over the limit the rest
+        // of the files are only counted.
+        for (size_t i = first; i < last && more; i++) {
+            if (isCancelled(search, job))
+                return;
+            more = searchFile(worker, job, i);
+        }
+        postBatch(worker, job);
+
+        unsigned int count = last - first;
+        if (atomic_fetch_add(&job->num_searched, count) + count == search->num_files)
+            search->notify();
+    }
+}
+
+static void *runWorker(void *arg)
+{
+    SearchWorker *worker = arg;
+    FileSearch *search = worker->search;
+
+    uint64_t generation = 0;
+    pthread_mutex_lock(&search->lock);
+    for (;;) {
+        while (!search->quit && (search->job == NULL || search->job->generation == generation))
+            pthread_cond_wait(&search->wake, &search->lock);
+        if (search->quit)
+            break;
+        SearchJob *job = search->job;
+        job->refs++;
+        generation = job->generation;
+        pthread_mutex_unlock(&search->lock);
+
+        runJob(worker, job);
+        free(worker->batch); // Only left over when cancelled
+        worker->batch = NULL;
+        if (worker->regex != NULL) {
+            Regex_free(worker->regex);
+            worker->regex = NULL;
+        }
+
+        pthread_mutex_lock(&search->lock);
+        job->refs--;
+        if (job->refs == 0 && job != search->job)
+            free(job);
+    }
+    pthread_mutex_unlock(&search->lock);
+    return NULL;
+}
+
+static void freeBatches(FileSearchBatch *batch)
+{
+    while (batch != NULL) {
+        FileSearchBatch *next = batch->next;
+        free(batch);
+        batch = next;
+    }
+}
+
+/* Replaces the current search with [job], which
+ * may be NULL, dropping what it found so far. */
+static void replaceJob(FileSearch *search, SearchJob *job)
+{
+    pthread_mutex_lock(&search->lock);
+    SearchJob *old = search->job;
+    if (old != NULL && old->refs == 0)
+        free(old);
+
+    search->last_generation++;
+    if (job != NULL)
+        job->generation = search->last_generation;
+    search->job = job;
+    atomic_store(&search->generation, search->last_generation);
+
+    freeBatches(search->head);
+    search->head = NULL;
+    search->tail = NULL;
+    pthread_cond_broadcast(&search->wake);
+    pthread_mutex_unlock(&search->lock);
+}
+
+static bool appendString(FileSearch *search, const char *str, size_t len)
+{
+    if (search->strings_max - search->strings_len < len) {
+        size_t max = MAX(2 * search->strings_max, search->strings_len + len);
+        char *strings = realloc(search->strings, max);
+        if (strings == NULL)
+            return false;
+        search->strings = strings;
+        search->strings_max = max;
+    }
+    if (str != NULL)
+        memcpy(search->strings + search->strings_len, str, len);
+    search->strings_len += len;
+    return true;
+}
+
+/* Copies the paths of the files of [index] that
+ * aren't ignored. Directories are stored with
+ * their whole path, built from the one of their
+ * parent since parents come first, and files only
+ * with their name. */
+static bool collectFiles(FileSearch *search, const FileIndex *index)
+{
+    search->root = malloc(index->root_len);
+    search->dirs = malloc(MAX(index->num_entries, 1) * sizeof(SearchDir));
+    search->files = malloc(MAX(index->num_files, 1) * sizeof(SearchFile));
+    search->strings_max = 4096;
+    search->strings = malloc(search->strings_max);
+    uint32_t *dir_of = malloc(MAX(index->num_entries, 1) * sizeof(uint32_t));
+    if (search->root == NULL || search->dirs == NULL || search->files == NULL
+        || search->strings == NULL || dir_of == NULL) {
+        free(dir_of);
+        return false;
+    }
+    memcpy(search->root, index->root, index->root_len);
+    search->root_len = index->root_len;
+
+    uint32_t num_dirs = 1;
+    search->dirs[0] = (SearchDir) { 0, 0 };
+    dir_of[0] = 0;
+    for (uint32_t i = 1; i < index->num_entries; i++) {
+        const FileIndexEntry *e = &index->entries[i];
+        dir_of[i] = FILEINDEX_NONE;
+        uint32_t parent = dir_of[e->parent];
+        if (e->ignored || parent == FILEINDEX_NONE)
+            continue;
+
+        const char *name = index->names + e->name_off;
+        if (e->type == DirEntryType_DIR) {
+            SearchDir up = search->dirs[parent];
+            SearchDir dir = { search->strings_len, up.path_len + e->name_len + 1 };
+            if (!appendString(search, NULL, dir.path_len)) {
+                free(dir_of);
+                return false;
+            }
+            char *dst = search->strings + dir.path_off;
+            memcpy(dst, search->strings + up.path_off, up.path_len);
+            memcpy(dst + up.path_len, name, e->name_len);
+            dst[dir.path_len - 1] = '/';
+            search->dirs[num_dirs] = dir;
+            dir_of[i] = num_dirs++;
+
+        } else if (e->type == DirEntryType_FILE && search->num_files < index->num_files) {
+            SearchFile file = { parent, search->strings_len, e->name_len };
+            if (!appendString(search, name, e->name_len)) {
+                free(dir_of);
+                return false;
+            }
+            search->files[search->num_files++] = file;
+        }
+    }
+    free(dir_of);
+    return true;
+}
+
+/* Prepares to search the files of [index] on
+ * [num_threads], or one per core if 0. [notify] is
+ * called from the workers when there are new hits
+ * to poll or the search is over. */
+FileSearch *FileSearch_new(const FileIndex *index, size_t num_threads, void (*notify)(void))
+{
+    if (num_threads == 0) {
+        long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (num_cores > 0) ? (size_t) num_cores : 1;
+    }
+
+    FileSearch *search = malloc(sizeof(FileSearch));
+    if (search == NULL)
+        return NULL;
+    search->root = NULL;
+    search->root_len = 0;
+    search->strings = NULL;
+    search->strings_len = 0;
+    search->strings_max = 0;
+    search->dirs = NULL;
+    search->files = NULL;
+    search->num_files = 0;
+    search->workers = malloc(num_threads * sizeof(SearchWorker));
+    search->num_workers = num_threads;
+    search->num_started = 0;
+    search->quit = false;
+    search->job = NULL;
+    search->last_generation = 0;
+    atomic_init(&search->generation, 0);
+    search->head = NULL;
+    search->tail = NULL;
+    search->notify = notify;
+    pthread_mutex_init(&search->lock, NULL);
+    pthread_cond_init(&search->wake, NULL);
+
+    if (search->workers == NULL || !collectFiles(search, index)) {
+        FileSearch_free(search);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < num_threads; i++) {
+        SearchWorker *worker = &search->workers[i];
+        worker->search = search;
+        worker->batch = NULL;
+        worker->regex = NULL;
+        if (pthread_create(&worker->thread, NULL, runWorker, worker))
+            break;
+        search->num_started++;
+    }
+    if (search->num_started == 0) {
+        FileSearch_free(search);
+        return NULL;
+    }
+    return search;
+}
+
+/* Cancels the search and waits for the workers
+ * to notice. */
+void FileSearch_free(FileSearch *search)
+{
+    if (search->workers != NULL) {
+        pthread_mutex_lock(&search->lock);
+        search->quit = true;
+        atomic_store(&search->generation, ++search->last_generation);
+        pthread_cond_broadcast(&search->wake);
+        pthread_mutex_unlock(&search->lock);
+        for (size_t i = 0; i < search->num_started; i++)
+            pthread_join(search->workers[i].thread, NULL);
+        free(search->workers);
+    }
+    free(search->job);
+    freeBatches(search->head);
+    pthread_mutex_destroy(&search->lock);
+    pthread_cond_destroy(&search->wake);
+    free(search->root);
+    free(search->strings);
+    free(search->dirs);
+    free(search->files);
+    free(search);
+}
+
+/* Starts looking for [pattern] in place of the
+ * previous search, as a regular expression if
+ * [regex] is set. An empty one just cancels it. */
+void FileSearch_start(FileSearch *search, const char *pattern, size_t len, bool regex)
+{
+    if (len == 0 || len > FILESEARCH_MAX_PATTERN) {
+        replaceJob(search, NULL);
+        return;
+    }
+
+    SearchJob *job = malloc(sizeof(SearchJob));
+    if (job == NULL) {
+        replaceJob(search, NULL);
+        return;
+    }
+    job->refs = 0;
+    atomic_init(&job->next_chunk, 0);
+    atomic_init(&job->num_searched, 0);
+    atomic_init(&job->num_hits, 0);
+    memcpy(job->pattern, pattern, len);
+    job->pattern_len = len;
+    job->regex = regex;
+    replaceJob(search, job);
+}
+
+void FileSearch_cancel(FileSearch *search)
+{
+    replaceJob(search, NULL);
+}
+
+/* Returns the oldest batch of hits of the current
+ * search that wasn't polled yet, or NULL. It's up
+ * to the caller to free it. */
+FileSearchBatch *FileSearch_poll(FileSearch *search)
+{
+    pthread_mutex_lock(&search->lock);
+    FileSearchBatch *batch = search->head;
+    if (batch != NULL) {
+        search->head = batch->next;
+        if (search->head == NULL)
+            search->tail = NULL;
+    }
+    pthread_mutex_unlock(&search->lock);
+    return batch;
+}
+
+/* The search is done once every file was searched
+ * and its hits were posted, so that what's left to
+ * poll is all there is. */
+void FileSearch_getProgress(FileSearch *search, FileSearchProgress *progress)
+{
+    pthread_mutex_lock(&search->lock);
+    SearchJob *job = search->job;
+    progress->num_files = search->num_files;
+    if (job == NULL) {
+        progress->num_searched = 0;
+        progress->done = true;
+        progress->truncated = false;
+    } else {
+        progress->num_searched = atomic_load(&job->num_searched);
+        progress->done = (progress->num_searched >= search->num_files);
+        progress->truncated = (atomic_load(&job->num_hits) >= MAX_HITS);
+    }
+    pthread_mutex_unlock(&search->lock);
+}
+
+/* Writes the path of [file], relative to the root
+ * unless [full] is set, and returns its length. If
+ * it's [max] or more nothing was written. */
+size_t FileSearch_getPath(const FileSearch *search, uint32_t file, bool full,
+                          char *dst, size_t max)
+{
+    const SearchFile *f = &search->files[file];
+    const SearchDir *dir = &search->dirs[f->dir];
+    size_t prefix_len = full ? search->root_len + 1 : 0;
+    size_t len = prefix_len + dir->path_len + f->name_len;
+    if (len >= max)
+        return len;
+
+    if (full) {
+        memcpy(dst, search->root, search->root_len);
+        dst[search->root_len] = '/';
+    }
+    memcpy(dst + prefix_len, search->strings + dir->path_off, dir->path_len);
+    memcpy(dst + prefix_len + dir->path_len, search->strings + f->name_off, f->name_len);
+    dst[len] = '\0';
+    return len;
+}
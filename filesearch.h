@@ -0,0 +1,63 @@
+#ifndef SNBPAD_FILESEARCH_H
+#define SNBPAD_FILESEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "fileindex.h"
+
+/* Looks for a string or a regular expression in
+ * the contents of all the files of an index, on a
+ * pool of threads in the background. Each file is
+ * mapped in memory and scanned with the literal
+ * kernels or the automaton of the regex, and what's
+ * found is handed back in batches as the search
+ * goes on. Matches of a regex don't span lines. Starting a search cancels the previous
+ * one, and batches of cancelled searches are
+ * dropped.
+ *
+ * The paths are copied out of the index, so that
+ * it can be freed while files are being read. */
+
+#define FILESEARCH_MAX_PATTERN 256
+#define FILESEARCH_MAX_PREVIEW 160
+#define FILESEARCH_BATCH_HITS  64
+
+typedef struct FileSearch FileSearch;
+
+typedef struct {
+    uint32_t file;
+    uint32_t line;        // From 0
+    uint64_t offset;      // Of the match in the file
+    uint32_t length;      // Of the match
+    uint32_t preview_off; // Into the text of the batch
+    uint16_t preview_len; // Part of the line around the match
+    uint16_t match_off;   // Into the preview
+} FileSearchHit;
+
+typedef struct FileSearchBatch FileSearchBatch;
+struct FileSearchBatch {
+    FileSearchBatch *next;
+    uint64_t generation;
+    size_t   num_hits;
+    size_t   text_len;
+    FileSearchHit hits[FILESEARCH_BATCH_HITS];
+    char     text[];
+};
+
+typedef struct {
+    size_t num_files;
+    size_t num_searched;
+    bool   done;
+    bool   truncated; // Hits beyond the limit were dropped
+} FileSearchProgress;
+
+FileSearch *FileSearch_new(const FileIndex *index, size_t num_threads, void (*notify)(void));
+void   FileSearch_free(FileSearch *search);
+void   FileSearch_start(FileSearch *search, const char *pattern, size_t len, bool regex);
+void   FileSearch_cancel(FileSearch *search);
+FileSearchBatch *FileSearch_poll(FileSearch *search);
+void   FileSearch_getProgress(FileSearch *search, FileSearchProgress *progress);
+size_t FileSearch_getPath(const FileSearch *search, uint32_t file, bool full,
+                          char *dst, size_t max);
+#endif
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <raylib.h>
+
+#include "font_data_inconsolata_light.c"
+#include "font_data_inconsolata_medium.c"
+
+// make font_atlas_inconsolata_medium.c
+//
+// Rasterizes one of the embedded fonts at a given
+// size and writes the atlas and glyph metrics as
+// a BakedFont (see bakedfont.h). Glyphs and padding
+// match what LoadFontFromMemory would produce.
+
+#define GLYPH_COUNT 250
+#define GLYPH_PADDING 4
+
+static const struct {
+    const char *name;
+    const unsigned char *data;
+    size_t size;
+} fonts[] = {
+    { "light",  font_data_inconsolata_light,  sizeof(font_data_inconsolata_light)  },
+    { "medium", font_data_inconsolata_medium, sizeof(font_data_inconsolata_medium) },
+};
+
+int main(int argc, char **argv)
+{
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s <light|medium> <size> <variable-name> <output>\n",
+                argv[0]);
+        return -1;
+    }
+
+    const char *name = argv[1];
+    int size = atoi(argv[2]);
+    const char *variable = argv[3];
+    const char *output = argv[4];
+
+    int font_index = -1;
+    for (int i = 0; i < (int) (sizeof(fonts)/sizeof(fonts[0])); i++)
+        if (!strcmp(fonts[i].name, name))
+            font_index = i;
+
+    if (font_index < 0 || size <= 0) {
+        fprintf(stderr, "Error: Invalid font \"%s\" or size \"%s\"\n",
+                argv[1], argv[2]);
+        return -1;
+    }
+
+    SetTraceLogLevel(LOG_WARNING);
+
+    GlyphInfo *glyphs = LoadFontData(fonts[font_index].data,
+                                     fonts[font_index].size,
+                                     size, NULL, GLYPH_COUNT,
+                                     FONT_DEFAULT);
+    if (glyphs == NULL) {
+        fprintf(stderr, "Error: Failed to rasterize the font\n");
+        return -1;
+    }
+
+    Rectangle *recs;
+    Image atlas = GenImageFontAtlas(glyphs, &recs, GLYPH_COUNT,
+                                    size, GLYPH_PADDING, 0);
+    if (atlas.data == NULL || atlas.format != PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA) {
+        fprintf(stderr, "Error: Failed to generate the atlas\n");
+        UnloadFontData(glyphs, GLYPH_COUNT);
+        return -1;
+    }
+
+    // Only the alpha channel carries information.
+    size_t pixels = (size_t) atlas.width * atlas.height;
+    unsigned char *alpha = malloc(pixels);
+    if (alpha == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    for (size_t i = 0; i < pixels; i++)
+        alpha[i] = ((unsigned char*) atlas.data)[2*i+1];
+
+    int compressed_size;
+    unsigned char *compressed = CompressData(alpha, pixels, &compressed_size);
+    if (compressed == NULL) {
+        fprintf(stderr, "Error: Failed to compress the atlas\n");
+        return -1;
+    }
+
+    FILE *out_stream = fopen(output, "wb");
+    if (out_stream == NULL) {
+        fprintf(stderr, "Error: Failed to open \"%s\"\n", output);
+        return -1;
+    }
+
+    fprintf(out_stream, "// Generated by fontbaker (%s %d), do not edit.\n\n", name, size);
+
+    fprintf(out_stream, "static const BakedGlyph %s_glyphs[] = {\n", variable);
+    for (int i = 0; i < GLYPH_COUNT; i++)
+        fprintf(out_stream, "\t{ %d, %d, %d, %d, { %g, %g, %g, %g } },\n",
+                glyphs[i].value, glyphs[i].offsetX,
+                glyphs[i].offsetY, glyphs[i].advanceX,
+                recs[i].x, recs[i].y, recs[i].width, recs[i].height);
+    fprintf(out_stream, "};\n\n");
+
+    fprintf(out_stream, "static const unsigned char %s_alpha[] = {\n\t", variable);
+    for (int i = 0; i < compressed_size; i++) {
+        fprintf(out_stream, "%3d, ", compressed[i]);
+        if ((i+1) % 16 == 0)
+            fprintf(out_stream, "\n\t");
+    }
+    fprintf(out_stream, "\n};\n\n");
+
+    fprintf(out_stream,
+        "static const BakedFont %s = {\n"
+        "\t.size = %d,\n"
+        "\t.padding = %d,\n"
+        "\t.glyph_count = %d,\n"
+        "\t.glyphs = %s_glyphs,\n"
+        "\t.width = %d,\n"
+        "\t.height = %d,\n"
+        "\t.alpha = %s_alpha,\n"
+        "\t.alpha_size = sizeof(%s_alpha),\n"
+        "};\n",
+        variable, size, GLYPH_PADDING, GLYPH_COUNT, variable,
+        atlas.width, atlas.height, variable, variable);
+
+    fclose(out_stream);
+    MemFree(compressed);
+    free(alpha);
+    free(recs);
+    UnloadImage(atlas);
+    UnloadFontData(glyphs, GLYPH_COUNT);
+    return 0;
+}
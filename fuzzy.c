@@ -0,0 +1,682 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "utils.h"
+#include "fuzzy.h"
+
+#if defined(__SSE2__)
+#define FUZZY_SSE2 1
+#include <emmintrin.h>
+#else
+#define FUZZY_SSE2 0
+#endif
+
+#define FUZZY_MAX_PATH 4096
+#define CHUNK_SIZE 4096
+
+#define SCORE_MATCH          16
+#define SCORE_GAP_START      -3
+#define SCORE_GAP_EXTENSION  -1
+#define BONUS_BOUNDARY        8 // After a separator
+#define BONUS_CAMEL           7 // Lower to upper case, or to a digit
+#define BONUS_CONSECUTIVE     4
+#define BONUS_FILE_NAME       8 // For each character matched in it
+
+typedef struct {
+    FuzzyMatcher *matcher;
+    pthread_t     thread;
+    FuzzyMatch   *best; // A heap with the worst match on top
+    size_t        num_best;
+    size_t        max_best;
+    uint32_t     *found; // Every file that matched
+    size_t        num_found;
+    size_t        max_found;
+    bool          lost;  // Some of them couldn't be stored
+    char          path[FUZZY_MAX_PATH];
+} FuzzyWorker;
+
+struct FuzzyMatcher {
+    const FileIndex *index;
+    uint32_t *files;  // Entries that aren't ignored
+    uint64_t *masks;  // Of the paths of [files]
+    uint32_t  num_files;
+
+    // The first worker is the thread searching,
+    // which is why it's not started.
+    FuzzyWorker *workers;
+    size_t       num_workers;
+    size_t       num_started;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_cond_t  done;
+    uint64_t     generation;
+    size_t       num_done;
+    bool         quit;
+
+    // The search going on
+    char         query[FUZZY_MAX_QUERY]; // Lower case
+    size_t       query_len;
+    uint64_t     query_mask;
+    size_t       max_matches;
+    const uint32_t *candidates; // Into [files], or NULL for all of them
+    size_t       num_candidates;
+    atomic_uint  next_chunk;
+    FuzzyMatch  *merged;
+    size_t       max_merged;
+
+    // The files that matched the previous query
+    char         last_query[FUZZY_MAX_QUERY];
+    size_t       last_len;
+    uint32_t    *survivors; // NULL if they're not known
+    size_t       num_survivors;
+};
+
+static char toLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static bool isUpper(char c)
+{
+    return c >= 'A' && c <= 'Z';
+}
+
+static bool isLower(char c)
+{
+    return c >= 'a' && c <= 'z';
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/* Letters and digits have a bit each, and the
+ * other bytes share the rest. */
+static uint64_t getCharBit(char c)
+{
+    c = toLower(c);
+    if (isLower(c))
+        return (uint64_t) 1 << (c - 'a');
+    if (isDigit(c))
+        return (uint64_t) 1 << (26 + c - '0');
+    return (uint64_t) 1 << (36 + (unsigned char) c % 28);
+}
+
+static uint64_t getMask(const char *str, size_t len)
+{
+    uint64_t mask = 0;
+    for (size_t i = 0; i < len; i++)
+        mask |= getCharBit(str[i]);
+    return mask;
+}
+
+/* Returns where [c], which is lower case, first
+ * appears in [str] in either case, or [len]. */
+static size_t findChar(const char *str, size_t len, char c)
+{
+    size_t i = 0;
+#if FUZZY_SSE2
+    const __m128i lower = _mm_set1_epi8(c);
+    const __m128i upper = _mm_set1_epi8(isLower(c) ? c - ('a' - 'A') : c);
+    for (; len - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (str + i));
+        __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, lower),
+                                  _mm_cmpeq_epi8(v, upper));
+        unsigned int mask = _mm_movemask_epi8(eq);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < len; i++)
+        if (toLower(str[i]) == c)
+            return i;
+    return len;
+}
+
+static int getBonus(const char *path, size_t i)
+{
+    if (i == 0)
+        return BONUS_BOUNDARY;
+    char prev = path[i-1];
+    char curr = path[i];
+    if (prev == '/' || prev == '_' || prev == '-' || prev == '.' || prev == ' ')
+        return BONUS_BOUNDARY;
+    if ((isLower(prev) && isUpper(curr)) || (!isDigit(prev) && isDigit(curr)))
+        return BONUS_CAMEL;
+    return 0;
+}
+
+/* Scores the shortest window at the end of the
+ * leftmost match of [query], which must be lower
+ * case, storing where its characters matched in
+ * [positions] if it's not NULL. Returns false if
+ * [path] doesn't match. */
+static bool score(const char *path, size_t len,
+                  const char *query, size_t query_len,
+                  int32_t *result, uint16_t *positions)
+{
+    size_t end = 0;
+    for (size_t j = 0; j < query_len; j++) {
+        size_t i = findChar(path + end, len - end, query[j]);
+        if (i == len - end)
+            return false;
+        end += i + 1;
+    }
+
+    // Going backwards from the end of the match
+    // finds where it could start at the latest.
+    size_t start = end;
+    for (size_t j = query_len; j-- > 0; ) {
+        start--;
+        while (toLower(path[start]) != query[j])
+            start--;
+    }
+
+    size_t name = len;
+    while (name > 0 && path[name-1] != '/')
+        name--;
+
+    int32_t total = 0;
+    int first_bonus = 0;
+    size_t consecutive = 0;
+    bool in_gap = false;
+    size_t j = 0;
+    for (size_t i = start; i < end; i++) {
+        if (toLower(path[i]) != query[j]) {
+            total += in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+            in_gap = true;
+            consecutive = 0;
+            continue;
+        }
+        int bonus = getBonus(path, i);
+        if (consecutive == 0)
+            first_bonus = bonus;
+        else {
+            // A run is worth as much as its start
+            if (bonus >= BONUS_BOUNDARY)
+                first_bonus = bonus;
+            bonus = MAX(bonus, MAX(first_bonus, BONUS_CONSECUTIVE));
+        }
+        total += SCORE_MATCH + ((j == 0) ? 2 * bonus : bonus);
+        if (i >= name)
+            total += BONUS_FILE_NAME;
+        if (positions != NULL)
+            positions[j] = i;
+        j++;
+        consecutive++;
+        in_gap = false;
+    }
+    *result = total;
+    return true;
+}
+
+/* Builds the path of [entry] relative to the root
+ * at the end of [dst]. Returns where it starts, or
+ * NULL if it doesn't fit. */
+static const char *buildPath(const FileIndex *index, uint32_t entry,
+                             char *dst, size_t max, size_t *len)
+{
+    char *start = dst + max;
+    while (entry != 0) {
+        const FileIndexEntry *e = &index->entries[entry];
+        size_t needed = e->name_len + (start < dst + max);
+        if ((size_t) (start - dst) < needed)
+            return NULL;
+        if (start < dst + max)
+            *--start = '/';
+        start -= e->name_len;
+        memcpy(start, index->names + e->name_off, e->name_len);
+        entry = e->parent;
+    }
+    *len = dst + max - start;
+    return start;
+}
+
+/* Writes the path of [dir] followed by a slash at
+ * the start of [dst], unless it's the root. Returns
+ * its length, or SIZE_MAX if it doesn't fit. */
+static size_t buildPrefix(const FileIndex *index, uint32_t dir,
+                          char *dst, size_t max)
+{
+    if (dir == 0)
+        return 0;
+    size_t len;
+    const char *path = buildPath(index, dir, dst, max - 1, &len);
+    if (path == NULL)
+        return SIZE_MAX;
+    memmove(dst, path, len);
+    dst[len] = '/';
+    return len + 1;
+}
+
+static bool isBetter(const FuzzyMatch *a, const FuzzyMatch *b)
+{
+    if (a->score != b->score)
+        return a->score > b->score;
+    if (a->len != b->len)
+        return a->len < b->len;
+    return a->entry < b->entry;
+}
+
+static int compareMatches(const void *a, const void *b)
+{
+    if (isBetter(a, b))
+        return -1;
+    if (isBetter(b, a))
+        return 1;
+    return 0;
+}
+
+static void swapMatches(FuzzyMatch *a, FuzzyMatch *b)
+{
+    FuzzyMatch tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void keepFound(FuzzyWorker *worker, uint32_t file)
+{
+    if (worker->num_found == worker->max_found) {
+        size_t max_found = MAX(2 * worker->max_found, 1024);
+        uint32_t *found = realloc(worker->found, max_found * sizeof(uint32_t));
+        if (found == NULL) {
+            worker->lost = true;
+            return;
+        }
+        worker->found = found;
+        worker->max_found = max_found;
+    }
+    worker->found[worker->num_found++] = file;
+}
+
+/* Keeps [match] if it's one of the best found by
+ * [worker] so far. */
+static void keepMatch(FuzzyWorker *worker, FuzzyMatch match, size_t max)
+{
+    FuzzyMatch *heap = worker->best;
+    size_t i;
+    if (worker->num_best < max) {
+        i = worker->num_best++;
+        heap[i] = match;
+        while (i > 0 && isBetter(&heap[(i-1)/2], &heap[i])) {
+            swapMatches(&heap[(i-1)/2], &heap[i]);
+            i = (i-1)/2;
+        }
+        return;
+    }
+    if (!isBetter(&match, &heap[0]))
+        return;
+
+    heap[0] = match;
+    i = 0;
+    for (;;) {
+        size_t worst = i;
+        size_t l = 2 * i + 1;
+        size_t r = 2 * i + 2;
+        if (l < max && isBetter(&heap[worst], &heap[l]))
+            worst = l;
+        if (r < max && isBetter(&heap[worst], &heap[r]))
+            worst = r;
+        if (worst == i)
+            break;
+        swapMatches(&heap[worst], &heap[i]);
+        i = worst;
+    }
+}
+
+static void searchChunks(FuzzyWorker *worker)
+{
+    FuzzyMatcher *matcher = worker->matcher;
+    const char *query = matcher->query;
+    size_t query_len  = matcher->query_len;
+    uint64_t query_mask = matcher->query_mask;
+
+    // Files of the same directory are next to
+    // each other, so its path is only built once.
+    const FileIndex *index = matcher->index;
+    uint32_t dir = FILEINDEX_NONE;
+    size_t prefix_len = 0;
+
+    worker->num_best = 0;
+    worker->num_found = 0;
+    worker->lost = false;
+    for (;;) {
+        size_t first = (size_t) atomic_fetch_add(&matcher->next_chunk, 1) * CHUNK_SIZE;
+        if (first >= matcher->num_candidates)
+            break;
+        size_t last = MIN(first + CHUNK_SIZE, matcher->num_candidates);
+
+        for (size_t j = first; j < last; j++) {
+            size_t i = (matcher->candidates == NULL) ? j : matcher->candidates[j];
+            if (query_mask & ~matcher->masks[i])
+                continue;
+
+            uint32_t entry = matcher->files[i];
+            const FileIndexEntry *e = &index->entries[entry];
+            if (e->parent != dir) {
+                dir = e->parent;
+                prefix_len = buildPrefix(index, dir, worker->path, sizeof(worker->path));
+            }
+            if (prefix_len == SIZE_MAX || e->name_len > sizeof(worker->path) - prefix_len)
+                continue;
+            size_t len = prefix_len + e->name_len;
+            memcpy(worker->path + prefix_len, index->names + e->name_off, e->name_len);
+
+            int32_t result;
+            if (!score(worker->path, len, query, query_len, &result, NULL))
+                continue;
+
+            keepFound(worker, i);
+            FuzzyMatch match = { entry, result, len };
+            keepMatch(worker, match, matcher->max_matches);
+        }
+    }
+}
+
+static void *runWorker(void *arg)
+{
+    FuzzyWorker *worker = arg;
+    FuzzyMatcher *matcher = worker->matcher;
+
+    uint64_t generation = 0;
+    pthread_mutex_lock(&matcher->lock);
+    for (;;) {
+        while (!matcher->quit && matcher->generation == generation)
+            pthread_cond_wait(&matcher->wake, &matcher->lock);
+        if (matcher->quit)
+            break;
+        generation = matcher->generation;
+        pthread_mutex_unlock(&matcher->lock);
+
+        searchChunks(worker);
+
+        pthread_mutex_lock(&matcher->lock);
+        matcher->num_done++;
+        if (matcher->num_done == matcher->num_started)
+            pthread_cond_signal(&matcher->done);
+    }
+    pthread_mutex_unlock(&matcher->lock);
+    return NULL;
+}
+
+/* Collects the files of [index] along with the
+ * masks of their paths. Parents come before their
+ * children, so the masks of directories are built
+ * from the ones of their parents in one pass. */
+static bool collectFiles(FuzzyMatcher *matcher, const FileIndex *index)
+{
+    uint64_t *all = malloc(MAX(index->num_entries, 1) * sizeof(uint64_t));
+    matcher->files = malloc(MAX(index->num_files, 1) * sizeof(uint32_t));
+    matcher->masks = malloc(MAX(index->num_files, 1) * sizeof(uint64_t));
+    if (all == NULL || matcher->files == NULL || matcher->masks == NULL) {
+        free(all);
+        return false;
+    }
+
+    uint32_t num_files = 0;
+    all[0] = 0;
+    for (uint32_t i = 1; i < index->num_entries; i++) {
+        const FileIndexEntry *e = &index->entries[i];
+        all[i] = all[e->parent] | getMask(index->names + e->name_off, e->name_len);
+        if (e->parent != 0)
+            all[i] |= getCharBit('/');
+
+        if (e->type == DirEntryType_FILE && !e->ignored && num_files < index->num_files) {
+            matcher->files[num_files] = i;
+            matcher->masks[num_files] = all[i];
+            num_files++;
+        }
+    }
+    matcher->num_files = num_files;
+    free(all);
+    return true;
+}
+
+/* Prepares to search the files of [index], which
+ * must stay around until the matcher is freed, on
+ * [num_threads] or one per core if 0. */
+FuzzyMatcher *FuzzyMatcher_new(const FileIndex *index, size_t num_threads)
+{
+    if (num_threads == 0) {
+        long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (num_cores > 0) ? (size_t) num_cores : 1;
+    }
+
+    FuzzyMatcher *matcher = malloc(sizeof(FuzzyMatcher));
+    if (matcher == NULL)
+        return NULL;
+    matcher->index = index;
+    matcher->files = NULL;
+    matcher->masks = NULL;
+    matcher->num_files = 0;
+    matcher->workers = malloc(num_threads * sizeof(FuzzyWorker));
+    matcher->num_workers = num_threads;
+    matcher->num_started = 0;
+    matcher->generation = 0;
+    matcher->num_done = 0;
+    matcher->quit = false;
+    matcher->query_len = 0;
+    matcher->query_mask = 0;
+    matcher->max_matches = 0;
+    matcher->candidates = NULL;
+    matcher->num_candidates = 0;
+    matcher->merged = NULL;
+    matcher->max_merged = 0;
+    matcher->last_len = 0;
+    matcher->survivors = NULL;
+    matcher->num_survivors = 0;
+    atomic_init(&matcher->next_chunk, 0);
+    pthread_mutex_init(&matcher->lock, NULL);
+    pthread_cond_init(&matcher->wake, NULL);
+    pthread_cond_init(&matcher->done, NULL);
+
+    if (matcher->workers == NULL) {
+        FuzzyMatcher_free(matcher);
+        return NULL;
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        FuzzyWorker *worker = &matcher->workers[i];
+        worker->matcher = matcher;
+        worker->best = NULL;
+        worker->num_best = 0;
+        worker->max_best = 0;
+        worker->found = NULL;
+        worker->num_found = 0;
+        worker->max_found = 0;
+        worker->lost = false;
+    }
+    if (!collectFiles(matcher, index)) {
+        FuzzyMatcher_free(matcher);
+        return NULL;
+    }
+
+    // Workers that couldn't be started just get
+    // no chunks.
+    for (size_t i = 1; i < num_threads; i++) {
+        FuzzyWorker *worker = &matcher->workers[i];
+        if (pthread_create(&worker->thread, NULL, runWorker, worker))
+            break;
+        matcher->num_started++;
+    }
+    return matcher;
+}
+
+void FuzzyMatcher_free(FuzzyMatcher *matcher)
+{
+    if (matcher->workers != NULL) {
+        pthread_mutex_lock(&matcher->lock);
+        matcher->quit = true;
+        pthread_cond_broadcast(&matcher->wake);
+        pthread_mutex_unlock(&matcher->lock);
+        for (size_t i = 0; i < matcher->num_started; i++)
+            pthread_join(matcher->workers[i+1].thread, NULL);
+        for (size_t i = 0; i < matcher->num_started + 1; i++) {
+            free(matcher->workers[i].best);
+            free(matcher->workers[i].found);
+        }
+        free(matcher->workers);
+    }
+    pthread_mutex_destroy(&matcher->lock);
+    pthread_cond_destroy(&matcher->wake);
+    pthread_cond_destroy(&matcher->done);
+    free(matcher->files);
+    free(matcher->masks);
+    free(matcher->merged);
+    free(matcher->survivors);
+    free(matcher);
+}
+
+static bool reserveMatches(FuzzyMatcher *matcher, size_t max_matches)
+{
+    size_t num_workers = matcher->num_started + 1;
+    for (size_t i = 0; i < num_workers; i++) {
+        FuzzyWorker *worker = &matcher->workers[i];
+        if (worker->max_best < max_matches) {
+            FuzzyMatch *best = realloc(worker->best, max_matches * sizeof(FuzzyMatch));
+            if (best == NULL)
+                return false;
+            worker->best = best;
+            worker->max_best = max_matches;
+        }
+    }
+    size_t max_merged = num_workers * max_matches;
+    if (matcher->max_merged < max_merged) {
+        FuzzyMatch *merged = realloc(matcher->merged, max_merged * sizeof(FuzzyMatch));
+        if (merged == NULL)
+            return false;
+        matcher->merged = merged;
+        matcher->max_merged = max_merged;
+    }
+    return true;
+}
+
+static void keepSurvivors(FuzzyMatcher *matcher)
+{
+    size_t num_workers = matcher->num_started + 1;
+    size_t count = 0;
+    bool lost = false;
+    for (size_t i = 0; i < num_workers; i++) {
+        count += matcher->workers[i].num_found;
+        lost |= matcher->workers[i].lost;
+    }
+
+    uint32_t *survivors = lost ? NULL : malloc(MAX(count, 1) * sizeof(uint32_t));
+    if (survivors != NULL) {
+        count = 0;
+        for (size_t i = 0; i < num_workers; i++) {
+            FuzzyWorker *worker = &matcher->workers[i];
+            if (worker->num_found > 0)
+                memcpy(survivors + count, worker->found, worker->num_found * sizeof(uint32_t));
+            count += worker->num_found;
+        }
+    }
+    free(matcher->survivors);
+    matcher->survivors = survivors;
+    matcher->num_survivors = count;
+    memcpy(matcher->last_query, matcher->query, matcher->query_len);
+    matcher->last_len = matcher->query_len;
+}
+
+/* Stores the best [max_matches] files for [query]
+ * in [matches], the best first, and returns how
+ * many there are. An empty query matches files
+ * in the order of the index, which lists the
+ * ones closer to the root first. */
+size_t FuzzyMatcher_search(FuzzyMatcher *matcher, const char *query, size_t len,
+                           FuzzyMatch *matches, size_t max_matches)
+{
+    if (len > FUZZY_MAX_QUERY)
+        len = FUZZY_MAX_QUERY;
+
+    if (len == 0) {
+        free(matcher->survivors);
+        matcher->survivors = NULL;
+        size_t count = MIN(max_matches, matcher->num_files);
+        for (size_t i = 0; i < count; i++)
+            matches[i] = (FuzzyMatch) { matcher->files[i], 0, 0 };
+        return count;
+    }
+    if (max_matches == 0 || !reserveMatches(matcher, max_matches))
+        return 0;
+
+    for (size_t i = 0; i < len; i++)
+        matcher->query[i] = toLower(query[i]);
+    matcher->query_len = len;
+    matcher->query_mask = getMask(query, len);
+    matcher->max_matches = max_matches;
+
+    // A path that matches a query also matches
+    // any prefix of it.
+    bool narrowed = (matcher->survivors != NULL && matcher->last_len <= len
+                  && !memcmp(matcher->last_query, matcher->query, matcher->last_len));
+    matcher->candidates = narrowed ? matcher->survivors : NULL;
+    matcher->num_candidates = narrowed ? matcher->num_survivors : matcher->num_files;
+    atomic_store(&matcher->next_chunk, 0);
+
+    pthread_mutex_lock(&matcher->lock);
+    matcher->generation++;
+    matcher->num_done = 0;
+    pthread_cond_broadcast(&matcher->wake);
+    pthread_mutex_unlock(&matcher->lock);
+
+    searchChunks(&matcher->workers[0]);
+
+    pthread_mutex_lock(&matcher->lock);
+    while (matcher->num_done < matcher->num_started)
+        pthread_cond_wait(&matcher->done, &matcher->lock);
+    pthread_mutex_unlock(&matcher->lock);
+
+    keepSurvivors(matcher);
+
+    size_t count = 0;
+    for (size_t i = 0; i < matcher->num_started + 1; i++) {
+        FuzzyWorker *worker = &matcher->workers[i];
+        memcpy(matcher->merged + count, worker->best, worker->num_best * sizeof(FuzzyMatch));
+        count += worker->num_best;
+    }
+    if (count > 1)
+        qsort(matcher->merged, count, sizeof(FuzzyMatch), compareMatches);
+    count = MIN(count, max_matches);
+    memcpy(matches, matcher->merged, count * sizeof(FuzzyMatch));
+    return count;
+}
+
+/* Writes the path of [entry] relative to the root
+ * of the index, like snprintf. */
+size_t FuzzyMatcher_getPath(const FuzzyMatcher *matcher, uint32_t entry,
+                            char *dst, size_t max)
+{
+    char buffer[FUZZY_MAX_PATH];
+    size_t len;
+    const char *path = buildPath(matcher->index, entry, buffer, sizeof(buffer), &len);
+    if (path == NULL)
+        len = 0;
+    if (max > 0) {
+        size_t copied = MIN(len, max-1);
+        if (copied > 0)
+            memcpy(dst, path, copied);
+        dst[copied] = '\0';
+    }
+    return len;
+}
+
+/* Stores where the characters of [query] match in
+ * [path], for highlighting them. Returns how many
+ * there are, which is 0 if it doesn't match. */
+size_t FuzzyMatcher_getPositions(const char *path, size_t path_len,
+                                 const char *query, size_t len,
+                                 uint16_t *positions)
+{
+    char lower[FUZZY_MAX_QUERY];
+    len = MIN(len, FUZZY_MAX_QUERY);
+    for (size_t i = 0; i < len; i++)
+        lower[i] = toLower(query[i]);
+
+    int32_t result;
+    if (path_len > UINT16_MAX || !score(path, path_len, lower, len, &result, positions))
+        return 0;
+    return len;
+}
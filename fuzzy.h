@@ -0,0 +1,41 @@
+#ifndef SNBPAD_FUZZY_H
+#define SNBPAD_FUZZY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fileindex.h"
+
+/* Fuzzy matches a query against the paths of all
+ * the files of an index, relative to its root.
+ * The query's characters must appear in a path in
+ * order but not necessarily next to each other,
+ * and matches that are contiguous, at the start of
+ * words or in the file name score better.
+ *
+ * Each path has a mask of the characters in it,
+ * so most of them are rejected without being
+ * built, and the others are scored on a pool of
+ * threads that keep the best ones each. When a
+ * query extends the previous one, only the files
+ * that matched it are searched again. */
+
+#define FUZZY_MAX_QUERY 256
+
+typedef struct FuzzyMatcher FuzzyMatcher;
+
+typedef struct {
+    uint32_t entry;
+    int32_t  score;
+    uint32_t len; // Of the path
+} FuzzyMatch;
+
+FuzzyMatcher *FuzzyMatcher_new(const FileIndex *index, size_t num_threads);
+void          FuzzyMatcher_free(FuzzyMatcher *matcher);
+size_t        FuzzyMatcher_search(FuzzyMatcher *matcher, const char *query, size_t len,
+                                  FuzzyMatch *matches, size_t max_matches);
+size_t        FuzzyMatcher_getPath(const FuzzyMatcher *matcher, uint32_t entry,
+                                   char *dst, size_t max);
+size_t        FuzzyMatcher_getPositions(const char *path, size_t path_len,
+                                        const char *query, size_t len,
+                                        uint16_t *positions);
+#endif
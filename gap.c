@@ -1,18 +1,76 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <raylib.h>
 #include "gap.h"
 #include "utils.h"
+#include "newline.h"
+#include "literal.h"
 #include "xutf8.h"
 
-static size_t countLines(const char *str, size_t len)
+static bool usesPieces(GapBuffer *buf)
 {
-    size_t lineno = 0;
-    for (size_t i = 0; i < len; i++)
-        if (str[i] == '\n')
-            lineno++;
-    return lineno;
+    return buf->backend != GapBufferBackend_GAP;
+}
+
+static void LineIndex_init(LineIndex *index)
+{
+    index->data = NULL;
+    index->size = 0;
+    index->head = 0;
+    index->tail = 0;
+}
+
+static void LineIndex_free(LineIndex *index)
+{
+    free(index->data);
+}
+
+static bool LineIndex_reserve(LineIndex *index, size_t num)
+{
+    if (index->size - index->head - index->tail >= num)
+        return true;
+
+    size_t new_size = MAX(MAX(2 * index->size, index->size + num), 512);
+    size_t *new_data = malloc(new_size * sizeof(size_t));
+    if (new_data == NULL)
+        return false;
+
+    if (index->data != NULL) {
+        memcpy(new_data, index->data, index->head * sizeof(size_t));
+        memcpy(new_data + new_size - index->tail, 
+               index->data + index->size - index->tail, 
+               index->tail * sizeof(size_t));
+        free(index->data);
+    }
+    index->data = new_data;
+    index->size = new_size;
+    return true;
+}
+
+/* Drops the newlines before the gap that come 
+ * after the offset [offset]. */
+static void LineIndex_popFrom(LineIndex *index, size_t offset)
+{
+    while (index->head > 0 && index->data[index->head-1] >= offset)
+        index->head--;
+}
+
+/* Returns the offset of the [i]-th newline of
+ * the buffer. */
+static size_t getNewline(GapBuffer *buf, size_t i)
+{
+    LineIndex *index = &buf->lines;
+    assert(i < index->head + index->tail);
+
+    if (i < index->head)
+        return index->data[i];
+
+    size_t dist = index->data[index->size - index->tail + (i - index->head)];
+    return GapBuffer_getUsage(buf) - dist;
 }
 
 static void moveBytesAfterGap(GapBuffer *buffer, size_t num)
@@ -24,6 +82,17 @@ static void moveBytesAfterGap(GapBuffer *buffer, size_t num)
             buffer->data + buffer->gap_offset - num,
             num);
 
+    // Newlines that were moved after the gap
+    // are now relative to the end of the text.
+    LineIndex *index = &buffer->lines;
+    size_t first = buffer->gap_offset - num;
+    size_t usage = GapBuffer_getUsage(buffer);
+    while (index->head > 0 && index->data[index->head-1] >= first) {
+        size_t offset = index->data[--index->head];
+        index->tail++;
+        index->data[index->size - index->tail] = usage - offset;
+    }
+
     buffer->gap_offset -= num;
 }
 
@@ -39,6 +108,17 @@ static void moveBytesBeforeGap(GapBuffer *buffer, size_t num)
             buffer->data + buffer->gap_offset + buffer->gap_length,
             num);
 
+    LineIndex *index = &buffer->lines;
+    size_t end = buffer->gap_offset + num;
+    size_t usage = GapBuffer_getUsage(buffer);
+    while (index->tail > 0) {
+        size_t offset = usage - index->data[index->size - index->tail];
+        if (offset >= end)
+            break;
+        index->tail--;
+        index->data[index->head++] = offset;
+    }
+
     buffer->gap_offset += num;
 }
 
@@ -46,36 +126,234 @@ void GapBuffer_removeRangeAndSetCursor(GapBuffer *buffer,
                                        size_t offset, 
                                        size_t length)
 {
-    if (offset + length <= buffer->gap_offset)
-        moveBytesAfterGap(buffer, buffer->gap_offset - (offset + length));
-    else if (offset >= buffer->gap_offset + buffer->gap_length)
-        moveBytesBeforeGap(buffer, (offset + length) - buffer->gap_offset);
-    buffer->lineno -= countLines(buffer->data + offset, length);
+    if (usesPieces(buffer)) {
+        PieceTable_removeRangeAndSetCursor(&buffer->pieces, offset, length);
+        return;
+    }
+
+    size_t usage = GapBuffer_getUsage(buffer);
+    if (offset > usage)
+        offset = usage;
+    if (length > usage - offset)
+        length = usage - offset;
+
+    // Place the gap right after the range so
+    // that removing it only means growing the
+    // gap backwards.
+    GapBuffer_setCursor(buffer, offset + length);
+    LineIndex_popFrom(&buffer->lines, offset);
     buffer->gap_offset = offset;
     buffer->gap_length += length;
 }
 
 size_t GapBuffer_getUsage(GapBuffer *buffer)
 {
+    if (usesPieces(buffer))
+        return PieceTable_getUsage(&buffer->pieces);
     return buffer->size - buffer->gap_length;
 }
 
 size_t GapBuffer_getLineno(GapBuffer *buf)
 {
-    return buf->lineno;
+    if (usesPieces(buf))
+        return PieceTable_getLineno(&buf->pieces);
+    return buf->lines.head + buf->lines.tail + 1;
+}
+
+/* Returns false while the line count is only an
+ * estimate, which it is for a while after a big
+ * file was mapped. Each call makes it better. */
+bool GapBuffer_countLines(GapBuffer *buf)
+{
+    if (usesPieces(buf))
+        return PieceTable_countLines(&buf->pieces);
+    return true;
+}
+
+/* Tells whether the file the buffer maps was cut
+ * short by someone else, losing some of the text. */
+bool GapBuffer_isDamaged(GapBuffer *buf)
+{
+    return usesPieces(buf) && PieceTable_isDamaged(&buf->pieces);
+}
+
+size_t GapBuffer_lineToOffset(GapBuffer *buf, size_t line)
+{
+    if (usesPieces(buf))
+        return PieceTable_lineToOffset(&buf->pieces, line);
+
+    if (line == 0)
+        return 0;
+    if (line >= GapBuffer_getLineno(buf))
+        return GapBuffer_getUsage(buf);
+    return getNewline(buf, line-1) + 1;
+}
+
+size_t GapBuffer_offsetToLine(GapBuffer *buf, size_t offset)
+{
+    if (usesPieces(buf))
+        return PieceTable_offsetToLine(&buf->pieces, offset);
+
+    // The line of an offset is the number of
+    // newlines that come before it.
+    size_t lo = 0;
+    size_t hi = buf->lines.head + buf->lines.tail;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (getNewline(buf, mid) < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+size_t GapBuffer_getCursor(GapBuffer *buf)
+{
+    if (usesPieces(buf))
+        return buf->pieces.cursor;
+    return buf->gap_offset;
+}
+
+/* Returns the longest contiguous run of text that
+ * starts at [offset], or NULL if the offset is at
+ * the end of the buffer. */
+const char *GapBuffer_getChunk(GapBuffer *buf, size_t offset, size_t *len)
+{
+    if (usesPieces(buf))
+        return PieceTable_getChunk(&buf->pieces, offset, len);
+
+    size_t usage = GapBuffer_getUsage(buf);
+    if (offset >= usage) {
+        *len = 0;
+        return NULL;
+    }
+    if (offset < buf->gap_offset) {
+        *len = buf->gap_offset - offset;
+        return buf->data + offset;
+    }
+    *len = usage - offset;
+    return buf->data + offset + buf->gap_length;
+}
+
+/* Returns the longest contiguous run of text that
+ * ends at [offset], or NULL if the offset is at the
+ * start of the buffer. */
+const char *GapBuffer_getChunkBefore(GapBuffer *buf, size_t offset, size_t *len)
+{
+    if (usesPieces(buf))
+        return PieceTable_getChunkBefore(&buf->pieces, offset, len);
+
+    offset = MIN(offset, GapBuffer_getUsage(buf));
+    if (offset == 0) {
+        *len = 0;
+        return NULL;
+    }
+    if (offset <= buf->gap_offset) {
+        *len = offset;
+        return buf->data;
+    }
+    *len = offset - buf->gap_offset;
+    return buf->data + buf->gap_offset + buf->gap_length;
+}
+
+/* Returns the offset of the first newline at or
+ * after [offset], or the size of the text if
+ * there is none. */
+size_t GapBuffer_findNextNewline(GapBuffer *buf, size_t offset)
+{
+    size_t chunk_len;
+    const char *chunk;
+    while ((chunk = GapBuffer_getChunk(buf, offset, &chunk_len)) != NULL) {
+        const char *nl = Newline_find(chunk, chunk_len);
+        if (nl != NULL)
+            return offset + (nl - chunk);
+        offset += chunk_len;
+    }
+    return offset;
+}
+
+/* Returns the offset of the last newline before
+ * [offset], or SIZE_MAX if there is none. */
+size_t GapBuffer_findPrevNewline(GapBuffer *buf, size_t offset)
+{
+    size_t chunk_len;
+    const char *chunk;
+    while ((chunk = GapBuffer_getChunkBefore(buf, offset, &chunk_len)) != NULL) {
+        const char *nl = Newline_findLast(chunk, chunk_len);
+        offset -= chunk_len;
+        if (nl != NULL)
+            return offset + (nl - chunk);
+    }
+    return SIZE_MAX;
+}
+
+static void copyOut(GapBuffer *buf, size_t offset, size_t length, char *dst)
+{
+    size_t copied = 0;
+    while (copied < length) {
+        size_t chunk_len;
+        const char *chunk = GapBuffer_getChunk(buf, offset + copied, &chunk_len);
+        assert(chunk != NULL);
+        chunk_len = MIN(chunk_len, length - copied);
+        memcpy(dst + copied, chunk, chunk_len);
+        copied += chunk_len;
+    }
+}
+
+/* Returns the offset of the first occurrence of
+ * [needle] that starts at or after [offset] and
+ * ends by [end], or SIZE_MAX if there is none.
+ * Every contiguous run of text is searched where
+ * it is, and only the few bytes around the end of
+ * each, where a match could straddle the next one,
+ * are copied out. */
+size_t GapBuffer_find(GapBuffer *buf, size_t offset, size_t end,
+                      const char *needle, size_t len)
+{
+    if (len == 0 || len > GAPBUFFER_MAX_NEEDLE)
+        return SIZE_MAX;
+    end = MIN(end, GapBuffer_getUsage(buf));
+
+    while (offset < end && end - offset >= len) {
+        size_t chunk_len;
+        const char *chunk = GapBuffer_getChunk(buf, offset, &chunk_len);
+        chunk_len = MIN(chunk_len, end - offset);
+
+        const char *match = Literal_find(chunk, chunk_len, needle, len);
+        if (match != NULL)
+            return offset + (match - chunk);
+
+        // Matches starting in the last [len-1] bytes
+        // of the run end in the ones after it.
+        size_t tail = MIN(chunk_len, len - 1);
+        size_t start = offset + chunk_len - tail;
+        size_t window_len = MIN(tail + len - 1, end - start);
+        if (tail > 0 && window_len >= len) {
+            char window[2 * GAPBUFFER_MAX_NEEDLE];
+            copyOut(buf, start, window_len, window);
+            match = Literal_find(window, window_len, needle, len);
+            if (match != NULL)
+                return start + (match - window);
+        }
+        offset += chunk_len;
+    }
+    return SIZE_MAX;
 }
 
 bool GapBuffer_removeBackwards(GapBuffer *buffer)
 {
+    if (usesPieces(buffer))
+        return PieceTable_removeBackwards(&buffer->pieces);
+
     if (buffer->gap_offset == 0)
         return false;
 
-    if (buffer->data[buffer->gap_offset-1] == '\n')
-        buffer->lineno--;
-
     int prev = xutf8_prev(buffer->data, buffer->size, buffer->gap_offset, NULL);
     assert(prev >= 0 && (size_t) prev < buffer->gap_offset);
 
+    LineIndex_popFrom(&buffer->lines, prev);
+
     buffer->gap_length += buffer->gap_offset - prev;
     buffer->gap_offset = prev;
     return true;
@@ -83,6 +361,9 @@ bool GapBuffer_removeBackwards(GapBuffer *buffer)
 
 bool GapBuffer_moveCursorForward(GapBuffer *buf)
 {
+    if (usesPieces(buf))
+        return PieceTable_moveCursorForward(&buf->pieces);
+
     if (buf->gap_offset + buf->gap_length == buf->size)
         return false;
     
@@ -103,6 +384,9 @@ bool GapBuffer_moveCursorForward(GapBuffer *buf)
 
 bool GapBuffer_moveCursorBackward(GapBuffer *buf)
 {
+    if (usesPieces(buf))
+        return PieceTable_moveCursorBackward(&buf->pieces);
+
     if (buf->gap_offset == 0)
         return false;
 
@@ -115,6 +399,11 @@ bool GapBuffer_moveCursorBackward(GapBuffer *buf)
 
 void GapBuffer_setCursor(GapBuffer *buf, size_t cur)
 {
+    if (usesPieces(buf)) {
+        PieceTable_setCursor(&buf->pieces, cur);
+        return;
+    }
+
     size_t usage = GapBuffer_getUsage(buf);
     cur = MIN(cur, usage);
 
@@ -165,18 +454,34 @@ void GapBuffer_initEmpty(GapBuffer *buf)
     buf->size = 0;
     buf->gap_offset = 0;
     buf->gap_length = 0;
-    buf->lineno = 1;
+    buf->backend = GapBufferBackend_GAP;
+    LineIndex_init(&buf->lines);
+    PieceTable_initEmpty(&buf->pieces);
 }
 
 bool GapBuffer_initFile(GapBuffer *buf, const char *file)
+{
+    return GapBuffer_initFileWithBackend(buf, file, GapBufferBackend_GAP);
+}
+
+bool GapBuffer_initFileWithBackend(GapBuffer *buf, const char *file, 
+                                   GapBufferBackend backend)
 {
     GapBuffer_initEmpty(buf);
-    return GapBuffer_insertFile(buf, file);
+    buf->backend = backend;
+    switch (backend) {
+        case GapBufferBackend_GAP:    return GapBuffer_insertFile(buf, file);
+        case GapBufferBackend_PIECES: return PieceTable_initFile(&buf->pieces, file);
+        case GapBufferBackend_MAPPED: return PieceTable_mapFile(&buf->pieces, file);
+    }
+    return false;
 }
 
 void GapBuffer_free(GapBuffer *buf)
 {
     free(buf->data);
+    LineIndex_free(&buf->lines);
+    PieceTable_free(&buf->pieces);
 }
 
 bool GapBuffer_insertFile(GapBuffer *buf,
@@ -217,18 +522,74 @@ bool GapBuffer_insertStream(GapBuffer *buf,
     return true;
 }
 
+/* Writes [str] at the start of the gap, which must
+ * have room for it, as must the line index for its
+ * newlines. */
+static void insertBeforeGap(GapBuffer *buf, const char *str, size_t len)
+{
+    LineIndex *index = &buf->lines;
+    memcpy(buf->data + buf->gap_offset, str, len);
+    const char *p = str;
+    const char *end = str + len;
+    while ((p = Newline_find(p, end - p)) != NULL) {
+        index->data[index->head++] = buf->gap_offset + (p - str);
+        p++;
+    }
+    buf->gap_offset += len;
+    buf->gap_length -= len;
+}
+
+/* Like [insertBeforeGap], but [str] is written at
+ * the end of the gap, so that it comes after it. */
+static void insertAfterGap(GapBuffer *buf, const char *str, size_t len)
+{
+    LineIndex *index = &buf->lines;
+    buf->gap_length -= len;
+    memcpy(buf->data + buf->gap_offset + buf->gap_length, str, len);
+
+    // Newlines after the gap are pushed from the
+    // last one, as their distance from the end.
+    size_t after_gap = buf->size - buf->gap_offset - buf->gap_length;
+    const char *p = str + len;
+    while ((p = Newline_findLast(str, p - str)) != NULL) {
+        index->tail++;
+        index->data[index->size - index->tail] = after_gap - (p - str);
+    }
+}
+
+static void removeBeforeGap(GapBuffer *buf, size_t len)
+{
+    LineIndex_popFrom(&buf->lines, buf->gap_offset - len);
+    buf->gap_offset -= len;
+    buf->gap_length += len;
+}
+
+static void removeAfterGap(GapBuffer *buf, size_t len)
+{
+    LineIndex *index = &buf->lines;
+    size_t usage = GapBuffer_getUsage(buf);
+    size_t end = buf->gap_offset + len;
+    while (index->tail > 0 && usage - index->data[index->size - index->tail] < end)
+        index->tail--;
+    buf->gap_length += len;
+}
+
 bool GapBuffer_insertString(GapBuffer *buf, 
                             const char *str, 
                             size_t len)
 {
+    if (usesPieces(buf))
+        return PieceTable_insertString(&buf->pieces, str, len);
+
+    LineIndex *index = &buf->lines;
+    if (!LineIndex_reserve(index, Newline_count(str, len)))
+        return false;
+
     if (buf->gap_length < len)
         if (!growGap(buf, len))
             return false;
 
-    memcpy(buf->data + buf->gap_offset, str, len);
-    buf->gap_offset += len;
-    buf->gap_length -= len;
-    buf->lineno += countLines(str, len);
+    insertBeforeGap(buf, str, len);
     return true;
 }
 
@@ -246,18 +607,227 @@ char *GapBuffer_copyRange(GapBuffer *buffer,
     if (dst == NULL)
         return NULL;
 
-    size_t first_copy = MIN(offset + length, buffer->gap_offset) - offset;
-    memcpy(dst, buffer->data + offset, first_copy);
-
-    if (first_copy < length)
-        memcpy(dst + first_copy, buffer->data + buffer->gap_offset + buffer->gap_length, length - first_copy);
-
+    copyOut(buffer, offset, length, dst);
     dst[length] = '\0';
     return dst;
 }
 
+/* Applies the [count] edits in a single pass that
+ * streams the text into a buffer of the final size
+ * with the replacements in place, instead of moving
+ * the gap to each of them, and indexes the newlines
+ * of the result once. A piece table is rebuilt on
+ * top of the new text, which isn't mapped anymore.
+ * The cursor keeps its place in the text around
+ * the edits. On failure nothing is changed. */
+bool GapBuffer_replaceAll(GapBuffer *buf, const GapBufferEdit *edits, size_t count)
+{
+    size_t usage = GapBuffer_getUsage(buf);
+    size_t cursor = GapBuffer_getCursor(buf);
+    size_t new_usage = usage;
+    size_t new_cursor = cursor;
+    for (size_t i = 0; i < count; i++) {
+        const GapBufferEdit *edit = &edits[i];
+        assert(edit->offset + edit->removed <= usage);
+        assert(i == 0 || edits[i-1].offset + edits[i-1].removed <= edit->offset);
+
+        new_usage = new_usage - edit->removed + edit->inserted;
+        if (edit->offset + edit->removed <= cursor)
+            new_cursor = new_cursor - edit->removed + edit->inserted;
+        else if (edit->offset < cursor)
+            new_cursor -= cursor - edit->offset;
+    }
+
+    size_t size = usesPieces(buf) ? new_usage : new_usage + 4096;
+    char *data = malloc(size);
+    if (data == NULL && size > 0)
+        return false;
+
+    size_t pos = 0;
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++) {
+        const GapBufferEdit *edit = &edits[i];
+        copyOut(buf, pos, edit->offset - pos, data + out);
+        out += edit->offset - pos;
+        if (edit->inserted > 0)
+            memcpy(data + out, edit->str, edit->inserted);
+        out += edit->inserted;
+        pos = edit->offset + edit->removed;
+    }
+    copyOut(buf, pos, usage - pos, data + out);
+    assert(out + usage - pos == new_usage);
+
+    if (usesPieces(buf)) {
+        PieceTable pieces;
+        if (!PieceTable_initBuffer(&pieces, data, new_usage))
+            return false;
+        PieceTable_free(&buf->pieces);
+        buf->pieces = pieces;
+        buf->backend = GapBufferBackend_PIECES;
+        PieceTable_setCursor(&buf->pieces, new_cursor);
+        return true;
+    }
+
+    LineIndex lines;
+    LineIndex_init(&lines);
+    if (!LineIndex_reserve(&lines, Newline_count(data, new_usage))) {
+        free(data);
+        return false;
+    }
+    const char *p = data;
+    const char *end = data + new_usage;
+    while ((p = Newline_find(p, end - p)) != NULL) {
+        lines.data[lines.head++] = p - data;
+        p++;
+    }
+
+    free(buf->data);
+    LineIndex_free(&buf->lines);
+    buf->data = data;
+    buf->size = size;
+    buf->gap_offset = new_usage;
+    buf->gap_length = size - new_usage;
+    buf->lines = lines;
+    GapBuffer_setCursor(buf, new_cursor);
+    return true;
+}
+
+/* Moves the [offsets] that come before the end of
+ * [edit], starting from the [i]-th one, to where
+ * they are once the edit is applied, [shift] being
+ * how much the edits before it moved the text.
+ * Returns the index of the first one left. */
+static size_t shiftOffsetsForward(const GapBufferEdit *edit, size_t shift,
+                                  size_t *offsets, size_t i, size_t num)
+{
+    while (i < num && offsets[i] < edit->offset)
+        offsets[i++] += shift;
+    while (i < num && offsets[i] < edit->offset + edit->removed)
+        offsets[i++] = edit->offset + shift + edit->inserted;
+    return i;
+}
+
+/* Like [shiftOffsetsForward] for the offsets from
+ * the start of [edit], going backwards from the one
+ * before the [i]-th, with [shift] being how much the
+ * edits before it moved the text. Returns the index
+ * after the last one left. */
+static size_t shiftOffsetsBackward(const GapBufferEdit *edit, size_t shift,
+                                   size_t *offsets, size_t i)
+{
+    size_t end = edit->offset + edit->removed;
+    while (i > 0 && offsets[i-1] >= end) {
+        offsets[i-1] += shift + edit->inserted - edit->removed;
+        i--;
+    }
+    while (i > 0 && offsets[i-1] >= edit->offset) {
+        offsets[i-1] = edit->offset + shift + edit->inserted;
+        i--;
+    }
+    return i;
+}
+
+/* Applies the [count] edits in a single sweep that
+ * carries the gap from the first one to the last
+ * one, or from the last to the first if the gap is
+ * closer to that end, so that however many there
+ * are, the text between them is moved once on top
+ * of moving the gap to where the sweep starts.
+ * When the gap starts between the edits, the text
+ * between it and that end is therefore moved twice,
+ * which is at most half of the span. The sorted
+ * [offsets] are moved along with the text around
+ * them in the same pass, and those in a removed
+ * range end up after the text replacing it. A
+ * piece table has its own way of applying many
+ * edits at once. */
+bool GapBuffer_applyEdits(GapBuffer *buf, const GapBufferEdit *edits, size_t count,
+                          size_t *offsets, size_t num_offsets)
+{
+    if (count == 0)
+        return true;
+
+    size_t usage = GapBuffer_getUsage(buf);
+    size_t inserted = 0;
+    size_t newlines = 0;
+    size_t shift = 0; // Wraps around when the text shrinks
+    for (size_t i = 0; i < count; i++) {
+        const GapBufferEdit *edit = &edits[i];
+        assert(edit->offset + edit->removed <= usage);
+        assert(i == 0 || edits[i-1].offset + edits[i-1].removed <= edit->offset);
+        inserted += edit->inserted;
+        newlines += Newline_count(edit->str, edit->inserted);
+        shift += edit->inserted - edit->removed;
+    }
+    for (size_t i = 1; i < num_offsets; i++)
+        assert(offsets[i-1] <= offsets[i]);
+
+    if (usesPieces(buf)) {
+        if (!PieceTable_applyEdits(&buf->pieces, edits, count))
+            return false;
+        size_t j = 0;
+        shift = 0;
+        for (size_t i = 0; i < count; i++) {
+            j = shiftOffsetsForward(&edits[i], shift, offsets, j, num_offsets);
+            shift += edits[i].inserted - edits[i].removed;
+        }
+        while (j < num_offsets)
+            offsets[j++] += shift;
+        return true;
+    }
+
+    const GapBufferEdit *first = &edits[0];
+    const GapBufferEdit *last = &edits[count-1];
+    size_t last_end = last->offset + last->removed;
+    if (!LineIndex_reserve(&buf->lines, newlines))
+        return false;
+    if (buf->gap_length < inserted && !growGap(buf, inserted))
+        return false;
+
+    size_t gap = buf->gap_offset;
+    size_t to_first = (gap > first->offset) ? gap - first->offset : first->offset - gap;
+    size_t to_last = (gap > last_end) ? gap - last_end : last_end - gap;
+    bool forward = (to_first <= to_last);
+
+    if (forward) {
+        GapBuffer_setCursor(buf, first->offset);
+        size_t j = 0;
+        shift = 0;
+        for (size_t i = 0; i < count; i++) {
+            const GapBufferEdit *edit = &edits[i];
+            if (i > 0)
+                moveBytesBeforeGap(buf, edit->offset - (edits[i-1].offset + edits[i-1].removed));
+            removeAfterGap(buf, edit->removed);
+            insertBeforeGap(buf, edit->str, edit->inserted);
+            j = shiftOffsetsForward(edit, shift, offsets, j, num_offsets);
+            shift += edit->inserted - edit->removed;
+        }
+        while (j < num_offsets)
+            offsets[j++] += shift;
+        return true;
+    }
+
+    // Going backwards, the edits before the one being
+    // applied haven't moved it yet.
+    GapBuffer_setCursor(buf, last_end);
+    size_t j = num_offsets;
+    for (size_t i = count; i-- > 0;) {
+        const GapBufferEdit *edit = &edits[i];
+        shift -= edit->inserted - edit->removed;
+        if (i < count-1)
+            moveBytesAfterGap(buf, buf->gap_offset - (edit->offset + edit->removed));
+        removeBeforeGap(buf, edit->removed);
+        insertAfterGap(buf, edit->str, edit->inserted);
+        j = shiftOffsetsBackward(edit, shift, offsets, j);
+    }
+    return true;
+}
+
 bool GapBuffer_saveToStream(GapBuffer *buffer, FILE *stream)
 {
+    if (usesPieces(buffer))
+        return PieceTable_saveToStream(&buffer->pieces, stream);
+
     size_t p = buffer->gap_offset 
              + buffer->gap_length;
     size_t n;
@@ -266,4 +836,69 @@ bool GapBuffer_saveToStream(GapBuffer *buffer, FILE *stream)
     n = fwrite(buffer->data + p, sizeof(char), buffer->size - p, stream);
     if (n < buffer->size - p) return false;
     return true;
+}
+
+/* Writes the buffer to a temporary file next to
+ * [file] and then renames it over it. */
+static bool replaceFile(GapBuffer *buffer, const char *file)
+{
+    size_t file_len = strlen(file);
+    char *temp = malloc(file_len + sizeof(".XXXXXX"));
+    if (temp == NULL)
+        return false;
+    memcpy(temp, file, file_len);
+    strcpy(temp + file_len, ".XXXXXX");
+
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        free(temp);
+        return false;
+    }
+
+    struct stat info;
+    if (stat(file, &info) == 0)
+        fchmod(fd, info.st_mode & 07777);
+    else
+        fchmod(fd, 0644);
+
+    bool ok = false;
+    FILE *stream = fdopen(fd, "wb");
+    if (stream == NULL)
+        close(fd);
+    else {
+        ok = GapBuffer_saveToStream(buffer, stream);
+        if (fclose(stream))
+            ok = false;
+    }
+
+    if (ok && rename(temp, file))
+        ok = false;
+    if (!ok)
+        unlink(temp);
+    free(temp);
+    return ok;
+}
+
+/* Saves the buffer to [file], which is written in
+ * place unless the buffer maps it. Truncating a
+ * mapped file would take the text being written
+ * out away, so the new contents are moved over
+ * it instead, following symbolic links so that
+ * they stay links. */
+bool GapBuffer_saveToFile(GapBuffer *buffer, const char *file)
+{
+    if (buffer->backend == GapBufferBackend_MAPPED) {
+        char *target = realpath(file, NULL);
+        bool ok = replaceFile(buffer, target != NULL ? target : file);
+        free(target);
+        return ok;
+    }
+
+    FILE *stream = fopen(file, "wb");
+    if (stream == NULL)
+        return false;
+    bool ok = GapBuffer_saveToStream(buffer, stream);
+    if (fclose(stream))
+        ok = false;
+    return ok;
 }
\ No newline at end of file
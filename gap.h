@@ -4,20 +4,66 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "piece.h"
 
+/* Offsets of the '\n' characters of the buffer, 
+ * laid out as a gap array that mirrors the gap of
+ * the text. Newlines before the gap are stored as
+ * absolute offsets while the ones after it are
+ * stored as their distance from the end of the
+ * text, so that inserting or removing at the gap
+ * doesn't invalidate any of them.
+ */
 typedef struct {
+    size_t *data;
+    size_t  size;
+    size_t  head; // Newlines before the gap
+    size_t  tail; // Newlines after the gap
+} LineIndex;
+
+/* Storage engine of a buffer. The plain gap buffer
+ * is the fastest for small files, while the piece 
+ * table keeps edits far apart from each other cheap
+ * on very large ones. The mapped variant is a piece
+ * table that reads the file through a read-only
+ * mapping instead of loading it. */
+typedef enum {
+    GapBufferBackend_GAP,
+    GapBufferBackend_PIECES,
+    GapBufferBackend_MAPPED,
+} GapBufferBackend;
+
+typedef struct {
+    GapBufferBackend backend;
     char *data;
     size_t size;
     size_t gap_offset;
     size_t gap_length;
-    size_t lineno;
+    LineIndex  lines;
+    PieceTable pieces;
 } GapBuffer;
 
+typedef PieceTableEdit GapBufferEdit;
+
+// Longest string GapBuffer_find looks for
+#define GAPBUFFER_MAX_NEEDLE 256
+
 void   GapBuffer_initEmpty(GapBuffer *buf);
 bool   GapBuffer_initFile(GapBuffer *buf, const char *file);
+bool   GapBuffer_initFileWithBackend(GapBuffer *buf, const char *file, GapBufferBackend backend);
 void   GapBuffer_free(GapBuffer *buf);
 size_t GapBuffer_getUsage(GapBuffer *buffer);
 size_t GapBuffer_getLineno(GapBuffer *buf);
+bool   GapBuffer_countLines(GapBuffer *buf);
+bool   GapBuffer_isDamaged(GapBuffer *buf);
+size_t GapBuffer_lineToOffset(GapBuffer *buf, size_t line);
+size_t GapBuffer_offsetToLine(GapBuffer *buf, size_t offset);
+size_t GapBuffer_getCursor(GapBuffer *buf);
+const char *GapBuffer_getChunk(GapBuffer *buf, size_t offset, size_t *len);
+const char *GapBuffer_getChunkBefore(GapBuffer *buf, size_t offset, size_t *len);
+size_t GapBuffer_findNextNewline(GapBuffer *buf, size_t offset);
+size_t GapBuffer_findPrevNewline(GapBuffer *buf, size_t offset);
+size_t GapBuffer_find(GapBuffer *buf, size_t offset, size_t end, const char *needle, size_t len);
 void   GapBuffer_setCursor(GapBuffer *buf, size_t cur);
 bool   GapBuffer_insertFile(GapBuffer *buf, const char *file);
 bool   GapBuffer_insertString(GapBuffer *buf, const char *str, size_t len);
@@ -26,6 +72,9 @@ bool   GapBuffer_moveCursorBackward(GapBuffer *buf);
 bool   GapBuffer_moveCursorForward(GapBuffer *buf);
 bool   GapBuffer_removeBackwards(GapBuffer *buffer);
 void   GapBuffer_removeRangeAndSetCursor(GapBuffer *buffer, size_t offset, size_t length);
+bool   GapBuffer_replaceAll(GapBuffer *buf, const GapBufferEdit *edits, size_t count);
+bool   GapBuffer_applyEdits(GapBuffer *buf, const GapBufferEdit *edits, size_t count, size_t *offsets, size_t num_offsets);
 char  *GapBuffer_copyRange(GapBuffer *buffer, size_t offset, size_t length);
 bool   GapBuffer_saveToStream(GapBuffer *buffer, FILE *stream);
+bool   GapBuffer_saveToFile(GapBuffer *buffer, const char *file);
 #endif
\ No newline at end of file
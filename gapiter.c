@@ -2,6 +2,7 @@
 #include <string.h>
 #include <assert.h>
 #include "utils.h"
+#include "newline.h"
 #include "gapiter.h"
 
 void GapBufferIter_init(GapBufferIter *iter, 
@@ -9,11 +10,24 @@ void GapBufferIter_init(GapBufferIter *iter,
 {
     iter->buf = buf;
     iter->cur = 0;
+    iter->temp = NULL;
+    iter->temp_size = 0;
 }
 
 void GapBufferIter_free(GapBufferIter *iter)
 {
-    (void) iter;
+    free(iter->temp);
+}
+
+static bool growTemp(GapBufferIter *iter, size_t min_size)
+{
+    size_t size = MAX(MAX(2 * iter->temp_size, min_size), 256);
+    char *temp = realloc(iter->temp, size);
+    if (temp == NULL)
+        return false;
+    iter->temp = temp;
+    iter->temp_size = size;
+    return true;
 }
 
 bool GapBufferIter_nextLine(GapBufferIter *iter, 
@@ -23,77 +37,69 @@ bool GapBufferIter_nextLine(GapBufferIter *iter,
     if (line == NULL)
         line = &line_fallback;
 
-    char  *s = iter->buf->data;
-    size_t n = iter->buf->size;
-    size_t goff = iter->buf->gap_offset;
-    size_t glen = iter->buf->gap_length;
+    GapBuffer *buf = iter->buf;
     size_t c = iter->cur;
 
-    if (c == n)
+    size_t chunk_len;
+    const char *chunk = GapBuffer_getChunk(buf, c, &chunk_len);
+    if (chunk == NULL)
         return false;
 
-    if (c > goff) {
-
-        size_t start = c; // Offset of the line
-        while (c < n && s[c] != '\n') 
-            c++;
+    const char *nl = Newline_find(chunk, chunk_len);
+    if (nl != NULL || c + chunk_len == GapBuffer_getUsage(buf)) {
 
-        line->str = s + start;
-        line->off = start - glen;
-        line->len = c - start;
-
-        if (c < n) 
+        // The line is contiguous in memory.
+        line->str = (char*) chunk;
+        line->off = c;
+        line->len = (nl == NULL) ? chunk_len : (size_t) (nl - chunk);
+        c += line->len;
+        if (nl != NULL)
             c++; // Skip the \n
 
     } else {
 
-        size_t first_start = c; // Offset of the line
-        while (c < goff && s[c] != '\n') 
-            c++;
-        size_t first_len = c - first_start;
-
-        if (c < goff) {
-            line->str = s + first_start;
-            line->off = first_start;
-            line->len = first_len;
-            c++; // Consume the \n
-            if (c == goff) 
-                c += glen;
-
-        } else {
-
-            assert(c == goff);
-            
-            c += glen; // Skip the gap
-
-            size_t second_start = c;
-            while (c < n && s[c] != '\n') 
-                c++;
-            size_t second_len = c - second_start;
-            
-            if (c < n) 
+        // The line continues in the following
+        // chunks, so it's joined in the temporary
+        // buffer, which grows to fit it. Without
+        // memory for that, it's cut short.
+        size_t copied = 0;
+
+        line->off = c;
+        while (chunk != NULL) {
+            size_t len = (nl == NULL) ? chunk_len : (size_t) (nl - chunk);
+            if (copied + len > iter->temp_size)
+                growTemp(iter, copied + len);
+            size_t copy_len = MIN(len, iter->temp_size - copied);
+            if (copy_len > 0)
+                memcpy(iter->temp + copied, chunk, copy_len);
+            copied += copy_len;
+            c += len;
+
+            if (nl != NULL) {
                 c++; // Consume the \n
+                break;
+            }
 
-            char  *dst = iter->temp;
-            size_t max = sizeof(iter->temp);
-            
-            size_t  first_copy_len = MIN( first_len, max);
-            size_t second_copy_len = MIN(second_len, max - first_copy_len);
-            memcpy(dst,                  s +  first_start,  first_copy_len);
-            memcpy(dst + first_copy_len, s + second_start, second_copy_len);
-            line->str = iter->temp;
-            line->off = first_start;
-            line->len = first_copy_len + second_copy_len;
+            chunk = GapBuffer_getChunk(buf, c, &chunk_len);
+            if (chunk != NULL)
+                nl = Newline_find(chunk, chunk_len);
         }
+        line->str = iter->temp;
+        line->len = copied;
     }
     iter->cur = c;
     return true;
 }
 
+void GapBufferIter_seekLine(GapBufferIter *iter, size_t idx)
+{
+    iter->cur = GapBuffer_lineToOffset(iter->buf, idx);
+}
+
 bool GapBufferIter_getLine(GapBufferIter *iter, size_t idx, Line *line)
 {
-    for (size_t i = 0; i < idx+1; i++)
-        if (!GapBufferIter_nextLine(iter, line))
-            return false;
-    return true;
+    if (idx >= GapBuffer_getLineno(iter->buf))
+        return false;
+    GapBufferIter_seekLine(iter, idx);
+    return GapBufferIter_nextLine(iter, line);
 }
\ No newline at end of file
@@ -7,8 +7,9 @@
 
 typedef struct {
     GapBuffer *buf;
-    size_t cur;
-    char temp[256];
+    size_t cur; // Offset of the next line
+    char  *temp; // Holds lines that span chunks
+    size_t temp_size;
 } GapBufferIter;
 
 typedef struct {
@@ -20,6 +21,7 @@ typedef struct {
 void GapBufferIter_init(GapBufferIter *iter, GapBuffer *buf);
 void GapBufferIter_free(GapBufferIter *iter);
 bool GapBufferIter_nextLine(GapBufferIter *iter, Line *line);
+void GapBufferIter_seekLine(GapBufferIter *iter, size_t idx);
 bool GapBufferIter_getLine(GapBufferIter *iter, size_t idx, Line *line);
 
 #endif
\ No newline at end of file
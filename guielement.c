@@ -1,4 +1,8 @@
+#include <time.h>
+#include <errno.h>
 #include <assert.h>
+#include <pthread.h>
+#include "utils.h"
 #include "xutf8.h"
 #include "guielement.h"
 
@@ -67,6 +71,18 @@ void GUIElement_onArrowRightDown(GUIElement *elem)
         elem->methods->onArrowRightDown(elem);
 }
 
+void GUIElement_onArrowUpDown(GUIElement *elem)
+{
+    if (elem->methods->onArrowUpDown != NULL)
+        elem->methods->onArrowUpDown(elem);
+}
+
+void GUIElement_onArrowDownDown(GUIElement *elem)
+{
+    if (elem->methods->onArrowDownDown != NULL)
+        elem->methods->onArrowDownDown(elem);
+}
+
 void GUIElement_onReturnDown(GUIElement *elem)
 {
     if (elem->methods->onReturnDown != NULL)
@@ -118,6 +134,18 @@ void GUIElement_onCut(GUIElement *elem)
         elem->methods->onCut(elem);
 }
 
+void GUIElement_onUndo(GUIElement *elem)
+{
+    if (elem->methods->onUndo != NULL)
+        elem->methods->onUndo(elem);
+}
+
+void GUIElement_onRedo(GUIElement *elem)
+{
+    if (elem->methods->onRedo != NULL)
+        elem->methods->onRedo(elem);
+}
+
 void GUIElement_onSave(GUIElement *elem)
 {
     if (elem->methods->onSave != NULL)
@@ -130,6 +158,30 @@ void GUIElement_onOpen(GUIElement *elem)
         elem->methods->onOpen(elem);
 }
 
+void GUIElement_onFind(GUIElement *elem)
+{
+    if (elem->methods->onFind != NULL)
+        elem->methods->onFind(elem);
+}
+
+void GUIElement_onToggleRegex(GUIElement *elem)
+{
+    if (elem->methods->onToggleRegex != NULL)
+        elem->methods->onToggleRegex(elem);
+}
+
+void GUIElement_onReplace(GUIElement *elem)
+{
+    if (elem->methods->onReplace != NULL)
+        elem->methods->onReplace(elem);
+}
+
+void GUIElement_onEscapeDown(GUIElement *elem)
+{
+    if (elem->methods->onEscapeDown != NULL)
+        elem->methods->onEscapeDown(elem);
+}
+
 void GUIElement_onFocusLost(GUIElement *elem)
 {
     if (elem->methods->onFocusLost != NULL)
@@ -162,6 +214,7 @@ void GUIElement_setRegion(GUIElement *elem, Rectangle region)
         elem->region = region;
         if (elem->methods->onResize != NULL)
             elem->methods->onResize(elem, old_region);
+        GUIElement_invalidateAll(elem);
     }
 }
 
@@ -177,6 +230,28 @@ bool GUIElement_openFile(GUIElement *elem, const char *file)
     return false;
 }
 
+bool GUIElement_saveFile(GUIElement *elem, const char *file)
+{
+    if (elem->methods->saveFile != NULL)
+        return elem->methods->saveFile(elem, file);
+    return false;
+}
+
+/* Hints that [file] is likely to be opened soon. */
+void GUIElement_prefetchFile(GUIElement *elem, const char *file)
+{
+    if (elem->methods->prefetchFile != NULL)
+        elem->methods->prefetchFile(elem, file);
+}
+
+/* Selects [len] bytes of text from [offset] and
+ * brings them into view. */
+void GUIElement_selectRange(GUIElement *elem, size_t offset, size_t len)
+{
+    if (elem->methods->selectRange != NULL)
+        elem->methods->selectRange(elem, offset, len);
+}
+
 void GUIElement_getMinimumSize(GUIElement *elem, 
                                int *w, int *h)
 {
@@ -196,4 +271,192 @@ void GUIElement_getLogicalSize(GUIElement *elem, int *w, int *h)
         *h = region.height;
     } else
         elem->methods->getLogicalSize(elem, w, h);
-}
\ No newline at end of file
+}
+
+// Set when any element is invalidated, so that
+// the main loop knows a new frame is needed.
+static bool window_damaged = false;
+
+/* Marks [rect] (relative to the element) as out
+ * of date. Elements that cache their contents
+ * only repaint the damaged area on the next draw.
+ */
+void GUIElement_invalidate(GUIElement *elem, Rectangle rect)
+{
+    Rectangle bounds = {0, 0, elem->region.width, elem->region.height};
+    rect = GetCollisionRec(rect, bounds);
+    if (rect.width <= 0 || rect.height <= 0)
+        return;
+
+    if (elem->dirty) {
+        float x0 = MIN(elem->damage.x, rect.x);
+        float y0 = MIN(elem->damage.y, rect.y);
+        float x1 = MAX(elem->damage.x + elem->damage.width,  rect.x + rect.width);
+        float y1 = MAX(elem->damage.y + elem->damage.height, rect.y + rect.height);
+        rect = (Rectangle) {x0, y0, x1 - x0, y1 - y0};
+    }
+    elem->damage = rect;
+    elem->dirty = true;
+    window_damaged = true;
+}
+
+void GUIElement_invalidateAll(GUIElement *elem)
+{
+    Rectangle rect = {0, 0, elem->region.width, elem->region.height};
+    GUIElement_invalidate(elem, rect);
+}
+
+/* Returns the damaged area of the element and
+ * marks it as clean, or false if it's clean. */
+bool GUIElement_takeDamage(GUIElement *elem, Rectangle *rect)
+{
+    if (!elem->dirty)
+        return false;
+    *rect = elem->damage;
+    elem->dirty = false;
+    return true;
+}
+
+bool GUIElement_takeWindowDamage(void)
+{
+    bool damaged = window_damaged;
+    window_damaged = false;
+    return damaged;
+}
+
+// Milliseconds until some element wants to be
+// ticked again, or UINT64_MAX if none does.
+static uint64_t tick_delay = UINT64_MAX;
+
+/* Asks the main loop to tick the elements again
+ * within [delay_ms], even if no input arrives. 
+ * Animations ask for 0 on every tick. */
+void GUIElement_scheduleTick(uint64_t delay_ms)
+{
+    if (delay_ms < tick_delay)
+        tick_delay = delay_ms;
+}
+
+uint64_t GUIElement_takeTickDelay(void)
+{
+    uint64_t delay = tick_delay;
+    tick_delay = UINT64_MAX;
+    return delay;
+}
+
+// Provided by the GLFW bundled in raylib
+void glfwPostEmptyEvent(void);
+
+/* Wakes up the main loop while it's waiting for
+ * input. Unlike the other functions it can be 
+ * called from any thread, for instance when a
+ * background job completes. */
+void GUIElement_wakeUp(void)
+{
+    glfwPostEmptyEvent();
+}
+
+// Wakes up the main loop at [timer_deadline] when
+// it's armed, since raylib's waiting for events
+// can't time out.
+static pthread_once_t  timer_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  timer_cond;
+static bool            timer_started = false;
+static bool            timer_armed = false;
+static struct timespec timer_deadline;
+
+static void *runTimer(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&timer_lock);
+    for (;;) {
+        if (!timer_armed)
+            pthread_cond_wait(&timer_cond, &timer_lock);
+        else if (pthread_cond_timedwait(&timer_cond, &timer_lock, &timer_deadline) == ETIMEDOUT) {
+            timer_armed = false;
+            GUIElement_wakeUp();
+        }
+    }
+    return NULL;
+}
+
+static void startTimer(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, runTimer, NULL) == 0) {
+        pthread_detach(thread);
+        timer_started = true;
+    }
+}
+
+static bool armTimer(uint64_t delay_ms)
+{
+    pthread_once(&timer_once, startTimer);
+    if (!timer_started)
+        return false;
+
+    pthread_mutex_lock(&timer_lock);
+    timer_armed = (delay_ms != UINT64_MAX);
+    if (timer_armed) {
+        clock_gettime(CLOCK_MONOTONIC, &timer_deadline);
+        timer_deadline.tv_sec  += delay_ms / 1000;
+        timer_deadline.tv_nsec += (delay_ms % 1000) * 1000000;
+        if (timer_deadline.tv_nsec >= 1000000000) {
+            timer_deadline.tv_sec++;
+            timer_deadline.tv_nsec -= 1000000000;
+        }
+    }
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_lock);
+    return true;
+}
+
+/* Registers the input like EndDrawing does, but
+ * first sleeps until some arrives, [delay_ms] went
+ * by or GUIElement_wakeUp is called. The sleep
+ * happens inside of PollInputEvents, after the
+ * state of the keys was saved, so that keys that
+ * are pressed meanwhile are seen as pressed by
+ * the next frame. */
+void GUIElement_waitEvents(uint64_t delay_ms)
+{
+    if (!armTimer(delay_ms) && delay_ms != UINT64_MAX) {
+        // Nothing could wake the loop up in time
+        WaitTime(delay_ms / 1000.0);
+        PollInputEvents();
+        return;
+    }
+    EnableEventWaiting();
+    PollInputEvents();
+    DisableEventWaiting();
+}
+
+// Element waiting for a file to be picked, or
+// NULL if none is.
+static GUIElement *file_requester = NULL;
+static bool file_request_save = false;
+
+/* Asks the main loop for a file to open, or to
+ * save to if [save] is set. Once one is picked
+ * it's handed to the element through its openFile
+ * or saveFile method. */
+void GUIElement_requestFile(GUIElement *elem, bool save)
+{
+    file_requester = elem;
+    file_request_save = save;
+}
+
+GUIElement *GUIElement_takeFileRequest(bool *save)
+{
+    GUIElement *elem = file_requester;
+    *save = file_request_save;
+    file_requester = NULL;
+    return elem;
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <raylib.h>
 
 typedef struct GUIElement GUIElement;
@@ -19,18 +20,29 @@ typedef struct {
     void (*onMouseMotion)(GUIElement*, int, int);
     void (*onArrowLeftDown)(GUIElement*);
     void (*onArrowRightDown)(GUIElement*);
+    void (*onArrowUpDown)(GUIElement*);
+    void (*onArrowDownDown)(GUIElement*);
     void (*onReturnDown)(GUIElement*);
     void (*onBackspaceDown)(GUIElement*);
     void (*onTextInput)(GUIElement*, const char*, size_t);
     void (*onPaste)(GUIElement*);
     void (*onCopy)(GUIElement*);
     void (*onCut)(GUIElement*);
+    void (*onUndo)(GUIElement*);
+    void (*onRedo)(GUIElement*);
     void (*onSave)(GUIElement*);
     void (*onOpen)(GUIElement*);
+    void (*onFind)(GUIElement*);
+    void (*onToggleRegex)(GUIElement*);
+    void (*onReplace)(GUIElement*);
+    void (*onEscapeDown)(GUIElement*);
     void (*onFocusLost)(GUIElement*);
     void (*onFocusGained)(GUIElement*);
     void (*onResize)(GUIElement*, Rectangle);
     bool (*openFile)(GUIElement*, const char*);
+    bool (*saveFile)(GUIElement*, const char*);
+    void (*prefetchFile)(GUIElement*, const char*);
+    void (*selectRange)(GUIElement*, size_t, size_t);
     void (*getMinimumSize)(GUIElement*, int*, int*);
     void (*getLogicalSize)(GUIElement*, int*, int*);
 } GUIElementMethods;
@@ -39,6 +51,8 @@ struct GUIElement {
     const GUIElementMethods *methods;
     Rectangle region;
     char name[16];
+    bool dirty;
+    Rectangle damage; // Relative to the region, only valid when dirty
 };
 
 void GUIElement_free(GUIElement *elem);
@@ -51,6 +65,8 @@ void GUIElement_onMouseWheel(GUIElement *elem, int y);
 void GUIElement_onMouseMotion(GUIElement *elem, int x, int y);
 void GUIElement_onArrowLeftDown(GUIElement *elem);
 void GUIElement_onArrowRightDown(GUIElement *elem);
+void GUIElement_onArrowUpDown(GUIElement *elem);
+void GUIElement_onArrowDownDown(GUIElement *elem);
 void GUIElement_onReturnDown(GUIElement *elem);
 void GUIElement_onBackspaceDown(GUIElement *elem);
 void GUIElement_onTabDown(GUIElement *elem);
@@ -59,14 +75,33 @@ void GUIElement_onTextInput2(GUIElement *elem, uint32_t rune);
 void GUIElement_onPaste(GUIElement *elem);
 void GUIElement_onCopy(GUIElement *elem);
 void GUIElement_onCut(GUIElement *elem);
+void GUIElement_onUndo(GUIElement *elem);
+void GUIElement_onRedo(GUIElement *elem);
 void GUIElement_onSave(GUIElement *elem);
 void GUIElement_onOpen(GUIElement *elem);
+void GUIElement_onFind(GUIElement *elem);
+void GUIElement_onToggleRegex(GUIElement *elem);
+void GUIElement_onReplace(GUIElement *elem);
+void GUIElement_onEscapeDown(GUIElement *elem);
 void GUIElement_onFocusLost(GUIElement *elem);
 void GUIElement_onFocusGained(GUIElement *elem);
 GUIElement *GUIElement_getHovered(GUIElement *elem, int x, int y);
 void      GUIElement_setRegion(GUIElement *elem, Rectangle region);
 Rectangle GUIElement_getRegion(GUIElement *elem);
 bool GUIElement_openFile(GUIElement *elem, const char *file);
+bool GUIElement_saveFile(GUIElement *elem, const char *file);
+void GUIElement_prefetchFile(GUIElement *elem, const char *file);
+void GUIElement_selectRange(GUIElement *elem, size_t offset, size_t len);
 void GUIElement_getMinimumSize(GUIElement *elem, int *w, int *h);
 void GUIElement_getLogicalSize(GUIElement *elem, int *w, int *h);
+void GUIElement_invalidate(GUIElement *elem, Rectangle rect);
+void GUIElement_invalidateAll(GUIElement *elem);
+bool GUIElement_takeDamage(GUIElement *elem, Rectangle *rect);
+bool GUIElement_takeWindowDamage(void);
+void GUIElement_scheduleTick(uint64_t delay_ms);
+uint64_t GUIElement_takeTickDelay(void);
+void GUIElement_wakeUp(void);
+void GUIElement_waitEvents(uint64_t delay_ms);
+void GUIElement_requestFile(GUIElement *elem, bool save);
+GUIElement *GUIElement_takeFileRequest(bool *save);
 #endif
\ No newline at end of file
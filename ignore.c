@@ -0,0 +1,552 @@
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "ignore.h"
+
+typedef struct {
+    uint32_t off; // Into the text of the rules
+    uint32_t len;
+    bool     any; // A "**", matching any number of directories
+} Component;
+
+typedef struct {
+    uint32_t first; // Component
+    uint32_t num_components;
+    bool     negated;
+    bool     dir_only;
+    bool     anchored; // Has a slash
+} Rule;
+
+/* The last rules matching a name, or -1. */
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+    int32_t  last;
+    int32_t  last_dir_only;
+} Slot;
+
+typedef struct {
+    Slot  *slots;
+    size_t mask;
+} NameTable;
+
+struct IgnoreRules {
+    char      *text;
+    size_t     text_len;
+    Rule      *rules;
+    uint32_t   num_rules;
+    Component *components;
+    uint32_t   num_components;
+    NameTable  names;    // Rules without a slash or wildcards
+    NameTable  suffixes; // Rules like "*.o", by extension
+    uint32_t  *globs;    // Other rules without a slash
+    uint32_t   num_globs;
+    uint32_t  *anchored; // Rules with a slash
+    uint32_t   num_anchored;
+};
+
+/* Parses the character class at [p], which is a
+ * '['. Returns where it ends, or NULL if it's not
+ * terminated and [p] is just a character. */
+static const char *matchClass(const char *p, const char *p_end,
+                              char c, bool *matched)
+{
+    p++;
+    bool negated = (p < p_end && (*p == '!' || *p == '^'));
+    if (negated)
+        p++;
+
+    bool found = false;
+    bool first = true;
+    while (p < p_end && (*p != ']' || first)) {
+        first = false;
+        char lo = *p++;
+        if (lo == '\\' && p < p_end)
+            lo = *p++;
+        char hi = lo;
+        if (p + 1 < p_end && *p == '-' && p[1] != ']') {
+            hi = p[1];
+            p += 2;
+            if (hi == '\\' && p < p_end)
+                hi = *p++;
+        }
+        if (lo <= c && c <= hi)
+            found = true;
+    }
+    if (p == p_end)
+        return NULL;
+    *matched = (found != negated);
+    return p + 1;
+}
+
+/* Matches a name against a pattern that has no
+ * slash, where '*' can only backtrack to the last
+ * star that was met. */
+static bool matchGlob(const char *p, const char *p_end,
+                      const char *s, const char *s_end)
+{
+    const char *star_p = NULL;
+    const char *star_s = NULL;
+    while (s < s_end) {
+        if (p < p_end) {
+            if (*p == '*') {
+                star_p = ++p;
+                star_s = s;
+                continue;
+            }
+            if (*p == '?') {
+                p++;
+                s++;
+                continue;
+            }
+            if (*p == '[') {
+                bool matched;
+                const char *end = matchClass(p, p_end, *s, &matched);
+                if (end != NULL) {
+                    if (!matched)
+                        goto backtrack;
+                    p = end;
+                    s++;
+                    continue;
+                }
+            }
+            const char *q = p;
+            if (*q == '\\' && q + 1 < p_end)
+                q++;
+            if (*q == *s) {
+                p = q + 1;
+                s++;
+                continue;
+            }
+        }
+    backtrack:
+        if (star_p == NULL)
+            return false;
+        p = star_p;
+        s = ++star_s;
+    }
+    while (p < p_end && *p == '*')
+        p++;
+    return p == p_end;
+}
+
+static bool matchComponent(const IgnoreRules *rules, const Component *c,
+                           const char *name, size_t len)
+{
+    const char *p = rules->text + c->off;
+    return matchGlob(p, p + c->len, name, name + len);
+}
+
+static uint32_t hashName(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static Slot *findSlot(const IgnoreRules *rules, const NameTable *table,
+                      const char *name, size_t len)
+{
+    size_t i = hashName(name, len) & table->mask;
+    for (;;) {
+        Slot *slot = &table->slots[i];
+        if (slot->last == -1 && slot->last_dir_only == -1)
+            return slot; // Unused
+        if (slot->len == len && !memcmp(rules->text + slot->off, name, len))
+            return slot;
+        i = (i + 1) & table->mask;
+    }
+}
+
+static bool initTable(NameTable *table, size_t count)
+{
+    table->slots = NULL;
+    table->mask = 0;
+    if (count == 0)
+        return true;
+
+    size_t capacity = 8;
+    while (capacity < 2 * count)
+        capacity *= 2;
+    table->slots = malloc(capacity * sizeof(Slot));
+    if (table->slots == NULL)
+        return false;
+    for (size_t i = 0; i < capacity; i++)
+        table->slots[i] = (Slot) { .last = -1, .last_dir_only = -1 };
+    table->mask = capacity - 1;
+    return true;
+}
+
+static void insertRule(IgnoreRules *rules, NameTable *table,
+                       uint32_t off, uint32_t len, uint32_t index)
+{
+    Slot *slot = findSlot(rules, table, rules->text + off, len);
+    slot->off = off;
+    slot->len = len;
+    if (rules->rules[index].dir_only)
+        slot->last_dir_only = index;
+    else
+        slot->last = index;
+}
+
+static int32_t lookupName(const IgnoreRules *rules, const NameTable *table,
+                          const char *name, size_t len, bool is_dir)
+{
+    if (table->slots == NULL)
+        return -1;
+    Slot *slot = findSlot(rules, table, name, len);
+    return is_dir ? MAX(slot->last, slot->last_dir_only) : slot->last;
+}
+
+static bool hasWildcards(const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\')
+            return true;
+    return false;
+}
+
+/* Returns true if [c] is a star followed by an
+ * extension, like "*.o". */
+static bool isSuffix(const IgnoreRules *rules, const Component *c)
+{
+    const char *s = rules->text + c->off;
+    return c->len > 2 && s[0] == '*' && s[1] == '.'
+        && !hasWildcards(s + 1, c->len - 1)
+        && memchr(s + 2, '.', c->len - 2) == NULL;
+}
+
+static bool appendComponent(IgnoreRules *rules, size_t *max_components,
+                            const char *s, size_t len)
+{
+    bool any = (len == 2 && s[0] == '*' && s[1] == '*');
+
+    // "a/**/**/b" is the same as "a/**/b"
+    Rule *rule = &rules->rules[rules->num_rules];
+    if (any && rule->num_components > 0 && rules->components[rules->num_components-1].any)
+        return true;
+
+    if (rules->num_components == *max_components) {
+        size_t max = MAX(2 * *max_components, 16);
+        Component *components = realloc(rules->components, max * sizeof(Component));
+        if (components == NULL)
+            return false;
+        rules->components = components;
+        *max_components = max;
+    }
+    memcpy(rules->text + rules->text_len, s, len);
+    rules->components[rules->num_components++] = (Component) {
+        .off = rules->text_len,
+        .len = len,
+        .any = any,
+    };
+    rules->text_len += len;
+    rule->num_components++;
+    return true;
+}
+
+/* Parses the line [s, e) into the next rule.
+ * Returns false if out of memory. */
+static bool parseLine(IgnoreRules *rules, size_t *max_components,
+                      const char *s, const char *e)
+{
+    if (e > s && e[-1] == '\r')
+        e--;
+    while (e > s && e[-1] == ' ' && !(e - 1 > s && e[-2] == '\\'))
+        e--;
+    if (s == e || *s == '#')
+        return true;
+
+    Rule *rule = &rules->rules[rules->num_rules];
+    rule->first = rules->num_components;
+    rule->num_components = 0;
+    rule->negated = (*s == '!');
+    if (rule->negated)
+        s++;
+    rule->dir_only = (e > s && e[-1] == '/');
+    if (rule->dir_only)
+        e--;
+    if (s >= e)
+        return true;
+
+    rule->anchored = (memchr(s, '/', e - s) != NULL);
+    while (s < e) {
+        const char *slash = memchr(s, '/', e - s);
+        const char *end = (slash == NULL) ? e : slash;
+        if (end > s && !appendComponent(rules, max_components, s, end - s))
+            return false;
+        s = end + (slash != NULL);
+    }
+    if (rule->num_components == 0)
+        return true;
+
+    if (rule->anchored) {
+        rules->anchored[rules->num_anchored++] = rules->num_rules;
+    } else {
+        // The others go in the tables once they're allocated
+        const Component *c = &rules->components[rule->first];
+        if (hasWildcards(rules->text + c->off, c->len) && !isSuffix(rules, c))
+            rules->globs[rules->num_globs++] = rules->num_rules;
+    }
+    rules->num_rules++;
+    return true;
+}
+
+/* Compiles the contents of a .gitignore file. */
+IgnoreRules *IgnoreRules_compile(const char *text, size_t len)
+{
+    size_t max_rules = 1;
+    for (size_t i = 0; i < len; i++)
+        if (text[i] == '\n')
+            max_rules++;
+
+    IgnoreRules *rules = malloc(sizeof(IgnoreRules));
+    if (rules == NULL)
+        return NULL;
+    rules->text = malloc(MAX(len, 1));
+    rules->text_len = 0;
+    rules->rules = malloc(max_rules * sizeof(Rule));
+    rules->num_rules = 0;
+    rules->components = NULL;
+    rules->num_components = 0;
+    rules->globs = malloc(max_rules * sizeof(uint32_t));
+    rules->num_globs = 0;
+    rules->anchored = malloc(max_rules * sizeof(uint32_t));
+    rules->num_anchored = 0;
+    rules->names.slots = NULL;
+    rules->suffixes.slots = NULL;
+    if (rules->text == NULL || rules->rules == NULL
+     || rules->globs == NULL || rules->anchored == NULL) {
+        IgnoreRules_free(rules);
+        return NULL;
+    }
+
+    size_t max_components = 0;
+    const char *s = text;
+    const char *end = text + len;
+    while (s < end) {
+        const char *newline = memchr(s, '\n', end - s);
+        const char *e = (newline == NULL) ? end : newline;
+        if (!parseLine(rules, &max_components, s, e)) {
+            IgnoreRules_free(rules);
+            return NULL;
+        }
+        s = e + 1;
+    }
+
+    // Now that the rules are known, the simple ones
+    // without a slash go in the tables.
+    size_t num_names = 0;
+    size_t num_suffixes = 0;
+    for (uint32_t i = 0; i < rules->num_rules; i++) {
+        const Rule *rule = &rules->rules[i];
+        const Component *c = &rules->components[rule->first];
+        if (rule->anchored || c->any)
+            continue;
+        if (!hasWildcards(rules->text + c->off, c->len))
+            num_names++;
+        else if (isSuffix(rules, c))
+            num_suffixes++;
+    }
+    if (!initTable(&rules->names, num_names)
+     || !initTable(&rules->suffixes, num_suffixes)) {
+        IgnoreRules_free(rules);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < rules->num_rules; i++) {
+        const Rule *rule = &rules->rules[i];
+        const Component *c = &rules->components[rule->first];
+        if (rule->anchored || c->any)
+            continue;
+        if (!hasWildcards(rules->text + c->off, c->len))
+            insertRule(rules, &rules->names, c->off, c->len, i);
+        else if (isSuffix(rules, c))
+            insertRule(rules, &rules->suffixes, c->off + 1, c->len - 1, i);
+    }
+    return rules;
+}
+
+/* Compiles a list of patterns ending with NULL,
+ * like the lines of a .gitignore. */
+IgnoreRules *IgnoreRules_compileList(const char *const *patterns)
+{
+    size_t len = 0;
+    for (size_t i = 0; patterns[i] != NULL; i++)
+        len += strlen(patterns[i]) + 1;
+
+    char *text = malloc(MAX(len, 1));
+    if (text == NULL)
+        return NULL;
+
+    size_t used = 0;
+    for (size_t i = 0; patterns[i] != NULL; i++) {
+        size_t pattern_len = strlen(patterns[i]);
+        memcpy(text + used, patterns[i], pattern_len);
+        used += pattern_len;
+        text[used++] = '\n';
+    }
+    IgnoreRules *rules = IgnoreRules_compile(text, used);
+    free(text);
+    return rules;
+}
+
+void IgnoreRules_free(IgnoreRules *rules)
+{
+    free(rules->text);
+    free(rules->rules);
+    free(rules->components);
+    free(rules->globs);
+    free(rules->anchored);
+    free(rules->names.slots);
+    free(rules->suffixes.slots);
+    free(rules);
+}
+
+/* Returns the last rule without a slash that
+ * matches [name], or -1. */
+static int32_t matchName(const IgnoreRules *rules, const char *name,
+                         size_t len, bool is_dir)
+{
+    int32_t last = lookupName(rules, &rules->names, name, len, is_dir);
+
+    size_t dot = len;
+    while (dot > 0 && name[dot-1] != '.')
+        dot--;
+    if (dot > 0)
+        last = MAX(last, lookupName(rules, &rules->suffixes, name + dot - 1,
+                                    len - dot + 1, is_dir));
+
+    for (uint32_t i = rules->num_globs; i-- > 0; ) {
+        uint32_t index = rules->globs[i];
+        if ((int32_t) index <= last)
+            break;
+        const Rule *rule = &rules->rules[index];
+        if (rule->dir_only && !is_dir)
+            continue;
+        if (matchComponent(rules, &rules->components[rule->first], name, len))
+            return index;
+    }
+    return last;
+}
+
+/* Returns true if [name] is the last component
+ * the partial match needs. */
+static bool completes(const IgnorePartial *partial, const char *name,
+                      size_t len, bool is_dir)
+{
+    const IgnoreRules *rules = partial->rules;
+    const Rule *rule = &rules->rules[partial->rule];
+    if (rule->dir_only && !is_dir)
+        return false;
+
+    uint32_t left = rule->num_components - partial->component;
+    const Component *c = &rules->components[rule->first + partial->component];
+    if (c->any)
+        return left == 1 || (left == 2 && matchComponent(rules, c + 1, name, len));
+    return left == 1 && matchComponent(rules, c, name, len);
+}
+
+bool IgnoreState_match(const IgnoreState *state, const char *name,
+                       size_t len, bool is_dir)
+{
+    for (const IgnoreLayer *layer = state->layers; layer != NULL; layer = layer->parent) {
+        const IgnoreRules *rules = layer->rules;
+
+        int32_t last = matchName(rules, name, len, is_dir);
+        for (size_t i = 0; i < state->num_partials; i++) {
+            const IgnorePartial *partial = &state->partials[i];
+            if (partial->rules == rules && (int32_t) partial->rule > last
+             && completes(partial, name, len, is_dir))
+                last = partial->rule;
+        }
+        if (last >= 0)
+            return !rules->rules[last].negated;
+    }
+    return false;
+}
+
+static bool appendPartial(IgnoreState *state, size_t *max_partials,
+                          IgnorePartial partial)
+{
+    for (size_t i = 0; i < state->num_partials; i++) {
+        IgnorePartial *other = &state->partials[i];
+        if (other->rules == partial.rules && other->rule == partial.rule
+         && other->component == partial.component)
+            return true;
+    }
+    if (state->num_partials == *max_partials) {
+        size_t max = MAX(2 * *max_partials, 8);
+        IgnorePartial *partials = realloc(state->partials, max * sizeof(IgnorePartial));
+        if (partials == NULL)
+            return false;
+        state->partials = partials;
+        *max_partials = max;
+    }
+    state->partials[state->num_partials++] = partial;
+    return true;
+}
+
+/* Adds the rules of [layer] to those of the
+ * directory at [state]. */
+bool IgnoreState_push(IgnoreState *state, IgnoreLayer *layer)
+{
+    layer->parent = state->layers;
+    state->layers = layer;
+
+    size_t max_partials = state->num_partials;
+    const IgnoreRules *rules = layer->rules;
+    for (uint32_t i = 0; i < rules->num_anchored; i++) {
+        IgnorePartial partial = { rules, rules->anchored[i], 0 };
+        if (!appendPartial(state, &max_partials, partial))
+            return false;
+    }
+    return true;
+}
+
+/* Makes the state of the subdirectory [name] of
+ * the one at [state]. */
+bool IgnoreState_enter(const IgnoreState *state, const char *name,
+                       size_t len, IgnoreState *child)
+{
+    child->layers = state->layers;
+    child->partials = NULL;
+    child->num_partials = 0;
+
+    size_t max_partials = 0;
+    for (size_t i = 0; i < state->num_partials; i++) {
+        IgnorePartial partial = state->partials[i];
+        const IgnoreRules *rules = partial.rules;
+        const Rule *rule = &rules->rules[partial.rule];
+        const Component *c = &rules->components[rule->first + partial.component];
+        uint32_t left = rule->num_components - partial.component;
+
+        bool ok = true;
+        if (c->any) {
+            // Either the directory is one of those
+            // the "**" stands for, or there are none
+            ok = appendPartial(child, &max_partials, partial);
+            if (ok && left > 2 && matchComponent(rules, c + 1, name, len)) {
+                partial.component += 2;
+                ok = appendPartial(child, &max_partials, partial);
+            }
+        } else if (left > 1 && matchComponent(rules, c, name, len)) {
+            partial.component++;
+            ok = appendPartial(child, &max_partials, partial);
+        }
+        if (!ok) {
+            IgnoreState_free(child);
+            return false;
+        }
+    }
+    return true;
+}
+
+void IgnoreState_free(IgnoreState *state)
+{
+    free(state->partials);
+    state->partials = NULL;
+    state->num_partials = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef SNBPAD_IGNORE_H
+#define SNBPAD_IGNORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Matches names against .gitignore style rules
+ * while walking down a tree, without building
+ * their paths. Rules without a slash are looked
+ * up by name or extension when possible, and the
+ * ones with a slash advance a component at a time
+ * as directories are entered.
+ *
+ * The rules of a directory are a layer over the
+ * ones of its parent, and the deepest layer with
+ * a matching rule decides, the last rule of it
+ * that matches in particular. */
+
+typedef struct IgnoreRules IgnoreRules;
+typedef struct IgnoreLayer IgnoreLayer;
+
+struct IgnoreLayer {
+    const IgnoreLayer *parent;
+    const IgnoreRules *rules;
+};
+
+// A rule with a slash that matched the path up to
+// the directory, up to [component] excluded.
+typedef struct {
+    const IgnoreRules *rules;
+    uint32_t rule;
+    uint32_t component;
+} IgnorePartial;
+
+typedef struct {
+    const IgnoreLayer *layers; // The deepest first
+    IgnorePartial *partials;
+    size_t num_partials;
+} IgnoreState;
+
+IgnoreRules *IgnoreRules_compile(const char *text, size_t len);
+IgnoreRules *IgnoreRules_compileList(const char *const *patterns);
+void         IgnoreRules_free(IgnoreRules *rules);
+bool         IgnoreState_push(IgnoreState *state, IgnoreLayer *layer);
+bool         IgnoreState_match(const IgnoreState *state, const char *name, size_t len, bool is_dir);
+bool         IgnoreState_enter(const IgnoreState *state, const char *name, size_t len, IgnoreState *child);
+void         IgnoreState_free(IgnoreState *state);
+#endif
@@ -0,0 +1,173 @@
+#include <string.h>
+#include "utils.h"
+#include "literal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LITERAL_X86 1
+#include <immintrin.h>
+#else
+#define LITERAL_X86 0
+#endif
+
+typedef const char *(*LiteralFind)(const char*, size_t, const char*, size_t);
+
+/* Tells if the needle occurs at [str], knowing
+ * that its first and last bytes already do. */
+static bool matchesInner(const char *str, const char *needle, size_t needle_len)
+{
+    return needle_len <= 2 || !memcmp(str + 1, needle + 1, needle_len - 2);
+}
+
+static const char *findScalar(const char *str, size_t len,
+                              const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+        return str;
+    if (needle_len > len)
+        return NULL;
+
+    const char *last = str + len - needle_len;
+    const char *p = str;
+    while (p <= last) {
+        p = memchr(p, needle[0], last - p + 1);
+        if (p == NULL)
+            break;
+        if (p[needle_len-1] == needle[needle_len-1]
+            && matchesInner(p, needle, needle_len))
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
+#if LITERAL_X86
+
+static const char *findSSE2(const char *str, size_t len,
+                            const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+        return str;
+    if (needle_len > len)
+        return NULL;
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last  = _mm_set1_epi8(needle[needle_len-1]);
+
+    // Candidates are the positions where the needle
+    // would start, and there are [len - needle_len + 1]
+    // of them.
+    size_t num_starts = len - needle_len + 1;
+    size_t i = 0;
+    for (; num_starts - i >= 16; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (str + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (str + i + needle_len - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                            _mm_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            const char *p = str + i + __builtin_ctz(mask);
+            if (matchesInner(p, needle, needle_len))
+                return p;
+            mask &= mask - 1;
+        }
+    }
+    return findScalar(str + i, len - i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static const char *findAVX2(const char *str, size_t len,
+                            const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+        return str;
+    if (needle_len > len)
+        return NULL;
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last  = _mm256_set1_epi8(needle[needle_len-1]);
+
+    size_t num_starts = len - needle_len + 1;
+    size_t i = 0;
+    for (; num_starts - i >= 32; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (str + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (str + i + needle_len - 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                                  _mm256_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            const char *p = str + i + __builtin_ctz(mask);
+            if (matchesInner(p, needle, needle_len))
+                return p;
+            mask &= mask - 1;
+        }
+    }
+    return findSSE2(str + i, len - i, needle, needle_len);
+}
+
+#endif
+
+static const LiteralFind kernels[] = {
+    [LiteralKernel_SCALAR] = findScalar,
+#if LITERAL_X86
+    [LiteralKernel_SSE2]   = findSSE2,
+    [LiteralKernel_AVX2]   = findAVX2,
+#endif
+};
+
+static LiteralFind current = NULL;
+static LiteralKernel current_kind;
+
+static bool isSupported(LiteralKernel kernel)
+{
+    switch (kernel) {
+        case LiteralKernel_SCALAR: return true;
+#if LITERAL_X86
+        case LiteralKernel_SSE2: return __builtin_cpu_supports("sse2");
+        case LiteralKernel_AVX2: return __builtin_cpu_supports("avx2");
+#else
+        default: break;
+#endif
+    }
+    return false;
+}
+
+static LiteralFind getKernel(void)
+{
+    if (current == NULL) {
+        if (!Literal_useKernel(LiteralKernel_AVX2) &&
+            !Literal_useKernel(LiteralKernel_SSE2))
+            Literal_useKernel(LiteralKernel_SCALAR);
+    }
+    return current;
+}
+
+bool Literal_useKernel(LiteralKernel kernel)
+{
+    if (!isSupported(kernel))
+        return false;
+    current = kernels[kernel];
+    current_kind = kernel;
+    return true;
+}
+
+LiteralKernel Literal_getKernel(void)
+{
+    getKernel();
+    return current_kind;
+}
+
+const char *Literal_getKernelName(LiteralKernel kernel)
+{
+    switch (kernel) {
+        case LiteralKernel_SCALAR: return "scalar";
+        case LiteralKernel_SSE2:   return "sse2";
+        case LiteralKernel_AVX2:   return "avx2";
+    }
+    return "???";
+}
+
+/* Returns where [needle] first occurs in [str],
+ * or NULL if it doesn't. */
+const char *Literal_find(const char *str, size_t len,
+                         const char *needle, size_t needle_len)
+{
+    return getKernel()(str, len, needle, needle_len);
+}
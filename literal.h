@@ -0,0 +1,24 @@
+#ifndef SNBPAD_LITERAL_H
+#define SNBPAD_LITERAL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Substring search kernels. Blocks of the text
+ * are compared against the first and the last
+ * byte of the needle at once, and only where both
+ * match is the rest of it compared. The best
+ * variant supported by the CPU is picked the first
+ * time one of them is used. */
+
+typedef enum {
+    LiteralKernel_SCALAR,
+    LiteralKernel_SSE2,
+    LiteralKernel_AVX2,
+} LiteralKernel;
+
+const char   *Literal_find(const char *str, size_t len, const char *needle, size_t needle_len);
+bool          Literal_useKernel(LiteralKernel kernel);
+LiteralKernel Literal_getKernel(void);
+const char   *Literal_getKernelName(LiteralKernel kernel);
+#endif
@@ -0,0 +1,115 @@
+#include <string.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "mapguard.h"
+
+// How many files may be mapped at once
+#define MAX_MAPPINGS 64
+
+/* Mapped files that are in use. When one is cut
+ * short by another program, reading the pages past
+ * its new end raises SIGBUS, which is handled by
+ * mapping zeroed pages in their place, so the text
+ * that was lost reads as zeros. */
+static struct {
+    atomic_bool          used;
+    _Atomic(const char*) start;
+    size_t               size;
+    atomic_bool          damaged;
+} mappings[MAX_MAPPINGS];
+
+static pthread_once_t   bus_once = PTHREAD_ONCE_INIT;
+static bool             bus_handled = false;
+static struct sigaction prev_bus;
+static uintptr_t        page_mask;
+
+static void onBus(int sig, siginfo_t *info, void *ctx)
+{
+    char *addr = info->si_addr;
+    for (int i = 0; i < MAX_MAPPINGS; i++) {
+        const char *start = atomic_load(&mappings[i].start);
+        size_t      size  = mappings[i].size;
+        if (start == NULL || addr < start || addr >= start + size)
+            continue;
+        // Any page after one past the end of the
+        // file is past it too.
+        char *page = (char*) ((uintptr_t) addr & ~page_mask);
+        void *zeros = mmap(page, start + size - page, PROT_READ,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (zeros != MAP_FAILED) {
+            atomic_store(&mappings[i].damaged, true);
+            return;
+        }
+    }
+
+    // Not a mapped file, so it's handled as
+    // it would have been without this.
+    if (prev_bus.sa_flags & SA_SIGINFO)
+        prev_bus.sa_sigaction(sig, info, ctx);
+    else if (prev_bus.sa_handler != SIG_DFL && prev_bus.sa_handler != SIG_IGN)
+        prev_bus.sa_handler(sig);
+    else
+        signal(SIGBUS, SIG_DFL); // The access faults again
+}
+
+static void handleBus(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = onBus;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    page_mask = sysconf(_SC_PAGESIZE) - 1;
+    bus_handled = sigaction(SIGBUS, &action, &prev_bus) == 0;
+}
+
+static int findMapping(const char *start)
+{
+    if (start != NULL)
+        for (int i = 0; i < MAX_MAPPINGS; i++)
+            if (atomic_load(&mappings[i].start) == start)
+                return i;
+    return -1;
+}
+
+/* Guards the [size] bytes mapped at [start], which
+ * must come from mmap. Returns false when they
+ * can't be, in which case reading the mapping
+ * isn't safe. */
+bool MapGuard_add(const char *start, size_t size)
+{
+    pthread_once(&bus_once, handleBus);
+    if (!bus_handled)
+        return false;
+
+    for (int i = 0; i < MAX_MAPPINGS; i++)
+        if (!atomic_exchange(&mappings[i].used, true)) {
+            mappings[i].size = size;
+            atomic_store(&mappings[i].damaged, false);
+            atomic_store(&mappings[i].start, start);
+            return true;
+        }
+    return false;
+}
+
+/* Call before unmapping a guarded mapping. */
+void MapGuard_remove(const char *start)
+{
+    int i = findMapping(start);
+    if (i >= 0) {
+        atomic_store(&mappings[i].start, NULL);
+        atomic_store(&mappings[i].used, false);
+    }
+}
+
+/* Tells whether the file mapped at [start] was
+ * cut short since it was guarded. */
+bool MapGuard_isDamaged(const char *start)
+{
+    int i = findMapping(start);
+    return i >= 0 && atomic_load(&mappings[i].damaged);
+}
@@ -0,0 +1,16 @@
+#ifndef SNBPAD_MAPGUARD_H
+#define SNBPAD_MAPGUARD_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Keeps files that are mapped read-only from
+ * killing the process with SIGBUS when they are
+ * truncated by another program while in use. The
+ * bytes past their new end read as zeros instead,
+ * and the mapping is marked as damaged. */
+
+bool MapGuard_add(const char *start, size_t size);
+void MapGuard_remove(const char *start);
+bool MapGuard_isDamaged(const char *start);
+#endif
@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "utils.h"
+#include "matchindex.h"
+
+// Past this many occurrences the search stops
+#define MAX_MATCHES (16 * 1024 * 1024)
+
+// Lists longer than this aren't narrowed down when
+// the needle grows, the buffer is searched again.
+#define MAX_FILTERED (1024 * 1024)
+
+void MatchIndex_init(MatchIndex *index)
+{
+    index->needle_len = 0;
+    index->regex = NULL;
+    index->data = NULL;
+    index->lengths = NULL;
+    index->size = 0;
+    MatchIndex_clear(index);
+}
+
+void MatchIndex_free(MatchIndex *index)
+{
+    free(index->data);
+    free(index->lengths);
+}
+
+/* Forgets the occurrences, for when the text was
+ * replaced, so that it's searched from the start. */
+void MatchIndex_clear(MatchIndex *index)
+{
+    index->head = 0;
+    index->tail = 0;
+    index->scanned = 0;
+    index->full = false;
+}
+
+static bool isSearching(MatchIndex *index)
+{
+    return index->needle_len > 0 || index->regex != NULL;
+}
+
+static bool reserve(MatchIndex *index, size_t num)
+{
+    if (index->size - index->head - index->tail >= num)
+        return true;
+
+    size_t new_size = MAX(MAX(2 * index->size, index->size + num), 512);
+    size_t *new_data = malloc(new_size * sizeof(size_t));
+    uint32_t *new_lengths = malloc(new_size * sizeof(uint32_t));
+    if (new_data == NULL || new_lengths == NULL) {
+        free(new_data);
+        free(new_lengths);
+        return false;
+    }
+
+    if (index->data != NULL) {
+        size_t tail_start = index->size - index->tail;
+        memcpy(new_data, index->data, index->head * sizeof(size_t));
+        memcpy(new_data + new_size - index->tail,
+               index->data + tail_start,
+               index->tail * sizeof(size_t));
+        memcpy(new_lengths, index->lengths, index->head * sizeof(uint32_t));
+        memcpy(new_lengths + new_size - index->tail,
+               index->lengths + tail_start,
+               index->tail * sizeof(uint32_t));
+        free(index->data);
+        free(index->lengths);
+    }
+    index->data = new_data;
+    index->lengths = new_lengths;
+    index->size = new_size;
+    return true;
+}
+
+/* Appends an occurrence before the gap. */
+static bool push(MatchIndex *index, size_t offset, size_t len)
+{
+    if (index->head + index->tail >= MAX_MATCHES || !reserve(index, 1))
+        return false;
+    index->data[index->head] = offset;
+    index->lengths[index->head] = len;
+    index->head++;
+    return true;
+}
+
+/* Moves the last occurrence before the gap after
+ * it. */
+static void pushBack(MatchIndex *index, size_t usage)
+{
+    index->head--;
+    index->tail++;
+    size_t i = index->size - index->tail;
+    index->data[i] = usage - index->data[index->head];
+    index->lengths[i] = index->lengths[index->head];
+}
+
+/* Moves the first occurrence after the gap before
+ * it. */
+static void pushFront(MatchIndex *index, size_t usage)
+{
+    size_t i = index->size - index->tail;
+    index->data[index->head] = usage - index->data[i];
+    index->lengths[index->head] = index->lengths[i];
+    index->head++;
+    index->tail--;
+}
+
+/* Moves the gap after the last occurrence, where
+ * the ones found further on are appended. */
+static void moveGapToEnd(MatchIndex *index, size_t usage)
+{
+    while (index->tail > 0)
+        pushFront(index, usage);
+}
+
+/* Keeps the occurrences that the needle still
+ * matches. */
+static void filter(MatchIndex *index, GapBuffer *buf)
+{
+    moveGapToEnd(index, GapBuffer_getUsage(buf));
+
+    size_t len = index->needle_len;
+    size_t kept = 0;
+    for (size_t i = 0; i < index->head; i++) {
+        size_t offset = index->data[i];
+        if (GapBuffer_find(buf, offset, offset + len, index->needle, len) == offset)
+            index->data[kept++] = offset;
+    }
+    index->head = kept;
+    index->full = false;
+}
+
+/* Changes what's looked for. A needle that extends
+ * the previous one can only occur where that one
+ * did, so those occurrences are just checked. */
+void MatchIndex_setNeedle(MatchIndex *index, GapBuffer *buf, const char *needle, size_t len)
+{
+    len = MIN(len, sizeof(index->needle));
+    bool extends = index->regex == NULL && index->needle_len > 0
+                && len >= index->needle_len
+                && !memcmp(needle, index->needle, index->needle_len)
+                && MatchIndex_getCount(index) <= MAX_FILTERED;
+
+    memcpy(index->needle, needle, len);
+    index->needle_len = len;
+    index->regex = NULL;
+    if (extends)
+        filter(index, buf);
+    else
+        MatchIndex_clear(index);
+}
+
+/* Looks for the matches of [regex] instead, which
+ * stays owned by the caller. NULL stops searching. */
+void MatchIndex_setRegex(MatchIndex *index, Regex *regex)
+{
+    index->needle_len = 0;
+    index->regex = regex;
+    MatchIndex_clear(index);
+}
+
+/* Returns true when there's nothing left to search,
+ * which is also the case once the list is full. */
+bool MatchIndex_isComplete(MatchIndex *index, GapBuffer *buf)
+{
+    return !isSearching(index) || index->full
+        || index->scanned >= GapBuffer_getUsage(buf);
+}
+
+/* Returns the offset following the line of
+ * [offset], or the end of the text. */
+static size_t getNextLine(GapBuffer *buf, size_t offset)
+{
+    size_t usage = GapBuffer_getUsage(buf);
+    if (offset >= usage)
+        return usage;
+    size_t newline = GapBuffer_findNextNewline(buf, offset);
+    return (newline < usage) ? newline + 1 : usage;
+}
+
+/* Appends the occurrences starting in [first, last)
+ * and returns where it stopped, which is before
+ * [last] if the list is full. */
+static size_t search(MatchIndex *index, GapBuffer *buf, size_t first, size_t last)
+{
+    size_t usage = GapBuffer_getUsage(buf);
+    size_t pos = first;
+
+    if (index->regex == NULL) {
+        // Occurrences starting before [last] may end
+        // after it.
+        size_t len = index->needle_len;
+        size_t end = (usage - last > len - 1) ? last + len - 1 : usage;
+        size_t found;
+        while ((found = GapBuffer_find(buf, pos, end, index->needle, len)) != SIZE_MAX) {
+            if (!push(index, found, len))
+                return found;
+            pos = found + 1;
+        }
+        return last;
+    }
+
+    // The matches of the regex don't span lines,
+    // and [last] is always the start of one.
+    size_t found, len;
+    while (Regex_findInBuffer(index->regex, buf, pos, last, &found, &len)) {
+        if (len == 0) {
+            pos = found + 1;
+            continue;
+        }
+        if (!push(index, found, len))
+            return found;
+        pos = found + len;
+    }
+    return last;
+}
+
+/* Searches up to [budget] more bytes of the text,
+ * or to the end of the line it stops in when the
+ * regex is used. Returns true when there's nothing
+ * left to do. */
+bool MatchIndex_scan(MatchIndex *index, GapBuffer *buf, size_t budget)
+{
+    if (MatchIndex_isComplete(index, buf))
+        return true;
+
+    size_t usage = GapBuffer_getUsage(buf);
+    moveGapToEnd(index, usage);
+
+    size_t limit = (usage - index->scanned > budget) ? index->scanned + budget : usage;
+    if (index->regex != NULL && limit < usage)
+        limit = getNextLine(buf, limit - 1);
+
+    size_t stop = search(index, buf, index->scanned, limit);
+    index->scanned = stop;
+    if (stop < limit) {
+        index->full = true;
+        return true;
+    }
+    return limit == usage;
+}
+
+/* Updates the list after [removed] bytes at
+ * [offset] were replaced by [inserted] ones. The
+ * gap is moved to the edit while dropping the
+ * occurrences it touched, and the text around it
+ * is searched again. */
+void MatchIndex_onEdit(MatchIndex *index, GapBuffer *buf, size_t offset,
+                       size_t removed, size_t inserted)
+{
+    if (!isSearching(index))
+        return;
+
+    size_t usage = GapBuffer_getUsage(buf);
+    size_t old_usage = usage - inserted + removed;
+
+    // The occurrences starting in [first, old_last)
+    // are dropped, and those in [first, last) are
+    // looked for again. For a needle, those are the
+    // ones that overlap the edit. For the regex, the
+    // lines it touched.
+    size_t first, last;
+    if (index->regex == NULL) {
+        size_t len = index->needle_len;
+        first = (offset > len - 1) ? offset - (len - 1) : 0;
+        last = offset + inserted;
+    } else {
+        size_t newline = (offset > 0) ? GapBuffer_findPrevNewline(buf, offset) : SIZE_MAX;
+        first = (newline == SIZE_MAX) ? 0 : newline + 1;
+        last = getNextLine(buf, offset + inserted);
+    }
+    size_t old_last = last - inserted + removed;
+
+    while (index->head > 0) {
+        size_t start = index->data[index->head-1];
+        if (start < first)
+            break;
+        if (start >= old_last)
+            pushBack(index, old_usage);
+        else
+            index->head--;
+    }
+    while (index->tail > 0) {
+        size_t start = old_usage - index->data[index->size - index->tail];
+        if (start < first)
+            pushFront(index, old_usage);
+        else if (start < old_last)
+            index->tail--;
+        else
+            break;
+    }
+
+    size_t scanned = index->scanned;
+    if (scanned >= offset)
+        scanned = (scanned >= old_last) ? scanned - removed + inserted : last;
+    index->scanned = scanned;
+
+    // Nothing is looked for where the rest of the
+    // text wasn't searched yet.
+    last = MIN(last, scanned);
+    if (first < last && search(index, buf, first, last) < last)
+        index->full = true;
+}
+
+size_t MatchIndex_getCount(MatchIndex *index)
+{
+    return index->head + index->tail;
+}
+
+/* Returns the offset of the [i]-th occurrence. */
+size_t MatchIndex_get(MatchIndex *index, GapBuffer *buf, size_t i)
+{
+    if (i < index->head)
+        return index->data[i];
+    size_t dist = index->data[index->size - index->tail + (i - index->head)];
+    return GapBuffer_getUsage(buf) - dist;
+}
+
+/* Returns the length of the [i]-th occurrence. */
+size_t MatchIndex_getLength(MatchIndex *index, size_t i)
+{
+    if (index->regex == NULL)
+        return index->needle_len;
+    if (i < index->head)
+        return index->lengths[i];
+    return index->lengths[index->size - index->tail + (i - index->head)];
+}
+
+/* Returns which occurrence is the first one at or
+ * after [offset], or the count if there is none. */
+size_t MatchIndex_search(MatchIndex *index, GapBuffer *buf, size_t offset)
+{
+    size_t lo = 0;
+    size_t hi = MatchIndex_getCount(index);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (MatchIndex_get(index, buf, mid) < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Returns which occurrence is the first one that
+ * ends after [offset], or the count if there is
+ * none. The ends are in the same order as the
+ * starts since the occurrences either have the
+ * same length or don't overlap. */
+size_t MatchIndex_searchEnd(MatchIndex *index, GapBuffer *buf, size_t offset)
+{
+    size_t lo = 0;
+    size_t hi = MatchIndex_getCount(index);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (MatchIndex_get(index, buf, mid) + MatchIndex_getLength(index, mid) <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
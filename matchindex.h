@@ -0,0 +1,59 @@
+#ifndef SNBPAD_MATCHINDEX_H
+#define SNBPAD_MATCHINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "gap.h"
+#include "regex.h"
+
+/* Offsets of the occurrences of a string in a
+ * buffer, laid out as a gap array like the line
+ * index: the ones before the gap are stored as
+ * offsets and the ones after it as their distance
+ * from the end of the text. Moving the gap to an
+ * edit means that what comes after it doesn't need
+ * to be updated, and only the occurrences around
+ * the edit are searched again.
+ *
+ * The buffer is searched a slice at a time, so
+ * that big ones can be searched in the background,
+ * and the occurrences are known up to how far it
+ * got. Occurrences may overlap.
+ *
+ * A regular expression can be looked for instead,
+ * in which case the lengths of the matches are
+ * kept alongside their offsets. It must be compiled
+ * with REGEX_NO_NEWLINE, so that the matches of a
+ * line only depend on that line: they're found one
+ * after the other without overlapping, and a line
+ * that's edited is searched again as a whole.
+ * Empty matches are left out. */
+
+typedef struct {
+    char      needle[GAPBUFFER_MAX_NEEDLE];
+    size_t    needle_len;
+    Regex    *regex;   // Looked for instead of the needle if not NULL
+    size_t   *data;
+    uint32_t *lengths; // Of the matches of the regex, laid out like [data]
+    size_t    size;
+    size_t    head;    // Occurrences before the gap
+    size_t    tail;    // Occurrences after the gap
+    size_t    scanned; // Those starting before this are known
+    bool      full;    // Stopped at the maximum count
+} MatchIndex;
+
+void   MatchIndex_init(MatchIndex *index);
+void   MatchIndex_free(MatchIndex *index);
+void   MatchIndex_clear(MatchIndex *index);
+void   MatchIndex_setNeedle(MatchIndex *index, GapBuffer *buf, const char *needle, size_t len);
+void   MatchIndex_setRegex(MatchIndex *index, Regex *regex);
+bool   MatchIndex_scan(MatchIndex *index, GapBuffer *buf, size_t budget);
+bool   MatchIndex_isComplete(MatchIndex *index, GapBuffer *buf);
+void   MatchIndex_onEdit(MatchIndex *index, GapBuffer *buf, size_t offset, size_t removed, size_t inserted);
+size_t MatchIndex_getCount(MatchIndex *index);
+size_t MatchIndex_get(MatchIndex *index, GapBuffer *buf, size_t i);
+size_t MatchIndex_getLength(MatchIndex *index, size_t i);
+size_t MatchIndex_search(MatchIndex *index, GapBuffer *buf, size_t offset);
+size_t MatchIndex_searchEnd(MatchIndex *index, GapBuffer *buf, size_t offset);
+#endif
@@ -0,0 +1,233 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "utils.h"
+#include "newline.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NEWLINE_X86 1
+#include <immintrin.h>
+#else
+#define NEWLINE_X86 0
+#endif
+
+typedef struct {
+    size_t      (*count)(const char*, size_t);
+    const char *(*find)(const char*, size_t);
+    const char *(*findLast)(const char*, size_t);
+} NewlineKernels;
+
+static size_t countScalar(const char *str, size_t len)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+        if (str[i] == '\n')
+            count++;
+    return count;
+}
+
+static const char *findScalar(const char *str, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (str[i] == '\n')
+            return str + i;
+    return NULL;
+}
+
+static const char *findLastScalar(const char *str, size_t len)
+{
+    while (len > 0) {
+        len--;
+        if (str[len] == '\n')
+            return str + len;
+    }
+    return NULL;
+}
+
+#if NEWLINE_X86
+
+static size_t countSSE2(const char *str, size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t count = 0;
+    size_t i = 0;
+    while (len - i >= 16) {
+
+        // Matches are accumulated in 8 bit lanes
+        // (a match is -1, so subtracting it adds 1)
+        // which overflow after 255 blocks.
+        size_t blocks = MIN((len - i) / 16, 255);
+        __m128i acc = zero;
+        for (size_t b = 0; b < blocks; b++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (str + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += (size_t) _mm_cvtsi128_si32(sums)
+               + (size_t) _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+    }
+    return count + countScalar(str + i, len - i);
+}
+
+static const char *findSSE2(const char *str, size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    size_t i = 0;
+    for (; len - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (str + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask != 0)
+            return str + i + __builtin_ctz(mask);
+    }
+    return findScalar(str + i, len - i);
+}
+
+static const char *findLastSSE2(const char *str, size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    size_t i = len;
+    while (i >= 16) {
+        i -= 16;
+        __m128i v = _mm_loadu_si128((const __m128i*) (str + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask != 0)
+            return str + i + 31 - __builtin_clz(mask);
+    }
+    return findLastScalar(str, i);
+}
+
+__attribute__((target("avx2")))
+static size_t countAVX2(const char *str, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t count = 0;
+    size_t i = 0;
+    while (len - i >= 32) {
+        size_t blocks = MIN((len - i) / 32, 255);
+        __m256i acc = zero;
+        for (size_t b = 0; b < blocks; b++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (str + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+        }
+        __m256i sums = _mm256_sad_epu8(acc, zero);
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums),
+                                     _mm256_extracti128_si256(sums, 1));
+        count += (size_t) _mm_cvtsi128_si32(half)
+               + (size_t) _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+    }
+    return count + countSSE2(str + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const char *findAVX2(const char *str, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+
+    size_t i = 0;
+    for (; len - i >= 32; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (str + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask != 0)
+            return str + i + __builtin_ctz(mask);
+    }
+    return findSSE2(str + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const char *findLastAVX2(const char *str, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+
+    size_t i = len;
+    while (i >= 32) {
+        i -= 32;
+        __m256i v = _mm256_loadu_si256((const __m256i*) (str + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask != 0)
+            return str + i + 31 - __builtin_clz(mask);
+    }
+    return findLastSSE2(str, i);
+}
+
+#endif
+
+static const NewlineKernels kernels[] = {
+    [NewlineKernel_SCALAR] = { countScalar, findScalar, findLastScalar },
+#if NEWLINE_X86
+    [NewlineKernel_SSE2]   = { countSSE2,   findSSE2,   findLastSSE2   },
+    [NewlineKernel_AVX2]   = { countAVX2,   findAVX2,   findLastAVX2   },
+#endif
+};
+
+// Picked on first use by whichever thread gets
+// there, which all pick the same one.
+static _Atomic(const NewlineKernels*) current = NULL;
+
+static bool isSupported(NewlineKernel kernel)
+{
+    switch (kernel) {
+        case NewlineKernel_SCALAR: return true;
+#if NEWLINE_X86
+        case NewlineKernel_SSE2: return __builtin_cpu_supports("sse2");
+        case NewlineKernel_AVX2: return __builtin_cpu_supports("avx2");
+#else
+        default: break;
+#endif
+    }
+    return false;
+}
+
+static const NewlineKernels *getKernels(void)
+{
+    const NewlineKernels *k = atomic_load_explicit(&current, memory_order_acquire);
+    if (k == NULL) {
+        if (!Newline_useKernel(NewlineKernel_AVX2) &&
+            !Newline_useKernel(NewlineKernel_SSE2))
+            Newline_useKernel(NewlineKernel_SCALAR);
+        k = atomic_load_explicit(&current, memory_order_acquire);
+    }
+    return k;
+}
+
+bool Newline_useKernel(NewlineKernel kernel)
+{
+    if (!isSupported(kernel))
+        return false;
+    atomic_store_explicit(&current, &kernels[kernel], memory_order_release);
+    return true;
+}
+
+NewlineKernel Newline_getKernel(void)
+{
+    return (NewlineKernel) (getKernels() - kernels);
+}
+
+const char *Newline_getKernelName(NewlineKernel kernel)
+{
+    switch (kernel) {
+        case NewlineKernel_SCALAR: return "scalar";
+        case NewlineKernel_SSE2:   return "sse2";
+        case NewlineKernel_AVX2:   return "avx2";
+    }
+    return "???";
+}
+
+size_t Newline_count(const char *str, size_t len)
+{
+    return getKernels()->count(str, len);
+}
+
+const char *Newline_find(const char *str, size_t len)
+{
+    return getKernels()->find(str, len);
+}
+
+const char *Newline_findLast(const char *str, size_t len)
+{
+    return getKernels()->findLast(str, len);
+}
@@ -0,0 +1,23 @@
+#ifndef SNBPAD_NEWLINE_H
+#define SNBPAD_NEWLINE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Newline scanning kernels. The best variant
+ * supported by the CPU is picked the first time
+ * one of them is used. */
+
+typedef enum {
+    NewlineKernel_SCALAR,
+    NewlineKernel_SSE2,
+    NewlineKernel_AVX2,
+} NewlineKernel;
+
+size_t      Newline_count(const char *str, size_t len);
+const char *Newline_find(const char *str, size_t len);
+const char *Newline_findLast(const char *str, size_t len);
+bool        Newline_useKernel(NewlineKernel kernel);
+NewlineKernel Newline_getKernel(void);
+const char   *Newline_getKernelName(NewlineKernel kernel);
+#endif
\ No newline at end of file
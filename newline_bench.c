@@ -0,0 +1,110 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "newline.h"
+
+// gcc newline_bench.c newline.c -o newline_bench -O2 -Wall -Wextra
+//
+// Measures the throughput of the newline kernels
+// over a buffer of text with lines of [line_len]
+// bytes, which can be passed as first argument.
+// A line length of 0 means no newlines at all.
+
+#define BUFFER_SIZE (256 * 1024 * 1024)
+#define REPEAT 4
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double toGBps(double seconds)
+{
+    return (double) BUFFER_SIZE * REPEAT / seconds / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    size_t line_len = 80;
+    if (argc > 1)
+        line_len = strtoul(argv[1], NULL, 10);
+
+    char *buffer = malloc(BUFFER_SIZE);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    for (size_t i = 0; i < BUFFER_SIZE; i++) {
+        if (line_len > 0 && i % line_len == line_len-1)
+            buffer[i] = '\n';
+        else
+            buffer[i] = 'a' + i % 26;
+    }
+
+    fprintf(stdout, "%zu MB, line length %zu\n",
+            (size_t) BUFFER_SIZE >> 20, line_len);
+    fprintf(stdout, "%-8s %12s %12s %12s\n", "kernel",
+            "count GB/s", "find GB/s", "rfind GB/s");
+
+    NewlineKernel list[] = {
+        NewlineKernel_SCALAR,
+        NewlineKernel_SSE2,
+        NewlineKernel_AVX2,
+    };
+    size_t expected = (line_len == 0) ? 0 : BUFFER_SIZE / line_len;
+
+    for (size_t k = 0; k < sizeof(list)/sizeof(list[0]); k++) {
+
+        if (!Newline_useKernel(list[k]))
+            continue;
+
+        size_t counted = 0;
+        double start = now();
+        for (int r = 0; r < REPEAT; r++)
+            counted += Newline_count(buffer, BUFFER_SIZE);
+        double t_count = now() - start;
+
+        // Visit every newline front to back, like
+        // the line iterator does.
+        size_t found = 0;
+        start = now();
+        for (int r = 0; r < REPEAT; r++) {
+            const char *p = buffer;
+            const char *end = buffer + BUFFER_SIZE;
+            while ((p = Newline_find(p, end - p)) != NULL) {
+                found++;
+                p++;
+            }
+        }
+        double t_find = now() - start;
+
+        size_t found_back = 0;
+        start = now();
+        for (int r = 0; r < REPEAT; r++) {
+            const char *p;
+            size_t len = BUFFER_SIZE;
+            while ((p = Newline_findLast(buffer, len)) != NULL) {
+                found_back++;
+                len = p - buffer;
+            }
+        }
+        double t_rfind = now() - start;
+
+        if (counted != expected * REPEAT || found != counted || found_back != counted) {
+            fprintf(stderr, "Error: Kernel %s gave wrong results\n",
+                    Newline_getKernelName(list[k]));
+            free(buffer);
+            return -1;
+        }
+
+        fprintf(stdout, "%-8s %12.2f %12.2f %12.2f\n",
+                Newline_getKernelName(list[k]),
+                toGBps(t_count), toGBps(t_find), toGBps(t_rfind));
+    }
+
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,1135 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "piece.h"
+#include "mapguard.h"
+#include "utils.h"
+#include "newline.h"
+#include "xutf8.h"
+
+// Pieces never get longer than this, so that
+// scanning a single one to resolve a line or
+// an offset is bounded.
+#define PIECE_MAX (4 * 1024)
+
+#define PIECES_PER_BATCH 256
+#define ADD_BLOCK_SIZE (64 * 1024)
+
+// Neighbouring pieces shorter than this together
+// are copied into a single one when a list of
+// edits is applied, so that typing at many places
+// at once doesn't leave a piece per keystroke.
+#define PIECE_SMALL 64
+
+// Lists of edits with more than one for this many
+// pieces are applied by rebuilding the tree.
+#define REBUILD_RATIO 16
+
+// Newlines of a mapped file are only counted up
+// front in this many bytes at its start. The rest
+// is counted in the background, and estimated from
+// these until then.
+#define COUNTED_PREFIX (64 * 1024)
+
+struct Piece {
+    Piece *left;
+    Piece *right;
+    uint32_t priority;
+    const char *str;
+    size_t len;
+    size_t newlines;
+    bool   estimated; // [newlines] is a guess, see LineCounter
+    size_t total_len;       // Of the whole subtree
+    size_t total_newlines;  // Of the whole subtree
+    size_t total_estimated; // Pieces of the whole subtree
+};
+
+/* Newline counts of the pieces of a mapped file,
+ * found by a thread reading it from the start, so
+ * that opening it doesn't wait for all of it to be
+ * read. The pieces it didn't get to yet are the
+ * [PIECE_MAX] bytes at a multiple of [PIECE_MAX] in
+ * the file, since cutting one counts its parts,
+ * and they stay in the order of the file. */
+struct LineCounter {
+    pthread_t   thread;
+    const char *data;
+    size_t      size;
+    uint16_t   *counts; // Per piece of the file
+    atomic_size_t done; // Pieces with a count
+    atomic_bool   stop;
+};
+
+struct PieceBatch {
+    PieceBatch *prev;
+    Piece       list[PIECES_PER_BATCH];
+};
+
+struct AddBlock {
+    AddBlock *prev;
+    size_t    size;
+    size_t    used;
+    char      data[];
+};
+
+static uint32_t randomPriority(PieceTable *pt)
+{
+    // xorshift32
+    uint32_t x = pt->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pt->seed = x;
+    return x;
+}
+
+static size_t totalLen(Piece *node)
+{
+    return node == NULL ? 0 : node->total_len;
+}
+
+static size_t totalNewlines(Piece *node)
+{
+    return node == NULL ? 0 : node->total_newlines;
+}
+
+static size_t totalEstimated(Piece *node)
+{
+    return node == NULL ? 0 : node->total_estimated;
+}
+
+static void update(Piece *node)
+{
+    node->total_len = totalLen(node->left)
+                    + totalLen(node->right)
+                    + node->len;
+    node->total_newlines = totalNewlines(node->left)
+                         + totalNewlines(node->right)
+                         + node->newlines;
+    node->total_estimated = totalEstimated(node->left)
+                          + totalEstimated(node->right)
+                          + node->estimated;
+}
+
+static bool reservePieces(PieceTable *pt, size_t num)
+{
+    size_t avail = 0;
+    for (Piece *p = pt->free_list; p != NULL && avail < num; p = p->left)
+        avail++;
+
+    while (avail < num) {
+        PieceBatch *batch = malloc(sizeof(PieceBatch));
+        if (batch == NULL)
+            return false;
+        for (size_t i = 0; i < PIECES_PER_BATCH; i++) {
+            batch->list[i].left = pt->free_list;
+            pt->free_list = &batch->list[i];
+        }
+        batch->prev = pt->batches;
+        pt->batches = batch;
+        avail += PIECES_PER_BATCH;
+    }
+    return true;
+}
+
+/* Only call after a [reservePieces] that
+ * guarantees a free slot. */
+static Piece *getSlot(PieceTable *pt)
+{
+    Piece *piece = pt->free_list;
+    assert(piece != NULL);
+    pt->free_list = piece->left;
+    pt->num_pieces++;
+    memset(piece, 0, sizeof(Piece));
+    return piece;
+}
+
+static void freeSubtree(PieceTable *pt, Piece *node)
+{
+    if (node != NULL) {
+        freeSubtree(pt, node->left);
+        freeSubtree(pt, node->right);
+        node->left = pt->free_list;
+        pt->free_list = node;
+        pt->num_pieces--;
+    }
+}
+
+/* Makes sure that the next [len] bytes added to
+ * the add buffer fit without allocating. */
+static bool reserveText(PieceTable *pt, size_t len)
+{
+    AddBlock *block = pt->blocks;
+    if (block == NULL || block->size - block->used < len) {
+        size_t size = MAX(ADD_BLOCK_SIZE, len);
+        block = malloc(sizeof(AddBlock) + size);
+        if (block == NULL)
+            return false;
+        block->size = size;
+        block->used = 0;
+        block->prev = pt->blocks;
+        pt->blocks = block;
+    }
+    return true;
+}
+
+/* Reserves [len] bytes at the end of the add
+ * buffer and returns where they are. */
+static char *allocText(PieceTable *pt, size_t len)
+{
+    if (!reserveText(pt, len))
+        return NULL;
+    AddBlock *block = pt->blocks;
+    char *dst = block->data + block->used;
+    block->used += len;
+    return dst;
+}
+
+/* Appends [str] to the add buffer and returns
+ * the location where it was stored. */
+static const char *appendText(PieceTable *pt, const char *str, size_t len)
+{
+    char *dst = allocText(pt, len);
+    if (dst == NULL)
+        return NULL;
+    memcpy(dst, str, len);
+    return dst;
+}
+
+static size_t countPieces(size_t len)
+{
+    return (len + PIECE_MAX - 1) / PIECE_MAX;
+}
+
+/* Builds a balanced subtree over [str] cut in
+ * pieces of [PIECE_MAX] bytes. Priorities only
+ * depend on the depth so that the result is a
+ * valid treap. The newlines of the pieces past
+ * [counted] bytes aren't counted, they are given
+ * [estimate] per [PIECE_MAX] bytes instead. */
+static Piece *buildTree(PieceTable *pt, const char *str,
+                        size_t lo, size_t hi, size_t len,
+                        size_t counted, size_t estimate,
+                        size_t depth)
+{
+    if (lo == hi)
+        return NULL;
+
+    size_t mid = lo + (hi - lo) / 2;
+    size_t off = mid * PIECE_MAX;
+
+    Piece *node = getSlot(pt);
+    node->priority = ((uint32_t) (31 - MIN(depth, 31)) << 27)
+                   | (randomPriority(pt) >> 5);
+    node->str = str + off;
+    node->len = MIN(PIECE_MAX, len - off);
+    if (off < counted)
+        node->newlines = Newline_count(node->str, node->len);
+    else {
+        node->newlines = estimate * node->len / PIECE_MAX;
+        node->estimated = true;
+    }
+    node->left  = buildTree(pt, str, lo, mid, len, counted, estimate, depth+1);
+    node->right = buildTree(pt, str, mid+1, hi, len, counted, estimate, depth+1);
+    update(node);
+    return node;
+}
+
+static Piece *merge(Piece *l, Piece *r)
+{
+    if (l == NULL) return r;
+    if (r == NULL) return l;
+    if (l->priority > r->priority) {
+        l->right = merge(l->right, r);
+        update(l);
+        return l;
+    } else {
+        r->left = merge(l, r->left);
+        update(r);
+        return r;
+    }
+}
+
+/* Splits [node] in the subtrees holding the
+ * text before and after [offset]. When the
+ * offset falls inside a piece, that piece is
+ * cut in two, which takes one free slot. */
+static void split(PieceTable *pt, Piece *node, size_t offset,
+                  Piece **l, Piece **r)
+{
+    if (node == NULL) {
+        *l = NULL;
+        *r = NULL;
+        return;
+    }
+
+    size_t left = totalLen(node->left);
+    if (offset <= left) {
+        split(pt, node->left, offset, l, &node->left);
+        update(node);
+        *r = node;
+    } else if (offset >= left + node->len) {
+        split(pt, node->right, offset - left - node->len, &node->right, r);
+        update(node);
+        *l = node;
+    } else {
+        size_t k = offset - left;
+        Piece *tail = getSlot(pt);
+        tail->priority = node->priority;
+        tail->str = node->str + k;
+        tail->len = node->len - k;
+        tail->newlines = Newline_count(tail->str, tail->len);
+        tail->right = node->right;
+        node->len = k;
+        if (node->estimated)
+            node->newlines = Newline_count(node->str, k);
+        else
+            node->newlines -= tail->newlines;
+        node->estimated = false;
+        node->right = NULL;
+        update(tail);
+        update(node);
+        *l = node;
+        *r = tail;
+    }
+}
+
+/* Grows the piece that ends at [offset] by [len]
+ * bytes if the new text was appended right after
+ * it in the add buffer. This is what keeps typing
+ * from creating one piece per keystroke. */
+static bool extendPiece(Piece *node, size_t offset,
+                        const char *str, size_t len,
+                        size_t newlines)
+{
+    if (node == NULL)
+        return false;
+
+    bool done;
+    size_t left = totalLen(node->left);
+    if (offset <= left)
+        done = extendPiece(node->left, offset, str, len, newlines);
+    else if (offset == left + node->len) {
+        done = node->str + node->len == str
+            && node->len + len <= PIECE_MAX
+            && !node->estimated;
+        if (done) {
+            node->len += len;
+            node->newlines += newlines;
+        }
+    } else if (offset < left + node->len)
+        done = false;
+    else
+        done = extendPiece(node->right, offset - left - node->len,
+                           str, len, newlines);
+
+    if (done) {
+        node->total_len += len;
+        node->total_newlines += newlines;
+    }
+    return done;
+}
+
+static size_t copyInto(PieceTable *pt, size_t offset,
+                       char *dst, size_t len)
+{
+    size_t copied = 0;
+    while (copied < len) {
+        size_t chunk_len;
+        const char *chunk = PieceTable_getChunk(pt, offset + copied, &chunk_len);
+        if (chunk == NULL)
+            break;
+        size_t n = MIN(chunk_len, len - copied);
+        memcpy(dst + copied, chunk, n);
+        copied += n;
+    }
+    return copied;
+}
+
+/* Only counts the newlines of the first [counted]
+ * bytes, which should be a multiple of [PIECE_MAX].
+ * The other pieces are assumed to be like those. */
+static bool buildOriginal(PieceTable *pt, char *data, size_t size, size_t counted)
+{
+    size_t num = countPieces(size);
+    if (!reservePieces(pt, num)) {
+        PieceTable_free(pt);
+        PieceTable_initEmpty(pt);
+        return false;
+    }
+    size_t estimate = 0;
+    if (counted > 0 && counted < size)
+        estimate = Newline_count(data, counted) * PIECE_MAX / counted;
+    pt->original = data;
+    pt->original_size = size;
+    pt->root = buildTree(pt, data, 0, num, size, counted, estimate, 0);
+    return true;
+}
+
+/* Counts the newlines of the estimated pieces of
+ * the subtree. */
+static void countSubtree(Piece *node)
+{
+    if (node == NULL || node->total_estimated == 0)
+        return;
+    countSubtree(node->left);
+    countSubtree(node->right);
+    if (node->estimated) {
+        node->newlines = Newline_count(node->str, node->len);
+        node->estimated = false;
+    }
+    update(node);
+}
+
+/* Counts the newlines of the estimated piece that
+ * holds [offset], fixing the totals above it. */
+static void countPieceAt(Piece *node, size_t offset)
+{
+    size_t left = totalLen(node->left);
+    if (offset < left)
+        countPieceAt(node->left, offset);
+    else if (offset >= left + node->len)
+        countPieceAt(node->right, offset - left - node->len);
+    else {
+        node->newlines = Newline_count(node->str, node->len);
+        node->estimated = false;
+    }
+    update(node);
+}
+
+static void *runCounter(void *arg)
+{
+    LineCounter *counter = arg;
+    size_t num = countPieces(counter->size);
+    for (size_t i = atomic_load(&counter->done); i < num; i++) {
+        if (atomic_load(&counter->stop))
+            break;
+        size_t off = i * PIECE_MAX;
+        counter->counts[i] = Newline_count(counter->data + off, MIN(PIECE_MAX, counter->size - off));
+        atomic_store(&counter->done, i + 1);
+    }
+    return NULL;
+}
+
+/* Starts counting the newlines of the pieces that
+ * only have an estimate, or counts them right away
+ * if no thread can do it. */
+static void startCounter(PieceTable *pt)
+{
+    if (totalEstimated(pt->root) == 0)
+        return;
+
+    LineCounter *counter = malloc(sizeof(LineCounter));
+    uint16_t *counts = malloc(countPieces(pt->original_size) * sizeof(uint16_t));
+    if (counter != NULL && counts != NULL) {
+        counter->data = pt->original;
+        counter->size = pt->original_size;
+        counter->counts = counts;
+        atomic_init(&counter->done, COUNTED_PREFIX / PIECE_MAX);
+        atomic_init(&counter->stop, false);
+        if (pthread_create(&counter->thread, NULL, runCounter, counter) == 0) {
+            pt->counter = counter;
+            return;
+        }
+    }
+    free(counter);
+    free(counts);
+    countSubtree(pt->root);
+}
+
+static void stopCounter(PieceTable *pt)
+{
+    LineCounter *counter = pt->counter;
+    if (counter != NULL) {
+        atomic_store(&counter->stop, true);
+        pthread_join(counter->thread, NULL);
+        free(counter->counts);
+        free(counter);
+        pt->counter = NULL;
+    }
+}
+
+/* Gives the estimated pieces of the subtree the
+ * counts found for them so far, in order. Returns
+ * false once it gets to one that wasn't counted. */
+static bool takeCounts(LineCounter *counter, size_t done, Piece *node)
+{
+    if (node == NULL || node->total_estimated == 0)
+        return true;
+
+    bool more = takeCounts(counter, done, node->left);
+    if (more && node->estimated) {
+        size_t i = (node->str - counter->data) / PIECE_MAX;
+        if (i < done) {
+            node->newlines = counter->counts[i];
+            node->estimated = false;
+        } else
+            more = false;
+    }
+    if (more)
+        more = takeCounts(counter, done, node->right);
+    update(node);
+    return more;
+}
+
+/* Updates the pieces with the newlines counted in
+ * the background so far. Returns true once they
+ * all have their exact count, until then the line
+ * count of the table is an estimate. */
+bool PieceTable_countLines(PieceTable *pt)
+{
+    LineCounter *counter = pt->counter;
+    if (counter == NULL)
+        return true;
+
+    takeCounts(counter, atomic_load(&counter->done), pt->root);
+    if (totalEstimated(pt->root) > 0)
+        return false;
+    stopCounter(pt);
+    return true;
+}
+
+void PieceTable_initEmpty(PieceTable *pt)
+{
+    pt->root = NULL;
+    pt->free_list = NULL;
+    pt->batches = NULL;
+    pt->num_pieces = 0;
+    pt->counter = NULL;
+    pt->blocks = NULL;
+    pt->original = NULL;
+    pt->original_size = 0;
+    pt->mapped = false;
+    pt->cursor = 0;
+    pt->seed = 2463534242;
+}
+
+bool PieceTable_initFile(PieceTable *pt, const char *file)
+{
+    PieceTable_initEmpty(pt);
+
+    FILE *stream = fopen(file, "rb");
+    if (stream == NULL)
+        return false;
+
+    struct stat info;
+    if (fstat(fileno(stream), &info) || info.st_size < 0) {
+        fclose(stream);
+        return false;
+    }
+    size_t size = info.st_size;
+
+    // The whole file is read with a single call
+    // in a buffer of the exact size, which then
+    // becomes the backing store of the pieces.
+    char *data = NULL;
+    if (size > 0) {
+        data = malloc(size);
+        if (data == NULL || fread(data, 1, size, stream) != size) {
+            free(data);
+            fclose(stream);
+            return false;
+        }
+    }
+    fclose(stream);
+
+    if (!buildOriginal(pt, data, size, size)) {
+        free(data);
+        return false;
+    }
+    return true;
+}
+
+/* Like [PieceTable_initFile], but the file is
+ * mapped read-only instead of being read, and
+ * its newlines are counted in the background
+ * past the first pieces. Edited text always
+ * lives in the add buffer, therefore the mapping
+ * is never written to. */
+bool PieceTable_mapFile(PieceTable *pt, const char *file)
+{
+    PieceTable_initEmpty(pt);
+
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) || info.st_size < 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = info.st_size;
+
+    char *data = NULL;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        if (!MapGuard_add(data, size)) {
+            // Not safe to use, so it's read instead
+            munmap(data, size);
+            close(fd);
+            return PieceTable_initFile(pt, file);
+        }
+    }
+    close(fd); // The mapping outlives the descriptor
+
+    if (!buildOriginal(pt, data, size, COUNTED_PREFIX)) {
+        if (data != NULL) {
+            MapGuard_remove(data);
+            munmap(data, size);
+        }
+        return false;
+    }
+    pt->mapped = true;
+    startCounter(pt);
+    return true;
+}
+
+/* Makes the table refer to the [size] bytes of
+ * [data], which must come from malloc and is then
+ * owned by the table, even if this fails. */
+bool PieceTable_initBuffer(PieceTable *pt, char *data, size_t size)
+{
+    PieceTable_initEmpty(pt);
+    if (!buildOriginal(pt, data, size, size)) {
+        free(data);
+        return false;
+    }
+    return true;
+}
+
+void PieceTable_free(PieceTable *pt)
+{
+    stopCounter(pt);
+
+    PieceBatch *batch = pt->batches;
+    while (batch != NULL) {
+        PieceBatch *prev = batch->prev;
+        free(batch);
+        batch = prev;
+    }
+
+    AddBlock *block = pt->blocks;
+    while (block != NULL) {
+        AddBlock *prev = block->prev;
+        free(block);
+        block = prev;
+    }
+
+    if (pt->mapped) {
+        if (pt->original != NULL) {
+            MapGuard_remove(pt->original);
+            munmap(pt->original, pt->original_size);
+        }
+    } else
+        free(pt->original);
+}
+
+/* Tells whether the mapped file was cut short
+ * while the table used it. */
+bool PieceTable_isDamaged(PieceTable *pt)
+{
+    return pt->mapped && MapGuard_isDamaged(pt->original);
+}
+
+size_t PieceTable_getUsage(PieceTable *pt)
+{
+    return totalLen(pt->root);
+}
+
+size_t PieceTable_getLineno(PieceTable *pt)
+{
+    return totalNewlines(pt->root) + 1;
+}
+
+size_t PieceTable_lineToOffset(PieceTable *pt, size_t line)
+{
+    if (line == 0)
+        return 0;
+    if (line >= PieceTable_getLineno(pt))
+        return PieceTable_getUsage(pt);
+
+    // Look for the newline that ends the
+    // previous line.
+    size_t k = line - 1;
+    size_t base = 0;
+    Piece *node = pt->root;
+    while (node != NULL) {
+        size_t left_newlines = totalNewlines(node->left);
+        if (k < left_newlines) {
+            node = node->left;
+            continue;
+        }
+        k -= left_newlines;
+        base += totalLen(node->left);
+
+        if (k < node->newlines) {
+            if (node->estimated) {
+                // The line may be in another piece
+                // once this one is counted.
+                countPieceAt(pt->root, base);
+                return PieceTable_lineToOffset(pt, line);
+            }
+            const char *p = node->str;
+            const char *end = node->str + node->len;
+            while ((p = Newline_find(p, end - p)) != NULL) {
+                if (k == 0)
+                    return base + (p - node->str) + 1;
+                k--;
+                p++;
+            }
+            assert(0);
+        }
+        k -= node->newlines;
+        base += node->len;
+        node = node->right;
+    }
+    assert(0);
+    return PieceTable_getUsage(pt);
+}
+
+static size_t findLine(PieceTable *pt, size_t offset)
+{
+    size_t pos = offset;
+    size_t count = 0;
+    Piece *node = pt->root;
+    while (node != NULL) {
+        size_t left = totalLen(node->left);
+        if (offset < left) {
+            node = node->left;
+            continue;
+        }
+        count  += totalNewlines(node->left);
+        offset -= left;
+
+        if (offset <= node->len) {
+            if (node->estimated && offset > 0) {
+                countPieceAt(pt->root, pos - offset);
+                return findLine(pt, pos);
+            }
+            return count + Newline_count(node->str, offset);
+        }
+
+        count  += node->newlines;
+        offset -= node->len;
+        node = node->right;
+    }
+    return count;
+}
+
+size_t PieceTable_offsetToLine(PieceTable *pt, size_t offset)
+{
+    // The line may start in a piece that is still
+    // estimated, which is then counted so that the
+    // line maps back to a start before [offset].
+    size_t line = findLine(pt, offset);
+    size_t estimated = totalEstimated(pt->root);
+    while (estimated > 0) {
+        PieceTable_lineToOffset(pt, line);
+        if (totalEstimated(pt->root) == estimated)
+            break;
+        line = findLine(pt, offset);
+        estimated = totalEstimated(pt->root);
+    }
+    return line;
+}
+
+const char *PieceTable_getChunk(PieceTable *pt, size_t offset, size_t *len)
+{
+    Piece *node = pt->root;
+    while (node != NULL) {
+        size_t left = totalLen(node->left);
+        if (offset < left)
+            node = node->left;
+        else if (offset < left + node->len) {
+            size_t k = offset - left;
+            *len = node->len - k;
+            return node->str + k;
+        } else {
+            offset -= left + node->len;
+            node = node->right;
+        }
+    }
+    *len = 0;
+    return NULL;
+}
+
+const char *PieceTable_getChunkBefore(PieceTable *pt, size_t offset, size_t *len)
+{
+    // Look for the piece holding the byte
+    // that comes before [offset].
+    Piece *node = pt->root;
+    size_t k = offset - 1;
+    while (offset > 0 && node != NULL) {
+        size_t left = totalLen(node->left);
+        if (k < left)
+            node = node->left;
+        else if (k < left + node->len) {
+            *len = k - left + 1;
+            return node->str;
+        } else {
+            k -= left + node->len;
+            node = node->right;
+        }
+    }
+    *len = 0;
+    return NULL;
+}
+
+void PieceTable_setCursor(PieceTable *pt, size_t cur)
+{
+    pt->cursor = MIN(cur, PieceTable_getUsage(pt));
+}
+
+bool PieceTable_insertString(PieceTable *pt, const char *str, size_t len)
+{
+    if (len == 0)
+        return true;
+
+    size_t num = countPieces(len);
+    if (!reservePieces(pt, num + 1))
+        return false;
+
+    const char *copy = appendText(pt, str, len);
+    if (copy == NULL)
+        return false;
+
+    if (num > 1 || !extendPiece(pt->root, pt->cursor, copy, len, Newline_count(str, len))) {
+        Piece *l, *r;
+        split(pt, pt->root, pt->cursor, &l, &r);
+        Piece *m = buildTree(pt, copy, 0, num, len, len, 0, 0);
+        pt->root = merge(merge(l, m), r);
+    }
+    pt->cursor += len;
+    return true;
+}
+
+bool PieceTable_moveCursorBackward(PieceTable *pt)
+{
+    if (pt->cursor == 0)
+        return false;
+
+    char window[4];
+    size_t n = MIN(pt->cursor, sizeof(window));
+    copyInto(pt, pt->cursor - n, window, n);
+
+    int prev = xutf8_prev(window, n, n, NULL);
+    if (prev < 0)
+        prev = n - 1;
+    pt->cursor -= n - prev;
+    return true;
+}
+
+bool PieceTable_moveCursorForward(PieceTable *pt)
+{
+    size_t usage = PieceTable_getUsage(pt);
+    if (pt->cursor == usage)
+        return false;
+
+    char window[4];
+    size_t n = copyInto(pt, pt->cursor, window, MIN(usage - pt->cursor, sizeof(window)));
+
+    int k = xutf8_sequence_to_utf32_codepoint(window, n, NULL);
+    if (k < 1)
+        k = 1;
+    pt->cursor += k;
+    return true;
+}
+
+bool PieceTable_removeBackwards(PieceTable *pt)
+{
+    size_t end = pt->cursor;
+    if (!PieceTable_moveCursorBackward(pt))
+        return false;
+    PieceTable_removeRangeAndSetCursor(pt, pt->cursor, end - pt->cursor);
+    return true;
+}
+
+void PieceTable_removeRangeAndSetCursor(PieceTable *pt,
+                                        size_t offset,
+                                        size_t length)
+{
+    size_t usage = PieceTable_getUsage(pt);
+    if (offset > usage)
+        offset = usage;
+    if (length > usage - offset)
+        length = usage - offset;
+
+    // Both splits may cut a piece in two. If
+    // there's no memory for it, the text is
+    // left untouched.
+    if (length > 0 && reservePieces(pt, 2)) {
+        Piece *a, *b, *c;
+        split(pt, pt->root, offset, &a, &b);
+        split(pt, b, length, &b, &c);
+        freeSubtree(pt, b);
+        pt->root = merge(a, c);
+    }
+    pt->cursor = offset;
+}
+
+typedef struct {
+    const char *str;
+    size_t len;
+    size_t newlines;
+    bool estimated;
+} Segment;
+
+/* State of the walk that rebuilds the pieces with
+ * a list of edits applied. */
+typedef struct {
+    PieceTable *pt;
+    const PieceTableEdit *edits;
+    size_t   count;
+    size_t   next;    // First edit that isn't applied yet
+    bool     started; // The text of [next] was added
+    size_t   pos;     // In the text before the edits
+    Segment *segs;
+    size_t   num_segs;
+    size_t   max_segs;
+    bool     failed;
+} Rebuild;
+
+/* Appends a slice to the new list of pieces. Text
+ * that isn't [stable] doesn't live in the table
+ * yet and is copied in the add buffer. When the
+ * slice and the one before it are both small, they
+ * are copied together in a single piece. Pieces of
+ * the original with [estimated] newlines are kept
+ * whole. */
+static void pushSegment(Rebuild *rb, const char *str, size_t len,
+                        size_t newlines, bool estimated, bool stable)
+{
+    if (len == 0 || rb->failed)
+        return;
+
+    PieceTable *pt = rb->pt;
+    Segment *last = (rb->num_segs > 0) ? &rb->segs[rb->num_segs-1] : NULL;
+    if (last != NULL && !last->estimated && !estimated
+        && last->len + len <= PIECE_MAX) {
+        AddBlock *block = pt->blocks;
+        bool at_tail = block != NULL
+                    && last->str + last->len == block->data + block->used
+                    && block->size - block->used >= len;
+        char *dst = NULL;
+        if (stable && last->str + last->len == str) {
+            // Already contiguous
+        } else if (!stable && at_tail) {
+            dst = allocText(pt, len);
+            memcpy(dst, str, len);
+        } else if (last->len + len <= PIECE_SMALL) {
+            dst = allocText(pt, last->len + len);
+            if (dst == NULL) {
+                rb->failed = true;
+                return;
+            }
+            memcpy(dst, last->str, last->len);
+            memcpy(dst + last->len, str, len);
+            last->str = dst;
+        } else
+            last = NULL;
+
+        if (last != NULL) {
+            last->len += len;
+            last->newlines += newlines;
+            return;
+        }
+    }
+
+    if (!stable && (str = appendText(pt, str, len)) == NULL) {
+        rb->failed = true;
+        return;
+    }
+    if (rb->num_segs == rb->max_segs) {
+        size_t max_segs = MAX(2 * rb->max_segs, 1024);
+        Segment *segs = realloc(rb->segs, max_segs * sizeof(Segment));
+        if (segs == NULL) {
+            rb->failed = true;
+            return;
+        }
+        rb->segs = segs;
+        rb->max_segs = max_segs;
+    }
+    rb->segs[rb->num_segs++] = (Segment) {str, len, newlines, estimated};
+}
+
+/* Appends the text of an edit, cut like an
+ * insertion would be. */
+static void pushText(Rebuild *rb, const char *str, size_t len)
+{
+    while (len > 0) {
+        size_t n = MIN(len, PIECE_MAX);
+        pushSegment(rb, str, n, Newline_count(str, n), false, false);
+        str += n;
+        len -= n;
+    }
+}
+
+/* Appends what the edits keep of a piece and the
+ * text they insert in it. [newlines] is always
+ * the count of what's left of the piece. */
+static void emitPiece(Rebuild *rb, const char *str, size_t len,
+                      size_t newlines, bool estimated)
+{
+    while (len > 0) {
+        const PieceTableEdit *edit = (rb->next < rb->count) ? &rb->edits[rb->next] : NULL;
+        if (edit == NULL || edit->offset >= rb->pos + len) {
+            pushSegment(rb, str, len, newlines, estimated, true);
+            rb->pos += len;
+            return;
+        }
+        if (estimated) {
+            newlines = Newline_count(str, len);
+            estimated = false;
+        }
+        if (edit->offset > rb->pos) {
+            size_t k = edit->offset - rb->pos;
+            size_t n = Newline_count(str, k);
+            pushSegment(rb, str, k, n, false, true);
+            str += k;
+            len -= k;
+            newlines -= n;
+            rb->pos += k;
+        }
+        if (!rb->started) {
+            pushText(rb, edit->str, edit->inserted);
+            rb->started = true;
+        }
+        size_t end = edit->offset + edit->removed;
+        size_t skip = MIN(len, end - rb->pos);
+        newlines -= Newline_count(str, skip);
+        str += skip;
+        len -= skip;
+        rb->pos += skip;
+        if (rb->pos == end) {
+            rb->next++;
+            rb->started = false;
+        }
+    }
+}
+
+static void emitSubtree(Rebuild *rb, Piece *node)
+{
+    if (node == NULL || rb->failed)
+        return;
+    emitSubtree(rb, node->left);
+    emitPiece(rb, node->str, node->len, node->newlines, node->estimated);
+    emitSubtree(rb, node->right);
+}
+
+static Piece *buildFromSegments(PieceTable *pt, const Segment *segs,
+                                size_t lo, size_t hi, size_t depth)
+{
+    if (lo == hi)
+        return NULL;
+
+    size_t mid = lo + (hi - lo) / 2;
+    Piece *node = getSlot(pt);
+    node->priority = ((uint32_t) (31 - MIN(depth, 31)) << 27)
+                   | (randomPriority(pt) >> 5);
+    node->str = segs[mid].str;
+    node->len = segs[mid].len;
+    node->newlines = segs[mid].newlines;
+    node->estimated = segs[mid].estimated;
+    node->left  = buildFromSegments(pt, segs, lo, mid, depth+1);
+    node->right = buildFromSegments(pt, segs, mid+1, hi, depth+1);
+    update(node);
+    return node;
+}
+
+/* Walks the pieces once in order, cutting the ones
+ * the edits touch, and puts them back together in
+ * a balanced tree. */
+static bool rebuildWithEdits(PieceTable *pt, const PieceTableEdit *edits, size_t count)
+{
+    Rebuild rb = {
+        .pt = pt,
+        .edits = edits,
+        .count = count,
+    };
+    emitSubtree(&rb, pt->root);
+
+    // Insertions at the end of the text
+    for (; rb.next < count; rb.next++) {
+        if (!rb.started)
+            pushText(&rb, edits[rb.next].str, edits[rb.next].inserted);
+        rb.started = false;
+    }
+
+    // The old pieces are only freed once there's
+    // room for the new ones.
+    size_t extra = (rb.num_segs > pt->num_pieces) ? rb.num_segs - pt->num_pieces : 0;
+    if (rb.failed || !reservePieces(pt, extra)) {
+        free(rb.segs);
+        return false;
+    }
+    freeSubtree(pt, pt->root);
+    pt->root = buildFromSegments(pt, rb.segs, 0, rb.num_segs, 0);
+    free(rb.segs);
+    return true;
+}
+
+/* Applies a list of edits and leaves the cursor
+ * after the text of the last one. Long lists are
+ * applied in a single walk over the pieces, which
+ * also merges the small pieces they leave next to
+ * each other, while short ones are applied one at
+ * a time from the last. */
+bool PieceTable_applyEdits(PieceTable *pt, const PieceTableEdit *edits, size_t count)
+{
+    if (count == 0)
+        return true;
+
+    size_t shift = 0; // Wraps around when the text shrinks
+    for (size_t i = 0; i < count; i++)
+        shift += edits[i].inserted - edits[i].removed;
+
+    if (count * REBUILD_RATIO >= pt->num_pieces) {
+        if (!rebuildWithEdits(pt, edits, count))
+            return false;
+    } else {
+        // Everything the edits may need is reserved
+        // first, so that they are either all applied
+        // or none of them is.
+        size_t pieces = 0;
+        size_t inserted = 0;
+        for (size_t i = 0; i < count; i++) {
+            pieces += countPieces(edits[i].inserted) + 3;
+            inserted += edits[i].inserted;
+        }
+        if (!reservePieces(pt, pieces) || !reserveText(pt, inserted))
+            return false;
+
+        for (size_t i = count; i-- > 0;) {
+            PieceTable_removeRangeAndSetCursor(pt, edits[i].offset, edits[i].removed);
+            PieceTable_insertString(pt, edits[i].str, edits[i].inserted);
+        }
+    }
+    const PieceTableEdit *last = &edits[count-1];
+    pt->cursor = last->offset + last->removed + shift;
+    return true;
+}
+
+static bool saveSubtree(Piece *node, FILE *stream)
+{
+    if (node == NULL)
+        return true;
+    return saveSubtree(node->left, stream)
+        && fwrite(node->str, sizeof(char), node->len, stream) == node->len
+        && saveSubtree(node->right, stream);
+}
+
+bool PieceTable_saveToStream(PieceTable *pt, FILE *stream)
+{
+    return saveSubtree(pt->root, stream);
+}
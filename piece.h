@@ -0,0 +1,70 @@
+#ifndef SNBPAD_PIECE_H
+#define SNBPAD_PIECE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct Piece Piece;
+typedef struct PieceBatch PieceBatch;
+typedef struct AddBlock AddBlock;
+typedef struct LineCounter LineCounter;
+
+/* Replacement of the [removed] bytes at [offset]
+ * by the [inserted] bytes of [str]. Lists of edits
+ * are sorted by offset, don't overlap, and their
+ * offsets all refer to the text before any of them
+ * is applied. */
+typedef struct {
+    size_t      offset;
+    size_t      removed;
+    const char *str;
+    size_t      inserted;
+} PieceTableEdit;
+
+/* Text stored as a sequence of pieces, each referring
+ * to a slice of either the original contents of the
+ * file or of an append-only buffer that holds all of
+ * the inserted text. The pieces are kept in a treap
+ * ordered by text offset where each node caches the
+ * length and newline count of its subtree, so that
+ * edits and lookups cost O(log n) regardless of
+ * where they happen and no text is ever moved.
+ */
+typedef struct {
+    Piece      *root;
+    Piece      *free_list;
+    PieceBatch *batches;
+    size_t      num_pieces;
+    LineCounter *counter; // Counts mapped newlines in the background
+    AddBlock   *blocks;
+    char       *original;
+    size_t      original_size;
+    bool        mapped;
+    size_t      cursor;
+    uint32_t    seed;
+} PieceTable;
+
+void   PieceTable_initEmpty(PieceTable *pt);
+bool   PieceTable_initFile(PieceTable *pt, const char *file);
+bool   PieceTable_mapFile(PieceTable *pt, const char *file);
+bool   PieceTable_initBuffer(PieceTable *pt, char *data, size_t size);
+void   PieceTable_free(PieceTable *pt);
+bool   PieceTable_isDamaged(PieceTable *pt);
+size_t PieceTable_getUsage(PieceTable *pt);
+size_t PieceTable_getLineno(PieceTable *pt);
+bool   PieceTable_countLines(PieceTable *pt);
+size_t PieceTable_lineToOffset(PieceTable *pt, size_t line);
+size_t PieceTable_offsetToLine(PieceTable *pt, size_t offset);
+const char *PieceTable_getChunk(PieceTable *pt, size_t offset, size_t *len);
+const char *PieceTable_getChunkBefore(PieceTable *pt, size_t offset, size_t *len);
+void   PieceTable_setCursor(PieceTable *pt, size_t cur);
+bool   PieceTable_insertString(PieceTable *pt, const char *str, size_t len);
+bool   PieceTable_moveCursorBackward(PieceTable *pt);
+bool   PieceTable_moveCursorForward(PieceTable *pt);
+bool   PieceTable_removeBackwards(PieceTable *pt);
+void   PieceTable_removeRangeAndSetCursor(PieceTable *pt, size_t offset, size_t length);
+bool   PieceTable_applyEdits(PieceTable *pt, const PieceTableEdit *edits, size_t count);
+bool   PieceTable_saveToStream(PieceTable *pt, FILE *stream);
+#endif
\ No newline at end of file
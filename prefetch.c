@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "prefetch.h"
+
+// Requests that weren't started beyond these are
+// forgotten, the oldest first.
+#define MAX_QUEUED 8
+#define MAX_ENTRIES 64
+
+typedef enum {
+    PrefetchState_QUEUED,
+    PrefetchState_LOADING,
+    PrefetchState_READY,
+    PrefetchState_FAILED,
+} PrefetchState;
+
+/* Entries go from the most recently requested to
+ * the least recently requested. One that's removed
+ * while it's being loaded is only marked as
+ * dropped, and the loader frees it once it's done
+ * with it. */
+typedef struct Prefetch Prefetch;
+struct Prefetch {
+    Prefetch *prev;
+    Prefetch *next;
+    PrefetchState state;
+    bool      dropped;
+    GapBuffer buffer;
+    size_t    usage;
+    struct stat info; // Of the file right before it was loaded
+    char      path[];
+};
+
+struct FilePrefetcher {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;   // A request was queued
+    pthread_cond_t  loaded; // A load is over
+    bool      stop;
+    Prefetch *head;
+    Prefetch *tail;
+    size_t    num_entries;
+    size_t    num_queued;
+    size_t    usage;
+    size_t    max_bytes;
+    bool    (*load)(GapBuffer*, const char*);
+};
+
+static void unlinkEntry(FilePrefetcher *prefetcher, Prefetch *entry)
+{
+    if (entry->prev == NULL)
+        prefetcher->head = entry->next;
+    else
+        entry->prev->next = entry->next;
+    if (entry->next == NULL)
+        prefetcher->tail = entry->prev;
+    else
+        entry->next->prev = entry->prev;
+    prefetcher->num_entries--;
+}
+
+static void pushEntry(FilePrefetcher *prefetcher, Prefetch *entry)
+{
+    entry->prev = NULL;
+    entry->next = prefetcher->head;
+    if (prefetcher->head == NULL)
+        prefetcher->tail = entry;
+    else
+        prefetcher->head->prev = entry;
+    prefetcher->head = entry;
+    prefetcher->num_entries++;
+}
+
+static Prefetch *findEntry(FilePrefetcher *prefetcher, const char *file)
+{
+    Prefetch *entry = prefetcher->head;
+    while (entry != NULL && strcmp(entry->path, file))
+        entry = entry->next;
+    return entry;
+}
+
+static void removeEntry(FilePrefetcher *prefetcher, Prefetch *entry)
+{
+    unlinkEntry(prefetcher, entry);
+    switch (entry->state) {
+        case PrefetchState_QUEUED:
+        prefetcher->num_queued--;
+        free(entry);
+        break;
+
+        case PrefetchState_LOADING:
+        entry->dropped = true;
+        break;
+
+        case PrefetchState_READY:
+        prefetcher->usage -= entry->usage;
+        GapBuffer_free(&entry->buffer);
+        free(entry);
+        break;
+
+        case PrefetchState_FAILED:
+        free(entry);
+        break;
+    }
+}
+
+/* Evicts the least recently requested entries
+ * until the limits are respected. */
+static void trim(FilePrefetcher *prefetcher)
+{
+    Prefetch *entry = prefetcher->tail;
+    while (entry != NULL) {
+        bool over_usage   = prefetcher->usage > prefetcher->max_bytes;
+        bool over_queued  = prefetcher->num_queued > MAX_QUEUED;
+        bool over_entries = prefetcher->num_entries > MAX_ENTRIES;
+        if (!over_usage && !over_queued && !over_entries)
+            break;
+
+        Prefetch *prev = entry->prev;
+        if ((entry->state == PrefetchState_READY && over_usage)
+            || (entry->state == PrefetchState_QUEUED && over_queued)
+            || (entry->state != PrefetchState_LOADING && over_entries))
+            removeEntry(prefetcher, entry);
+        entry = prev;
+    }
+}
+
+static bool sameFile(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev
+        && a->st_ino == b->st_ino
+        && a->st_size == b->st_size
+        && a->st_mtim.tv_sec  == b->st_mtim.tv_sec
+        && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void *runLoader(void *arg)
+{
+    FilePrefetcher *prefetcher = arg;
+    pthread_mutex_lock(&prefetcher->lock);
+    for (;;) {
+        Prefetch *entry = NULL;
+        while (!prefetcher->stop) {
+            entry = prefetcher->head;
+            while (entry != NULL && entry->state != PrefetchState_QUEUED)
+                entry = entry->next;
+            if (entry != NULL)
+                break;
+            pthread_cond_wait(&prefetcher->wake, &prefetcher->lock);
+        }
+        if (prefetcher->stop)
+            break;
+
+        entry->state = PrefetchState_LOADING;
+        prefetcher->num_queued--;
+        pthread_mutex_unlock(&prefetcher->lock);
+
+        // Files that wouldn't fit aren't loaded
+        bool loaded = false;
+        GapBuffer buffer;
+        struct stat info;
+        if (stat(entry->path, &info) == 0 && S_ISREG(info.st_mode)
+            && (size_t) info.st_size <= prefetcher->max_bytes) {
+            loaded = prefetcher->load(&buffer, entry->path);
+            if (!loaded)
+                GapBuffer_free(&buffer);
+        }
+
+        pthread_mutex_lock(&prefetcher->lock);
+        if (entry->dropped) {
+            if (loaded)
+                GapBuffer_free(&buffer);
+            free(entry);
+        } else if (loaded) {
+            entry->state = PrefetchState_READY;
+            entry->buffer = buffer;
+            entry->info = info;
+            entry->usage = GapBuffer_getUsage(&buffer);
+            prefetcher->usage += entry->usage;
+            trim(prefetcher);
+        } else
+            entry->state = PrefetchState_FAILED;
+        pthread_cond_broadcast(&prefetcher->loaded);
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+    return NULL;
+}
+
+/* Buffers are loaded with [load], which must leave
+ * them safe to free when it fails, and hold up to
+ * [max_bytes] of text in total. */
+FilePrefetcher *FilePrefetcher_start(size_t max_bytes, bool (*load)(GapBuffer*, const char*))
+{
+    FilePrefetcher *prefetcher = malloc(sizeof(FilePrefetcher));
+    if (prefetcher == NULL)
+        return NULL;
+
+    prefetcher->stop = false;
+    prefetcher->head = NULL;
+    prefetcher->tail = NULL;
+    prefetcher->num_entries = 0;
+    prefetcher->num_queued = 0;
+    prefetcher->usage = 0;
+    prefetcher->max_bytes = max_bytes;
+    prefetcher->load = load;
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->wake, NULL);
+    pthread_cond_init(&prefetcher->loaded, NULL);
+
+    if (pthread_create(&prefetcher->thread, NULL, runLoader, prefetcher)) {
+        pthread_mutex_destroy(&prefetcher->lock);
+        pthread_cond_destroy(&prefetcher->wake);
+        pthread_cond_destroy(&prefetcher->loaded);
+        free(prefetcher);
+        return NULL;
+    }
+    return prefetcher;
+}
+
+/* Waits for the file being loaded, if any, and
+ * drops everything else. */
+void FilePrefetcher_stop(FilePrefetcher *prefetcher)
+{
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->stop = true;
+    pthread_cond_signal(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    pthread_join(prefetcher->thread, NULL);
+
+    while (prefetcher->head != NULL)
+        removeEntry(prefetcher, prefetcher->head);
+    pthread_mutex_destroy(&prefetcher->lock);
+    pthread_cond_destroy(&prefetcher->wake);
+    pthread_cond_destroy(&prefetcher->loaded);
+    free(prefetcher);
+}
+
+/* Asks for [file] to be loaded before the other
+ * requests, or to be kept longer if it already
+ * was. Loads that failed are tried again. */
+void FilePrefetcher_request(FilePrefetcher *prefetcher, const char *file)
+{
+    pthread_mutex_lock(&prefetcher->lock);
+
+    Prefetch *entry = findEntry(prefetcher, file);
+    if (entry != NULL && entry->state == PrefetchState_FAILED) {
+        removeEntry(prefetcher, entry);
+        entry = NULL;
+    }
+
+    if (entry != NULL) {
+        unlinkEntry(prefetcher, entry);
+        pushEntry(prefetcher, entry);
+    } else {
+        size_t len = strlen(file);
+        entry = malloc(sizeof(Prefetch) + len + 1);
+        if (entry != NULL) {
+            entry->state = PrefetchState_QUEUED;
+            entry->dropped = false;
+            entry->usage = 0;
+            memcpy(entry->path, file, len + 1);
+            pushEntry(prefetcher, entry);
+            prefetcher->num_queued++;
+            pthread_cond_signal(&prefetcher->wake);
+        }
+    }
+    trim(prefetcher);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+/* Moves the buffer of [file] into [buffer] if it
+ * was loaded and the file didn't change since.
+ * If it's being loaded, that's waited for since
+ * it's quicker than starting over. Otherwise the
+ * request is dropped, as the caller is going to
+ * load the file itself. */
+bool FilePrefetcher_take(FilePrefetcher *prefetcher, const char *file, GapBuffer *buffer)
+{
+    pthread_mutex_lock(&prefetcher->lock);
+
+    Prefetch *entry = findEntry(prefetcher, file);
+    while (entry != NULL && entry->state == PrefetchState_LOADING) {
+        pthread_cond_wait(&prefetcher->loaded, &prefetcher->lock);
+        entry = findEntry(prefetcher, file);
+    }
+
+    bool taken = false;
+    struct stat info;
+    if (entry != NULL && entry->state == PrefetchState_READY) {
+        taken = true;
+        *buffer = entry->buffer;
+        info = entry->info;
+        prefetcher->usage -= entry->usage;
+        unlinkEntry(prefetcher, entry);
+        free(entry);
+    } else if (entry != NULL)
+        removeEntry(prefetcher, entry);
+
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    if (taken) {
+        struct stat current;
+        if (stat(file, &current) || !sameFile(&current, &info)) {
+            GapBuffer_free(buffer);
+            taken = false;
+        }
+    }
+    return taken;
+}
@@ -0,0 +1,24 @@
+#ifndef SNBPAD_PREFETCH_H
+#define SNBPAD_PREFETCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "gap.h"
+
+/* Loads files into buffers on a background thread
+ * ahead of them being opened, for instance while
+ * the pointer rests on them, so that opening one
+ * only means taking its buffer. The most recent
+ * request is loaded first, and the loaded buffers
+ * are evicted, least recently requested first,
+ * once they hold more than a given amount of text.
+ * A buffer is only handed out if its file didn't
+ * change since it was loaded. */
+
+typedef struct FilePrefetcher FilePrefetcher;
+
+FilePrefetcher *FilePrefetcher_start(size_t max_bytes, bool (*load)(GapBuffer*, const char*));
+void FilePrefetcher_stop(FilePrefetcher *prefetcher);
+void FilePrefetcher_request(FilePrefetcher *prefetcher, const char *file);
+bool FilePrefetcher_take(FilePrefetcher *prefetcher, const char *file, GapBuffer *buffer);
+#endif
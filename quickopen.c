@@ -0,0 +1,331 @@
+#include <string.h>
+#include <stdlib.h>
+#include "utils.h"
+#include "fuzzy.h"
+#include "treeview.h"
+#include "quickopen.h"
+#include "textrenderutils.h"
+
+#define MAX_MATCHES 100
+
+typedef struct {
+    GUIElement base;
+    const QuickOpenStyle *style;
+    FontMetrics *font;
+    GUIElement  *tree_view;
+    const FileIndex *index; // The one [matcher] was built for
+    uint32_t      index_version;
+    FuzzyMatcher *matcher;  // NULL while there's no index
+    char   query[FUZZY_MAX_QUERY];
+    size_t query_len;
+    FuzzyMatch matches[MAX_MATCHES];
+    size_t num_matches;
+    size_t selected;
+    size_t first_row;
+    void (*callback)(const char*, size_t, void*);
+    void *userp;
+} QuickOpen;
+
+/* Rebuilds the matcher if the tree view has a new
+ * index. Returns true if it did. */
+static bool syncIndex(QuickOpen *qo)
+{
+    uint32_t version;
+    const FileIndex *index = TreeView_getIndex(qo->tree_view, &version);
+    if (version == qo->index_version && (qo->matcher != NULL || index == NULL))
+        return false;
+
+    if (qo->matcher != NULL)
+        FuzzyMatcher_free(qo->matcher);
+    qo->matcher = NULL;
+    qo->index = index;
+    qo->index_version = version;
+    if (index != NULL) {
+        qo->matcher = FuzzyMatcher_new(index, 0);
+        if (qo->matcher == NULL)
+            TraceLog(LOG_WARNING, "Couldn't prepare the quick-open search");
+    }
+    return true;
+}
+
+static void search(QuickOpen *qo)
+{
+    qo->num_matches = 0;
+    if (qo->matcher != NULL)
+        qo->num_matches = FuzzyMatcher_search(qo->matcher, qo->query, qo->query_len,
+                                              qo->matches, MAX_MATCHES);
+    qo->selected = 0;
+    qo->first_row = 0;
+    GUIElement_invalidateAll(&qo->base);
+}
+
+static void selectRow(QuickOpen *qo, size_t row)
+{
+    if (row >= qo->num_matches)
+        return;
+    qo->selected = row;
+    if (qo->selected < qo->first_row)
+        qo->first_row = qo->selected;
+    if (qo->selected >= qo->first_row + qo->style->max_rows)
+        qo->first_row = qo->selected - qo->style->max_rows + 1;
+    GUIElement_invalidateAll(&qo->base);
+}
+
+static void openSelected(QuickOpen *qo)
+{
+    // Matches of an index that was replaced
+    // aren't opened.
+    if (syncIndex(qo)) {
+        search(qo);
+        return;
+    }
+    if (qo->selected >= qo->num_matches)
+        return;
+
+    char path[4096];
+    uint32_t entry = qo->matches[qo->selected].entry;
+    size_t len = FileIndex_getPath(qo->index, entry, path, sizeof(path));
+    if (len >= sizeof(path)) {
+        TraceLog(LOG_WARNING, "Path is too long to be opened");
+        return;
+    }
+    qo->callback(path, len, qo->userp);
+}
+
+static void freeCallback(GUIElement *elem)
+{
+    QuickOpen *qo = (QuickOpen*) elem;
+    if (qo->matcher != NULL)
+        FuzzyMatcher_free(qo->matcher);
+    FontMetrics_unload(qo->font);
+    free(qo);
+}
+
+static void tickCallback(GUIElement *elem, uint64_t time_in_ms)
+{
+    (void) time_in_ms;
+    QuickOpen *qo = (QuickOpen*) elem;
+    if (syncIndex(qo))
+        search(qo);
+}
+
+/* Draws [path] with the characters that matched
+ * the query highlighted. */
+static void renderMatch(QuickOpen *qo, const char *path, size_t len,
+                        int x, int y)
+{
+    const QuickOpenStyle *style = qo->style;
+
+    uint16_t positions[FUZZY_MAX_QUERY];
+    size_t num_positions = FuzzyMatcher_getPositions(path, len, qo->query,
+                                                     qo->query_len, positions);
+    size_t k = 0;
+    size_t i = 0;
+    while (i < len) {
+        size_t j = i;
+        bool matched = (k < num_positions && positions[k] == i);
+        if (matched) {
+            while (k < num_positions && positions[k] == j) {
+                k++;
+                j++;
+            }
+        } else
+            j = (k < num_positions) ? positions[k] : len;
+        x += renderString(qo->font, path + i, j - i, x, y, style->font_size,
+                          matched ? style->match_fgcolor : style->fgcolor);
+        i = j;
+    }
+}
+
+static void drawCallback(GUIElement *elem)
+{
+    QuickOpen *qo = (QuickOpen*) elem;
+    const QuickOpenStyle *style = qo->style;
+    Rectangle region = elem->region;
+
+    Rectangle damage;
+    GUIElement_takeDamage(elem, &damage);
+
+    BeginScissorMode(region.x, region.y, region.width, region.height);
+    DrawRectangleRec(region, style->bgcolor);
+
+    int x = region.x + style->padding;
+    int y = region.y + style->padding;
+    int text_y = (style->line_height - style->font_size) / 2;
+    float query_w = renderString(qo->font, qo->query, qo->query_len,
+                                 x, y + text_y, style->font_size, style->fgcolor);
+    DrawRectangle(x + query_w, y + text_y, 2, style->font_size, style->cursor_color);
+
+    if (qo->matcher == NULL) {
+        const char *message = "Indexing...";
+        renderString(qo->font, message, strlen(message), x,
+                     y + style->line_height + text_y, style->font_size, style->fgcolor);
+    }
+
+    size_t last = MIN(qo->first_row + style->max_rows, qo->num_matches);
+    for (size_t i = qo->first_row; i < last; i++) {
+        int row_y = y + (i - qo->first_row + 1) * style->line_height;
+        if (i == qo->selected)
+            DrawRectangle(region.x, row_y, region.width, style->line_height,
+                          style->selection_bgcolor);
+
+        char path[4096];
+        size_t len = FuzzyMatcher_getPath(qo->matcher, qo->matches[i].entry,
+                                          path, sizeof(path));
+        len = MIN(len, sizeof(path) - 1);
+        renderMatch(qo, path, len, x, row_y + text_y);
+    }
+    EndScissorMode();
+}
+
+static GUIElement *onClickDownCallback(GUIElement *elem, int x, int y)
+{
+    (void) x;
+    QuickOpen *qo = (QuickOpen*) elem;
+    const QuickOpenStyle *style = qo->style;
+
+    int rows_y = style->padding + style->line_height;
+    if (y >= rows_y) {
+        size_t row = qo->first_row + (y - rows_y) / style->line_height;
+        if (row < qo->first_row + style->max_rows && row < qo->num_matches) {
+            selectRow(qo, row);
+            openSelected(qo);
+        }
+    }
+    return elem;
+}
+
+static void onMouseWheelCallback(GUIElement *elem, int y)
+{
+    QuickOpen *qo = (QuickOpen*) elem;
+    if (y > 0 && qo->selected > 0)
+        selectRow(qo, qo->selected - 1);
+    else if (y < 0)
+        selectRow(qo, qo->selected + 1);
+}
+
+static void onArrowUpDownCallback(GUIElement *elem)
+{
+    QuickOpen *qo = (QuickOpen*) elem;
+    if (qo->selected > 0)
+        selectRow(qo, qo->selected - 1);
+}
+
+static void onArrowDownDownCallback(GUIElement *elem)
+{
+    QuickOpen *qo = (QuickOpen*) elem;
+    selectRow(qo, qo->selected + 1);
+}
+
+static void onReturnDownCallback(GUIElement *elem)
+{
+    openSelected((QuickOpen*) elem);
+}
+
+static void onBackspaceDownCallback(GUIElement *elem)
+{
+    QuickOpen *qo = (QuickOpen*) elem;
+    if (qo->query_len == 0)
+        return;
+
+    // Drops the whole last codepoint
+    do
+        qo->query_len--;
+    while (qo->query_len > 0 && (qo->query[qo->query_len] & 0xC0) == 0x80);
+    search(qo);
+}
+
+static void onTextInputCallback(GUIElement *elem, const char *str, size_t len)
+{
+    QuickOpen *qo = (QuickOpen*) elem;
+    if (len > sizeof(qo->query) - qo->query_len)
+        return;
+    memcpy(qo->query + qo->query_len, str, len);
+    qo->query_len += len;
+    search(qo);
+}
+
+static void onPasteCallback(GUIElement *elem)
+{
+    const char *text = GetClipboardText();
+    if (text == NULL)
+        return;
+
+    // Only up to the first line
+    size_t len = strcspn(text, "\r\n");
+    onTextInputCallback(elem, text, len);
+}
+
+static const GUIElementMethods methods = {
+    .free = freeCallback,
+    .tick = tickCallback,
+    .draw = drawCallback,
+    .onClickDown = onClickDownCallback,
+    .onMouseWheel = onMouseWheelCallback,
+    .onArrowUpDown = onArrowUpDownCallback,
+    .onArrowDownDown = onArrowDownDownCallback,
+    .onReturnDown = onReturnDownCallback,
+    .onBackspaceDown = onBackspaceDownCallback,
+    .onTextInput = onTextInputCallback,
+    .onPaste = onPasteCallback,
+};
+
+/* Returns how tall the box is with the query and
+ * every row. */
+int QuickOpen_getHeight(const QuickOpenStyle *style)
+{
+    return 2 * style->padding + (style->max_rows + 1) * style->line_height;
+}
+
+/* Clears the query, for when the box is shown
+ * again, and lists the files that match it. */
+void QuickOpen_reset(GUIElement *elem)
+{
+    QuickOpen *qo = (QuickOpen*) elem;
+    qo->query_len = 0;
+    syncIndex(qo);
+    search(qo);
+}
+
+/* [callback] is called with the full path of the
+ * file that was picked. Files are looked for in
+ * the index of [tree_view], which must outlive
+ * the box. */
+GUIElement *QuickOpen_new(Rectangle region,
+                          const char *name,
+                          GUIElement *tree_view,
+                          void (*callback)(const char*, size_t, void*),
+                          const QuickOpenStyle *style,
+                          void *userp)
+{
+    QuickOpen *qo = malloc(sizeof(QuickOpen));
+    if (qo == NULL)
+        return NULL;
+
+    qo->base.region = region;
+    qo->base.methods = &methods;
+    qo->base.dirty = false;
+    strncpy(qo->base.name, name, sizeof(qo->base.name));
+    qo->base.name[sizeof(qo->base.name)-1] = '\0';
+
+    qo->font = FontMetrics_load(loadFont(style->baked_font, style->font_data,
+                                         style->font_data_size, style->font_file,
+                                         style->font_size));
+    if (qo->font == NULL) {
+        free(qo);
+        return NULL;
+    }
+
+    qo->style = style;
+    qo->tree_view = tree_view;
+    qo->index = NULL;
+    qo->index_version = 0;
+    qo->matcher = NULL;
+    qo->query_len = 0;
+    qo->num_matches = 0;
+    qo->selected = 0;
+    qo->first_row = 0;
+    qo->callback = callback;
+    qo->userp = userp;
+    return (GUIElement*) qo;
+}
@@ -0,0 +1,39 @@
+#ifndef SNBPAD_QUICKOPEN_H
+#define SNBPAD_QUICKOPEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <raylib.h>
+#include "guielement.h"
+#include "bakedfont.h"
+
+/* A box that fuzzy finds files among the ones a
+ * tree view indexed as a query is typed, to be
+ * shown over the other elements. */
+
+typedef struct {
+    Color bgcolor;
+    Color fgcolor;
+    Color match_fgcolor;
+    Color selection_bgcolor;
+    Color cursor_color;
+    const BakedFont     *baked_font;
+    const unsigned char *font_data;
+    size_t               font_data_size;
+    const char  *font_file;
+    unsigned int font_size;
+    size_t line_height;
+    size_t padding;
+    size_t max_rows;
+} QuickOpenStyle;
+
+GUIElement *QuickOpen_new(Rectangle region,
+                          const char *name,
+                          GUIElement *tree_view,
+                          void (*callback)(const char*, size_t, void*),
+                          const QuickOpenStyle *style,
+                          void *userp);
+void QuickOpen_reset(GUIElement *elem);
+int  QuickOpen_getHeight(const QuickOpenStyle *style);
+#endif
@@ -0,0 +1,1413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "utils.h"
+#include "literal.h"
+#include "regex.h"
+
+// Limits on the size of compiled patterns
+#define MAX_NODES  8192
+#define MAX_INSTS  65536
+#define MAX_REPEAT 1000
+
+// Memory the states of an automaton may take
+// before they're all dropped and built again.
+#define DFA_MAX_MEMORY (4 * 1024 * 1024)
+#define DFA_BLOCK_SIZE (64 * 1024)
+#define DFA_BUCKETS    4096
+
+// Separates the groups of threads in a state
+#define MARK UINT32_MAX
+
+// Longest literal prefix that's looked for to skip
+// the text where no match starts.
+#define MAX_PREFIX 64
+
+// Skipping is given up once this many tries didn't
+// skip this many bytes each on average, since then
+// it costs more than it saves.
+#define SKIP_TRIES 256
+#define SKIP_MIN_AVERAGE 16
+
+typedef struct {
+    uint64_t bits[4];
+} ByteSet;
+
+static bool ByteSet_has(const ByteSet *set, uint8_t b)
+{
+    return (set->bits[b >> 6] >> (b & 63)) & 1;
+}
+
+static void ByteSet_addRange(ByteSet *set, uint8_t lo, uint8_t hi)
+{
+    for (int b = lo; b <= hi; b++)
+        set->bits[b >> 6] |= (uint64_t) 1 << (b & 63);
+}
+
+static void ByteSet_add(ByteSet *set, uint8_t b)
+{
+    ByteSet_addRange(set, b, b);
+}
+
+static void ByteSet_remove(ByteSet *set, uint8_t b)
+{
+    set->bits[b >> 6] &= ~((uint64_t) 1 << (b & 63));
+}
+
+/* Returns the only byte of the set, or -1. */
+static int ByteSet_getSingle(const ByteSet *set)
+{
+    int byte = -1;
+    for (int b = 0; b < 256; b++)
+        if (ByteSet_has(set, b)) {
+            if (byte >= 0)
+                return -1;
+            byte = b;
+        }
+    return byte;
+}
+
+/* Adds the other case of the ASCII letters. */
+static void ByteSet_foldCase(ByteSet *set)
+{
+    for (int b = 'a'; b <= 'z'; b++)
+        if (ByteSet_has(set, b) || ByteSet_has(set, b - 'a' + 'A')) {
+            ByteSet_add(set, b);
+            ByteSet_add(set, b - 'a' + 'A');
+        }
+}
+
+typedef enum {
+    Node_EMPTY,
+    Node_BYTES,
+    Node_CONCAT,
+    Node_ALTER,
+    Node_REPEAT,
+    Node_LINE_START,
+    Node_LINE_END,
+} NodeType;
+
+typedef struct Node Node;
+struct Node {
+    NodeType type;
+    uint32_t set;      // Of Node_BYTES
+    int      min, max; // Of Node_REPEAT, max is -1 when unbounded
+    Node    *left;
+    Node    *right;
+};
+
+typedef struct {
+    const char *src;
+    size_t      len;
+    size_t      pos;
+    int         flags;
+    Node       *nodes;
+    size_t      num_nodes;
+    ByteSet    *sets;
+    size_t      num_sets;
+    size_t      max_sets;
+    const char *error;
+} Parser;
+
+typedef enum {
+    Op_BYTES,      // Consumes a byte of [arg]
+    Op_SPLIT,      // Goes on at both [arg] and [next]
+    Op_LINE_START, // Goes on if the previous byte is a newline
+    Op_LINE_END,   // Goes on if the next byte is a newline
+    Op_MATCH,
+} Op;
+
+typedef struct {
+    uint32_t op;
+    uint32_t arg;
+    uint32_t next;
+} Inst;
+
+enum {
+    DState_LINE_START      = 1 << 0, // Entered after a newline
+    DState_MATCHED         = 1 << 1, // No more matches are started
+    DState_MATCH_BEFORE    = 1 << 2, // A match ends before the next byte
+    DState_MATCH_BEFORE_NL = 1 << 3, // Same, when the next one is a newline or the end
+    DState_DEAD            = 1 << 4,
+};
+
+#define DState_SPECIAL (DState_MATCH_BEFORE | DState_MATCH_BEFORE_NL | DState_DEAD)
+#define DState_KEY_FLAGS (DState_LINE_START | DState_MATCHED)
+
+/* The threads of a state are grouped by where the
+ * match they're following started, from the
+ * earliest. Once a group gets to a match, the ones
+ * after it are dropped since they can only lead to
+ * matches further to the right, which is how the
+ * leftmost match is found without tracking offsets.
+ * Threads are stored before their empty transitions
+ * are followed, since those depend on the byte
+ * that comes next. */
+typedef struct DState DState;
+struct DState {
+    DState   *chain; // Next in the same bucket
+    uint32_t  hash;
+    uint32_t  flags;
+    uint32_t  key_len;
+    uint32_t *key;
+    DState   *next[]; // Per byte class, NULL until needed
+};
+
+typedef struct DBlock DBlock;
+struct DBlock {
+    DBlock *next;
+    size_t  used;
+    char    data[];
+};
+
+typedef struct {
+    const Regex *re;
+    Inst     *insts;
+    uint32_t  num_insts;
+    uint32_t  start;
+    bool      anchored;
+    DState   *buckets[DFA_BUCKETS];
+    DState   *initial[2]; // By whether the text before is a newline
+    DBlock   *blocks;
+    size_t    memory;
+    size_t    flushes;
+    // Scratch space for building states
+    uint32_t *marks;
+    uint32_t *step_marks;
+    uint32_t  generation;
+    uint32_t *stack;
+    uint32_t *closure;
+    uint32_t *key;
+} DFA;
+
+struct Regex {
+    ByteSet *sets;
+    size_t   num_sets;
+    uint8_t  classes[256]; // Bytes that no set tells apart share a class
+    uint8_t  reps[256];    // A byte of every class
+    int      num_classes;
+    DFA      forward;      // Finds where the leftmost-longest match ends
+    DFA      reverse;      // Runs back from there to where it starts
+    bool     can_skip;     // No match is empty, see skipAhead
+    size_t   skip_tries;
+    size_t   skip_bytes;
+    bool     first[256];   // Bytes that matches may start with, plus the newline
+    char     prefix[MAX_PREFIX]; // That every match starts with
+    size_t   prefix_len;
+};
+
+/* --- Parsing --- */
+
+static Node *newNode(Parser *p, NodeType type, Node *left, Node *right)
+{
+    if (p->num_nodes == MAX_NODES) {
+        p->error = "Pattern is too complex";
+        return NULL;
+    }
+    Node *node = &p->nodes[p->num_nodes++];
+    node->type = type;
+    node->set = 0;
+    node->min = 0;
+    node->max = 0;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+static Node *newBytes(Parser *p, ByteSet set)
+{
+    if (p->flags & REGEX_ICASE)
+        ByteSet_foldCase(&set);
+    if (p->flags & REGEX_NO_NEWLINE)
+        ByteSet_remove(&set, '\n');
+
+    if (p->num_sets == p->max_sets) {
+        size_t max_sets = MAX(2 * p->max_sets, 16);
+        ByteSet *sets = realloc(p->sets, max_sets * sizeof(ByteSet));
+        if (sets == NULL) {
+            p->error = "Out of memory";
+            return NULL;
+        }
+        p->sets = sets;
+        p->max_sets = max_sets;
+    }
+    Node *node = newNode(p, Node_BYTES, NULL, NULL);
+    if (node != NULL) {
+        node->set = p->num_sets;
+        p->sets[p->num_sets++] = set;
+    }
+    return node;
+}
+
+static Node *newByte(Parser *p, uint8_t b)
+{
+    ByteSet set = {0};
+    ByteSet_add(&set, b);
+    return newBytes(p, set);
+}
+
+static Node *newRange(Parser *p, uint8_t lo, uint8_t hi)
+{
+    ByteSet set = {0};
+    ByteSet_addRange(&set, lo, hi);
+    return newBytes(p, set);
+}
+
+/* Joins [left] and [right] if both were built,
+ * and lets a missing [left] stand for nothing. */
+static Node *concat(Parser *p, Node *left, Node *right)
+{
+    if (right == NULL)
+        return NULL;
+    if (left == NULL)
+        return right;
+    return newNode(p, Node_CONCAT, left, right);
+}
+
+static Node *alter(Parser *p, Node *left, Node *right)
+{
+    if (right == NULL)
+        return NULL;
+    if (left == NULL)
+        return right;
+    return newNode(p, Node_ALTER, left, right);
+}
+
+/* Matches any codepoint encoded on more than one
+ * byte. */
+static Node *anyMultibyte(Parser *p)
+{
+    Node *cont2 = concat(p, newRange(p, 0xC2, 0xDF), newRange(p, 0x80, 0xBF));
+
+    Node *cont3 = newRange(p, 0xE0, 0xEF);
+    for (int i = 0; i < 2 && cont3 != NULL; i++)
+        cont3 = concat(p, cont3, newRange(p, 0x80, 0xBF));
+
+    Node *cont4 = newRange(p, 0xF0, 0xF4);
+    for (int i = 0; i < 3 && cont4 != NULL; i++)
+        cont4 = concat(p, cont4, newRange(p, 0x80, 0xBF));
+
+    if (cont2 == NULL || cont3 == NULL || cont4 == NULL)
+        return NULL;
+    return alter(p, alter(p, cont2, cont3), cont4);
+}
+
+/* Matches a codepoint that is either one of the
+ * ASCII ones of [ascii] or not ASCII at all. */
+static Node *asciiOrMultibyte(Parser *p, ByteSet ascii)
+{
+    Node *single = newBytes(p, ascii);
+    Node *multi  = anyMultibyte(p);
+    if (single == NULL || multi == NULL)
+        return NULL;
+    return alter(p, single, multi);
+}
+
+/* Returns the length of the UTF-8 sequence at the
+ * current position, or 1 for bytes that don't
+ * start a valid one. */
+static size_t sequenceLength(Parser *p)
+{
+    uint8_t c = p->src[p->pos];
+    size_t len = 1;
+    if (c >= 0xC2 && c <= 0xDF)
+        len = 2;
+    else if (c >= 0xE0 && c <= 0xEF)
+        len = 3;
+    else if (c >= 0xF0 && c <= 0xF4)
+        len = 4;
+
+    if (p->pos + len > p->len)
+        return 1;
+    for (size_t i = 1; i < len; i++)
+        if (((uint8_t) p->src[p->pos + i] & 0xC0) != 0x80)
+            return 1;
+    return len;
+}
+
+/* Consumes a whole codepoint and matches it as
+ * the sequence of its bytes. */
+static Node *parseCodepoint(Parser *p)
+{
+    size_t len = sequenceLength(p);
+    Node *node = NULL;
+    for (size_t i = 0; i < len; i++) {
+        node = concat(p, node, newByte(p, p->src[p->pos++]));
+        if (node == NULL)
+            return NULL;
+    }
+    return node;
+}
+
+static bool addNamedClass(ByteSet *set, const char *name, size_t len)
+{
+    #define IS(s) (len == sizeof(s)-1 && !memcmp(name, s, len))
+    if (IS("alnum")) {
+        ByteSet_addRange(set, '0', '9');
+        ByteSet_addRange(set, 'A', 'Z');
+        ByteSet_addRange(set, 'a', 'z');
+    } else if (IS("alpha")) {
+        ByteSet_addRange(set, 'A', 'Z');
+        ByteSet_addRange(set, 'a', 'z');
+    } else if (IS("blank")) {
+        ByteSet_add(set, ' ');
+        ByteSet_add(set, '\t');
+    } else if (IS("cntrl")) {
+        ByteSet_addRange(set, 0x00, 0x1F);
+        ByteSet_add(set, 0x7F);
+    } else if (IS("digit"))
+        ByteSet_addRange(set, '0', '9');
+    else if (IS("graph"))
+        ByteSet_addRange(set, 0x21, 0x7E);
+    else if (IS("lower"))
+        ByteSet_addRange(set, 'a', 'z');
+    else if (IS("print"))
+        ByteSet_addRange(set, 0x20, 0x7E);
+    else if (IS("punct")) {
+        ByteSet_addRange(set, 0x21, 0x2F);
+        ByteSet_addRange(set, 0x3A, 0x40);
+        ByteSet_addRange(set, 0x5B, 0x60);
+        ByteSet_addRange(set, 0x7B, 0x7E);
+    } else if (IS("space")) {
+        ByteSet_addRange(set, '\t', '\r');
+        ByteSet_add(set, ' ');
+    } else if (IS("upper"))
+        ByteSet_addRange(set, 'A', 'Z');
+    else if (IS("xdigit")) {
+        ByteSet_addRange(set, '0', '9');
+        ByteSet_addRange(set, 'A', 'F');
+        ByteSet_addRange(set, 'a', 'f');
+    } else
+        return false;
+    #undef IS
+    return true;
+}
+
+/* Handles the \d, \w and \s classes. Their upper
+ * case versions are negated. */
+static bool addEscapedClass(ByteSet *set, char c, bool *negated)
+{
+    *negated = (c == 'D' || c == 'W' || c == 'S');
+    switch (c) {
+        case 'd': case 'D': addNamedClass(set, "digit", 5); break;
+        case 's': case 'S': addNamedClass(set, "space", 5); break;
+        case 'w': case 'W':
+        addNamedClass(set, "alnum", 5);
+        ByteSet_add(set, '_');
+        break;
+        default: return false;
+    }
+    return true;
+}
+
+/* Returns the byte that an escaped character
+ * stands for, or -1 if it's not one. */
+static int escapedByte(char c)
+{
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+    }
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+        return -1;
+    return (uint8_t) c;
+}
+
+static void complementASCII(ByteSet *set)
+{
+    for (int b = 0; b < 0x80; b++) {
+        if (ByteSet_has(set, b))
+            ByteSet_remove(set, b);
+        else
+            ByteSet_add(set, b);
+    }
+    for (int b = 0x80; b < 0x100; b++)
+        ByteSet_remove(set, b);
+}
+
+static Node *parseBracket(Parser *p)
+{
+    p->pos++; // The [
+    bool negated = false;
+    if (p->pos < p->len && p->src[p->pos] == '^') {
+        negated = true;
+        p->pos++;
+    }
+
+    ByteSet set = {0};
+    Node *multi = NULL; // Codepoints that aren't ASCII
+    bool first = true;
+    for (;;) {
+        if (p->pos == p->len) {
+            p->error = "Unmatched [";
+            return NULL;
+        }
+        char c = p->src[p->pos];
+        if (c == ']' && !first) {
+            p->pos++;
+            break;
+        }
+        first = false;
+
+        if (c == '[' && p->pos + 1 < p->len && p->src[p->pos+1] == ':') {
+            const char *name = p->src + p->pos + 2;
+            const char *stop = NULL;
+            for (size_t i = p->pos + 2; i + 1 < p->len; i++)
+                if (p->src[i] == ':' && p->src[i+1] == ']') {
+                    stop = p->src + i;
+                    break;
+                }
+            if (stop == NULL || !addNamedClass(&set, name, stop - name)) {
+                p->error = "Unknown character class";
+                return NULL;
+            }
+            p->pos = stop - p->src + 2;
+            continue;
+        }
+
+        int lo;
+        if (c == '\\' && p->pos + 1 < p->len) {
+            char e = p->src[p->pos+1];
+            bool class_negated;
+            ByteSet class = {0};
+            if (addEscapedClass(&class, e, &class_negated)) {
+                if (class_negated) {
+                    p->error = "Negated classes can't be used in brackets";
+                    return NULL;
+                }
+                for (int i = 0; i < 4; i++)
+                    set.bits[i] |= class.bits[i];
+                p->pos += 2;
+                continue;
+            }
+            lo = escapedByte(e);
+            if (lo < 0) {
+                p->error = "Unknown escape sequence";
+                return NULL;
+            }
+            p->pos += 2;
+        } else if ((uint8_t) c >= 0x80 && sequenceLength(p) > 1) {
+            if (negated) {
+                p->error = "Negated brackets can only hold ASCII characters";
+                return NULL;
+            }
+            multi = alter(p, multi, parseCodepoint(p));
+            if (multi == NULL)
+                return NULL;
+            if (p->pos + 1 < p->len && p->src[p->pos] == '-' && p->src[p->pos+1] != ']') {
+                p->error = "Ranges can only hold ASCII characters";
+                return NULL;
+            }
+            continue;
+        } else {
+            lo = (uint8_t) c;
+            p->pos++;
+        }
+
+        int hi = lo;
+        if (p->pos + 1 < p->len && p->src[p->pos] == '-' && p->src[p->pos+1] != ']') {
+            p->pos++;
+            c = p->src[p->pos];
+            if (c == '\\' && p->pos + 1 < p->len) {
+                hi = escapedByte(p->src[p->pos+1]);
+                p->pos += 2;
+            } else {
+                hi = (uint8_t) c;
+                p->pos++;
+            }
+            if (hi < lo || hi >= 0x80) {
+                p->error = "Invalid range";
+                return NULL;
+            }
+        }
+        ByteSet_addRange(&set, lo, hi);
+    }
+
+    if (negated) {
+        if (p->flags & REGEX_ICASE)
+            ByteSet_foldCase(&set);
+        complementASCII(&set);
+        return asciiOrMultibyte(p, set);
+    }
+    Node *single = newBytes(p, set);
+    if (single == NULL)
+        return NULL;
+    if (multi == NULL)
+        return single;
+    return alter(p, single, multi);
+}
+
+static Node *parseAlternation(Parser *p);
+
+static Node *parseAtom(Parser *p)
+{
+    char c = p->src[p->pos];
+    switch (c) {
+        case '(': {
+            p->pos++;
+            Node *node = parseAlternation(p);
+            if (node == NULL)
+                return NULL;
+            if (p->pos == p->len || p->src[p->pos] != ')') {
+                p->error = "Unmatched (";
+                return NULL;
+            }
+            p->pos++;
+            return node;
+        }
+
+        case '[':
+        return parseBracket(p);
+
+        case '.': {
+            p->pos++;
+            ByteSet set = {0};
+            ByteSet_addRange(&set, 0x00, 0x7F);
+            ByteSet_remove(&set, '\n');
+            return asciiOrMultibyte(p, set);
+        }
+
+        case '^':
+        p->pos++;
+        return newNode(p, Node_LINE_START, NULL, NULL);
+
+        case '$':
+        p->pos++;
+        return newNode(p, Node_LINE_END, NULL, NULL);
+
+        case '*':
+        case '+':
+        case '?':
+        p->error = "Nothing to repeat";
+        return NULL;
+
+        case '\\': {
+            if (p->pos + 1 == p->len) {
+                p->error = "Trailing backslash";
+                return NULL;
+            }
+            char e = p->src[p->pos+1];
+            bool negated;
+            ByteSet set = {0};
+            if (addEscapedClass(&set, e, &negated)) {
+                p->pos += 2;
+                if (!negated)
+                    return newBytes(p, set);
+                complementASCII(&set);
+                return asciiOrMultibyte(p, set);
+            }
+            if ((uint8_t) e >= 0x80) {
+                p->pos++;
+                return parseCodepoint(p);
+            }
+            int b = escapedByte(e);
+            if (b < 0) {
+                p->error = "Unknown escape sequence";
+                return NULL;
+            }
+            p->pos += 2;
+            return newByte(p, b);
+        }
+    }
+    return parseCodepoint(p);
+}
+
+/* Parses a {m}, {m,} or {m,n} bound. Braces that
+ * don't start one are taken literally. */
+static bool parseBound(Parser *p, int *min, int *max)
+{
+    size_t pos = p->pos + 1;
+    long m = 0, n;
+    size_t digits = 0;
+    while (pos < p->len && p->src[pos] >= '0' && p->src[pos] <= '9' && m <= MAX_REPEAT) {
+        m = 10 * m + (p->src[pos++] - '0');
+        digits++;
+    }
+    if (digits == 0)
+        return false;
+
+    n = m;
+    if (pos < p->len && p->src[pos] == ',') {
+        pos++;
+        n = -1;
+        if (pos < p->len && p->src[pos] >= '0' && p->src[pos] <= '9') {
+            n = 0;
+            while (pos < p->len && p->src[pos] >= '0' && p->src[pos] <= '9' && n <= MAX_REPEAT)
+                n = 10 * n + (p->src[pos++] - '0');
+        }
+    }
+    if (pos == p->len || p->src[pos] != '}')
+        return false;
+
+    if (m > MAX_REPEAT || n > MAX_REPEAT || (n >= 0 && n < m)) {
+        p->error = "Invalid repetition bound";
+        return false;
+    }
+    p->pos = pos + 1;
+    *min = m;
+    *max = n;
+    return true;
+}
+
+static Node *parseRepeat(Parser *p)
+{
+    Node *node = parseAtom(p);
+    while (node != NULL && p->pos < p->len) {
+        int min, max;
+        char c = p->src[p->pos];
+        if (c == '*') {
+            min = 0;
+            max = -1;
+            p->pos++;
+        } else if (c == '+') {
+            min = 1;
+            max = -1;
+            p->pos++;
+        } else if (c == '?') {
+            min = 0;
+            max = 1;
+            p->pos++;
+        } else if (c == '{') {
+            if (!parseBound(p, &min, &max)) {
+                if (p->error != NULL)
+                    return NULL;
+                break;
+            }
+        } else
+            break;
+
+        node = newNode(p, Node_REPEAT, node, NULL);
+        if (node != NULL) {
+            node->min = min;
+            node->max = max;
+        }
+    }
+    return node;
+}
+
+static Node *parseConcat(Parser *p)
+{
+    Node *node = newNode(p, Node_EMPTY, NULL, NULL);
+    while (node != NULL && p->pos < p->len
+        && p->src[p->pos] != '|' && p->src[p->pos] != ')')
+        node = concat(p, node, parseRepeat(p));
+    return node;
+}
+
+static Node *parseAlternation(Parser *p)
+{
+    Node *node = parseConcat(p);
+    while (node != NULL && p->pos < p->len && p->src[p->pos] == '|') {
+        p->pos++;
+        node = alter(p, node, parseConcat(p));
+    }
+    return node;
+}
+
+/* --- Compiling --- */
+
+typedef struct {
+    Inst    *insts;
+    uint32_t num_insts;
+    uint32_t max_insts;
+    bool     reverse;
+} Compiler;
+
+static uint32_t emit(Compiler *c, Op op, uint32_t arg, uint32_t next)
+{
+    if (next == UINT32_MAX || c->num_insts == MAX_INSTS)
+        return UINT32_MAX;
+    if (c->num_insts == c->max_insts) {
+        uint32_t max_insts = MAX(2 * c->max_insts, 64);
+        Inst *insts = realloc(c->insts, max_insts * sizeof(Inst));
+        if (insts == NULL)
+            return UINT32_MAX;
+        c->insts = insts;
+        c->max_insts = max_insts;
+    }
+    c->insts[c->num_insts] = (Inst) {op, arg, next};
+    return c->num_insts++;
+}
+
+/* Compiles [node] so that it goes on at [next]
+ * and returns where it starts, or UINT32_MAX if
+ * the program got too big. The reverse program
+ * matches the text back to front, so it has its
+ * concatenations and line anchors swapped. */
+static uint32_t compile(Compiler *c, Node *node, uint32_t next)
+{
+    if (next == UINT32_MAX)
+        return UINT32_MAX;
+
+    switch (node->type) {
+        case Node_EMPTY:
+        return next;
+
+        case Node_BYTES:
+        return emit(c, Op_BYTES, node->set, next);
+
+        case Node_CONCAT:
+        if (c->reverse)
+            return compile(c, node->right, compile(c, node->left, next));
+        return compile(c, node->left, compile(c, node->right, next));
+
+        case Node_ALTER: {
+            uint32_t left  = compile(c, node->left, next);
+            uint32_t right = compile(c, node->right, next);
+            if (left == UINT32_MAX)
+                return UINT32_MAX;
+            return emit(c, Op_SPLIT, left, right);
+        }
+
+        case Node_LINE_START:
+        return emit(c, c->reverse ? Op_LINE_END : Op_LINE_START, 0, next);
+
+        case Node_LINE_END:
+        return emit(c, c->reverse ? Op_LINE_START : Op_LINE_END, 0, next);
+
+        case Node_REPEAT: {
+            uint32_t pc = next;
+            if (node->max < 0) {
+                uint32_t loop = emit(c, Op_SPLIT, 0, next);
+                uint32_t body = compile(c, node->left, loop);
+                if (body == UINT32_MAX)
+                    return UINT32_MAX;
+                c->insts[loop].arg = body;
+                pc = loop;
+            } else {
+                // Each optional copy either goes on
+                // to the next one or skips the rest.
+                for (int i = node->min; i < node->max; i++) {
+                    uint32_t body = compile(c, node->left, pc);
+                    if (body == UINT32_MAX)
+                        return UINT32_MAX;
+                    pc = emit(c, Op_SPLIT, body, next);
+                }
+            }
+            for (int i = 0; i < node->min; i++)
+                pc = compile(c, node->left, pc);
+            return pc;
+        }
+    }
+    return UINT32_MAX;
+}
+
+/* --- Deterministic automaton --- */
+
+static bool DFA_init(DFA *dfa, const Regex *re, Compiler *c, uint32_t start, bool anchored)
+{
+    dfa->re = re;
+    dfa->insts = c->insts;
+    dfa->num_insts = c->num_insts;
+    dfa->start = start;
+    dfa->anchored = anchored;
+    memset(dfa->buckets, 0, sizeof(dfa->buckets));
+    dfa->initial[0] = NULL;
+    dfa->initial[1] = NULL;
+    dfa->blocks = NULL;
+    dfa->memory = 0;
+    dfa->flushes = 0;
+    dfa->generation = 0;
+
+    // A state holds every instruction at most once,
+    // plus a mark after each group.
+    size_t n = c->num_insts;
+    dfa->marks      = calloc(n, sizeof(uint32_t));
+    dfa->step_marks = calloc(n, sizeof(uint32_t));
+    dfa->stack   = malloc(n * sizeof(uint32_t));
+    dfa->closure = malloc(2 * n * sizeof(uint32_t));
+    dfa->key     = malloc((2 * n + 2) * sizeof(uint32_t));
+    return dfa->marks != NULL && dfa->step_marks != NULL && dfa->stack != NULL
+        && dfa->closure != NULL && dfa->key != NULL;
+}
+
+static void flush(DFA *dfa)
+{
+    while (dfa->blocks != NULL) {
+        DBlock *next = dfa->blocks->next;
+        free(dfa->blocks);
+        dfa->blocks = next;
+    }
+    memset(dfa->buckets, 0, sizeof(dfa->buckets));
+    dfa->initial[0] = NULL;
+    dfa->initial[1] = NULL;
+    dfa->memory = 0;
+    dfa->flushes++;
+}
+
+static void DFA_free(DFA *dfa)
+{
+    flush(dfa);
+    free(dfa->insts);
+    free(dfa->marks);
+    free(dfa->step_marks);
+    free(dfa->stack);
+    free(dfa->closure);
+    free(dfa->key);
+}
+
+static void *allocate(DFA *dfa, size_t size)
+{
+    size = (size + 7) & ~(size_t) 7;
+    DBlock *block = dfa->blocks;
+    if (block == NULL || DFA_BLOCK_SIZE - block->used < size) {
+        size_t block_size = MAX(size, DFA_BLOCK_SIZE);
+        block = malloc(sizeof(DBlock) + block_size);
+        if (block == NULL)
+            return NULL;
+        block->used = 0;
+        block->next = dfa->blocks;
+        dfa->blocks = block;
+        dfa->memory += sizeof(DBlock) + block_size;
+    }
+    void *p = block->data + block->used;
+    block->used += size;
+    return p;
+}
+
+static uint32_t nextGeneration(DFA *dfa)
+{
+    if (++dfa->generation == 0) {
+        memset(dfa->marks, 0, dfa->num_insts * sizeof(uint32_t));
+        memset(dfa->step_marks, 0, dfa->num_insts * sizeof(uint32_t));
+        dfa->generation = 1;
+    }
+    return dfa->generation;
+}
+
+/* Follows the empty transitions from the threads
+ * of [key], leaving in the closure buffer the ones
+ * that consume a byte, group by group, with a mark
+ * after each group and MARK-1 after those that get
+ * to a match. Threads that an earlier group already
+ * has are dropped. Returns the length. */
+static size_t getClosure(DFA *dfa, const uint32_t *key, size_t key_len,
+                         bool line_start, bool line_end)
+{
+    uint32_t gen = nextGeneration(dfa);
+    size_t len = 0;
+    size_t i = 0;
+    while (i < key_len) {
+        bool matched = false;
+        for (; key[i] != MARK; i++) {
+            size_t depth = 0;
+            dfa->stack[depth++] = key[i];
+            while (depth > 0) {
+                uint32_t pc = dfa->stack[--depth];
+                if (dfa->marks[pc] == gen)
+                    continue;
+                dfa->marks[pc] = gen;
+
+                Inst *inst = &dfa->insts[pc];
+                switch (inst->op) {
+                    case Op_BYTES: dfa->closure[len++] = pc; break;
+                    case Op_MATCH: matched = true; break;
+                    case Op_SPLIT:
+                    dfa->stack[depth++] = inst->next;
+                    dfa->stack[depth++] = inst->arg;
+                    break;
+                    case Op_LINE_START:
+                    if (line_start)
+                        dfa->stack[depth++] = inst->next;
+                    break;
+                    case Op_LINE_END:
+                    if (line_end)
+                        dfa->stack[depth++] = inst->next;
+                    break;
+                }
+            }
+        }
+        i++;
+        dfa->closure[len++] = matched ? MARK - 1 : MARK;
+    }
+    return len;
+}
+
+static bool closureMatches(DFA *dfa, const uint32_t *key, size_t key_len,
+                           bool line_start, bool line_end)
+{
+    size_t len = getClosure(dfa, key, key_len, line_start, line_end);
+    for (size_t i = 0; i < len; i++)
+        if (dfa->closure[i] == MARK - 1)
+            return true;
+    return false;
+}
+
+static uint32_t hashKey(const uint32_t *key, size_t len, uint32_t flags)
+{
+    uint32_t h = 2166136261u ^ flags;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ key[i]) * 16777619u;
+    return h;
+}
+
+/* Returns the state with the threads of [key],
+ * building it if it's not in the cache. When the
+ * cache is full it's emptied first, which the
+ * caller can tell by the flush count. */
+static DState *intern(DFA *dfa, const uint32_t *key, size_t len, uint32_t flags)
+{
+    uint32_t hash = hashKey(key, len, flags);
+    DState **bucket = &dfa->buckets[hash % DFA_BUCKETS];
+    for (DState *s = *bucket; s != NULL; s = s->chain)
+        if (s->hash == hash && (s->flags & DState_KEY_FLAGS) == flags
+            && s->key_len == len && !memcmp(s->key, key, len * sizeof(uint32_t)))
+            return s;
+
+    int num_classes = dfa->re->num_classes;
+    size_t size = sizeof(DState) + num_classes * sizeof(DState*) + len * sizeof(uint32_t);
+    if (dfa->memory + size > DFA_MAX_MEMORY && dfa->memory > 0) {
+        flush(dfa);
+        bucket = &dfa->buckets[hash % DFA_BUCKETS];
+    }
+    DState *s = allocate(dfa, size);
+    if (s == NULL)
+        return NULL;
+    s->hash = hash;
+    s->flags = flags;
+    s->key_len = len;
+    s->key = (uint32_t*) (s->next + num_classes);
+    memcpy(s->key, key, len * sizeof(uint32_t));
+    memset(s->next, 0, num_classes * sizeof(DState*));
+
+    bool line_start = flags & DState_LINE_START;
+    if (closureMatches(dfa, key, len, line_start, false))
+        s->flags |= DState_MATCH_BEFORE;
+    if (closureMatches(dfa, key, len, line_start, true))
+        s->flags |= DState_MATCH_BEFORE_NL;
+    if (len == 0 && (dfa->anchored || (flags & DState_MATCHED)))
+        s->flags |= DState_DEAD;
+
+    s->chain = *bucket;
+    *bucket = s;
+
+    // The unanchored automaton gets back to these
+    // wherever no match is in progress, so they're
+    // remembered even when they're built by a step.
+    if (len == 2 && key[0] == dfa->start && !(flags & DState_MATCHED))
+        dfa->initial[line_start] = s;
+    return s;
+}
+
+static DState *getInitial(DFA *dfa, bool line_start)
+{
+    if (dfa->initial[line_start] == NULL) {
+        uint32_t key[2] = {dfa->start, MARK};
+        intern(dfa, key, 2, line_start ? DState_LINE_START : 0);
+    }
+    return dfa->initial[line_start];
+}
+
+/* Builds the state that [s] goes to on a byte of
+ * class [cls]. */
+static DState *computeNext(DFA *dfa, DState *s, int cls)
+{
+    const Regex *re = dfa->re;
+    uint8_t byte = re->reps[cls];
+    bool line_start = s->flags & DState_LINE_START;
+    size_t closure_len = getClosure(dfa, s->key, s->key_len, line_start, byte == '\n');
+
+    uint32_t gen = nextGeneration(dfa);
+    size_t len = 0;
+    bool matched = s->flags & DState_MATCHED;
+    size_t group_start = 0;
+    for (size_t i = 0; i < closure_len; i++) {
+        uint32_t pc = dfa->closure[i];
+        if (pc == MARK || pc == MARK - 1) {
+            if (len > group_start)
+                dfa->key[len++] = MARK;
+            group_start = len;
+            if (pc == MARK - 1) {
+                matched = true;
+                break;
+            }
+            continue;
+        }
+        Inst *inst = &dfa->insts[pc];
+        if (ByteSet_has(&re->sets[inst->arg], byte) && dfa->step_marks[inst->next] != gen) {
+            dfa->step_marks[inst->next] = gen;
+            dfa->key[len++] = inst->next;
+        }
+    }
+    if (!matched && !dfa->anchored && dfa->step_marks[dfa->start] != gen) {
+        dfa->key[len++] = dfa->start;
+        dfa->key[len++] = MARK;
+    }
+
+    uint32_t flags = 0;
+    if (byte == '\n')
+        flags |= DState_LINE_START;
+    if (matched)
+        flags |= DState_MATCHED;
+
+    size_t flushes = dfa->flushes;
+    DState *next = intern(dfa, dfa->key, len, flags);
+    if (next != NULL && flushes == dfa->flushes)
+        s->next[cls] = next;
+    return next;
+}
+
+/* --- Searching --- */
+
+typedef struct {
+    GapBuffer  *buf; // NULL for a plain string
+    const char *str;
+    size_t      len;
+} Text;
+
+static const char *getChunk(Text *text, size_t offset, size_t *len)
+{
+    if (text->buf != NULL)
+        return GapBuffer_getChunk(text->buf, offset, len);
+    *len = text->len - offset;
+    return text->str + offset;
+}
+
+static const char *getChunkBefore(Text *text, size_t offset, size_t *len)
+{
+    if (text->buf != NULL)
+        return GapBuffer_getChunkBefore(text->buf, offset, len);
+    *len = offset;
+    return text->str;
+}
+
+static bool isNewline(Text *text, size_t offset)
+{
+    size_t len;
+    const char *chunk = getChunk(text, offset, &len);
+    return chunk != NULL && len > 0 && chunk[0] == '\n';
+}
+
+/* Returns how far in [chunk], from [i] on, the
+ * forward automaton can jump while it's in its
+ * initial state for a byte that isn't a newline.
+ * Bytes no match starts with leave it there, and so
+ * does anything before an occurrence of the prefix,
+ * since every match starts with it. The byte before
+ * the occurrence is still stepped through, which
+ * only starts a thread that dies. */
+static size_t skipAhead(const Regex *re, const uint8_t *chunk, size_t i, size_t len)
+{
+    if (re->prefix_len > 0) {
+        const char *found = Literal_find((const char*) chunk + i, len - i,
+                                         re->prefix, re->prefix_len);
+        size_t j = (found != NULL) ? (size_t) ((const uint8_t*) found - chunk)
+                                   : len - MIN(len - i, re->prefix_len - 1);
+        return (j > i) ? j - 1 : i;
+    }
+    while (i < len && !re->first[chunk[i]])
+        i++;
+    return i;
+}
+
+/* Runs the forward automaton from [offset] and
+ * returns where the leftmost-longest match that
+ * ends by [end] ends, or SIZE_MAX. */
+static size_t scanForward(Regex *re, Text *text, size_t offset, size_t end)
+{
+    DFA *dfa = &re->forward;
+    bool line_start = (offset == 0 || isNewline(text, offset - 1));
+    DState *s = getInitial(dfa, line_start);
+    if (s == NULL)
+        return SIZE_MAX;
+
+    // Building states may change which one is the
+    // initial one.
+    DState *skip_from = re->can_skip ? dfa->initial[0] : NULL;
+
+    size_t match_end = SIZE_MAX;
+    size_t pos = offset;
+    while (pos < end) {
+        size_t chunk_len;
+        const uint8_t *chunk = (const uint8_t*) getChunk(text, pos, &chunk_len);
+        chunk_len = MIN(chunk_len, end - pos);
+        for (size_t i = 0; i < chunk_len; i++) {
+            if (s == skip_from) {
+                size_t skipped = skipAhead(re, chunk, i, chunk_len) - i;
+                i += skipped;
+                re->skip_bytes += skipped;
+                if (++re->skip_tries == SKIP_TRIES) {
+                    re->can_skip = (re->skip_bytes >= SKIP_TRIES * SKIP_MIN_AVERAGE);
+                    re->skip_tries = 0;
+                    re->skip_bytes = 0;
+                    if (!re->can_skip)
+                        skip_from = NULL;
+                }
+                if (i == chunk_len)
+                    break;
+            }
+            uint8_t b = chunk[i];
+            if (s->flags & DState_SPECIAL) {
+                if (s->flags & DState_DEAD)
+                    return match_end;
+                if (s->flags & (b == '\n' ? DState_MATCH_BEFORE_NL : DState_MATCH_BEFORE))
+                    match_end = pos + i;
+            }
+            int cls = re->classes[b];
+            DState *next = s->next[cls];
+            if (next == NULL) {
+                if ((next = computeNext(dfa, s, cls)) == NULL)
+                    return SIZE_MAX;
+                skip_from = re->can_skip ? dfa->initial[0] : NULL;
+            }
+            s = next;
+        }
+        pos += chunk_len;
+    }
+    bool line_end = (end == text->len || isNewline(text, end));
+    if (s->flags & (line_end ? DState_MATCH_BEFORE_NL : DState_MATCH_BEFORE))
+        match_end = end;
+    return match_end;
+}
+
+/* Runs the reverse automaton back from [end] and
+ * returns the lowest offset, not before [offset],
+ * where a match that ends at [end] starts. */
+static size_t scanBackward(Regex *re, Text *text, size_t offset, size_t end)
+{
+    DFA *dfa = &re->reverse;
+    bool line_start = (end == text->len || isNewline(text, end));
+    DState *s = getInitial(dfa, line_start);
+    if (s == NULL)
+        return SIZE_MAX;
+
+    size_t match_start = SIZE_MAX;
+    size_t pos = end;
+    while (pos > offset) {
+        size_t chunk_len;
+        const uint8_t *chunk = (const uint8_t*) getChunkBefore(text, pos, &chunk_len);
+        const uint8_t *p = chunk + chunk_len;
+        chunk_len = MIN(chunk_len, pos - offset);
+        for (size_t i = 0; i < chunk_len; i++) {
+            uint8_t b = *--p;
+            if (s->flags & DState_SPECIAL) {
+                if (s->flags & DState_DEAD)
+                    return match_start;
+                if (s->flags & (b == '\n' ? DState_MATCH_BEFORE_NL : DState_MATCH_BEFORE))
+                    match_start = pos - i;
+            }
+            int cls = re->classes[b];
+            DState *next = s->next[cls];
+            if (next == NULL && (next = computeNext(dfa, s, cls)) == NULL)
+                return SIZE_MAX;
+            s = next;
+        }
+        pos -= chunk_len;
+    }
+    bool line_end = (offset == 0 || isNewline(text, offset - 1));
+    if (s->flags & (line_end ? DState_MATCH_BEFORE_NL : DState_MATCH_BEFORE))
+        match_start = offset;
+    return match_start;
+}
+
+static bool find(Regex *re, Text *text, size_t offset, size_t end,
+                 size_t *match_off, size_t *match_len)
+{
+    end = MIN(end, text->len);
+    if (offset > end)
+        return false;
+
+    size_t match_end = scanForward(re, text, offset, end);
+    if (match_end == SIZE_MAX)
+        return false;
+    size_t match_start = scanBackward(re, text, offset, match_end);
+    if (match_start == SIZE_MAX)
+        return false;
+
+    *match_off = match_start;
+    *match_len = match_end - match_start;
+    return true;
+}
+
+/* Finds the leftmost-longest match that lies in
+ * [offset, end) of [str]. The text around that
+ * range is still looked at by the anchors. */
+bool Regex_find(Regex *re, const char *str, size_t len, size_t offset,
+                size_t end, size_t *match_off, size_t *match_len)
+{
+    Text text = {NULL, str, len};
+    return find(re, &text, offset, end, match_off, match_len);
+}
+
+/* Same as Regex_find, reading the buffer in place
+ * a contiguous run at a time. */
+bool Regex_findInBuffer(Regex *re, GapBuffer *buf, size_t offset,
+                        size_t end, size_t *match_off, size_t *match_len)
+{
+    Text text = {buf, NULL, GapBuffer_getUsage(buf)};
+    return find(re, &text, offset, end, match_off, match_len);
+}
+
+/* Splits the bytes in classes that every set
+ * either fully holds or doesn't hold at all, with
+ * the newline in a class of its own since the
+ * anchors tell it apart. */
+static void computeClasses(Regex *re)
+{
+    bool starts[256] = {0};
+    starts['\n'] = true;
+    starts['\n' + 1] = true;
+    for (size_t i = 0; i < re->num_sets; i++)
+        for (int b = 1; b < 256; b++)
+            if (ByteSet_has(&re->sets[i], b) != ByteSet_has(&re->sets[i], b - 1))
+                starts[b] = true;
+
+    int cls = 0;
+    re->reps[0] = 0;
+    for (int b = 0; b < 256; b++) {
+        if (b > 0 && starts[b]) {
+            cls++;
+            re->reps[cls] = b;
+        }
+        re->classes[b] = cls;
+    }
+    re->num_classes = cls + 1;
+}
+
+/* Collects the bytes that matches may start with,
+ * letting the anchors through, and the ones that
+ * all matches start with, for as long as there's
+ * only one possible byte. Returns false if a match
+ * may be empty, since then it can start anywhere. */
+static bool computeFirstBytes(Regex *re, const Compiler *c, uint32_t start)
+{
+    re->prefix_len = 0;
+    uint32_t pc = start;
+    while (re->prefix_len < MAX_PREFIX && c->insts[pc].op == Op_BYTES) {
+        int byte = ByteSet_getSingle(&re->sets[c->insts[pc].arg]);
+        if (byte < 0)
+            break;
+        re->prefix[re->prefix_len++] = byte;
+        pc = c->insts[pc].next;
+    }
+
+    memset(re->first, 0, sizeof(re->first));
+    re->first['\n'] = true;
+
+    bool *visited = calloc(c->num_insts, sizeof(bool));
+    uint32_t *stack = malloc(c->num_insts * sizeof(uint32_t));
+    bool can_skip = (visited != NULL && stack != NULL);
+    size_t depth = 0;
+    if (can_skip) {
+        stack[depth++] = start;
+        visited[start] = true;
+    }
+    while (can_skip && depth > 0) {
+        const Inst *inst = &c->insts[stack[--depth]];
+        switch (inst->op) {
+            case Op_BYTES:
+            for (int b = 0; b < 256; b++)
+                if (ByteSet_has(&re->sets[inst->arg], b))
+                    re->first[b] = true;
+            break;
+
+            case Op_MATCH:
+            can_skip = false;
+            break;
+
+            case Op_SPLIT:
+            if (!visited[inst->arg]) {
+                visited[inst->arg] = true;
+                stack[depth++] = inst->arg;
+            }
+            /* fallthrough */
+            case Op_LINE_START:
+            case Op_LINE_END:
+            if (!visited[inst->next]) {
+                visited[inst->next] = true;
+                stack[depth++] = inst->next;
+            }
+            break;
+        }
+    }
+    free(visited);
+    free(stack);
+    return can_skip;
+}
+
+static void setError(char *error, size_t error_size, const char *message)
+{
+    if (error != NULL && error_size > 0)
+        snprintf(error, error_size, "%s", message);
+}
+
+/* Returns NULL if the pattern isn't valid, with a
+ * description of the problem in [error]. */
+Regex *Regex_compile(const char *pattern, size_t len, int flags,
+                     char *error, size_t error_size)
+{
+    Parser p = {
+        .src = pattern,
+        .len = len,
+        .pos = 0,
+        .flags = flags,
+        .nodes = malloc(MAX_NODES * sizeof(Node)),
+        .num_nodes = 0,
+        .sets = NULL,
+        .num_sets = 0,
+        .max_sets = 0,
+        .error = NULL,
+    };
+    Regex *re = malloc(sizeof(Regex));
+    if (p.nodes == NULL || re == NULL) {
+        free(p.nodes);
+        free(re);
+        setError(error, error_size, "Out of memory");
+        return NULL;
+    }
+
+    Node *root = parseAlternation(&p);
+    if (root != NULL && p.pos < p.len)
+        p.error = "Unmatched )";
+    if (p.error != NULL) {
+        setError(error, error_size, p.error);
+        free(p.nodes);
+        free(p.sets);
+        free(re);
+        return NULL;
+    }
+
+    re->sets = p.sets;
+    re->num_sets = p.num_sets;
+    computeClasses(re);
+
+    Compiler forward = {NULL, 0, 0, false};
+    Compiler reverse = {NULL, 0, 0, true};
+    uint32_t forward_start = compile(&forward, root, emit(&forward, Op_MATCH, 0, 0));
+    uint32_t reverse_start = compile(&reverse, root, emit(&reverse, Op_MATCH, 0, 0));
+    free(p.nodes);
+
+    if (forward_start == UINT32_MAX || reverse_start == UINT32_MAX) {
+        setError(error, error_size, "Pattern is too big");
+        free(forward.insts);
+        free(reverse.insts);
+        free(re->sets);
+        free(re);
+        return NULL;
+    }
+
+    re->can_skip = computeFirstBytes(re, &forward, forward_start);
+    re->skip_tries = 0;
+    re->skip_bytes = 0;
+
+    bool ok = DFA_init(&re->forward, re, &forward, forward_start, false);
+    ok = DFA_init(&re->reverse, re, &reverse, reverse_start, true) && ok;
+    if (!ok) {
+        setError(error, error_size, "Out of memory");
+        Regex_free(re);
+        return NULL;
+    }
+    return re;
+}
+
+void Regex_free(Regex *re)
+{
+    DFA_free(&re->forward);
+    DFA_free(&re->reverse);
+    free(re->sets);
+    free(re);
+}
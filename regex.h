@@ -0,0 +1,37 @@
+#ifndef SNBPAD_REGEX_H
+#define SNBPAD_REGEX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "gap.h"
+
+/* Regular expressions in the POSIX extended syntax
+ * (alternation, grouping, the *, +, ? and {m,n}
+ * repetitions, brackets with [:class:] names and
+ * the ^ and $ line anchors) plus the \d, \w and \s
+ * classes and their negations. Patterns work on
+ * UTF-8: a . or a negated bracket matches a whole
+ * codepoint, and . doesn't match newlines.
+ *
+ * A pattern is compiled to an automaton whose
+ * deterministic states are built as the text asks
+ * for them and kept in a cache of bounded size, so
+ * every byte of the text costs a table lookup most
+ * of the time, and never more than one step of the
+ * automaton: there's no backtracking. Matches are
+ * the leftmost-longest ones, as in POSIX.
+ *
+ * The cache makes searching modify the Regex, so
+ * threads that search at the same time need their
+ * own copy of it. */
+
+typedef struct Regex Regex;
+
+#define REGEX_ICASE      (1 << 0) // ASCII letters match both cases
+#define REGEX_NO_NEWLINE (1 << 1) // Nothing matches newlines, so matches stay on a line
+
+Regex *Regex_compile(const char *pattern, size_t len, int flags, char *error, size_t error_size);
+void   Regex_free(Regex *re);
+bool   Regex_find(Regex *re, const char *str, size_t len, size_t offset, size_t end, size_t *match_off, size_t *match_len);
+bool   Regex_findInBuffer(Regex *re, GapBuffer *buf, size_t offset, size_t end, size_t *match_off, size_t *match_len);
+#endif
@@ -0,0 +1,164 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gap.h"
+#include "regex.h"
+#include "literal.h"
+
+// make regex_bench
+//
+// Measures the throughput of the regex engine over
+// lines of words, finding every match of a few
+// patterns in a flat buffer and in a gap buffer
+// whose gap sits in the middle of the text. The
+// literal kernels are timed on the first pattern,
+// which is a plain string, for comparison. The
+// size in MB can be passed as first argument.
+
+#define REPEAT 2
+
+static const char *words[] = {
+    "static", "const", "char", "return", "buffer", "offset", "length",
+    "while", "size_t", "struct", "include", "running", "parsing", "if",
+    "12", "404", "2024", "0x1f", "=", "+=", "(", ")", "{", "}", ";",
+};
+
+static const char *patterns[] = {
+    "needle",
+    "[a-z]+ing",
+    "(buffer|offset|length)\\[",
+    "\\d{3,}",
+    "^#include",
+    "[[:upper:]][a-z]*Error",
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double toGBps(size_t size, double seconds)
+{
+    return (double) size * REPEAT / seconds / 1e9;
+}
+
+/* Fills [buffer] with lines of random words, with
+ * a rare "needle" so that the literal search has
+ * something to find. */
+static void fill(char *buffer, size_t size)
+{
+    size_t num_words = sizeof(words) / sizeof(words[0]);
+    size_t line_len = 0;
+    size_t i = 0;
+    srand(1);
+    while (i < size) {
+        const char *word = (rand() % 4096 == 0) ? "needle" : words[rand() % num_words];
+        size_t len = strlen(word);
+        if (line_len > 60 || i + len + 1 > size) {
+            buffer[i++] = '\n';
+            line_len = 0;
+            continue;
+        }
+        memcpy(buffer + i, word, len);
+        i += len;
+        buffer[i++] = ' ';
+        line_len += len + 1;
+    }
+}
+
+static size_t countMatches(Regex *re, const char *str, GapBuffer *buf, size_t size)
+{
+    size_t count = 0;
+    size_t pos = 0;
+    size_t off, len;
+    while (str != NULL ? Regex_find(re, str, size, pos, size, &off, &len)
+                       : Regex_findInBuffer(re, buf, pos, size, &off, &len)) {
+        pos = off + (len > 0 ? len : 1);
+        count++;
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size = 256;
+    if (argc > 1)
+        size = strtoul(argv[1], NULL, 10);
+    size <<= 20;
+
+    char *buffer = malloc(size);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    fill(buffer, size);
+
+    GapBuffer buf;
+    GapBuffer_initEmpty(&buf);
+    if (!GapBuffer_insertString(&buf, buffer, size)) {
+        fprintf(stderr, "Error: Out of memory\n");
+        GapBuffer_free(&buf);
+        free(buffer);
+        return -1;
+    }
+    GapBuffer_setCursor(&buf, size / 2);
+
+    fprintf(stdout, "%zu MB of text\n", size >> 20);
+    fprintf(stdout, "%-26s %10s %12s %12s\n", "pattern", "matches", "flat GB/s", "gap GB/s");
+
+    size_t num_patterns = sizeof(patterns) / sizeof(patterns[0]);
+    for (size_t p = 0; p < num_patterns; p++) {
+
+        char error[64];
+        Regex *re = Regex_compile(patterns[p], strlen(patterns[p]), REGEX_NO_NEWLINE,
+                                  error, sizeof(error));
+        if (re == NULL) {
+            fprintf(stderr, "Error: %s: %s\n", patterns[p], error);
+            continue;
+        }
+
+        size_t found = 0;
+        double start = now();
+        for (int r = 0; r < REPEAT; r++)
+            found += countMatches(re, buffer, NULL, size);
+        double t_flat = now() - start;
+
+        size_t found_gap = 0;
+        start = now();
+        for (int r = 0; r < REPEAT; r++)
+            found_gap += countMatches(re, NULL, &buf, size);
+        double t_gap = now() - start;
+        Regex_free(re);
+
+        if (found != found_gap) {
+            fprintf(stderr, "Error: %s gave %zu matches in the gap buffer instead of %zu\n",
+                    patterns[p], found_gap / REPEAT, found / REPEAT);
+            continue;
+        }
+        fprintf(stdout, "%-26s %10zu %12.2f %12.2f\n", patterns[p],
+                found / REPEAT, toGBps(size, t_flat), toGBps(size, t_gap));
+    }
+
+    const char *needle = patterns[0];
+    size_t needle_len = strlen(needle);
+    size_t found = 0;
+    double start = now();
+    for (int r = 0; r < REPEAT; r++) {
+        const char *q = buffer;
+        const char *end = buffer + size;
+        while ((q = Literal_find(q, end - q, needle, needle_len)) != NULL) {
+            found++;
+            q += needle_len;
+        }
+    }
+    double t_literal = now() - start;
+    fprintf(stdout, "%-26s %10zu %12.2f %12s\n", "needle (literal kernel)",
+            found / REPEAT, toGBps(size, t_literal), "-");
+
+    GapBuffer_free(&buf);
+    free(buffer);
+    return 0;
+}
@@ -86,7 +86,10 @@ void Scrollbar_setValue(Scrollbar *state, int value)
     if (adjusted_value > max_scroll)
         adjusted_value = max_scroll;
 
-    state->amount = adjusted_value;
+    if (adjusted_value != state->amount) {
+        state->amount = adjusted_value;
+        GUIElement_invalidateAll(state->parent);
+    }
 }
 
 void Scrollbar_addValue(Scrollbar *state, int delta)
@@ -98,6 +101,8 @@ void Scrollbar_addValue(Scrollbar *state, int delta)
 void Scrollbar_addForce(Scrollbar *state, int delta)
 {
     state->force += delta;
+    if (state->force != 0)
+        GUIElement_scheduleTick(0);
 }
 
 void Scrollbar_tick(Scrollbar *state, uint64_t time_in_ms)
@@ -120,6 +125,10 @@ void Scrollbar_tick(Scrollbar *state, uint64_t time_in_ms)
         }
     }
     state->force = force;
+
+    // Keep ticking until the inertia runs out
+    if (force != 0)
+        GUIElement_scheduleTick(0);
 }
 
 static int getParentLogicSize(Scrollbar *state)
@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "utils.h"
+#include "regex.h"
+#include "treeview.h"
+#include "filesearch.h"
+#include "searchpanel.h"
+#include "textrenderutils.h"
+
+typedef struct {
+    GUIElement base;
+    const SearchPanelStyle *style;
+    FontMetrics *font;
+    GUIElement  *tree_view;
+    uint32_t     index_version;
+    FileSearch  *search; // NULL while there's no index
+    char   query[FILESEARCH_MAX_PATTERN];
+    size_t query_len;
+    bool   regex;     // The query is a regular expression
+    char   error[64]; // Why the regex doesn't compile
+    FileSearchHit *hits; // With their previews in [text]
+    size_t num_hits;
+    size_t max_hits;
+    char  *text;
+    size_t text_len;
+    size_t text_max;
+    FileSearchProgress progress;
+    size_t selected;
+    size_t first_row;
+    void (*callback)(const char*, size_t, size_t, size_t, void*);
+    void *userp;
+} SearchPanel;
+
+// Hits are found on other threads
+static void notifyCallback(void)
+{
+    GUIElement_wakeUp();
+}
+
+/* Rebuilds the search if the tree view has a new
+ * index. Returns true if it did. */
+static bool syncIndex(SearchPanel *sp)
+{
+    uint32_t version;
+    const FileIndex *index = TreeView_getIndex(sp->tree_view, &version);
+    if (version == sp->index_version && (sp->search != NULL || index == NULL))
+        return false;
+
+    if (sp->search != NULL)
+        FileSearch_free(sp->search);
+    sp->search = NULL;
+    sp->index_version = version;
+    if (index != NULL) {
+        sp->search = FileSearch_new(index, 0, notifyCallback);
+        if (sp->search == NULL)
+            TraceLog(LOG_WARNING, "Couldn't prepare the project search");
+    }
+    return true;
+}
+
+/* Drops the hits and looks for the query again,
+ * which cancels the search going on. */
+static void restart(SearchPanel *sp)
+{
+    sp->num_hits = 0;
+    sp->text_len = 0;
+    sp->selected = 0;
+    sp->first_row = 0;
+    memset(&sp->progress, 0, sizeof(sp->progress));
+
+    // The workers compile the regex on their own,
+    // it's only checked here.
+    size_t len = sp->query_len;
+    sp->error[0] = '\0';
+    if (sp->regex && len > 0) {
+        Regex *re = Regex_compile(sp->query, len, REGEX_NO_NEWLINE, sp->error, sizeof(sp->error));
+        if (re == NULL)
+            len = 0;
+        else
+            Regex_free(re);
+    }
+    if (sp->search != NULL) {
+        FileSearch_start(sp->search, sp->query, len, sp->regex);
+        FileSearch_getProgress(sp->search, &sp->progress);
+    }
+    GUIElement_invalidateAll(&sp->base);
+}
+
+static void search(SearchPanel *sp)
+{
+    syncIndex(sp);
+    restart(sp);
+}
+
+static bool keepBatch(SearchPanel *sp, const FileSearchBatch *batch)
+{
+    if (sp->max_hits - sp->num_hits < batch->num_hits) {
+        size_t max = MAX(2 * sp->max_hits, sp->num_hits + batch->num_hits);
+        FileSearchHit *hits = realloc(sp->hits, max * sizeof(FileSearchHit));
+        if (hits == NULL)
+            return false;
+        sp->hits = hits;
+        sp->max_hits = max;
+    }
+    if (sp->text_max - sp->text_len < batch->text_len) {
+        size_t max = MAX(2 * sp->text_max, sp->text_len + batch->text_len);
+        char *text = realloc(sp->text, max);
+        if (text == NULL)
+            return false;
+        sp->text = text;
+        sp->text_max = max;
+    }
+
+    for (size_t i = 0; i < batch->num_hits; i++) {
+        FileSearchHit hit = batch->hits[i];
+        hit.preview_off += sp->text_len;
+        sp->hits[sp->num_hits++] = hit;
+    }
+    memcpy(sp->text + sp->text_len, batch->text, batch->text_len);
+    sp->text_len += batch->text_len;
+    return true;
+}
+
+static void selectRow(SearchPanel *sp, size_t row)
+{
+    if (row >= sp->num_hits)
+        return;
+    sp->selected = row;
+    if (sp->selected < sp->first_row)
+        sp->first_row = sp->selected;
+    if (sp->selected >= sp->first_row + sp->style->max_rows)
+        sp->first_row = sp->selected - sp->style->max_rows + 1;
+    GUIElement_invalidateAll(&sp->base);
+}
+
+static void openSelected(SearchPanel *sp)
+{
+    if (sp->search == NULL || sp->selected >= sp->num_hits)
+        return;
+
+    char path[4096];
+    const FileSearchHit *hit = &sp->hits[sp->selected];
+    size_t len = FileSearch_getPath(sp->search, hit->file, true, path, sizeof(path));
+    if (len >= sizeof(path)) {
+        TraceLog(LOG_WARNING, "Path is too long to be opened");
+        return;
+    }
+    sp->callback(path, len, hit->offset, hit->length, sp->userp);
+}
+
+static void freeCallback(GUIElement *elem)
+{
+    SearchPanel *sp = (SearchPanel*) elem;
+    if (sp->search != NULL)
+        FileSearch_free(sp->search);
+    free(sp->hits);
+    free(sp->text);
+    FontMetrics_unload(sp->font);
+    free(sp);
+}
+
+/* Takes the hits found since the last tick. */
+static void tickCallback(GUIElement *elem, uint64_t time_in_ms)
+{
+    (void) time_in_ms;
+    SearchPanel *sp = (SearchPanel*) elem;
+    if (sp->search == NULL) {
+        if (syncIndex(sp))
+            restart(sp);
+        if (sp->search == NULL)
+            return;
+    }
+
+    bool changed = false;
+    FileSearchBatch *batch;
+    while ((batch = FileSearch_poll(sp->search)) != NULL) {
+        if (!keepBatch(sp, batch))
+            TraceLog(LOG_WARNING, "Couldn't keep the hits of the search");
+        free(batch);
+        changed = true;
+    }
+
+    FileSearchProgress progress;
+    FileSearch_getProgress(sp->search, &progress);
+    if (progress.num_searched != sp->progress.num_searched
+        || progress.done != sp->progress.done
+        || progress.truncated != sp->progress.truncated)
+        changed = true;
+    sp->progress = progress;
+
+    if (changed)
+        GUIElement_invalidateAll(elem);
+}
+
+static void getStatus(SearchPanel *sp, char *dst, size_t max)
+{
+    const FileSearchProgress *progress = &sp->progress;
+    if (sp->search == NULL)
+        snprintf(dst, max, "Indexing...");
+    else if (sp->query_len == 0)
+        snprintf(dst, max, "Type to search the files of the project%s",
+                 sp->regex ? " with a regex" : "");
+    else if (sp->error[0] != '\0')
+        snprintf(dst, max, "%s", sp->error);
+    else if (!progress->done)
+        snprintf(dst, max, "Searching... %zu of %zu files, %zu hits",
+                 progress->num_searched, progress->num_files, sp->num_hits);
+    else
+        snprintf(dst, max, "%zu hits in %zu files%s", sp->num_hits, progress->num_files,
+                 progress->truncated ? ", stopped at the limit" : "");
+}
+
+/* Draws the location of [hit] followed by its
+ * line with the match highlighted. */
+static void renderHit(SearchPanel *sp, const FileSearchHit *hit, int x, int y)
+{
+    const SearchPanelStyle *style = sp->style;
+
+    char label[4096 + 16];
+    size_t len = FileSearch_getPath(sp->search, hit->file, false, label, sizeof(label) - 16);
+    if (len >= sizeof(label) - 16)
+        len = 0;
+    len += snprintf(label + len, 16, ":%u: ", hit->line + 1);
+    x += renderString(sp->font, label, len, x, y, style->font_size, style->path_fgcolor);
+
+    const char *preview = sp->text + hit->preview_off;
+    size_t match_len = MIN(hit->length, (size_t) hit->preview_len - hit->match_off);
+    size_t match_end = hit->match_off + match_len;
+    x += renderString(sp->font, preview, hit->match_off, x, y, style->font_size, style->fgcolor);
+    x += renderString(sp->font, preview + hit->match_off, match_len, x, y,
+                      style->font_size, style->match_fgcolor);
+    renderString(sp->font, preview + match_end, hit->preview_len - match_end, x, y,
+                 style->font_size, style->fgcolor);
+}
+
+static void drawCallback(GUIElement *elem)
+{
+    SearchPanel *sp = (SearchPanel*) elem;
+    const SearchPanelStyle *style = sp->style;
+    Rectangle region = elem->region;
+
+    Rectangle damage;
+    GUIElement_takeDamage(elem, &damage);
+
+    BeginScissorMode(region.x, region.y, region.width, region.height);
+    DrawRectangleRec(region, style->bgcolor);
+
+    int x = region.x + style->padding;
+    int y = region.y + style->padding;
+    int text_y = (style->line_height - style->font_size) / 2;
+    float query_x = x;
+    if (sp->regex) {
+        const char *label = "Regex: ";
+        query_x += renderString(sp->font, label, strlen(label), x, y + text_y,
+                                style->font_size, style->hint_fgcolor);
+    }
+    float query_w = renderString(sp->font, sp->query, sp->query_len,
+                                 query_x, y + text_y, style->font_size, style->fgcolor);
+    DrawRectangle(query_x + query_w, y + text_y, 2, style->font_size, style->cursor_color);
+
+    char status[128];
+    getStatus(sp, status, sizeof(status));
+    renderString(sp->font, status, strlen(status), x, y + style->line_height + text_y,
+                 style->font_size, style->hint_fgcolor);
+
+    size_t last = MIN(sp->first_row + style->max_rows, sp->num_hits);
+    for (size_t i = sp->first_row; i < last; i++) {
+        int row_y = y + (i - sp->first_row + 2) * style->line_height;
+        if (i == sp->selected)
+            DrawRectangle(region.x, row_y, region.width, style->line_height,
+                          style->selection_bgcolor);
+        renderHit(sp, &sp->hits[i], x, row_y + text_y);
+    }
+    EndScissorMode();
+}
+
+static GUIElement *onClickDownCallback(GUIElement *elem, int x, int y)
+{
+    (void) x;
+    SearchPanel *sp = (SearchPanel*) elem;
+    const SearchPanelStyle *style = sp->style;
+
+    int rows_y = style->padding + 2 * style->line_height;
+    if (y >= rows_y) {
+        size_t row = sp->first_row + (y - rows_y) / style->line_height;
+        if (row < sp->first_row + style->max_rows && row < sp->num_hits) {
+            selectRow(sp, row);
+            openSelected(sp);
+        }
+    }
+    return elem;
+}
+
+static void onMouseWheelCallback(GUIElement *elem, int y)
+{
+    SearchPanel *sp = (SearchPanel*) elem;
+    if (y > 0 && sp->selected > 0)
+        selectRow(sp, sp->selected - 1);
+    else if (y < 0)
+        selectRow(sp, sp->selected + 1);
+}
+
+static void onArrowUpDownCallback(GUIElement *elem)
+{
+    SearchPanel *sp = (SearchPanel*) elem;
+    if (sp->selected > 0)
+        selectRow(sp, sp->selected - 1);
+}
+
+static void onArrowDownDownCallback(GUIElement *elem)
+{
+    SearchPanel *sp = (SearchPanel*) elem;
+    selectRow(sp, sp->selected + 1);
+}
+
+static void onReturnDownCallback(GUIElement *elem)
+{
+    openSelected((SearchPanel*) elem);
+}
+
+static void onBackspaceDownCallback(GUIElement *elem)
+{
+    SearchPanel *sp = (SearchPanel*) elem;
+    if (sp->query_len == 0)
+        return;
+
+    // Drops the whole last codepoint
+    do
+        sp->query_len--;
+    while (sp->query_len > 0 && (sp->query[sp->query_len] & 0xC0) == 0x80);
+    search(sp);
+}
+
+static void onTextInputCallback(GUIElement *elem, const char *str, size_t len)
+{
+    SearchPanel *sp = (SearchPanel*) elem;
+    if (len > sizeof(sp->query) - sp->query_len)
+        return;
+    memcpy(sp->query + sp->query_len, str, len);
+    sp->query_len += len;
+    search(sp);
+}
+
+static void onToggleRegexCallback(GUIElement *elem)
+{
+    SearchPanel *sp = (SearchPanel*) elem;
+    sp->regex = !sp->regex;
+    search(sp);
+}
+
+static void onPasteCallback(GUIElement *elem)
+{
+    const char *text = GetClipboardText();
+    if (text == NULL)
+        return;
+
+    // Only up to the first line
+    size_t len = strcspn(text, "\r\n");
+    onTextInputCallback(elem, text, len);
+}
+
+static const GUIElementMethods methods = {
+    .free = freeCallback,
+    .tick = tickCallback,
+    .draw = drawCallback,
+    .onClickDown = onClickDownCallback,
+    .onMouseWheel = onMouseWheelCallback,
+    .onArrowUpDown = onArrowUpDownCallback,
+    .onArrowDownDown = onArrowDownDownCallback,
+    .onReturnDown = onReturnDownCallback,
+    .onBackspaceDown = onBackspaceDownCallback,
+    .onTextInput = onTextInputCallback,
+    .onPaste = onPasteCallback,
+    .onToggleRegex = onToggleRegexCallback,
+};
+
+/* Returns how tall the box is with the query, the
+ * status and every row. */
+int SearchPanel_getHeight(const SearchPanelStyle *style)
+{
+    return 2 * style->padding + (style->max_rows + 2) * style->line_height;
+}
+
+/* Keeps the query and its hits from the last time
+ * the box was shown, unless the files changed. */
+void SearchPanel_show(GUIElement *elem)
+{
+    SearchPanel *sp = (SearchPanel*) elem;
+    if (syncIndex(sp))
+        restart(sp);
+    GUIElement_invalidateAll(elem);
+}
+
+/* [callback] is called with the full path of the
+ * file of the hit that was picked, the offset of
+ * the match in it and its length. Files are taken
+ * from the index of [tree_view], which must
+ * outlive the box. */
+GUIElement *SearchPanel_new(Rectangle region,
+                            const char *name,
+                            GUIElement *tree_view,
+                            void (*callback)(const char*, size_t, size_t, size_t, void*),
+                            const SearchPanelStyle *style,
+                            void *userp)
+{
+    SearchPanel *sp = malloc(sizeof(SearchPanel));
+    if (sp == NULL)
+        return NULL;
+
+    sp->base.region = region;
+    sp->base.methods = &methods;
+    sp->base.dirty = false;
+    strncpy(sp->base.name, name, sizeof(sp->base.name));
+    sp->base.name[sizeof(sp->base.name)-1] = '\0';
+
+    sp->font = FontMetrics_load(loadFont(style->baked_font, style->font_data,
+                                         style->font_data_size, style->font_file,
+                                         style->font_size));
+    if (sp->font == NULL) {
+        free(sp);
+        return NULL;
+    }
+
+    sp->style = style;
+    sp->tree_view = tree_view;
+    sp->index_version = 0;
+    sp->search = NULL;
+    sp->query_len = 0;
+    sp->regex = false;
+    sp->error[0] = '\0';
+    sp->hits = NULL;
+    sp->num_hits = 0;
+    sp->max_hits = 0;
+    sp->text = NULL;
+    sp->text_len = 0;
+    sp->text_max = 0;
+    memset(&sp->progress, 0, sizeof(sp->progress));
+    sp->selected = 0;
+    sp->first_row = 0;
+    sp->callback = callback;
+    sp->userp = userp;
+    return (GUIElement*) sp;
+}
@@ -0,0 +1,42 @@
+#ifndef SNBPAD_SEARCHPANEL_H
+#define SNBPAD_SEARCHPANEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <raylib.h>
+#include "guielement.h"
+#include "bakedfont.h"
+
+/* A box that looks for the typed text in all the
+ * files a tree view indexed, to be shown over the
+ * other elements. Hits are listed as they're found
+ * and every change to the text starts over. */
+
+typedef struct {
+    Color bgcolor;
+    Color fgcolor;
+    Color path_fgcolor;
+    Color match_fgcolor;
+    Color hint_fgcolor;
+    Color selection_bgcolor;
+    Color cursor_color;
+    const BakedFont     *baked_font;
+    const unsigned char *font_data;
+    size_t               font_data_size;
+    const char  *font_file;
+    unsigned int font_size;
+    size_t line_height;
+    size_t padding;
+    size_t max_rows;
+} SearchPanelStyle;
+
+GUIElement *SearchPanel_new(Rectangle region,
+                            const char *name,
+                            GUIElement *tree_view,
+                            void (*callback)(const char*, size_t, size_t, size_t, void*),
+                            const SearchPanelStyle *style,
+                            void *userp);
+void SearchPanel_show(GUIElement *elem);
+int  SearchPanel_getHeight(const SearchPanelStyle *style);
+#endif
@@ -8,17 +8,101 @@
 #include "gapiter.h"
 #include "utils.h"
 #include "treeview.h"
+#include "quickopen.h"
+#include "filepicker.h"
+#include "searchpanel.h"
 #include "splitview.h"
 #include "textdisplay.h"
+#include "bakedfont.h"
 
 #include "font_data_inconsolata_light.c"
 #include "font_data_inconsolata_medium.c"
+#include "font_atlas_inconsolata_light.c"
+#include "font_atlas_inconsolata_medium.c"
 
 GUIElement *focused = NULL;
 GUIElement *last_focused = NULL;
 GUIElement *elements[2]; 
 size_t element_count = 0;
 
+// Shown over the elements when not NULL, and
+// focused until it's hidden.
+GUIElement *overlay = NULL;
+GUIElement *focused_before_overlay = NULL;
+
+// Element the file picker is picking a file for,
+// once its request was taken from guielement.c,
+// and whether the file is to be saved.
+static GUIElement *picker_requester = NULL;
+static bool picker_save = false;
+
+typedef struct {
+    int  key;
+    bool was_pressed;
+    int  counter;
+} KeyRepeat;
+
+/* Returns true when [key] is pressed and then
+ * every [interval] ms while it's held down. */
+static bool repeatKey(KeyRepeat *repeat, int interval, int ms_per_frame)
+{
+    bool trigger;
+    bool is_pressed = IsKeyDown(repeat->key);
+    if (is_pressed) {
+        if (!repeat->was_pressed) {
+            trigger = true;
+            repeat->counter = 0;
+        } else {
+            if (repeat->counter * ms_per_frame > interval) {
+                trigger = true;
+                repeat->counter = 0;
+            } else {
+                trigger = false;
+                repeat->counter++;
+            }
+        }
+    } else
+        trigger = false;
+    repeat->was_pressed = is_pressed;
+    return trigger;
+}
+
+static void showOverlay(GUIElement *elem)
+{
+    if (focused != NULL)
+        GUIElement_onFocusLost(focused);
+    focused_before_overlay = focused;
+    overlay = elem;
+    focused = elem;
+    GUIElement_onFocusGained(elem);
+    GUIElement_invalidateAll(elem);
+}
+
+static void hideOverlay(void)
+{
+    if (overlay == NULL)
+        return;
+    GUIElement_onFocusLost(overlay);
+    // Whatever was under it is drawn again
+    GUIElement_invalidateAll(overlay);
+    overlay = NULL;
+    focused = focused_before_overlay;
+    if (focused != NULL)
+        GUIElement_onFocusGained(focused);
+}
+
+static Rectangle getOverlayRegion(int height)
+{
+    int w = GetScreenWidth();
+    int h = GetScreenHeight();
+    Rectangle region;
+    region.width  = MIN(700, MAX(w - 40, 0));
+    region.height = MIN(height, MAX(h - 80, 0));
+    region.x = (w - region.width) / 2;
+    region.y = 40;
+    return region;
+}
+
 static void treeViewCallback(const char *file, 
                              size_t file_len, 
                              void *userp)
@@ -28,12 +112,63 @@ static void treeViewCallback(const char *file,
         GUIElement_openFile(last_focused, file);
 }
 
+/* Files the pointer rests on in the tree are
+ * loaded ahead for the display they'd open in. */
+static void treeViewHoverCallback(const char *file, 
+                                  size_t file_len, 
+                                  void *userp)
+{
+    (void) file_len;
+    (void) userp;
+    if (last_focused != NULL)
+        GUIElement_prefetchFile(last_focused, file);
+}
+
+static void quickOpenCallback(const char *file, 
+                              size_t file_len, 
+                              void *userp)
+{
+    hideOverlay();
+    treeViewCallback(file, file_len, userp);
+}
+
+/* Hits are opened with the cursor on the match. */
+static void searchPanelCallback(const char *file, 
+                                size_t file_len, 
+                                size_t offset, 
+                                size_t len, 
+                                void *userp)
+{
+    (void) file_len;
+    (void) userp;
+    hideOverlay();
+    TraceLog(LOG_INFO, "Opening \"%s\" at %zu", file, offset);
+    if (last_focused != NULL && GUIElement_openFile(last_focused, file))
+        GUIElement_selectRange(last_focused, offset, len);
+}
+
+static void filePickerCallback(const char *file, 
+                               size_t file_len, 
+                               void *userp)
+{
+    (void) file_len;
+    (void) userp;
+    hideOverlay();
+    if (picker_requester == NULL)
+        return;
+    if (picker_save)
+        GUIElement_saveFile(picker_requester, file);
+    else
+        GUIElement_openFile(picker_requester, file);
+    picker_requester = NULL;
+}
+
 void snbpad(void)
 {
     int w = 800;
     int h = 700;
 
-    SetConfigFlags(FLAG_WINDOW_RESIZABLE);
+    SetConfigFlags(FLAG_WINDOW_RESIZABLE | FLAG_VSYNC_HINT);
     InitWindow(w, h, "SnBpad");
     if (!IsWindowReady()) {
         TraceLog(LOG_FATAL, "Failed to create window");
@@ -57,9 +192,10 @@ void snbpad(void)
             .fgcolor = {0xcc, 0xcc, 0xcc, 0xff},
             .bgcolor = {48, 56, 65, 255},//{0x33, 0x33, 0x33, 0xff},
             .font_file = NULL,
+            .baked_font = &font_atlas_inconsolata_medium,
             .font_data = font_data_inconsolata_medium,
             .font_data_size = sizeof(font_data_inconsolata_medium),
-            .font_size = 22,
+            .font_size = font_atlas_inconsolata_medium.size,
             .auto_width = true,
             //.width = 40,
             .h_align = TextAlignH_RIGHT,
@@ -72,13 +208,15 @@ void snbpad(void)
         .text = {
             .nobg = false,
             .font_file = NULL,
+            .baked_font = &font_atlas_inconsolata_medium,
             .font_data = font_data_inconsolata_medium,
             .font_data_size = sizeof(font_data_inconsolata_medium),
-            .font_size = 22,
+            .font_size = font_atlas_inconsolata_medium.size,
             .v_align = TextAlignV_CENTER,
             .bgcolor = {48, 56, 65, 255},
             .fgcolor = {0xee, 0xee, 0xee, 0xff},
             .selection_bgcolor = {87, 95, 104, 0xff},
+            .match_bgcolor = {0x6b, 0x5a, 0x2e, 0xff},
         },
         .cursor = {
             .bgcolor = {0xbb, 0xbb, 0xbb, 0xff},
@@ -87,6 +225,7 @@ void snbpad(void)
         .h_scroll = &scrollbar_style,
         .auto_line_height = true,
         .line_height = 20,
+        .undo_budget = 64 * 1024 * 1024,
     };
 
     SplitViewStyle split_view_style = {
@@ -101,13 +240,20 @@ void snbpad(void)
         .bgcolor = {0x33, 0x33, 0x33, 0xff},
     };
 
+    // Besides what the .gitignore files say
+    static const char *const tree_view_exclude[] = {
+        "node_modules/",
+        NULL,
+    };
+
     TreeViewStyle tree_view_style = {
         .bgcolor = {0x33, 0x33, 0x33, 0xff},
         .fgcolor = {0xcc, 0xcc, 0xcc, 0xff},
         .font_file = NULL,
+        .baked_font = &font_atlas_inconsolata_light,
         .font_data = font_data_inconsolata_light,
         .font_data_size = sizeof(font_data_inconsolata_light),
-        .font_size = 23,
+        .font_size = font_atlas_inconsolata_light.size,
         .auto_line_height = false,
         .line_height = 30,
         .padding_top = 10,
@@ -115,8 +261,65 @@ void snbpad(void)
         .subtree_padding_left = 20,
         .v_scroll = &tree_view_scrollbar_style,
         .h_scroll = &tree_view_scrollbar_style,
+        .exclude = tree_view_exclude,
     };
 
+    QuickOpenStyle quick_open_style = {
+        .bgcolor = {0x26, 0x2b, 0x31, 0xff},
+        .fgcolor = {0xcc, 0xcc, 0xcc, 0xff},
+        .match_fgcolor = {0xff, 0xc6, 0x6d, 0xff},
+        .selection_bgcolor = {87, 95, 104, 0xff},
+        .cursor_color = {0xbb, 0xbb, 0xbb, 0xff},
+        .font_file = NULL,
+        .baked_font = &font_atlas_inconsolata_medium,
+        .font_data = font_data_inconsolata_medium,
+        .font_data_size = sizeof(font_data_inconsolata_medium),
+        .font_size = font_atlas_inconsolata_medium.size,
+        .line_height = 28,
+        .padding = 10,
+        .max_rows = 12,
+    };
+
+    FilePickerStyle file_picker_style = {
+        .bgcolor = {0x26, 0x2b, 0x31, 0xff},
+        .fgcolor = {0xcc, 0xcc, 0xcc, 0xff},
+        .dir_fgcolor = {0x8f, 0xbc, 0xe6, 0xff},
+        .hint_fgcolor = {0x88, 0x88, 0x88, 0xff},
+        .selection_bgcolor = {87, 95, 104, 0xff},
+        .cursor_color = {0xbb, 0xbb, 0xbb, 0xff},
+        .font_file = NULL,
+        .baked_font = &font_atlas_inconsolata_medium,
+        .font_data = font_data_inconsolata_medium,
+        .font_data_size = sizeof(font_data_inconsolata_medium),
+        .font_size = font_atlas_inconsolata_medium.size,
+        .line_height = 28,
+        .padding = 10,
+        .max_rows = 12,
+    };
+
+    SearchPanelStyle search_panel_style = {
+        .bgcolor = {0x26, 0x2b, 0x31, 0xff},
+        .fgcolor = {0xcc, 0xcc, 0xcc, 0xff},
+        .path_fgcolor = {0x8f, 0xbc, 0xe6, 0xff},
+        .match_fgcolor = {0xff, 0xc6, 0x6d, 0xff},
+        .hint_fgcolor = {0x88, 0x88, 0x88, 0xff},
+        .selection_bgcolor = {87, 95, 104, 0xff},
+        .cursor_color = {0xbb, 0xbb, 0xbb, 0xff},
+        .font_file = NULL,
+        .baked_font = &font_atlas_inconsolata_medium,
+        .font_data = font_data_inconsolata_medium,
+        .font_data_size = sizeof(font_data_inconsolata_medium),
+        .font_size = font_atlas_inconsolata_medium.size,
+        .line_height = 28,
+        .padding = 10,
+        .max_rows = 12,
+    };
+
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        strcpy(cwd, ".");
+
+    GUIElement *tv;
     GUIElement *sv2;
     {
         GUIElement *sv;
@@ -150,15 +353,12 @@ void snbpad(void)
             }
         }
 
-        GUIElement *tv;
         {
             Rectangle region = {0};
-            char tree_view_path[1024];
-            if (getcwd(tree_view_path, sizeof(tree_view_path)) == NULL)
-                strcpy(tree_view_path, ".");
             tv = TreeView_new(region, "Tree-View", 
-                              tree_view_path, 
+                              cwd, 
                               treeViewCallback,
+                              treeViewHoverCallback,
                               &tree_view_style,
                               NULL);
             if (tv == NULL) {
@@ -183,6 +383,38 @@ void snbpad(void)
     }
     elements[element_count++] = sv2;
 
+    GUIElement *quick_open = QuickOpen_new(getOverlayRegion(QuickOpen_getHeight(&quick_open_style)),
+                                           "Quick-Open", tv, quickOpenCallback,
+                                           &quick_open_style, NULL);
+    if (quick_open == NULL) {
+        GUIElement_free(sv2);
+        return;
+    }
+
+    // Made up front so that the working directory
+    // is already listed when it's first shown.
+    GUIElement *file_picker = FilePicker_new(getOverlayRegion(FilePicker_getHeight(&file_picker_style)),
+                                             "File-Picker", cwd, filePickerCallback,
+                                             &file_picker_style, NULL);
+    if (file_picker == NULL) {
+        GUIElement_free(quick_open);
+        GUIElement_free(sv2);
+        return;
+    }
+
+    GUIElement *search_panel = SearchPanel_new(getOverlayRegion(SearchPanel_getHeight(&search_panel_style)),
+                                               "Search-Panel", tv, searchPanelCallback,
+                                               &search_panel_style, NULL);
+    if (search_panel == NULL) {
+        GUIElement_free(file_picker);
+        GUIElement_free(quick_open);
+        GUIElement_free(sv2);
+        return;
+    }
+
+    // Escape hides the overlay instead
+    SetExitKey(KEY_NULL);
+
     int arrow_press_interval = 70;
 
     SetTraceLogLevel(LOG_DEBUG);
@@ -190,14 +422,17 @@ void snbpad(void)
     const int fps = 60;
     const int ms_per_frame = 1000 / fps;
     bool mouse_button_left_was_pressed = false;
-    bool arrow_left_was_pressed = false;
-    bool arrow_right_was_pressed = false;
-    int left_arrow_counter = 0;
-    int right_arrow_counter = 0;
+    KeyRepeat arrow_left  = { .key = KEY_LEFT  };
+    KeyRepeat arrow_right = { .key = KEY_RIGHT };
+    KeyRepeat arrow_up    = { .key = KEY_UP    };
+    KeyRepeat arrow_down  = { .key = KEY_DOWN  };
+    bool window_was_focused = false;
+    bool window_was_minimized = false;
     SetTargetFPS(fps);
-    uint64_t time_in_ms = 0;
     while (!WindowShouldClose()) {
 
+        uint64_t time_in_ms = GetTime() * 1000;
+
         {
             int min_w = 0;
             int min_h = 0;
@@ -213,7 +448,8 @@ void snbpad(void)
 
         for (size_t i = 0; i < element_count; i++)
             GUIElement_tick(elements[i], time_in_ms);
-        time_in_ms += ms_per_frame;
+        if (overlay != NULL)
+            GUIElement_tick(overlay, time_in_ms);
 
         if (IsWindowResized()) {
             GUIElement_setRegion(sv2, (Rectangle) {
@@ -221,11 +457,16 @@ void snbpad(void)
                 .height = GetScreenHeight(),
                 .x = 0, .y = 0,
             });
+            GUIElement_setRegion(quick_open, getOverlayRegion(QuickOpen_getHeight(&quick_open_style)));
+            GUIElement_setRegion(file_picker, getOverlayRegion(FilePicker_getHeight(&file_picker_style)));
+            GUIElement_setRegion(search_panel, getOverlayRegion(SearchPanel_getHeight(&search_panel_style)));
         }
         
         GUIElement *hovered = NULL;
 
         Vector2 cursor_point = {GetMouseX(), GetMouseY()};
+        if (overlay != NULL && CheckCollisionPointRec(cursor_point, overlay->region))
+            hovered = overlay;
         for (size_t i = 0; i < element_count && hovered == NULL; i++)
             if (CheckCollisionPointRec(cursor_point, elements[i]->region))
                 hovered = GUIElement_getHovered(elements[i], 
@@ -244,8 +485,16 @@ void snbpad(void)
 
         bool mouse_button_left_is_pressed = IsMouseButtonDown(MOUSE_BUTTON_LEFT);
         if (mouse_button_left_is_pressed && !mouse_button_left_was_pressed) {
-            
-            if (hovered != NULL) {
+
+            // Clicking anywhere else hides the overlay
+            if (overlay != NULL && hovered != overlay)
+                hideOverlay();
+
+            if (hovered == overlay && overlay != NULL)
+                GUIElement_onClickDown(overlay, 
+                    cursor_point.x - overlay->region.x, 
+                    cursor_point.y - overlay->region.y);
+            else if (hovered != NULL) {
                 GUIElement *new_focused = GUIElement_onClickDown(hovered, 
                     cursor_point.x - hovered->region.x, 
                     cursor_point.y - hovered->region.y);
@@ -304,6 +553,27 @@ void snbpad(void)
         mouse_button_left_was_pressed = mouse_button_left_is_pressed;
 
         if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
+
+            if (IsKeyPressed(KEY_P)) {
+                if (overlay == quick_open)
+                    hideOverlay();
+                else {
+                    hideOverlay();
+                    QuickOpen_reset(quick_open);
+                    showOverlay(quick_open);
+                }
+            }
+
+            bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+            if (shift && IsKeyPressed(KEY_F)) {
+                if (overlay == search_panel)
+                    hideOverlay();
+                else {
+                    hideOverlay();
+                    SearchPanel_show(search_panel);
+                    showOverlay(search_panel);
+                }
+            }
             
             if (last_focused != NULL) {
                 if (IsKeyPressed(KEY_S))
@@ -315,6 +585,15 @@ void snbpad(void)
                 if (IsKeyPressed(KEY_O))
                     GUIElement_onOpen(focused);
 
+                if (!shift && IsKeyPressed(KEY_F))
+                    GUIElement_onFind(focused);
+
+                if (IsKeyPressed(KEY_R))
+                    GUIElement_onToggleRegex(focused);
+
+                if (IsKeyPressed(KEY_H))
+                    GUIElement_onReplace(focused);
+
                 if (IsKeyPressed(KEY_C))
                     GUIElement_onCopy(focused);
                 
@@ -323,47 +602,36 @@ void snbpad(void)
                 
                 if (IsKeyPressed(KEY_V))
                     GUIElement_onPaste(focused);
+
+                if (IsKeyPressed(KEY_Z)) {
+                    if (shift)
+                        GUIElement_onRedo(focused);
+                    else
+                        GUIElement_onUndo(focused);
+                }
+
+                if (IsKeyPressed(KEY_Y))
+                    GUIElement_onRedo(focused);
             }
         
         } else {
 
-            bool trigger_left_arrow;
-            bool arrow_left_is_pressed = IsKeyDown(KEY_LEFT);
-            if (arrow_left_is_pressed) {
-                if (!arrow_left_was_pressed) {
-                    trigger_left_arrow = true;
-                    left_arrow_counter = 0;
-                } else {
-                    if (left_arrow_counter * ms_per_frame > arrow_press_interval) {
-                        trigger_left_arrow = true;
-                        left_arrow_counter = 0;
-                    } else {
-                        trigger_left_arrow = false;
-                        left_arrow_counter++;
-                    }
-                }
-            } else
-                trigger_left_arrow = false;
-            arrow_left_was_pressed = arrow_left_is_pressed;
-
-            bool trigger_right_arrow;
-            bool arrow_right_is_pressed = IsKeyDown(KEY_RIGHT);
-            if (arrow_right_is_pressed) {
-                if (!arrow_right_was_pressed) {
-                    trigger_right_arrow = true;
-                    right_arrow_counter = 0;
-                } else {
-                    if (right_arrow_counter * ms_per_frame > arrow_press_interval) {
-                        trigger_right_arrow = true;
-                        right_arrow_counter = 0;
-                    } else {
-                        trigger_right_arrow = false;
-                        right_arrow_counter++;
-                    }
-                }
-            } else
-                trigger_right_arrow = false;
-            arrow_right_was_pressed = arrow_right_is_pressed;
+            bool trigger_left_arrow  = repeatKey(&arrow_left,  arrow_press_interval, ms_per_frame);
+            bool trigger_right_arrow = repeatKey(&arrow_right, arrow_press_interval, ms_per_frame);
+            bool trigger_up_arrow    = repeatKey(&arrow_up,    arrow_press_interval, ms_per_frame);
+            bool trigger_down_arrow  = repeatKey(&arrow_down,  arrow_press_interval, ms_per_frame);
+
+            // Key repetition is counted in frames
+            if (arrow_left.was_pressed || arrow_right.was_pressed ||
+                arrow_up.was_pressed   || arrow_down.was_pressed)
+                GUIElement_scheduleTick(0);
+
+            if (IsKeyPressed(KEY_ESCAPE)) {
+                if (overlay != NULL)
+                    hideOverlay();
+                else if (focused != NULL)
+                    GUIElement_onEscapeDown(focused);
+            }
 
             if (focused != NULL) {
 
@@ -373,6 +641,12 @@ void snbpad(void)
                 if (trigger_right_arrow)
                     GUIElement_onArrowRightDown(focused);
 
+                if (trigger_up_arrow)
+                    GUIElement_onArrowUpDown(focused);
+
+                if (trigger_down_arrow)
+                    GUIElement_onArrowDownDown(focused);
+
                 if (IsKeyPressed(KEY_ENTER))
                     GUIElement_onReturnDown(focused);
             
@@ -387,12 +661,49 @@ void snbpad(void)
             }
         }
 
+        // Open and save requests are answered by the
+        // file picker, without blocking the loop.
+        {
+            bool save;
+            GUIElement *requester = GUIElement_takeFileRequest(&save);
+            if (requester != NULL) {
+                hideOverlay();
+                picker_requester = requester;
+                picker_save = save;
+                FilePicker_show(file_picker, save);
+                showOverlay(file_picker);
+            }
+        }
+
+        // Frames are only drawn when some element
+        // changed or the window needs to be repainted.
+        // Otherwise the loop sleeps until there's input,
+        // a tick was scheduled or a background job woke
+        // it up.
+        bool window_is_focused = IsWindowFocused();
+        bool window_is_minimized = IsWindowMinimized();
+        if (window_is_focused != window_was_focused ||
+            window_is_minimized != window_was_minimized)
+            GUIElement_invalidateAll(sv2);
+        window_was_focused = window_is_focused;
+        window_was_minimized = window_is_minimized;
+
+        uint64_t tick_delay = GUIElement_takeTickDelay();
+        if (!GUIElement_takeWindowDamage()) {
+            if (tick_delay != UINT64_MAX)
+                tick_delay = MAX(tick_delay, (uint64_t) ms_per_frame);
+            GUIElement_waitEvents(tick_delay);
+            continue;
+        }
+
         SetTraceLogLevel(LOG_WARNING);
 
         BeginDrawing();
         ClearBackground(RAYWHITE);
         for (size_t i = 0; i < element_count; i++)
             GUIElement_draw(elements[i]);
+        if (overlay != NULL)
+            GUIElement_draw(overlay);
         /*
         if (hovered != NULL)
             DrawRectangleLines(hovered->region.x + 5,
@@ -406,6 +717,9 @@ void snbpad(void)
     }
     for (size_t i = 0; i < element_count; i++)
         GUIElement_free(elements[i]);
+    GUIElement_free(quick_open);
+    GUIElement_free(file_picker);
+    GUIElement_free(search_panel);
     CloseWindow();
 }
 
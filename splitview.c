@@ -380,6 +380,12 @@ getHoveredCallback(GUIElement *elem,
 static void drawCallback(GUIElement *elem)
 {
     SplitView *sv = (SplitView*) elem;
+
+    // Nothing is cached here, the separator is
+    // drawn on every frame.
+    Rectangle damage;
+    GUIElement_takeDamage(elem, &damage);
+
     Rectangle separator = getSeparatorRegion(sv);
     DrawRectangle(separator.x, 
                   separator.y,
@@ -428,6 +434,7 @@ GUIElement *SplitView_new(Rectangle region,
     if (sv != NULL) {
         sv->base.region = region;
         sv->base.methods = &methods;
+        sv->base.dirty = false;
         strncpy(sv->base.name, name, 
                 sizeof(sv->base.name));
         sv->base.name[sizeof(sv->base.name)-1] = '\0';
@@ -467,6 +474,7 @@ GUIElement *SplitView_new(Rectangle region,
         }
         GUIElement_setRegion(child_0, subregion_1);
         GUIElement_setRegion(child_1, subregion_2);
+        GUIElement_invalidateAll(&sv->base);
     }
     return (GUIElement*) sv;
 }
\ No newline at end of file
@@ -2,37 +2,82 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
-#include "sfd.h"
+#include <sys/stat.h>
 #include "utils.h"
 #include "xutf8.h"
+#include "undo.h"
 #include "gapiter.h"
+#include "regex.h"
+#include "matchindex.h"
+#include "prefetch.h"
 #include "scrollbar.h"
 #include "textdisplay.h"
 #include "textrenderutils.h"
 
+// Files bigger than this are mapped in memory
+// and edited through a piece table instead of
+// being loaded in a gap buffer.
+#define MAPPED_THRESHOLD (8 * 1024 * 1024)
+
+// How much text files loaded ahead of being
+// opened may hold in total.
+#define PREFETCH_MAX_BYTES (32 * 1024 * 1024)
+
+// How much text the find bar searches per tick,
+// so that big files don't hold up the frames.
+#define FIND_SCAN_BUDGET (8 * 1024 * 1024)
+
+// How often the line count of a mapped file is
+// refreshed while its newlines are being counted.
+#define LINE_COUNT_POLL_MS 100
+
+#define FIND_BAR_PADDING 8
+
+/* A caret at [head] that also selects the text up
+ * to [anchor] when the two differ. */
 typedef struct {
-    bool active;
-    size_t start, end;
-} Selection;
+    size_t head;
+    size_t anchor;
+} Cursor;
 
 typedef struct {
     GUIElement base;
     Rectangle old_region;
     const TextDisplayStyle *style;
     struct {
-        Font font;
+        FontMetrics *font;
         int logest_line_width;
     } text;
     struct {
-        Font font;
+        FontMetrics *font;
     } lineno;
     Scrollbar v_scroll;
     Scrollbar h_scroll;
     RenderTexture2D texture;
     bool      focused;
     bool      selecting;
-    Selection selection;
+    Cursor   *cursors; // Sorted and apart from each other
+    size_t    num_cursors;
+    size_t    max_cursors;
+    size_t    main_cursor; // The one the view follows
     GapBuffer buffer;
+    bool      damaged; // The mapped file was cut short and it was reported
+    UndoJournal journal;
+    struct {
+        bool   active;
+        bool   pending; // Jumps to the first match after [origin] once it's found
+        size_t origin;
+        char   query[GAPBUFFER_MAX_NEEDLE];
+        size_t query_len;
+        bool   regex;    // The query is a regular expression
+        Regex *compiled; // Of the query, NULL if it isn't valid
+        char   error[64];
+        bool   replacing; // Typing goes to the replacement
+        char   replacement[GAPBUFFER_MAX_NEEDLE];
+        size_t replacement_len;
+        MatchIndex matches;
+    } find;
+    FilePrefetcher *prefetcher; // NULL if it couldn't be started
     char file[1024];
 } TextDisplay;
 
@@ -46,18 +91,57 @@ static void updateWindowTitle(TextDisplay *tdisp)
     SetWindowTitle(buffer);
 }
 
-void Selection_getSlice(Selection selection,
-                        size_t *offset,
-                        size_t *length)
+static bool loadBuffer(GapBuffer *buffer, const char *file)
 {
-    assert(selection.active);
-    if (selection.start < selection.end) {
-        *offset = selection.start;
-        *length = selection.end - selection.start;
-    } else {
-        *offset = selection.end;
-        *length = selection.start - selection.end;
+    GapBufferBackend backend = GapBufferBackend_GAP;
+
+    struct stat info;
+    if (stat(file, &info) == 0 && info.st_size >= MAPPED_THRESHOLD)
+        backend = GapBufferBackend_MAPPED;
+
+    return GapBuffer_initFileWithBackend(buffer, file, backend);
+}
+
+static size_t cursorStart(Cursor cursor)
+{
+    return MIN(cursor.head, cursor.anchor);
+}
+
+static size_t cursorEnd(Cursor cursor)
+{
+    return MAX(cursor.head, cursor.anchor);
+}
+
+/* Returns the offset of the codepoint that ends at
+ * [offset], stepping over continuation bytes that
+ * may be in earlier chunks. */
+static size_t prevCodepoint(GapBuffer *buf, size_t offset)
+{
+    size_t len;
+    const char *chunk;
+    while ((chunk = GapBuffer_getChunkBefore(buf, offset, &len)) != NULL) {
+        while (len > 0) {
+            offset--;
+            if ((chunk[--len] & 0xC0) != 0x80)
+                return offset;
+        }
     }
+    return offset;
+}
+
+/* Returns the offset of the codepoint that follows
+ * the one at [offset]. */
+static size_t nextCodepoint(GapBuffer *buf, size_t offset)
+{
+    size_t len;
+    const char *chunk = GapBuffer_getChunk(buf, offset, &len);
+    if (chunk == NULL)
+        return offset;
+    do
+        offset++;
+    while ((chunk = GapBuffer_getChunk(buf, offset, &len)) != NULL
+        && (chunk[0] & 0xC0) == 0x80);
+    return offset;
 }
 
 static unsigned int 
@@ -80,7 +164,7 @@ TextDisplay_getLinenoColumnWidth(TextDisplay *tdisp)
     if (tdisp->style->lineno.hide)
         width = 0;
     else if (tdisp->style->lineno.auto_width) {
-        Font font = tdisp->lineno.font;
+        const FontMetrics *font = tdisp->lineno.font;
         size_t max_lineno = GapBuffer_getLineno(&tdisp->buffer);
         char s[8];
         int n = snprintf(s, sizeof(s), "%ld", max_lineno);
@@ -93,6 +177,524 @@ TextDisplay_getLinenoColumnWidth(TextDisplay *tdisp)
          + tdisp->style->lineno.padding_right;
 }
 
+/* Invalidates the rows that hold the text between
+ * the two offsets, which can be in any order. */
+static void invalidateRows(TextDisplay *tdisp, size_t a, size_t b)
+{
+    size_t first = GapBuffer_offsetToLine(&tdisp->buffer, MIN(a, b));
+    size_t last  = GapBuffer_offsetToLine(&tdisp->buffer, MAX(a, b));
+    int h = TextDisplay_getLineHeight(tdisp);
+    Rectangle rect = {
+        .x = 0,
+        .y = (float) first * h - Scrollbar_getValue(&tdisp->v_scroll),
+        .width  = tdisp->base.region.width,
+        .height = (float) (last - first + 1) * h,
+    };
+    GUIElement_invalidate(&tdisp->base, rect);
+}
+
+static Cursor *getMainCursor(TextDisplay *tdisp)
+{
+    return &tdisp->cursors[tdisp->main_cursor];
+}
+
+/* Invalidates the rows of the cursors and their
+ * selections. With more than one, the whole view
+ * is repainted. */
+static void invalidateCursors(TextDisplay *tdisp)
+{
+    if (tdisp->num_cursors > 1)
+        GUIElement_invalidateAll(&tdisp->base);
+    else
+        invalidateRows(tdisp, tdisp->cursors[0].head,
+                              tdisp->cursors[0].anchor);
+}
+
+/* Drops every cursor but a new one. */
+static void setCursor(TextDisplay *tdisp, size_t head, size_t anchor)
+{
+    invalidateCursors(tdisp);
+    tdisp->cursors[0] = (Cursor) {head, anchor};
+    tdisp->num_cursors = 1;
+    tdisp->main_cursor = 0;
+    invalidateCursors(tdisp);
+}
+
+static bool reserveCursors(TextDisplay *tdisp, size_t num)
+{
+    if (num <= tdisp->max_cursors)
+        return true;
+
+    size_t max_cursors = MAX(num, 2 * tdisp->max_cursors);
+    Cursor *cursors = realloc(tdisp->cursors, max_cursors * sizeof(Cursor));
+    if (cursors == NULL)
+        return false;
+    tdisp->cursors = cursors;
+    tdisp->max_cursors = max_cursors;
+    return true;
+}
+
+/* Puts the cursors back in order after some moved
+ * and merges the ones that overlap or touch. What
+ * a merge gives faces the same way as the main
+ * cursor when that's one of them. */
+static void mergeCursors(TextDisplay *tdisp)
+{
+    Cursor *cursors = tdisp->cursors;
+    size_t num = tdisp->num_cursors;
+    size_t main_cursor = tdisp->main_cursor;
+
+    // They are almost always sorted already
+    for (size_t i = 1; i < num; i++) {
+        Cursor cursor = cursors[i];
+        size_t j = i;
+        while (j > 0 && cursorStart(cursors[j-1]) > cursorStart(cursor)) {
+            cursors[j] = cursors[j-1];
+            j--;
+        }
+        cursors[j] = cursor;
+        if (main_cursor == i)
+            main_cursor = j;
+        else if (main_cursor >= j && main_cursor < i)
+            main_cursor++;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < num; i++) {
+        Cursor cursor = cursors[i];
+        if (n == 0 || cursorStart(cursor) > cursorEnd(cursors[n-1])) {
+            if (main_cursor == i)
+                main_cursor = n;
+            cursors[n++] = cursor;
+            continue;
+        }
+        Cursor *prev = &cursors[n-1];
+        Cursor facing = (main_cursor == i) ? cursor : *prev;
+        size_t start = cursorStart(*prev);
+        size_t end = MAX(cursorEnd(*prev), cursorEnd(cursor));
+        if (facing.head < facing.anchor)
+            *prev = (Cursor) {start, end};
+        else
+            *prev = (Cursor) {end, start};
+        if (main_cursor == i)
+            main_cursor = n-1;
+    }
+    tdisp->num_cursors = n;
+    tdisp->main_cursor = main_cursor;
+}
+
+/* Adds a cursor that becomes the main one. */
+static bool addCursor(TextDisplay *tdisp, size_t head, size_t anchor)
+{
+    if (!reserveCursors(tdisp, tdisp->num_cursors + 1))
+        return false;
+    tdisp->cursors[tdisp->num_cursors] = (Cursor) {head, anchor};
+    tdisp->main_cursor = tdisp->num_cursors++;
+    mergeCursors(tdisp);
+    return true;
+}
+
+/* Returns the first cursor that ends at or after
+ * [offset], or the count if there is none. */
+static size_t findCursor(TextDisplay *tdisp, size_t offset)
+{
+    size_t lo = 0;
+    size_t hi = tdisp->num_cursors;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cursorEnd(tdisp->cursors[mid]) < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Scrolls so that the text at [offset] is in view,
+ * centering it if it wasn't. */
+static void scrollToOffset(TextDisplay *tdisp, size_t offset)
+{
+    Rectangle region = tdisp->base.region;
+    size_t line = GapBuffer_offsetToLine(&tdisp->buffer, offset);
+    int h = TextDisplay_getLineHeight(tdisp);
+    int y = (int) line * h;
+    int scroll_y = Scrollbar_getValue(&tdisp->v_scroll);
+    if (y < scroll_y || y + h > scroll_y + region.height)
+        Scrollbar_setValue(&tdisp->v_scroll, y - (region.height - h) / 2);
+
+    // Lines too long to be measured quickly are
+    // left scrolled as they are.
+    size_t line_off = GapBuffer_lineToOffset(&tdisp->buffer, line);
+    if (offset - line_off > 4096)
+        return;
+    char *s = GapBuffer_copyRange(&tdisp->buffer, line_off, offset - line_off);
+    if (s == NULL)
+        return;
+    int x = TextDisplay_getLinenoColumnWidth(tdisp)
+          + calculateStringRenderWidth(tdisp->text.font, tdisp->style->text.font_size,
+                                       s, offset - line_off);
+    free(s);
+    int scroll_x = Scrollbar_getValue(&tdisp->h_scroll);
+    if (x < scroll_x || x >= scroll_x + region.width)
+        Scrollbar_setValue(&tdisp->h_scroll, x - region.width / 2);
+}
+
+static void selectRangeCallback(GUIElement *elem, size_t offset, size_t len)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+    size_t usage = GapBuffer_getUsage(&tdisp->buffer);
+    offset = MIN(offset, usage);
+    len = MIN(len, usage - offset);
+
+    tdisp->selecting = false;
+    setCursor(tdisp, offset + len, offset);
+    scrollToOffset(tdisp, offset);
+}
+
+static void invalidateFindBar(TextDisplay *tdisp)
+{
+    Rectangle rect = {0, 0, tdisp->base.region.width, TextDisplay_getLineHeight(tdisp)};
+    GUIElement_invalidate(&tdisp->base, rect);
+}
+
+/* Keeps the matches of the find bar in sync with
+ * every change made through the journal. */
+static void onBufferEdit(size_t offset, size_t removed, size_t inserted, void *userp)
+{
+    TextDisplay *tdisp = userp;
+    MatchIndex_onEdit(&tdisp->find.matches, &tdisp->buffer, offset, removed, inserted);
+}
+
+static void jumpToMatch(TextDisplay *tdisp, size_t i)
+{
+    MatchIndex *matches = &tdisp->find.matches;
+    size_t offset = MatchIndex_get(matches, &tdisp->buffer, i);
+    selectRangeCallback(&tdisp->base, offset, MatchIndex_getLength(matches, i));
+    invalidateFindBar(tdisp);
+}
+
+/* Jumps to the first match at or after the origin
+ * once the search got that far, wrapping around
+ * if there's none. */
+static void resolvePendingJump(TextDisplay *tdisp)
+{
+    if (!tdisp->find.pending)
+        return;
+
+    MatchIndex *matches = &tdisp->find.matches;
+    size_t count = MatchIndex_getCount(matches);
+    size_t i = MatchIndex_search(matches, &tdisp->buffer, tdisp->find.origin);
+    if (i < count) {
+        tdisp->find.pending = false;
+        jumpToMatch(tdisp, i);
+    } else if (MatchIndex_isComplete(matches, &tdisp->buffer)) {
+        tdisp->find.pending = false;
+        if (count > 0)
+            jumpToMatch(tdisp, 0);
+    }
+}
+
+/* Stops looking for the query. */
+static void clearMatches(TextDisplay *tdisp)
+{
+    MatchIndex_setNeedle(&tdisp->find.matches, &tdisp->buffer, NULL, 0);
+    if (tdisp->find.compiled != NULL) {
+        Regex_free(tdisp->find.compiled);
+        tdisp->find.compiled = NULL;
+    }
+}
+
+/* Looks for the query again, which is searched
+ * for in the background from here on. Regular
+ * expressions are matched within lines, and one
+ * that doesn't compile has no matches. */
+static void updateQuery(TextDisplay *tdisp)
+{
+    clearMatches(tdisp);
+    tdisp->find.error[0] = '\0';
+    if (!tdisp->find.regex)
+        MatchIndex_setNeedle(&tdisp->find.matches, &tdisp->buffer,
+                             tdisp->find.query, tdisp->find.query_len);
+    else if (tdisp->find.query_len > 0) {
+        tdisp->find.compiled = Regex_compile(tdisp->find.query, tdisp->find.query_len,
+                                             REGEX_NO_NEWLINE, tdisp->find.error,
+                                             sizeof(tdisp->find.error));
+        MatchIndex_setRegex(&tdisp->find.matches, tdisp->find.compiled);
+    }
+    tdisp->find.pending = (tdisp->find.query_len > 0 && tdisp->find.error[0] == '\0');
+    resolvePendingJump(tdisp);
+    GUIElement_scheduleTick(0);
+    GUIElement_invalidateAll(&tdisp->base);
+}
+
+static void findNext(TextDisplay *tdisp, bool backwards)
+{
+    MatchIndex *matches = &tdisp->find.matches;
+    size_t cursor = cursorStart(*getMainCursor(tdisp));
+    size_t count = MatchIndex_getCount(matches);
+    bool complete = MatchIndex_isComplete(matches, &tdisp->buffer);
+
+    if (backwards) {
+        size_t i = MatchIndex_search(matches, &tdisp->buffer, cursor);
+        if (i > 0)
+            jumpToMatch(tdisp, i - 1);
+        else if (complete && count > 0)
+            jumpToMatch(tdisp, count - 1);
+    } else {
+        size_t i = MatchIndex_search(matches, &tdisp->buffer, cursor + 1);
+        if (i < count)
+            jumpToMatch(tdisp, i);
+        else if (!complete) {
+            // The next one wasn't reached yet
+            tdisp->find.origin = cursor + 1;
+            tdisp->find.pending = true;
+        } else if (count > 0)
+            jumpToMatch(tdisp, 0);
+    }
+}
+
+static void appendToQuery(TextDisplay *tdisp, const char *str, size_t len)
+{
+    if (len > sizeof(tdisp->find.query) - tdisp->find.query_len)
+        return;
+    memcpy(tdisp->find.query + tdisp->find.query_len, str, len);
+    tdisp->find.query_len += len;
+    updateQuery(tdisp);
+}
+
+static void dropFromQuery(TextDisplay *tdisp)
+{
+    if (tdisp->find.query_len == 0)
+        return;
+
+    // Drops the whole last codepoint
+    do
+        tdisp->find.query_len--;
+    while (tdisp->find.query_len > 0 
+        && (tdisp->find.query[tdisp->find.query_len] & 0xC0) == 0x80);
+    updateQuery(tdisp);
+}
+
+static void appendToReplacement(TextDisplay *tdisp, const char *str, size_t len)
+{
+    if (len > sizeof(tdisp->find.replacement) - tdisp->find.replacement_len)
+        return;
+    memcpy(tdisp->find.replacement + tdisp->find.replacement_len, str, len);
+    tdisp->find.replacement_len += len;
+    invalidateFindBar(tdisp);
+}
+
+static void dropFromReplacement(TextDisplay *tdisp)
+{
+    if (tdisp->find.replacement_len == 0)
+        return;
+
+    do
+        tdisp->find.replacement_len--;
+    while (tdisp->find.replacement_len > 0
+        && (tdisp->find.replacement[tdisp->find.replacement_len] & 0xC0) == 0x80);
+    invalidateFindBar(tdisp);
+}
+
+static bool pushEdit(GapBufferEdit **edits, size_t *count, size_t *capacity,
+                     size_t offset, size_t removed)
+{
+    if (*count == *capacity) {
+        size_t new_capacity = MAX(2 * *capacity, 1024);
+        GapBufferEdit *new_edits = realloc(*edits, new_capacity * sizeof(GapBufferEdit));
+        if (new_edits == NULL)
+            return false;
+        *edits = new_edits;
+        *capacity = new_capacity;
+    }
+    (*edits)[(*count)++] = (GapBufferEdit) {
+        .offset = offset,
+        .removed = removed,
+    };
+    return true;
+}
+
+/* Replaces every match of the query with the
+ * replacement, taken as it is even in regex mode,
+ * in a single pass over the text that is undone
+ * as one edit. The matches are looked for from
+ * the start instead of being taken from the index,
+ * which may not have reached the end yet, and
+ * overlapping occurrences of a needle are only
+ * replaced once. */
+static void replaceAll(TextDisplay *tdisp)
+{
+    GapBuffer *buf = &tdisp->buffer;
+    size_t usage = GapBuffer_getUsage(buf);
+    if (tdisp->find.query_len == 0 || (tdisp->find.regex && tdisp->find.compiled == NULL))
+        return;
+
+    GapBufferEdit *edits = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t pos = 0;
+    size_t found, len;
+    bool ok = true;
+    if (!tdisp->find.regex) {
+        len = tdisp->find.query_len;
+        while (ok && (found = GapBuffer_find(buf, pos, usage, tdisp->find.query, len)) != SIZE_MAX) {
+            ok = pushEdit(&edits, &count, &capacity, found, len);
+            pos = found + len;
+        }
+    } else {
+        while (ok && Regex_findInBuffer(tdisp->find.compiled, buf, pos, usage, &found, &len)) {
+            if (len == 0) {
+                pos = found + 1;
+                continue;
+            }
+            ok = pushEdit(&edits, &count, &capacity, found, len);
+            pos = found + len;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        edits[i].str = tdisp->find.replacement;
+        edits[i].inserted = tdisp->find.replacement_len;
+    }
+
+    // The buffer moves its own cursor along with the
+    // text, and the view follows it.
+    GapBuffer_setCursor(buf, getMainCursor(tdisp)->head);
+    if (!ok || !UndoJournal_replaceAll(&tdisp->journal, buf, edits, count))
+        TraceLog(LOG_WARNING, "Not enough memory to replace the matches");
+    else if (count > 0) {
+        size_t cursor = GapBuffer_getCursor(buf);
+        setCursor(tdisp, cursor, cursor);
+        GUIElement_scheduleTick(0);
+        GUIElement_invalidateAll(&tdisp->base);
+    }
+    free(edits);
+}
+
+/* Makes the query match [str] as it is, escaping
+ * it in regex mode. Returns false if it's too long. */
+static bool setQuery(TextDisplay *tdisp, const char *str, size_t len)
+{
+    char  *query = tdisp->find.query;
+    size_t max = sizeof(tdisp->find.query);
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        bool escape = tdisp->find.regex && str[i] != '\0'
+                   && strchr("\\.^$|?*+()[]{}", str[i]) != NULL;
+        if (n + escape + 1 > max)
+            return false;
+        if (escape)
+            query[n++] = '\\';
+        query[n++] = str[i];
+    }
+    tdisp->find.query_len = n;
+    return true;
+}
+
+/* Opens the find bar. A selection that fits on a
+ * line becomes the query. */
+static void onFindCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+
+    Cursor *cursor = getMainCursor(tdisp);
+    size_t offset = cursorStart(*cursor);
+    size_t length = cursorEnd(*cursor) - offset;
+    tdisp->find.origin = offset;
+    if (length > 0 && length <= sizeof(tdisp->find.query)) {
+        char *s = GapBuffer_copyRange(&tdisp->buffer, offset, length);
+        if (s != NULL && memchr(s, '\n', length) == NULL)
+            setQuery(tdisp, s, length);
+        free(s);
+    }
+    tdisp->find.active = true;
+    updateQuery(tdisp);
+}
+
+static void closeFindBar(TextDisplay *tdisp)
+{
+    // The query is kept for the next time
+    tdisp->find.active = false;
+    tdisp->find.pending = false;
+    tdisp->find.replacing = false;
+    clearMatches(tdisp);
+    GUIElement_invalidateAll(&tdisp->base);
+}
+
+/* Closes the find bar or, when it's not open,
+ * leaves only the main cursor. */
+static void onEscapeDownCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+    if (tdisp->find.active)
+        closeFindBar(tdisp);
+    else if (tdisp->num_cursors > 1) {
+        Cursor cursor = *getMainCursor(tdisp);
+        setCursor(tdisp, cursor.head, cursor.anchor);
+    }
+}
+
+/* Searches the rest of the text and puts a cursor
+ * on every match, selecting it, then closes the
+ * find bar. Overlapping occurrences of a needle
+ * only get one. The main cursor is on the first
+ * match after it, as the find bar would go to. */
+static void selectAllMatches(TextDisplay *tdisp)
+{
+    MatchIndex *matches = &tdisp->find.matches;
+    while (!MatchIndex_scan(matches, &tdisp->buffer, SIZE_MAX));
+
+    size_t count = MatchIndex_getCount(matches);
+    if (count == 0)
+        return;
+    if (!reserveCursors(tdisp, count)) {
+        TraceLog(LOG_WARNING, "Not enough memory for a cursor at every match");
+        return;
+    }
+
+    size_t origin = cursorStart(*getMainCursor(tdisp));
+    size_t main_cursor = SIZE_MAX;
+    size_t n = 0;
+    size_t end = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t start = MatchIndex_get(matches, &tdisp->buffer, i);
+        if (n > 0 && start < end)
+            continue;
+        if (main_cursor == SIZE_MAX && start >= origin)
+            main_cursor = n;
+        end = start + MatchIndex_getLength(matches, i);
+        tdisp->cursors[n++] = (Cursor) {end, start};
+    }
+    tdisp->num_cursors = n;
+    tdisp->main_cursor = (main_cursor == SIZE_MAX) ? 0 : main_cursor;
+    mergeCursors(tdisp);
+    closeFindBar(tdisp);
+}
+
+/* Opens the find bar with the replacement being
+ * edited, or switches between it and the query. */
+static void onReplaceCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+    if (!tdisp->find.active) {
+        onFindCallback(elem);
+        tdisp->find.replacing = true;
+    } else
+        tdisp->find.replacing = !tdisp->find.replacing;
+    invalidateFindBar(tdisp);
+}
+
+/* Switches the find bar between looking for the
+ * query as it is and as a regular expression. */
+static void onToggleRegexCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+    if (tdisp->find.active) {
+        tdisp->find.regex = !tdisp->find.regex;
+        tdisp->find.origin = cursorStart(*getMainCursor(tdisp));
+        updateQuery(tdisp);
+    }
+}
+
 static size_t 
 cursorFromClick(TextDisplay *tdisp,
                 float x, float y)
@@ -112,7 +714,7 @@ cursorFromClick(TextDisplay *tdisp,
 
     float lineno_colm_w = TextDisplay_getLinenoColumnWidth(tdisp);
 
-    Font font = tdisp->text.font;
+    const FontMetrics *font = tdisp->text.font;
     size_t cursor;
     if (logic_x < lineno_colm_w)
         cursor = line.off;
@@ -167,6 +769,27 @@ static void tickCallback(GUIElement *elem, uint64_t time_in_ms)
     TextDisplay *tdisp = (TextDisplay*) elem;
     Scrollbar_tick(&tdisp->v_scroll, time_in_ms);
     Scrollbar_tick(&tdisp->h_scroll, time_in_ms);
+
+    // Until the newlines are all counted, the gutter
+    // and the scrollbar go by an estimate.
+    size_t lineno = GapBuffer_getLineno(&tdisp->buffer);
+    if (!GapBuffer_countLines(&tdisp->buffer))
+        GUIElement_scheduleTick(LINE_COUNT_POLL_MS);
+    if (GapBuffer_getLineno(&tdisp->buffer) != lineno)
+        GUIElement_invalidateAll(elem);
+
+    MatchIndex *matches = &tdisp->find.matches;
+    if (tdisp->find.active && !MatchIndex_isComplete(matches, &tdisp->buffer)) {
+        size_t scanned = matches->scanned;
+        size_t count = MatchIndex_getCount(matches);
+        bool done = MatchIndex_scan(matches, &tdisp->buffer, FIND_SCAN_BUDGET);
+        if (MatchIndex_getCount(matches) != count)
+            invalidateRows(tdisp, scanned, matches->scanned);
+        invalidateFindBar(tdisp);
+        resolvePendingJump(tdisp);
+        if (!done)
+            GUIElement_scheduleTick(0);
+    }
 }
 
 static void onMouseWheelCallback(GUIElement *elem, int y)
@@ -184,7 +807,16 @@ static void onMouseMotionCallback(GUIElement *elem,
     } else if (Scrollbar_onMouseMotion(&tdisp->h_scroll, x)) {
     } else if (tdisp->selecting) {
         size_t pos = cursorFromClick(tdisp, x, y);
-        tdisp->selection.end = pos;
+        Cursor *cursor = getMainCursor(tdisp);
+        if (pos != cursor->head) {
+            invalidateRows(tdisp, cursor->head, pos);
+            cursor->head = pos;
+            if (tdisp->num_cursors > 1) {
+                // The selection may swallow other cursors
+                mergeCursors(tdisp);
+                GUIElement_invalidateAll(elem);
+            }
+        }
     }
 }
 
@@ -199,16 +831,19 @@ onClickDownCallback(GUIElement *elem,
         on_thumb = true;
     } else if (Scrollbar_onClickDown(&tdisp->h_scroll, x, y)) {
         on_thumb = true;
-    } else if (tdisp->selection.active) {
-        on_thumb = false;
-        tdisp->selection.active = false;
     } else if (!tdisp->selecting) {
+        // Clicking with control held adds a cursor
+        // instead of moving the one there is.
         on_thumb = false;
         TraceLog(LOG_INFO, "Selection started");
         tdisp->selecting = true;
-        tdisp->selection.active = true;
-        tdisp->selection.start = cursorFromClick(tdisp, x, y);
-        tdisp->selection.end = tdisp->selection.start;
+        size_t pos = cursorFromClick(tdisp, x, y);
+        if (!IsKeyDown(KEY_LEFT_CONTROL) && !IsKeyDown(KEY_RIGHT_CONTROL))
+            setCursor(tdisp, pos, pos);
+        else if (addCursor(tdisp, pos, pos))
+            invalidateCursors(tdisp);
+        else
+            TraceLog(LOG_WARNING, "Not enough memory to add a cursor");
     }
 
     return on_thumb ? NULL : elem;
@@ -225,60 +860,146 @@ static void clickUpCallback(GUIElement *elem,
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
 
+    (void) x;
+    (void) y;
     Scrollbar_clickUp(&tdisp->v_scroll);
     Scrollbar_clickUp(&tdisp->h_scroll);
 
     if (tdisp->selecting) {
         TraceLog(LOG_INFO, "Selection stopped");
         tdisp->selecting = false;
-        if (tdisp->selection.start == tdisp->selection.end) {
-            tdisp->selection.active = false;
-            size_t cur = cursorFromClick(tdisp, x, y);
-            GapBuffer_setCursor(&tdisp->buffer, cur);
-        }
     }
 }
 
+/* Moves every cursor by a codepoint, or to that
+ * side of its selection if it has one. */
+static void moveCursors(TextDisplay *tdisp, bool forward)
+{
+    invalidateCursors(tdisp);
+    for (size_t i = 0; i < tdisp->num_cursors; i++) {
+        Cursor *cursor = &tdisp->cursors[i];
+        size_t pos;
+        if (cursor->head != cursor->anchor)
+            pos = forward ? cursorEnd(*cursor) : cursorStart(*cursor);
+        else if (forward)
+            pos = nextCodepoint(&tdisp->buffer, cursor->head);
+        else
+            pos = prevCodepoint(&tdisp->buffer, cursor->head);
+        *cursor = (Cursor) {pos, pos};
+    }
+    mergeCursors(tdisp);
+    invalidateCursors(tdisp);
+}
+
 static void onArrowLeftDownCallback(GUIElement *elem)
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
-
-    tdisp->selection.active = false;
-    GapBuffer_moveCursorBackward(&tdisp->buffer);
+    moveCursors(tdisp, false);
 }
 
 static void onArrowRightDownCallback(GUIElement *elem)
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
+    moveCursors(tdisp, true);
+}
+
+static void onArrowUpDownCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+    if (tdisp->find.active)
+        findNext(tdisp, true);
+}
+
+static void onArrowDownDownCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+    if (tdisp->find.active)
+        findNext(tdisp, false);
+}
 
-    tdisp->selection.active = false;
-    GapBuffer_moveCursorForward(&tdisp->buffer);
+/* Replaces the selection of every cursor with
+ * [str], or inserts it where there's none. With
+ * [backspace], cursors without a selection remove
+ * the codepoint before them instead. All edits are
+ * applied in a single sweep over the buffer and
+ * undone as one, and the cursors are left after
+ * the text they inserted. */
+static void editAtCursors(TextDisplay *tdisp, const char *str, size_t len,
+                          bool backspace, bool typed)
+{
+    size_t num = tdisp->num_cursors;
+    GapBufferEdit *edits = malloc(num * sizeof(GapBufferEdit));
+    size_t *offsets = malloc(num * sizeof(size_t));
+    if (edits == NULL || offsets == NULL) {
+        TraceLog(LOG_WARNING, "Not enough memory to edit at the cursors");
+        free(edits);
+        free(offsets);
+        return;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < num; i++) {
+        Cursor cursor = tdisp->cursors[i];
+        size_t start = cursorStart(cursor);
+        size_t end = cursorEnd(cursor);
+        if (start == end && backspace)
+            start = prevCodepoint(&tdisp->buffer, end);
+        offsets[i] = end;
+        if (start < end || len > 0)
+            edits[count++] = (GapBufferEdit) {
+                .offset = start,
+                .removed = end - start,
+                .str = str,
+                .inserted = len,
+            };
+    }
+
+    if (!UndoJournal_applyEdits(&tdisp->journal, &tdisp->buffer, edits, count, offsets, num, typed))
+        TraceLog(LOG_WARNING, "Not enough memory to edit at the cursors");
+    else {
+        for (size_t i = 0; i < num; i++)
+            tdisp->cursors[i] = (Cursor) {offsets[i], offsets[i]};
+        mergeCursors(tdisp);
+    }
+    GUIElement_invalidateAll(&tdisp->base);
+    free(edits);
+    free(offsets);
 }
 
 static void onBackspaceDownCallback(GUIElement *elem)
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
 
-    if (tdisp->selection.active) {
-        size_t offset, length;
-        Selection_getSlice(tdisp->selection, &offset, &length);
-        GapBuffer_removeRangeAndSetCursor(&tdisp->buffer, offset, length);
-        tdisp->selection.active = false;
-    } else
-        GapBuffer_removeBackwards(&tdisp->buffer); 
+    if (tdisp->find.active) {
+        if (tdisp->find.replacing)
+            dropFromReplacement(tdisp);
+        else
+            dropFromQuery(tdisp);
+        return;
+    }
+
+    editAtCursors(tdisp, "", 0, true, false);
 }
 
 static void onReturnDownCallback(GUIElement *elem)
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
 
-    if (tdisp->selection.active) {
-        size_t offset, length;
-        Selection_getSlice(tdisp->selection, &offset, &length);
-        GapBuffer_removeRangeAndSetCursor(&tdisp->buffer, offset, length);
-        tdisp->selection.active = false;
+    if (tdisp->find.active && tdisp->find.replacing) {
+        replaceAll(tdisp);
+        return;
+    }
+    if (tdisp->find.active) {
+        bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+        bool alt = IsKeyDown(KEY_LEFT_ALT) || IsKeyDown(KEY_RIGHT_ALT);
+        if (alt)
+            selectAllMatches(tdisp);
+        else
+            findNext(tdisp, shift);
+        return;
     }
-    GapBuffer_insertString(&tdisp->buffer, "\n", 1); 
+
+    editAtCursors(tdisp, "\n", 1, false, false);
 }
 
 static void onTextInputCallback(GUIElement *elem, 
@@ -287,46 +1008,103 @@ static void onTextInputCallback(GUIElement *elem,
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
 
-    if (tdisp->selection.active) {
-        size_t offset, length;
-        Selection_getSlice(tdisp->selection, &offset, &length);
-        GapBuffer_removeRangeAndSetCursor(&tdisp->buffer, offset, length);
-        tdisp->selection.active = false;
+    if (tdisp->find.active) {
+        if (tdisp->find.replacing)
+            appendToReplacement(tdisp, str, len);
+        else
+            appendToQuery(tdisp, str, len);
+        return;
     }
-    GapBuffer_insertString(&tdisp->buffer, str, len);
+
+    editAtCursors(tdisp, str, len, false, true);
 }
 
 static void onFocusLost(GUIElement *elem)
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
     tdisp->focused = false;
+    invalidateCursors(tdisp);
 }
 
 static void onFocusGained(GUIElement *elem)
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
     tdisp->focused = true;
+    invalidateCursors(tdisp);
     updateWindowTitle(tdisp);
 }
 
+/* Copies the selections to the clipboard, one per
+ * line, and removes them if [cut] is set. */
 static void cutOrCopy(TextDisplay *tdisp, bool cut)
 {
-    if (tdisp->selection.active) {
-        size_t offset, length;
-        Selection_getSlice(tdisp->selection, &offset, &length);
-        char *s = GapBuffer_copyRange(&tdisp->buffer, offset, length);
-        if (s == NULL)
-            TraceLog(LOG_WARNING, "Failed to copy text from the buffer");
-        else {
-            SetClipboardText(s);
-            free(s);
-        }
+    size_t size = 0;
+    for (size_t i = 0; i < tdisp->num_cursors; i++) {
+        Cursor cursor = tdisp->cursors[i];
+        if (cursor.head != cursor.anchor)
+            size += cursorEnd(cursor) - cursorStart(cursor) + 1;
+    }
+    if (size == 0)
+        return;
 
-        if (cut) {
-            GapBuffer_removeRangeAndSetCursor(&tdisp->buffer, offset, length);
-            tdisp->selection.active = false;
+    char *s = malloc(size);
+    if (s == NULL) {
+        TraceLog(LOG_WARNING, "Failed to copy text from the buffer");
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < tdisp->num_cursors; i++) {
+        Cursor cursor = tdisp->cursors[i];
+        size_t offset = cursorStart(cursor);
+        size_t end = cursorEnd(cursor);
+        if (offset == end)
+            continue;
+        if (n > 0)
+            s[n++] = '\n';
+        while (offset < end) {
+            size_t len;
+            const char *chunk = GapBuffer_getChunk(&tdisp->buffer, offset, &len);
+            len = MIN(len, end - offset);
+            memcpy(s + n, chunk, len);
+            n += len;
+            offset += len;
         }
     }
+    s[n] = '\0';
+    SetClipboardText(s);
+    free(s);
+
+    if (cut)
+        editAtCursors(tdisp, "", 0, false, false);
+}
+
+static void undoOrRedo(TextDisplay *tdisp, bool redo)
+{
+    bool done;
+    if (redo)
+        done = UndoJournal_redo(&tdisp->journal, &tdisp->buffer);
+    else
+        done = UndoJournal_undo(&tdisp->journal, &tdisp->buffer);
+
+    // The cursors aren't part of the history, only
+    // the one of the buffer is left.
+    if (done) {
+        size_t cursor = GapBuffer_getCursor(&tdisp->buffer);
+        setCursor(tdisp, cursor, cursor);
+        GUIElement_invalidateAll(&tdisp->base);
+    }
+}
+
+static void onUndoCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+    undoOrRedo(tdisp, false);
+}
+
+static void onRedoCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+    undoOrRedo(tdisp, true);
 }
 
 static void onCopyCallback(GUIElement *elem)
@@ -345,70 +1123,50 @@ static void onPasteCallback(GUIElement *elem)
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
     const char *s = GetClipboardText();
-    if (s != NULL)
-        GapBuffer_insertString(&tdisp->buffer, s, strlen(s));
+    if (s != NULL && tdisp->find.active && tdisp->find.replacing)
+        appendToReplacement(tdisp, s, strcspn(s, "\r\n"));
+    else if (s != NULL && tdisp->find.active)
+        // Only up to the first line
+        appendToQuery(tdisp, s, strcspn(s, "\r\n"));
+    else if (s != NULL)
+        editAtCursors(tdisp, s, strlen(s), false, false);
 }
 
 static void onOpenCallback(GUIElement *elem)
 {
-    TextDisplay *tdisp = (TextDisplay*) elem;
-
-    sfd_Options opt = {
-        .title        = "Open Text File",
-        .filter_name  = "Text File",
-        .filter       = "*.txt|*.c|*.h",
-    };
-
-    const char *file = sfd_open_dialog(&opt);
+    // The file comes back through openFile
+    GUIElement_requestFile(elem, false);
+}
 
-    if (file == NULL) {
-        TraceLog(LOG_ERROR, "Failed to get dialog result");
+static void onSaveCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+    if (tdisp->file[0] == '\0') {
+        // The file comes back through saveFile
+        GUIElement_requestFile(elem, true);
         return;
     }
 
-    GapBuffer temp;
-    if (GapBuffer_initFile(&temp, file)) {
-        /* Managed to open the file in a buffer */
-
-        // Swap the current one with the new one
-        GapBuffer_free(&tdisp->buffer);
-        tdisp->buffer = temp;
-        Scrollbar_setValue(&tdisp->v_scroll, 0);
-        Scrollbar_setValue(&tdisp->h_scroll, 0);
-        strncpy(tdisp->file, file, sizeof(tdisp->file));
-        updateWindowTitle(tdisp);
-    }
+    if (!GapBuffer_saveToFile(&tdisp->buffer, tdisp->file))
+        TraceLog(LOG_ERROR, "Failed to save to \"%s\"", tdisp->file);
 }
 
-static void onSaveCallback(GUIElement *elem)
+static bool saveFileCallback(GUIElement *elem, const char *file)
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
-    if (tdisp->file[0] == '\0') {
-        
-        sfd_Options opt = {
-            .title        = "Save Text File",
-            .filter_name  = "Text File",
-            .filter       = "*.txt|*.c|*.h",
-        };
-
-        const char *file = sfd_save_dialog(&opt);
 
-        if (file == NULL) {
-            TraceLog(LOG_ERROR, "Failed to get dialog result");
-            return;
-        }
-        strncpy(tdisp->file, file, sizeof(tdisp->file));
-        updateWindowTitle(tdisp);
-    }        
+    if (strlen(file) >= sizeof(tdisp->file)) {
+        TraceLog(LOG_ERROR, "File name is too long to be stored");
+        return false;
+    }
 
-    FILE *stream = fopen(tdisp->file, "wb");
-    if (stream == NULL) {
-        TraceLog(LOG_ERROR, "Failed to open \"%s\" in write mode", tdisp->file);
-    } else {
-        if (!GapBuffer_saveToStream(&tdisp->buffer, stream))
-            TraceLog(LOG_ERROR, "Failed to save to \"%s\"\n", tdisp->file);
-        fclose(stream);
+    if (!GapBuffer_saveToFile(&tdisp->buffer, file)) {
+        TraceLog(LOG_ERROR, "Failed to save to \"%s\"", file);
+        return false;
     }
+    strcpy(tdisp->file, file);
+    updateWindowTitle(tdisp);
+    return true;
 }
 
 static bool openFileCallback(GUIElement *elem, 
@@ -426,28 +1184,43 @@ static bool openFileCallback(GUIElement *elem,
         TraceLog(LOG_ERROR, "File name is too long to be stored");
     else {
 
-        FILE *stream = fopen(file, "rb");
-        if (stream == NULL)
-            TraceLog(LOG_ERROR, "Failed to open \"%s\" in read mode", file);
-        else {
-            GapBuffer buffer2;
-            if (!GapBuffer_initFile(&buffer2, file)) 
-                TraceLog(LOG_ERROR, "Failed to insert \"%s\" into the gap buffer", file);
-            else {
-                GapBuffer_free(&td->buffer);
-                td->buffer = buffer2;
-                Scrollbar_setValue(&td->v_scroll, 0);
-                Scrollbar_setValue(&td->h_scroll, 0);
-                strcpy(td->file, file);
-                TraceLog(LOG_INFO, "Opened file \"%s\"", file);
-                opened = true;
-            }
-            fclose(stream);
+        // The file may have been loaded already
+        GapBuffer buffer2;
+        bool prefetched = td->prefetcher != NULL 
+                       && FilePrefetcher_take(td->prefetcher, file, &buffer2);
+        if (!prefetched && !loadBuffer(&buffer2, file)) {
+            TraceLog(LOG_ERROR, "Failed to load \"%s\"", file);
+            GapBuffer_free(&buffer2);
+        } else {
+            GapBuffer_free(&td->buffer);
+            UndoJournal_clear(&td->journal);
+            MatchIndex_clear(&td->find.matches);
+            td->find.pending = false;
+            td->buffer = buffer2;
+            td->damaged = false;
+            size_t cursor = GapBuffer_getCursor(&td->buffer);
+            setCursor(td, cursor, cursor);
+            GUIElement_scheduleTick(0);
+            Scrollbar_setValue(&td->v_scroll, 0);
+            Scrollbar_setValue(&td->h_scroll, 0);
+            strcpy(td->file, file);
+            updateWindowTitle(td);
+            TraceLog(LOG_INFO, "Opened file \"%s\"%s", file, 
+                     prefetched ? " (prefetched)" : "");
+            GUIElement_invalidateAll(elem);
+            opened = true;
         }
     }
     return opened;
 }
 
+static void prefetchFileCallback(GUIElement *elem, const char *file)
+{
+    TextDisplay *td = (TextDisplay*) elem;
+    if (td->prefetcher != NULL && strcmp(file, td->file))
+        FilePrefetcher_request(td->prefetcher, file);
+}
+
 typedef struct {
     TextDisplay *tdisp;
     GapBufferIter iter;
@@ -479,11 +1252,22 @@ static void freeDrawContext(DrawContext *draw_context)
 
 static void skipLinesBeforeViewport(DrawContext *draw_context)
 {
-    while (draw_context->line_y + (int) draw_context->line_height < 0 
-        && GapBufferIter_nextLine(&draw_context->iter, NULL)) {
-        draw_context->line_y += draw_context->line_height;
-        draw_context->no++;
-    }
+    // Lines whose bottom is above the viewport are
+    // skipped. Jump straight to the first visible 
+    // one using the line index of the buffer.
+    int h = draw_context->line_height;
+    int scroll = -draw_context->line_y;
+    if (scroll <= h)
+        return;
+
+    size_t skip = (scroll + h - 1) / h - 1;
+    size_t lineno = GapBuffer_getLineno(&draw_context->tdisp->buffer);
+    if (skip > lineno - 1)
+        skip = lineno - 1;
+
+    GapBufferIter_seekLine(&draw_context->iter, skip);
+    draw_context->line_y += skip * h;
+    draw_context->no += skip;
 }
 
 static bool nextLine(DrawContext *draw_context)
@@ -500,7 +1284,7 @@ static bool nextLine(DrawContext *draw_context)
 }
 
 static void drawLineno(int no, int x, int y, 
-                       int w, int h, Font font,
+                       int w, int h, const FontMetrics *font,
                        const TextDisplayStyle *style)
 {
     if (style->lineno.hide == false) {
@@ -532,15 +1316,15 @@ static void drawLineno(int no, int x, int y,
     }
 }
 
-static void drawSelection(DrawContext draw_context)
+static void drawSelection(DrawContext draw_context, Cursor cursor)
 {
     TextDisplay *tdisp = draw_context.tdisp;
     Line line = draw_context.line;
 
-    if (tdisp->selection.active) {
+    if (cursor.head != cursor.anchor) {
 
-        size_t sel_abs_off, sel_len;
-        Selection_getSlice(tdisp->selection, &sel_abs_off, &sel_len);
+        size_t sel_abs_off = cursorStart(cursor);
+        size_t sel_len = cursorEnd(cursor) - sel_abs_off;
         int sel_rel_off = sel_abs_off - line.off;
 
         if (sel_abs_off < line.off + line.len && sel_abs_off + sel_len > line.off) {
@@ -555,7 +1339,7 @@ static void drawSelection(DrawContext draw_context)
                 size_t rel_head = MAX(sel_rel_off, 0);
                 size_t rel_tail = MIN(sel_rel_off + sel_len, line.len);
             
-                Font font = tdisp->text.font;
+                const FontMetrics *font = tdisp->text.font;
                 sel_w = calculateStringRenderWidth(font, tdisp->style->text.font_size, line.str + rel_head, rel_tail - rel_head);
                 sel_x = calculateStringRenderWidth(font, tdisp->style->text.font_size, line.str, rel_head)
                       + draw_context.line_x + draw_context.line_num_w;
@@ -568,10 +1352,90 @@ static void drawSelection(DrawContext draw_context)
     }
 }
 
+/* Draws the selections that cross the line. */
+static void drawSelections(DrawContext draw_context)
+{
+    TextDisplay *tdisp = draw_context.tdisp;
+    Line line = draw_context.line;
+    for (size_t i = findCursor(tdisp, line.off + 1); i < tdisp->num_cursors; i++) {
+        Cursor cursor = tdisp->cursors[i];
+        if (cursorStart(cursor) >= line.off + line.len)
+            break;
+        drawSelection(draw_context, cursor);
+    }
+}
+
+static void drawHighlight(DrawContext draw_context, int x, int w)
+{
+    TextDisplay *tdisp = draw_context.tdisp;
+    DrawRectangle(x, draw_context.line_y, w, draw_context.line_height,
+                  tdisp->style->text.match_bgcolor);
+}
+
+/* Highlights the matches of the find bar in the
+ * line. Overlapping ones are merged, and the line
+ * is measured once from left to right up to where
+ * it leaves the viewport. */
+static void drawMatches(DrawContext draw_context)
+{
+    TextDisplay *tdisp = draw_context.tdisp;
+    MatchIndex *matches = &tdisp->find.matches;
+    Line line = draw_context.line;
+    size_t count = MatchIndex_getCount(matches);
+    if (!tdisp->find.active || count == 0)
+        return;
+
+    const FontMetrics *font = tdisp->text.font;
+    int font_size = tdisp->style->text.font_size;
+    int max_x = tdisp->base.region.width;
+    int x = draw_context.line_x + draw_context.line_num_w;
+    size_t measured = 0; // Bytes of the line left of [x]
+
+    // Matches that started on previous lines may
+    // end on this one.
+    size_t i = MatchIndex_searchEnd(matches, &tdisp->buffer, line.off);
+
+    bool in_run = false;
+    size_t run_head = 0;
+    size_t run_tail = 0;
+    for (;;) {
+        size_t head = SIZE_MAX;
+        size_t tail = 0;
+        if (i < count) {
+            size_t len = MatchIndex_getLength(matches, i);
+            size_t start = MatchIndex_get(matches, &tdisp->buffer, i++);
+            if (start < line.off + line.len || (line.len == 0 && start == line.off)) {
+                head = MAX(start, line.off) - line.off;
+                tail = MIN(start + len, line.off + line.len) - line.off;
+            }
+        }
+        if (in_run && head != SIZE_MAX && head <= run_tail) {
+            run_tail = MAX(run_tail, tail);
+            continue;
+        }
+        if (in_run) {
+            x += calculateStringRenderWidth(font, font_size, line.str + measured, run_head - measured);
+            int w = calculateStringRenderWidth(font, font_size, line.str + run_head, run_tail - run_head);
+            // Matches of newlines are shown as a
+            // bit of space, like the selection.
+            drawHighlight(draw_context, x, MAX(w, 4));
+            x += w;
+            measured = run_tail;
+            if (x > max_x)
+                break;
+        }
+        if (head == SIZE_MAX)
+            break;
+        in_run = true;
+        run_head = head;
+        run_tail = tail;
+    }
+}
+
 static float drawLineText(DrawContext draw_context)
 {
     TextDisplay *tdisp = draw_context.tdisp;
-    Font font = tdisp->text.font;
+    const FontMetrics *font = tdisp->text.font;
     int  font_size = tdisp->style->text.font_size;
     const char  *s = draw_context.line.str;
     const size_t n = draw_context.line.len;
@@ -582,53 +1446,80 @@ static float drawLineText(DrawContext draw_context)
     return w;
 }
 
-static bool drawCursor(DrawContext draw_context)
+static void drawCursor(DrawContext draw_context, size_t cursor)
 {
     TextDisplay *tdisp = draw_context.tdisp;
-    const size_t cursor = tdisp->buffer.gap_offset;
     Line line = draw_context.line;
-    Font font = tdisp->text.font;
+    const FontMetrics *font = tdisp->text.font;
+
+    if (tdisp->focused) {
+        int relative_cursor_x = calculateStringRenderWidth(font, tdisp->style->text.font_size, line.str, cursor - line.off);
+        Color color = tdisp->style->cursor.bgcolor;
+        DrawRectangle(
+            draw_context.line_x + draw_context.line_num_w + relative_cursor_x,
+            draw_context.line_y,
+            3,
+            draw_context.line_height,
+            color
+        );
+    }
+}
 
-    if (line.off <= cursor && cursor <= line.off + line.len) {
-        /* The cursor is in this line */
-        if (tdisp->focused) {
-            int relative_cursor_x = calculateStringRenderWidth(font, tdisp->style->text.font_size, line.str, cursor - line.off);
-            Color color = tdisp->style->cursor.bgcolor;
-            DrawRectangle(
-                draw_context.line_x + draw_context.line_num_w + relative_cursor_x,
-                draw_context.line_y,
-                3,
-                draw_context.line_height,
-                color
-            );
-        }
-        return true;
+/* Draws the carets that are in the line. */
+static void drawCursors(DrawContext draw_context)
+{
+    TextDisplay *tdisp = draw_context.tdisp;
+    Line line = draw_context.line;
+    for (size_t i = findCursor(tdisp, line.off); i < tdisp->num_cursors; i++) {
+        Cursor cursor = tdisp->cursors[i];
+        if (cursorStart(cursor) > line.off + line.len)
+            break;
+        if (line.off <= cursor.head && cursor.head <= line.off + line.len)
+            drawCursor(draw_context, cursor.head);
     }
-    return false;
 }
 
-static void drawCallback(GUIElement *elem)
+static bool rowIsDamaged(DrawContext draw_context, Rectangle damage)
 {
-    TextDisplay *tdisp = (TextDisplay*) elem;
+    return draw_context.line_y < damage.y + damage.height
+        && draw_context.line_y + (int) draw_context.line_height > damage.y;
+}
 
+/* Repaints the damaged area of the cached texture.
+ * Rows outside of it are only measured, since the
+ * width of the longest line is still needed. */
+static void renderTexture(TextDisplay *tdisp, Rectangle damage)
+{
     BeginTextureMode(tdisp->texture);
+    BeginScissorMode(damage.x, damage.y, damage.width, damage.height);
     ClearBackground(tdisp->style->text.bgcolor);
     
+    // Only the last cursor can be past the last line
+    size_t last_cursor = tdisp->cursors[tdisp->num_cursors-1].head;
+
     float max_w = 0;
     bool drew_cursor = false;
     DrawContext draw_context;
     initDrawContext(&draw_context, tdisp);
     while (nextLine(&draw_context)) {
-        drawLineno(draw_context.no, 
-                   draw_context.line_x, 
-                   draw_context.line_y, 
-                   draw_context.line_num_w, 
-                   draw_context.line_height,
-                   tdisp->lineno.font,
-                   tdisp->style);
-        drawSelection(draw_context);
-        float w = drawLineText(draw_context);
-        if (drawCursor(draw_context))
+        float w;
+        Line line = draw_context.line;
+        if (rowIsDamaged(draw_context, damage)) {
+            drawLineno(draw_context.no, 
+                       draw_context.line_x, 
+                       draw_context.line_y, 
+                       draw_context.line_num_w, 
+                       draw_context.line_height,
+                       tdisp->lineno.font,
+                       tdisp->style);
+            drawMatches(draw_context);
+            drawSelections(draw_context);
+            w = drawLineText(draw_context);
+            drawCursors(draw_context);
+        } else
+            w = calculateStringRenderWidth(tdisp->text.font, tdisp->style->text.font_size, 
+                                           line.str, line.len);
+        if (line.off <= last_cursor && last_cursor <= line.off + line.len)
             drew_cursor = true;
 
         if (w > max_w)
@@ -656,7 +1547,78 @@ static void drawCallback(GUIElement *elem)
     scrollbar_draw(&tdisp->h_scroll);
     tdisp->text.logest_line_width = max_w;
     freeDrawContext(&draw_context);
+    EndScissorMode();
     EndTextureMode();
+}
+
+/* Draws the query and the position of the selected
+ * match over the first row. */
+static void drawFindBar(TextDisplay *tdisp)
+{
+    const TextDisplayStyle *style = tdisp->style;
+    const FontMetrics *font = tdisp->text.font;
+    MatchIndex *matches = &tdisp->find.matches;
+    Rectangle region = tdisp->base.region;
+    int font_size = style->text.font_size;
+    int h = TextDisplay_getLineHeight(tdisp);
+    int x = region.x + FIND_BAR_PADDING;
+    int y = region.y + (h - font_size) / 2;
+
+    BeginScissorMode(region.x, region.y, region.width, h);
+    DrawRectangle(region.x, region.y, region.width, h, style->lineno.bgcolor);
+
+    const char *label = tdisp->find.regex ? "Regex: " : "Find: ";
+    x += renderString(font, label, strlen(label), x, y, font_size, style->lineno.fgcolor);
+    x += renderString(font, tdisp->find.query, tdisp->find.query_len,
+                      x, y, font_size, style->text.fgcolor);
+    if (!tdisp->find.replacing)
+        DrawRectangle(x, y, 2, font_size, style->cursor.bgcolor);
+    else {
+        x += 2 * FIND_BAR_PADDING;
+        const char *replace_label = "Replace: ";
+        x += renderString(font, replace_label, strlen(replace_label),
+                          x, y, font_size, style->lineno.fgcolor);
+        x += renderString(font, tdisp->find.replacement, tdisp->find.replacement_len,
+                          x, y, font_size, style->text.fgcolor);
+        DrawRectangle(x, y, 2, font_size, style->cursor.bgcolor);
+    }
+
+    char status[64];
+    int n = 0;
+    size_t count = MatchIndex_getCount(matches);
+    bool complete = MatchIndex_isComplete(matches, &tdisp->buffer);
+    const char *more = (complete && !matches->full) ? "" : "+";
+    if (tdisp->find.query_len == 0)
+        n = 0;
+    else if (tdisp->find.error[0] != '\0')
+        n = snprintf(status, sizeof(status), "%s", tdisp->find.error);
+    else if (count == 0 && complete)
+        n = snprintf(status, sizeof(status), "No matches");
+    else {
+        Cursor *main_cursor = getMainCursor(tdisp);
+        size_t cursor = cursorStart(*main_cursor);
+        size_t i = MatchIndex_search(matches, &tdisp->buffer, cursor);
+        if (main_cursor->head != main_cursor->anchor && i < count 
+            && MatchIndex_get(matches, &tdisp->buffer, i) == cursor)
+            n = snprintf(status, sizeof(status), "%zu of %zu%s", i + 1, count, more);
+        else
+            n = snprintf(status, sizeof(status), "%zu%s matches", count, more);
+    }
+    if (n > 0) {
+        int w = calculateStringRenderWidth(font, font_size, status, n);
+        renderString(font, status, n, region.x + region.width - w - FIND_BAR_PADDING,
+                     y, font_size, style->lineno.fgcolor);
+    }
+    EndScissorMode();
+}
+
+static void drawCallback(GUIElement *elem)
+{
+    TextDisplay *tdisp = (TextDisplay*) elem;
+
+    Rectangle damage;
+    if (GUIElement_takeDamage(elem, &damage))
+        renderTexture(tdisp, damage);
 
     {
         RenderTexture2D target = tdisp->texture;
@@ -674,17 +1636,32 @@ static void drawCallback(GUIElement *elem)
         DrawTexturePro(target.texture, src, 
                        dst, org, 0, WHITE);
     }
+
+    if (tdisp->find.active)
+        drawFindBar(tdisp);
+
+    if (!tdisp->damaged && GapBuffer_isDamaged(&tdisp->buffer)) {
+        TraceLog(LOG_WARNING, "\"%s\" was cut short by another program, "
+                 "the text past its new end reads as zeros", tdisp->file);
+        tdisp->damaged = true;
+    }
 }
 
 static void freeCallback(GUIElement *elem)
 {
     TextDisplay *tdisp = (TextDisplay*) elem;
     UnloadRenderTexture(tdisp->texture);
-    UnloadFont(tdisp->text.font);
-    UnloadFont(tdisp->lineno.font);
+    FontMetrics_unload(tdisp->text.font);
+    FontMetrics_unload(tdisp->lineno.font);
     Scrollbar_free(&tdisp->v_scroll);
     Scrollbar_free(&tdisp->h_scroll);
     GapBuffer_free(&tdisp->buffer);
+    UndoJournal_free(&tdisp->journal);
+    free(tdisp->cursors);
+    clearMatches(tdisp);
+    MatchIndex_free(&tdisp->find.matches);
+    if (tdisp->prefetcher != NULL)
+        FilePrefetcher_stop(tdisp->prefetcher);
     free(elem);
 }
 
@@ -707,11 +1684,22 @@ static const GUIElementMethods methods = {
     .onPaste = onPasteCallback,
     .onCopy = onCopyCallback,
     .onCut = onCutCallback,
+    .onUndo = onUndoCallback,
+    .onRedo = onRedoCallback,
     .onSave = onSaveCallback,
     .onOpen = onOpenCallback,
+    .onFind = onFindCallback,
+    .onToggleRegex = onToggleRegexCallback,
+    .onReplace = onReplaceCallback,
+    .onEscapeDown = onEscapeDownCallback,
+    .onArrowUpDown = onArrowUpDownCallback,
+    .onArrowDownDown = onArrowDownDownCallback,
     .getHovered = NULL,
     .onResize = onResizeCallback,
     .openFile = openFileCallback,
+    .saveFile = saveFileCallback,
+    .prefetchFile = prefetchFileCallback,
+    .selectRange = selectRangeCallback,
     .getMinimumSize = getMinimumSize,
     .getLogicalSize = getLogicalSizeCallback,
 };
@@ -723,8 +1711,27 @@ GUIElement *TextDisplay_new(Rectangle region,
 {
     TextDisplay *tdisp = malloc(sizeof(TextDisplay));
     if (tdisp != NULL) {
+        tdisp->text.font = FontMetrics_load(loadFont(style->text.baked_font,
+                                                     style->text.font_data, 
+                                                     style->text.font_data_size,
+                                                     style->text.font_file, 
+                                                     style->text.font_size));
+        tdisp->lineno.font = FontMetrics_load(loadFont(style->lineno.baked_font,
+                                                       style->lineno.font_data, 
+                                                       style->lineno.font_data_size,
+                                                       style->lineno.font_file, 
+                                                       style->lineno.font_size));
+        tdisp->cursors = malloc(sizeof(Cursor));
+        if (tdisp->text.font == NULL || tdisp->lineno.font == NULL || tdisp->cursors == NULL) {
+            FontMetrics_unload(tdisp->text.font);
+            FontMetrics_unload(tdisp->lineno.font);
+            free(tdisp->cursors);
+            free(tdisp);
+            return NULL;
+        }
         tdisp->base.region = region;
         tdisp->base.methods = &methods;
+        tdisp->base.dirty = false;
         strncpy(tdisp->base.name, name, 
                 sizeof(tdisp->base.name));
         tdisp->base.name[sizeof(tdisp->base.name)-1] = '\0';
@@ -734,27 +1741,30 @@ GUIElement *TextDisplay_new(Rectangle region,
         Scrollbar_init(&tdisp->h_scroll, ScrollbarDirection_HORIZONTAL, (GUIElement*) tdisp, style->h_scroll);
         tdisp->focused = false;
         tdisp->selecting = false;
-        tdisp->selection.active = false;
+        tdisp->cursors[0] = (Cursor) {0, 0};
+        tdisp->num_cursors = 1;
+        tdisp->max_cursors = 1;
+        tdisp->main_cursor = 0;
         tdisp->texture = LoadRenderTexture(region.width, 
                                            region.height);
 
         tdisp->text.logest_line_width = 0;
-        if (style->text.font_data == NULL)
-            tdisp->text.font = LoadFontEx(style->text.font_file, 
-                                          style->text.font_size, 
-                                          NULL, 250);
-        else
-            tdisp->text.font = LoadFontFromMemory(".ttf", style->text.font_data, 
-                                                  style->text.font_data_size, 
-                                                  style->text.font_size, NULL, 250);
-        if (style->lineno.font_data == NULL)
-            tdisp->lineno.font = LoadFontEx(style->lineno.font_file, 
-                                            style->lineno.font_size, 
-                                            NULL, 250);
-        else
-            tdisp->lineno.font = LoadFontFromMemory(".ttf", style->lineno.font_data, 
-                                                    style->lineno.font_data_size, 
-                                                    style->lineno.font_size, NULL, 250);
+        UndoJournal_init(&tdisp->journal, style->undo_budget);
+        UndoJournal_setListener(&tdisp->journal, onBufferEdit, tdisp);
+        tdisp->find.active = false;
+        tdisp->find.pending = false;
+        tdisp->find.query_len = 0;
+        tdisp->find.regex = false;
+        tdisp->find.compiled = NULL;
+        tdisp->find.error[0] = '\0';
+        tdisp->find.replacing = false;
+        tdisp->find.replacement_len = 0;
+        MatchIndex_init(&tdisp->find.matches);
+
+        tdisp->damaged = false;
+        tdisp->prefetcher = FilePrefetcher_start(PREFETCH_MAX_BYTES, loadBuffer);
+        if (tdisp->prefetcher == NULL)
+            TraceLog(LOG_WARNING, "Couldn't start loading files ahead");
 
         if (file == NULL) {
             tdisp->file[0] = '\0';
@@ -762,13 +1772,15 @@ GUIElement *TextDisplay_new(Rectangle region,
         } else {
             strncpy(tdisp->file, file, sizeof(tdisp->file));
             if (FileExists(file)) {
-                if (!GapBuffer_initFile(&tdisp->buffer, file)) {
+                if (!loadBuffer(&tdisp->buffer, file)) {
                     TraceLog(LOG_WARNING, "Failed to load \"%s\"", file);
                     GapBuffer_initEmpty(&tdisp->buffer);
                 }
             } else
                 GapBuffer_initEmpty(&tdisp->buffer);
         }
+        GUIElement_scheduleTick(0);
+        GUIElement_invalidateAll(&tdisp->base);
     }
     return (GUIElement*) tdisp;
 }
@@ -3,6 +3,7 @@
 #include <raylib.h>
 #include "guielement.h"
 #include "scrollbar.h"
+#include "bakedfont.h"
 
 typedef enum {
     TextAlignH_LEFT,
@@ -22,6 +23,7 @@ typedef struct {
         bool nobg;
         Color fgcolor;
         Color bgcolor;
+        const BakedFont     *baked_font;
         const unsigned char *font_data;
         size_t               font_data_size;
         const char *font_file;
@@ -39,12 +41,14 @@ typedef struct {
         bool nobg;
         Color fgcolor;
         Color bgcolor;
+        const BakedFont     *baked_font;
         const unsigned char *font_data;
         size_t               font_data_size;
         const char *font_file;
         int         font_size;
         TextAlignV v_align;
         Color selection_bgcolor;
+        Color match_bgcolor; // Of the matches of the find bar
     } text;
     struct {
         Color bgcolor;
@@ -53,6 +57,7 @@ typedef struct {
     ScrollbarStyle *h_scroll;
     bool    auto_line_height;
     unsigned int line_height;
+    size_t  undo_budget; // Bytes of edit history, 0 for the default
 } TextDisplayStyle;
 
 GUIElement *TextDisplay_new(Rectangle region, const char *name, const char *file, const TextDisplayStyle *style);
@@ -1,79 +1,211 @@
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <raylib.h>
+#include <rlgl.h>
+#include "utils.h"
 #include "xutf8.h"
 #include "textrenderutils.h"
 
-float 
-calculateStringRenderWidth(Font font, int font_size,
-                           const char *str, size_t len)
+/* Loads the font for a widget, preferring the atlas
+ * baked at build time when there's one for the 
+ * requested size, then the embedded TTF and lastly
+ * the TTF file. */
+Font loadFont(const BakedFont *baked, 
+              const unsigned char *data, size_t data_size, 
+              const char *file, int font_size)
+{
+    if (baked != NULL) {
+        if (baked->size == font_size)
+            return BakedFont_load(baked);
+        TraceLog(LOG_WARNING, "Baked font has size %d instead of %d", 
+                 baked->size, font_size);
+    }
+    if (data == NULL)
+        return LoadFontEx(file, font_size, NULL, 250);
+    return LoadFontFromMemory(".ttf", data, data_size, font_size, NULL, 250);
+}
+
+static float getGlyphAdvance(Font font, int glyph_index)
+{
+    int advance_x = font.glyphs[glyph_index].advanceX;
+    if (advance_x)
+        return (float) advance_x;
+    return (float) font.recs[glyph_index].width
+         + (float) font.glyphs[glyph_index].offsetX;
+}
+
+FontMetrics *FontMetrics_load(Font font)
 {
     if (font.texture.id == 0) 
         font = GetFontDefault();
 
-    float scale = (float) font_size / font.baseSize;
-    float  w = 0;
+    FontMetrics *metrics = malloc(sizeof(FontMetrics));
+    float *advances = malloc(sizeof(float) * MAX(font.glyphCount, 1));
+    if (metrics == NULL || advances == NULL) {
+        TraceLog(LOG_WARNING, "Failed to allocate font metrics");
+        UnloadFont(font);
+        free(metrics);
+        free(advances);
+        return NULL;
+    }
+    metrics->font = font;
+    metrics->advances = advances;
+
+    // Codepoints that aren't in the font are drawn
+    // as the question mark, like GetGlyphIndex does.
+    int fallback = 0;
+    for (int i = 0; i < font.glyphCount; i++)
+        if (font.glyphs[i].value == '?') {
+            fallback = i;
+            break;
+        }
+    for (size_t i = 0; i < 0x10000; i++)
+        metrics->index[i] = fallback;
+
+    // Walked backwards so that the first glyph wins
+    // when a codepoint appears more than once.
+    metrics->monospace = (font.glyphCount > 0);
+    metrics->advance = (font.glyphCount > 0) ? getGlyphAdvance(font, 0) : 0;
+    for (int i = font.glyphCount-1; i >= 0; i--) {
+        int value = font.glyphs[i].value;
+        if (value >= 0 && value < 0x10000 && i <= UINT16_MAX)
+            metrics->index[value] = i;
+        advances[i] = getGlyphAdvance(font, i);
+        if (advances[i] != metrics->advance)
+            metrics->monospace = false;
+    }
+
+    for (int i = 0; i < 128; i++)
+        metrics->ascii[i] = advances[metrics->index[i]];
+    return metrics;
+}
+
+void FontMetrics_unload(FontMetrics *metrics)
+{
+    if (metrics != NULL) {
+        UnloadFont(metrics->font);
+        free(metrics->advances);
+        free(metrics);
+    }
+}
+
+static int getGlyphIndexFast(const FontMetrics *metrics, uint32_t codepoint)
+{
+    if (codepoint < 0x10000)
+        return metrics->index[codepoint];
+    return GetGlyphIndex(metrics->font, codepoint);
+}
+
+static float getAdvance(const FontMetrics *metrics, uint32_t codepoint)
+{
+    if (codepoint < 128)
+        return metrics->ascii[codepoint];
+    return metrics->advances[getGlyphIndexFast(metrics, codepoint)];
+}
+
+/* Decodes the codepoint at the start of [str],
+ * which is '?' when the sequence is invalid. */
+static int nextCodepoint(const char *str, size_t len, uint32_t *codepoint)
+{
+    unsigned char first = str[0];
+    if (first < 0x80) {
+        *codepoint = first;
+        return 1;
+    }
+    int consumed = xutf8_sequence_to_utf32_codepoint(str, len, codepoint);
+    if (consumed < 1) {
+        *codepoint = '?';
+        consumed = 1;
+    }
+    return consumed;
+}
+
+static size_t countCodepoints(const char *str, size_t len)
+{
+    size_t count = 0;
     size_t i = 0;
     while (i < len) {
 
-        int consumed;
-        int letter = GetCodepoint(str + i, &consumed);
-        assert(letter != '\n');
+        // Skip runs of ASCII a word at a time
+        uint64_t word;
+        while (len - i >= sizeof(word)) {
+            memcpy(&word, str + i, sizeof(word));
+            if (word & 0x8080808080808080)
+                break;
+            i += sizeof(word);
+            count += sizeof(word);
+        }
+        if (i == len)
+            break;
 
-        int glyph_index = GetGlyphIndex(font, letter);
+        uint32_t codepoint;
+        i += nextCodepoint(str + i, len - i, &codepoint);
+        count++;
+    }
+    return count;
+}
 
-        if (letter == 0x3f)
-            i++;
-        else
-            i += consumed;
+float 
+calculateStringRenderWidth(const FontMetrics *font, int font_size,
+                           const char *str, size_t len)
+{
+    float scale = (float) font_size / font->font.baseSize;
 
-        float delta;
-        int advanceX = font.glyphs[glyph_index].advanceX;
-        if (advanceX)
-            delta = (float) advanceX * scale;
-        else
-            delta = (float) font.recs[glyph_index].width * scale
-                  + (float) font.glyphs[glyph_index].offsetX * scale;
+    if (font->monospace)
+        return (float) countCodepoints(str, len) * font->advance * scale;
 
-        w += delta;
+    float  w = 0;
+    size_t i = 0;
+    while (i < len) {
+        uint32_t codepoint;
+        i += nextCodepoint(str + i, len - i, &codepoint);
+        assert(codepoint != '\n');
+        w += getAdvance(font, codepoint) * scale;
     }
     return w;
 }
 
 size_t 
-longestSubstringThatRendersInLessPixelsThan(Font font, int font_size,
+longestSubstringThatRendersInLessPixelsThan(const FontMetrics *font, int font_size,
                                             const char *str, size_t len, 
                                             float max_px_len)
 {
     if (str == NULL)
         str = "";
 
-    if (font.texture.id == 0) 
-        font = GetFontDefault();
+    float scale = (float) font_size / font->font.baseSize;
 
-    float scale = (float) font_size / font.baseSize;
+    // The codepoint that crosses the limit is
+    // part of the substring.
+    if (font->monospace) {
+        float delta = font->advance * scale;
+        size_t count;
+        if (max_px_len < 0)
+            count = 1;
+        else if (delta <= 0 || max_px_len / delta >= len)
+            count = len;
+        else
+            count = (size_t) (max_px_len / delta) + 1;
+
+        size_t i = 0;
+        while (i < len && count > 0) {
+            uint32_t codepoint;
+            i += nextCodepoint(str + i, len - i, &codepoint);
+            count--;
+        }
+        return i;
+    }
 
     float  w = 0;
     size_t i = 0;
     while (i < len) {
 
         uint32_t codepoint;
-        int consumed = xutf8_sequence_to_utf32_codepoint(str + i, len - i, &codepoint);
-
-        if (consumed < 0) {
-            codepoint = '?';
-            consumed = 1;
-        }
-        i += consumed;
-        int glyph_index = GetGlyphIndex(font, codepoint);
+        i += nextCodepoint(str + i, len - i, &codepoint);
 
-        float delta;
-        int advanceX = font.glyphs[glyph_index].advanceX;
-        if (advanceX)
-            delta = (float) advanceX * scale;
-        else
-            delta = (float) font.recs[glyph_index].width * scale
-                  + (float) font.glyphs[glyph_index].offsetX * scale;
-        
+        float delta = getAdvance(font, codepoint) * scale;
         assert(delta >= 0);
         if (w + delta > max_px_len)
             break;
@@ -84,51 +216,109 @@ longestSubstringThatRendersInLessPixelsThan(Font font, int font_size,
     return i;
 }
 
-float renderString(Font font, const char *str, size_t len,
+// Glyphs are handed to rlgl this many at a time
+#define GLYPH_RUN_CAPACITY 256
+
+typedef struct {
+    Rectangle src; // In texture coordinates
+    Rectangle dst;
+} GlyphQuad;
+
+/* Quads of glyphs that share the same atlas and
+ * color, which are submitted to the render batch
+ * in one go instead of going through the checks 
+ * of DrawTexturePro for each one. */
+typedef struct {
+    Texture2D texture;
+    Color     tint;
+    size_t    count;
+    GlyphQuad quads[GLYPH_RUN_CAPACITY];
+} GlyphRun;
+
+static void flushGlyphRun(GlyphRun *run)
+{
+    if (run->count == 0)
+        return;
+
+    rlCheckRenderBatchLimit(4 * run->count);
+    rlSetTexture(run->texture.id);
+    rlBegin(RL_QUADS);
+    rlColor4ub(run->tint.r, run->tint.g, run->tint.b, run->tint.a);
+    rlNormal3f(0, 0, 1);
+    for (size_t i = 0; i < run->count; i++) {
+        Rectangle src = run->quads[i].src;
+        Rectangle dst = run->quads[i].dst;
+        rlTexCoord2f(src.x, src.y);
+        rlVertex2f(dst.x, dst.y);
+        rlTexCoord2f(src.x, src.y + src.height);
+        rlVertex2f(dst.x, dst.y + dst.height);
+        rlTexCoord2f(src.x + src.width, src.y + src.height);
+        rlVertex2f(dst.x + dst.width, dst.y + dst.height);
+        rlTexCoord2f(src.x + src.width, src.y);
+        rlVertex2f(dst.x + dst.width, dst.y);
+    }
+    rlEnd();
+    rlSetTexture(0);
+    run->count = 0;
+}
+
+/* Same quad as raylib's DrawTextCodepoint, but
+ * with the glyph index already resolved. */
+static void pushGlyph(GlyphRun *run, Font font, int glyph_index, 
+                      float x, float y, float scale)
+{
+    if (run->count == GLYPH_RUN_CAPACITY)
+        flushGlyphRun(run);
+
+    Rectangle rec = font.recs[glyph_index];
+    GlyphInfo glyph = font.glyphs[glyph_index];
+    float padding = font.glyphPadding;
+    float tex_w = font.texture.width;
+    float tex_h = font.texture.height;
+
+    GlyphQuad *quad = &run->quads[run->count++];
+    quad->src.x = (rec.x - padding) / tex_w;
+    quad->src.y = (rec.y - padding) / tex_h;
+    quad->src.width  = (rec.width  + 2 * padding) / tex_w;
+    quad->src.height = (rec.height + 2 * padding) / tex_h;
+    quad->dst.x = x + (glyph.offsetX - padding) * scale;
+    quad->dst.y = y + (glyph.offsetY - padding) * scale;
+    quad->dst.width  = (rec.width  + 2 * padding) * scale;
+    quad->dst.height = (rec.height + 2 * padding) * scale;
+}
+
+float renderString(const FontMetrics *font, const char *str, size_t len,
                    int off_x, int off_y, float font_size, 
                    Color tint)
 {
-    if (font.texture.id == 0) 
-        font = GetFontDefault();
-
     int   y = off_y;
     float x = off_x; // Offset X to next character to draw
 
-    float spacing = 0;
-    float scale = (float) font_size / font.baseSize; // Character quad scaling factor
+    float scale = (float) font_size / font->font.baseSize; // Character quad scaling factor
+
+    GlyphRun run;
+    run.texture = font->font.texture;
+    run.tint = tint;
+    run.count = 0;
 
     size_t i = 0;
     while (i < len) {
 
         uint32_t codepoint;
-        int consumed = xutf8_sequence_to_utf32_codepoint(str + i, len - i, &codepoint);
-
-        if (consumed < 1) {
-            codepoint = '?';
-            consumed = 1;
-        }
-
+        int consumed = nextCodepoint(str + i, len - i, &codepoint);
         assert(consumed > 0);
-        int glyph_index = GetGlyphIndex(font, codepoint);
-
         assert(codepoint != '\n');
 
-        if (codepoint != ' ' && codepoint != '\t') {
-            Vector2 position = {x, y};
-            DrawTextCodepoint(font, codepoint, position, 
-                              font_size, tint);
-        }
+        int glyph_index = getGlyphIndexFast(font, codepoint);
 
-        float delta;
-        int advance_x = font.glyphs[glyph_index].advanceX;
-        if (advance_x == 0) 
-            delta = (float) font.recs[glyph_index].width * scale + spacing;
-        else 
-            delta = (float) advance_x * scale + spacing;
+        if (codepoint != ' ' && codepoint != '\t')
+            pushGlyph(&run, font->font, glyph_index, x, y, scale);
 
-        x += delta;
+        x += font->advances[glyph_index] * scale;
         i += consumed;
     }
+    flushGlyphRun(&run);
+
     float w = x - (float) off_x;
     return w;
 }
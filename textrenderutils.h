@@ -1,15 +1,40 @@
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <raylib.h>
+#include "bakedfont.h"
 
-float renderString(Font font, const char *str, size_t len,
+/* A font along with flat tables of its glyph
+ * indices and advances, so that measuring and
+ * drawing text doesn't go through GetGlyphIndex
+ * (which is a linear search) for every glyph.
+ * Advances are in the font's base size units.
+ * Loading the metrics takes ownership of the font. */
+typedef struct {
+    Font     font;
+    bool     monospace;
+    float    advance; // Of every glyph when monospace
+    float    ascii[128];
+    float   *advances; // By glyph index
+    uint16_t index[0x10000]; // Glyph index of each BMP codepoint
+} FontMetrics;
+
+FontMetrics *FontMetrics_load(Font font);
+void         FontMetrics_unload(FontMetrics *metrics);
+
+Font loadFont(const BakedFont *baked, 
+              const unsigned char *data, size_t data_size, 
+              const char *file, int font_size);
+
+float renderString(const FontMetrics *font, const char *str, size_t len,
                    int off_x, int off_y, float font_size, 
                    Color tint);
 
 float 
-calculateStringRenderWidth(Font font, int font_size,
+calculateStringRenderWidth(const FontMetrics *font, int font_size,
                            const char *str, size_t len);
 
 size_t 
-longestSubstringThatRendersInLessPixelsThan(Font font, int font_size,
+longestSubstringThatRendersInLessPixelsThan(const FontMetrics *font, int font_size,
                                             const char *str, size_t len, 
                                             float max_px_len);
@@ -1,364 +1,1313 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
-#include <dirent.h>
 #include <libgen.h>
-#include <unistd.h>
-#include <sys/stat.h>
+#include "utils.h"
 #include "treeview.h"
+#include "dirscan.h"
+#include "dirwatch.h"
+#include "dircrawl.h"
 #include "textrenderutils.h"
 
-#define ITEMS_PER_BATCH 64
+#define NO_ITEM UINT32_MAX
+#define ROOT_ITEM 0
+
+// How long the pointer rests on a file before
+// it's reported as likely to be opened.
+#define HOVER_DELAY_MS 50
 
 typedef enum {
     ItemType_DIR,
     ItemType_FILE,
     ItemType_OTHER,
+    ItemType_FREE, // Released, dropped by the next compaction
 } ItemType;
 
-typedef struct Item Item;
-struct Item {
-    char   name[256];
-    size_t name_len;
-    ItemType type;
+typedef enum {
+    ItemScan_NONE,    // The children weren't listed yet
+    ItemScan_PENDING, // The children are being listed
+    ItemScan_STALE,   // Like PENDING, but changed since
+    ItemScan_DONE,
+} ItemScan;
+
+/* Items refer to each other by their index in
+ * the pool, and the children of a directory are
+ * stored next to each other. */
+typedef struct {
+    uint32_t name;         // Offset in the name arena
+    uint32_t parent;
+    uint32_t children;     // Index of the first child
+    uint32_t num_children;
+    uint8_t  type;
+    uint8_t  scan;
     bool     open;
-    Item *children;
-    Item *next;
-};
-
-typedef struct ItemBatch ItemBatch;
-struct ItemBatch {
-    ItemBatch *prev;
-    Item       list[ITEMS_PER_BATCH];
-};
+} Item;
 
+/* Names are interned, each one stored once in
+ * the arena prefixed by its length. Released
+ * items stay in place until there are enough of
+ * them to be worth compacting the pool. */
 typedef struct {
-    Item *free_list;
-    ItemBatch *tail;
-    ItemBatch  head;
+    Item     *items;
+    uint32_t  num_items;
+    uint32_t  max_items;
+    uint32_t  num_free;
+    char     *names;
+    uint32_t  names_used;
+    uint32_t  names_size;
+    uint32_t *table; // Offsets of the names by hash, 0 when empty
+    uint32_t  table_size;
+    uint32_t  num_names;
 } ItemPool;
 
-static void initBatch(ItemBatch *batch)
+static void ItemPool_init(ItemPool *pool)
 {
-    for (size_t i = 0; i < ITEMS_PER_BATCH-1; i++)
-        batch->list[i].next = &batch->list[i+1];
-    batch->list[ITEMS_PER_BATCH-1].next = NULL;
-    batch->prev = NULL;
+    memset(pool, 0, sizeof(ItemPool));
+    pool->names_used = 1; // Offset 0 is not a name
 }
 
-static void linkBatch(ItemBatch *batch, ItemPool *pool)
+static void ItemPool_free(ItemPool *pool)
 {
-    batch->prev = pool->tail;
-    pool->tail = batch;
+    free(pool->items);
+    free(pool->names);
+    free(pool->table);
+}
 
-    batch->list[ITEMS_PER_BATCH-1].next = pool->free_list;
-    pool->free_list = batch->list;
+/* Returns the index of [count] new contiguous
+ * items, or NO_ITEM. The items may be moved, so
+ * pointers to them don't survive this. */
+static uint32_t ItemPool_alloc(ItemPool *pool, uint32_t count)
+{
+    if (pool->max_items - pool->num_items < count) {
+        size_t max_items = MAX(2 * (size_t) pool->max_items, (size_t) pool->num_items + count);
+        max_items = MAX(max_items, 256);
+        if (max_items >= NO_ITEM)
+            return NO_ITEM;
+        Item *items = realloc(pool->items, max_items * sizeof(Item));
+        if (items == NULL)
+            return NO_ITEM;
+        pool->items = items;
+        pool->max_items = max_items;
+    }
+    uint32_t index = pool->num_items;
+    pool->num_items += count;
+    return index;
 }
 
-static void ItemPool_init(ItemPool *pool)
+static const char *getName(const ItemPool *pool, const Item *item, size_t *len)
 {
-    ItemBatch *head = &pool->head;
-    pool->tail = NULL;
-    pool->free_list = NULL;
-    initBatch(head);
-    linkBatch(head, pool);
+    const char *name = pool->names + item->name;
+    *len = (unsigned char) name[0];
+    return name + 1;
 }
 
-static void ItemPool_free(ItemPool *pool)
+static uint32_t hashName(const char *name, size_t len)
 {
-    ItemBatch *batch = pool->tail;
-    while (batch->prev != NULL) {
-        ItemBatch *prev = batch->prev;
-        free(batch);
-        batch = prev;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
     }
+    return hash;
 }
 
-static bool ItemPool_grow(ItemPool *pool)
+static bool growTable(ItemPool *pool)
 {
-    ItemBatch *batch = malloc(sizeof(ItemBatch));
-    if (batch != NULL) {
-        initBatch(batch);
-        linkBatch(batch, pool);
-        return true;
+    uint32_t size = MAX(2 * pool->table_size, 1024);
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    if (table == NULL)
+        return false;
+
+    for (uint32_t i = 0; i < pool->table_size; i++) {
+        uint32_t name = pool->table[i];
+        if (name != 0) {
+            size_t len = (unsigned char) pool->names[name];
+            uint32_t j = hashName(pool->names + name + 1, len) & (size - 1);
+            while (table[j] != 0)
+                j = (j + 1) & (size - 1);
+            table[j] = name;
+        }
     }
-    return false;
+    free(pool->table);
+    pool->table = table;
+    pool->table_size = size;
+    return true;
 }
 
-static Item *ItemPool_getSlot(ItemPool *pool)
+/* Returns the offset of [name] in the arena,
+ * adding it if no item uses it yet, or 0 if
+ * there's no memory. */
+static uint32_t ItemPool_intern(ItemPool *pool, const char *name, size_t len)
 {
-    bool no_free_slots_left = (pool->free_list == NULL);
+    assert(len < 256);
+
+    if (2 * (pool->num_names + 1) > pool->table_size && !growTable(pool))
+        return 0;
+
+    uint32_t mask = pool->table_size - 1;
+    uint32_t i = hashName(name, len) & mask;
+    while (pool->table[i] != 0) {
+        const char *curr = pool->names + pool->table[i];
+        if ((unsigned char) curr[0] == len && !memcmp(curr + 1, name, len))
+            return pool->table[i];
+        i = (i + 1) & mask;
+    }
 
-    if (no_free_slots_left) {
-        bool failed_to_grow_pool = !ItemPool_grow(pool);
-        if (failed_to_grow_pool)
-            return NULL;
+    if ((size_t) pool->names_used + len + 1 > pool->names_size) {
+        size_t size = MAX(2 * (size_t) pool->names_size, pool->names_used + len + 1);
+        size = MAX(size, 4096);
+        if (size > UINT32_MAX)
+            return 0;
+        char *names = realloc(pool->names, size);
+        if (names == NULL)
+            return 0;
+        pool->names = names;
+        pool->names_size = size;
     }
 
-    Item *item = pool->free_list;
-    pool->free_list = item->next;
+    uint32_t offset = pool->names_used;
+    pool->names[offset] = len;
+    memcpy(pool->names + offset + 1, name, len);
+    pool->names_used += len + 1;
+    pool->table[i] = offset;
+    pool->num_names++;
+    return offset;
+}
 
-    memset(item, 0, sizeof(Item));
-    return item;
+/* A directory being listed by the scanner. [dir]
+ * is NO_ITEM when the listing isn't wanted anymore
+ * but the scanner may still send batches for it.
+ * The first listing of a directory appends its
+ * entries as they come, while a refresh collects
+ * them and compares them with the children once
+ * it's complete. */
+typedef struct ScanTarget ScanTarget;
+struct ScanTarget {
+    ScanTarget *prev;
+    ScanTarget *next;
+    uint32_t dir;
+    size_t   last_row; // Where the last child was last seen
+    bool     refresh;
+    DirScanBatch *listing; // Batches of a refresh
+    size_t   path_len;
+    char     path[];
+};
+
+/* Open directories are watched for changes. */
+typedef struct {
+    int      wd;
+    uint32_t dir;
+} Watch;
+
+/* The tree is drawn and hit-tested through the
+ * list of its visible items, which is patched
+ * when a directory is opened, closed or gets new
+ * entries instead of walking the tree. */
+typedef struct {
+    uint32_t item;
+    uint32_t depth;
+    float    width; // Including the indentation
+} Row;
+
+typedef struct {
+    GUIElement base;
+    Rectangle old_region;
+    Scrollbar v_scroll;
+    Scrollbar h_scroll;
+    ItemPool pool;
+    DirScanner *scanner;
+    ScanTarget *targets;
+    DirWatcher *watcher; // NULL if inotify isn't available
+    Watch *watches;
+    size_t num_watches;
+    size_t max_watches;
+    DirCrawler *crawler; // NULL once the crawl is over
+    FileIndex  *index;   // NULL until then
+    uint32_t    index_version; // Changes with [index]
+    IgnoreRules *exclude; // Of the style, or NULL
+    Row   *rows;
+    size_t num_rows;
+    size_t max_rows;
+    FontMetrics *font;
+    RenderTexture2D texture;
+    float logic_w;
+    float logic_h;
+    char   path[1024];
+    size_t path_len;
+    uint32_t hovered;       // File under the pointer, or NO_ITEM
+    uint64_t hovered_since; // 0 until the first tick over it
+    bool     hover_reported;
+    const TreeViewStyle *style;
+    void (*callback)(const char*, size_t, void*);
+    void (*hover_callback)(const char*, size_t, void*);
+    void *userp;
+} TreeView;
+
+static Item *getItem(TreeView *tv, uint32_t index)
+{
+    assert(index < tv->pool.num_items);
+    return &tv->pool.items[index];
 }
 
-static Item*
-buildDirectoryTree(const char *path, size_t path_len,
-                   const char *name, size_t name_len,
-                   size_t max_depth, ItemPool *pool)
+static bool isListing(const Item *item)
 {
-    if (max_depth == 0)
-        return NULL;
+    return item->scan == ItemScan_PENDING
+        || item->scan == ItemScan_STALE;
+}
 
-    if (name_len >= 256)
-        return NULL;
+static size_t getLineHeight(const TreeViewStyle *style)
+{
+    return (style->auto_line_height) ? (style->font_size) : (style->line_height);
+}
 
-    char full_name[1024];
-    if (path_len + name_len + 1 >= sizeof(full_name))
-        return NULL;
+/* Finds the row at [y], relative to the element. */
+static bool getRowAt(TreeView *tv, int y, size_t *row)
+{
+    int y_scroll = Scrollbar_getValue(&tv->v_scroll);
+    int off_y = y + y_scroll - (int) tv->style->padding_top;
+    if (off_y < 0)
+        return false;
+    *row = off_y / (int) getLineHeight(tv->style);
+    return *row < tv->num_rows;
+}
 
-    memcpy(full_name,                path, path_len);
-    memcpy(full_name + path_len + 1, name, name_len);
-    full_name[path_len] = '/';
-    full_name[path_len + name_len + 1] = '\0';
+static float measureRow(TreeView *tv, uint32_t index, size_t depth)
+{
+    size_t len;
+    const char *name = getName(&tv->pool, getItem(tv, index), &len);
+    const TreeViewStyle *style = tv->style;
+    return style->padding_left + depth * style->subtree_padding_left
+         + calculateStringRenderWidth(tv->font, style->font_size, name, len);
+}
 
-    DIR *dir = opendir(full_name);
-    if (dir == NULL)
-        return NULL;
+static void updateLogicalSize(TreeView *tv)
+{
+    float max_w = 0;
+    for (size_t i = 0; i < tv->num_rows; i++)
+        if (tv->rows[i].width > max_w)
+            max_w = tv->rows[i].width;
+    tv->logic_w = max_w;
+    tv->logic_h = getLineHeight(tv->style) * tv->num_rows
+                + tv->style->padding_top;
+}
 
-    Item *root;
-    {
-        root = ItemPool_getSlot(pool);
-        if (root == NULL) {
-            closedir(dir);
-            return NULL;
-        }
-        strcpy(root->name, name);
-        root->name_len = name_len;
-        root->type = ItemType_DIR;
-        root->open = false;
-        // root->children can be left uninitialized for now
-        root->next = NULL;
+/* Makes space for [count] rows at [index]. */
+static bool insertRows(TreeView *tv, size_t index, size_t count)
+{
+    assert(index <= tv->num_rows);
+
+    if (tv->num_rows + count > tv->max_rows) {
+        size_t max_rows = MAX(2 * tv->max_rows, tv->num_rows + count);
+        max_rows = MAX(max_rows, 256);
+        Row *rows = realloc(tv->rows, max_rows * sizeof(Row));
+        if (rows == NULL)
+            return false;
+        tv->rows = rows;
+        tv->max_rows = max_rows;
     }
+    memmove(tv->rows + index + count, tv->rows + index,
+            (tv->num_rows - index) * sizeof(Row));
+    tv->num_rows += count;
+    return true;
+}
 
-    Item **tail = &root->children;
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) {
+static void removeRows(TreeView *tv, size_t index, size_t count)
+{
+    assert(index + count <= tv->num_rows);
+    memmove(tv->rows + index, tv->rows + index + count,
+            (tv->num_rows - index - count) * sizeof(Row));
+    tv->num_rows -= count;
+}
 
-        char  *child_name = ent->d_name;
-        size_t child_name_len = strlen(child_name);
+static size_t countVisibleChildren(TreeView *tv, uint32_t dir)
+{
+    Item *item = getItem(tv, dir);
+    size_t count = item->num_children;
+    for (uint32_t i = 0; i < item->num_children; i++) {
+        Item *child = getItem(tv, item->children + i);
+        if (child->type == ItemType_DIR && child->open)
+            count += countVisibleChildren(tv, item->children + i);
+    }
+    return count;
+}
 
-        if (child_name[0] == '.')
-            continue;
+static size_t writeVisibleChildren(TreeView *tv, uint32_t dir,
+                                   size_t depth, Row *dst)
+{
+    Item *item = getItem(tv, dir);
+    size_t count = 0;
+    for (uint32_t i = 0; i < item->num_children; i++) {
+        uint32_t index = item->children + i;
+        dst[count].item  = index;
+        dst[count].depth = depth;
+        dst[count].width = measureRow(tv, index, depth);
+        count++;
+        Item *child = getItem(tv, index);
+        if (child->type == ItemType_DIR && child->open)
+            count += writeVisibleChildren(tv, index, depth+1, dst + count);
+    }
+    return count;
+}
 
-        ItemType type;
-        bool failed = false;
-        switch (ent->d_type) {
-            case DT_DIR: type = ItemType_DIR;  break;
-            case DT_REG: type = ItemType_FILE; break;
-            case DT_UNKNOWN: {
-                
-                if (path_len + name_len + child_name_len + 1 >= sizeof(full_name))
-                    failed = true;
-                else {
-                    memcpy(full_name + path_len + name_len + 1, child_name, child_name_len);
-                    full_name[path_len + name_len + 1 + child_name_len] = '\0';
-
-                    struct stat buffer;
-                    if (lstat(full_name, &buffer))
-                        // Failed to query file information
-                        failed = true;
-                    else {
-                        switch (buffer.st_mode & S_IFMT) {
-                            case S_IFDIR: type = ItemType_DIR;  break;
-                            case S_IFREG: type = ItemType_FILE; break;
-                            default: type = ItemType_OTHER; break;
-                        }
-                    }
+/* Returns the index of the row of [item], or
+ * SIZE_MAX if it's not visible. [hint] is where
+ * it's expected to be. */
+static size_t findRow(TreeView *tv, uint32_t item, size_t hint)
+{
+    if (hint < tv->num_rows && tv->rows[hint].item == item)
+        return hint;
+    for (size_t i = 0; i < tv->num_rows; i++)
+        if (tv->rows[i].item == item)
+            return i;
+    return SIZE_MAX;
+}
 
-                    full_name[path_len + name_len + 1] = '\0';
-                }
-            } break;
-            default: type = ItemType_OTHER; break;
+/* Index of the first row after the ones of the
+ * subtree of the row at [index]. */
+static size_t getSubtreeEnd(TreeView *tv, size_t index)
+{
+    size_t depth = tv->rows[index].depth;
+    size_t end = index + 1;
+    while (end < tv->num_rows && tv->rows[end].depth > depth)
+        end++;
+    return end;
+}
+
+/* Replaces the indices of the items moved from
+ * [old_index] by a compaction or a relocation
+ * wherever the view holds on to them. */
+static void remapRange(TreeView *tv, uint32_t old_index,
+                       uint32_t count, uint32_t new_index)
+{
+    for (size_t i = 0; i < tv->num_rows; i++) {
+        uint32_t item = tv->rows[i].item;
+        if (item >= old_index && item - old_index < count)
+            tv->rows[i].item = item - old_index + new_index;
+    }
+    if (tv->hovered != NO_ITEM && tv->hovered >= old_index && tv->hovered - old_index < count)
+        tv->hovered = tv->hovered - old_index + new_index;
+    for (ScanTarget *target = tv->targets; target != NULL; target = target->next) {
+        uint32_t dir = target->dir;
+        if (dir != NO_ITEM && dir >= old_index && dir - old_index < count)
+            target->dir = dir - old_index + new_index;
+    }
+    for (size_t i = 0; i < tv->num_watches; i++) {
+        uint32_t dir = tv->watches[i].dir;
+        if (dir >= old_index && dir - old_index < count)
+            tv->watches[i].dir = dir - old_index + new_index;
+    }
+}
+
+/* Makes room for [count] more children of [dir]
+ * and returns the index of the first one. Since
+ * children are contiguous, they're moved at the
+ * end of the pool unless they're already there. */
+static uint32_t appendChildren(TreeView *tv, uint32_t dir, uint32_t count)
+{
+    ItemPool *pool = &tv->pool;
+    uint32_t first = getItem(tv, dir)->children;
+    uint32_t num   = getItem(tv, dir)->num_children;
+
+    bool at_end = (num == 0 || first + num == pool->num_items);
+    uint32_t index = ItemPool_alloc(pool, at_end ? count : num + count);
+    if (index == NO_ITEM)
+        return NO_ITEM;
+
+    Item *item = getItem(tv, dir);
+    if (at_end) {
+        if (num == 0)
+            item->children = index;
+        item->num_children += count;
+        return item->children + num;
+    }
+
+    memcpy(pool->items + index, pool->items + first, num * sizeof(Item));
+    for (uint32_t i = 0; i < num; i++) {
+        pool->items[first + i].type = ItemType_FREE;
+        Item *child = &pool->items[index + i];
+        for (uint32_t j = 0; j < child->num_children; j++)
+            pool->items[child->children + j].parent = index + i;
+    }
+    pool->num_free += num;
+    remapRange(tv, first, num, index);
+
+    item->children = index;
+    item->num_children = num + count;
+    return index + num;
+}
+
+/* Moves the live items to a new pool in breadth
+ * first order, which drops the released items
+ * and the names that aren't used anymore. */
+static void compactPool(TreeView *tv)
+{
+    ItemPool *old = &tv->pool;
+    uint32_t live = old->num_items - old->num_free;
+
+    ItemPool new;
+    ItemPool_init(&new);
+    uint32_t *remap = malloc(old->num_items * sizeof(uint32_t));
+    if (remap == NULL || ItemPool_alloc(&new, live) == NO_ITEM) {
+        free(remap);
+        ItemPool_free(&new);
+        return;
+    }
+
+    new.items[ROOT_ITEM] = old->items[ROOT_ITEM];
+    remap[ROOT_ITEM] = ROOT_ITEM;
+    uint32_t used = 1;
+    for (uint32_t i = 0; i < used; i++) {
+
+        Item *item = &new.items[i];
+
+        size_t len;
+        const char *name = getName(old, item, &len);
+        item->name = ItemPool_intern(&new, name, len);
+        if (item->name == 0) {
+            free(remap);
+            ItemPool_free(&new);
+            return;
         }
 
-        Item *item;
-        if (failed)
-            item = NULL;
-        else {
-            if (type == ItemType_DIR)
-                item = buildDirectoryTree(full_name, path_len + name_len + 1, 
-                                          child_name, child_name_len, max_depth-1,
-                                          pool);
-            else {
-                item = ItemPool_getSlot(pool);
-                if (item != NULL) {
-                    assert(child_name_len < sizeof(item->name));
-                    strcpy(item->name, child_name);
-                    item->name_len = child_name_len;
-                    item->type = type;
-                    item->open = false;
-                    item->children = NULL;
-                }
+        uint32_t first = item->children;
+        uint32_t count = item->num_children;
+        if (count > 0) {
+            memcpy(new.items + used, old->items + first, count * sizeof(Item));
+            for (uint32_t j = 0; j < count; j++) {
+                remap[first + j] = used + j;
+                new.items[used + j].parent = i;
             }
+            item->children = used;
+            used += count;
         }
+    }
+    assert(used == live);
+
+    for (size_t i = 0; i < tv->num_rows; i++)
+        tv->rows[i].item = remap[tv->rows[i].item];
+    for (ScanTarget *target = tv->targets; target != NULL; target = target->next)
+        if (target->dir != NO_ITEM)
+            target->dir = remap[target->dir];
+    for (size_t i = 0; i < tv->num_watches; i++)
+        tv->watches[i].dir = remap[tv->watches[i].dir];
+
+    // It may have been released. If not, it's
+    // found again by the next motion.
+    tv->hovered = NO_ITEM;
+
+    free(remap);
+    ItemPool_free(old);
+    *old = new;
+}
 
-        if (item != NULL) {
-            *tail = item;
-            tail = &item->next;
+/* Releases the subtree below [dir], leaving it
+ * as if it was never listed. */
+static void releaseChildren(TreeView *tv, uint32_t dir)
+{
+    Item *item = getItem(tv, dir);
+    uint32_t first = item->children;
+    uint32_t count = item->num_children;
+    item->children = 0;
+    item->num_children = 0;
+    item->scan = ItemScan_NONE;
+    item->open = false;
+
+    for (uint32_t i = first; i < first + count; i++) {
+        if (getItem(tv, i)->type == ItemType_DIR)
+            releaseChildren(tv, i);
+        getItem(tv, i)->type = ItemType_FREE;
+    }
+    tv->pool.num_free += count;
+}
+
+static void dropTarget(TreeView *tv, ScanTarget *target)
+{
+    if (target->prev == NULL)
+        tv->targets = target->next;
+    else
+        target->prev->next = target->next;
+    if (target->next != NULL)
+        target->next->prev = target->prev;
+    while (target->listing != NULL) {
+        DirScanBatch *batch = target->listing;
+        target->listing = batch->next;
+        DirScanBatch_free(batch);
+    }
+    free(target);
+}
+
+static void removeWatch(TreeView *tv, size_t i)
+{
+    DirWatcher_remove(tv->watcher, tv->watches[i].wd);
+    tv->watches[i] = tv->watches[--tv->num_watches];
+}
+
+static void watchDir(TreeView *tv, uint32_t dir, const char *path)
+{
+    if (tv->watcher == NULL)
+        return;
+
+    int wd = DirWatcher_add(tv->watcher, path);
+    if (wd < 0)
+        return;
+
+    for (size_t i = 0; i < tv->num_watches; i++)
+        if (tv->watches[i].wd == wd) {
+            tv->watches[i].dir = dir;
+            return;
+        }
+
+    if (tv->num_watches == tv->max_watches) {
+        size_t max_watches = MAX(2 * tv->max_watches, 16);
+        Watch *watches = realloc(tv->watches, max_watches * sizeof(Watch));
+        if (watches == NULL) {
+            DirWatcher_remove(tv->watcher, wd);
+            return;
+        }
+        tv->watches = watches;
+        tv->max_watches = max_watches;
+    }
+    tv->watches[tv->num_watches++] = (Watch) { .wd = wd, .dir = dir };
+}
+
+/* Stops listing the directories that were
+ * released and watching the ones that were
+ * closed. */
+static void dropReferences(TreeView *tv)
+{
+    ScanTarget *target = tv->targets;
+    while (target != NULL) {
+        ScanTarget *next = target->next;
+        if (target->dir != NO_ITEM) {
+            Item *dir = getItem(tv, target->dir);
+            if (dir->type == ItemType_FREE || !isListing(dir)) {
+                if (DirScanner_cancel(tv->scanner, target))
+                    dropTarget(tv, target);
+                else
+                    target->dir = NO_ITEM;
+            }
         }
+        target = next;
     }
-    *tail = NULL;
 
-    closedir(dir);
-    return root;
+    // Only the directories that are open are
+    // watched, as the others are listed again
+    // when they're opened.
+    for (size_t i = 0; i < tv->num_watches; ) {
+        uint32_t dir = tv->watches[i].dir;
+        Item *item = getItem(tv, dir);
+        if (item->type == ItemType_FREE || (dir != ROOT_ITEM && !item->open))
+            removeWatch(tv, i);
+        else
+            i++;
+    }
 }
 
-typedef struct {
-    GUIElement base;
-    Rectangle old_region;
-    Scrollbar v_scroll;
-    Scrollbar h_scroll;
-    Item    *tree;
-    ItemPool pool;
-    Font     font;
-    RenderTexture2D texture;
-    float logic_w;
-    float logic_h;
-    char   path[1024];
-    size_t path_len;
-    const TreeViewStyle *style;
-    void (*callback)(const char*, size_t, void*);
-    void *userp;
-} TreeView;
+/* Drops what refers to released items, then
+ * compacts the pool if enough of it is free. */
+static void collectGarbage(TreeView *tv)
+{
+    dropReferences(tv);
 
-static void freeCallback(GUIElement *elem)
+    ItemPool *pool = &tv->pool;
+    if (pool->num_free > 4096 && pool->num_free > pool->num_items / 2)
+        compactPool(tv);
+}
+
+static void showChildren(TreeView *tv, size_t index)
 {
-    TreeView *tv = (TreeView*) elem;
-    Scrollbar_free(&tv->v_scroll);
-    Scrollbar_free(&tv->h_scroll);
-    UnloadRenderTexture(tv->texture);
-    UnloadFont(tv->font);
-    free(elem);
+    Row *row = &tv->rows[index];
+    size_t count = countVisibleChildren(tv, row->item);
+    if (!insertRows(tv, index + 1, count))
+        return;
+    row = &tv->rows[index];
+    writeVisibleChildren(tv, row->item, row->depth + 1, tv->rows + index + 1);
+    updateLogicalSize(tv);
 }
 
-static void onResizeCallback(GUIElement *elem, 
-                             Rectangle old_region)
+/* Closing a directory keeps the list of its
+ * children but releases everything below them,
+ * which is listed again when it's reopened. */
+static void hideChildren(TreeView *tv, size_t index)
 {
-    (void) old_region;
-    Rectangle region = GUIElement_getRegion(elem);
-    TreeView *tv = (TreeView*) elem;
-    UnloadRenderTexture(tv->texture);
-    tv->texture = LoadRenderTexture(region.width, region.height);
+    size_t end = getSubtreeEnd(tv, index);
+    removeRows(tv, index + 1, end - index - 1);
+    updateLogicalSize(tv);
+
+    uint32_t dir = tv->rows[index].item;
+    uint32_t first = getItem(tv, dir)->children;
+    uint32_t count = getItem(tv, dir)->num_children;
+    for (uint32_t i = first; i < first + count; i++)
+        if (getItem(tv, i)->type == ItemType_DIR)
+            releaseChildren(tv, i);
+    collectGarbage(tv);
 }
 
-static size_t getLineHeight(const TreeViewStyle *style)
+/* Adds the rows of the [count] children of [dir]
+ * starting at [first], if they're visible. [hint]
+ * is the row where the child before them is
+ * expected, and is updated with the last one. */
+static void showNewEntries(TreeView *tv, uint32_t dir,
+                           uint32_t first, uint32_t count,
+                           size_t *hint)
 {
-    return (style->auto_line_height) ? (style->font_size) : (style->line_height);
+    bool had_children = (getItem(tv, dir)->children != first);
+
+    size_t index, depth;
+    if (dir == ROOT_ITEM) {
+        depth = 1;
+        if (!had_children)
+            index = 0;
+        else {
+            size_t row = findRow(tv, first - 1, *hint);
+            assert(row != SIZE_MAX);
+            index = getSubtreeEnd(tv, row);
+        }
+    } else {
+        if (!getItem(tv, dir)->open)
+            return;
+        size_t row = findRow(tv, had_children ? first - 1 : dir, *hint);
+        if (row == SIZE_MAX)
+            return; // Inside a closed directory
+        depth = tv->rows[row].depth + !had_children;
+        index = getSubtreeEnd(tv, row);
+    }
+
+    if (!insertRows(tv, index, count))
+        return;
+
+    float max_w = tv->logic_w;
+    for (uint32_t i = 0; i < count; i++) {
+        Row *row = &tv->rows[index + i];
+        row->item  = first + i;
+        row->depth = depth;
+        row->width = measureRow(tv, first + i, depth);
+        if (row->width > max_w)
+            max_w = row->width;
+    }
+    *hint = index + count - 1;
+
+    tv->logic_w = max_w;
+    tv->logic_h = getLineHeight(tv->style) * tv->num_rows
+                + tv->style->padding_top;
 }
 
+/* Writes the full path of [item] in [dst] and
+ * returns its length, or 0 if it doesn't fit. */
+static size_t getItemPath(TreeView *tv, uint32_t item, char dst[static 1024])
+{
+    size_t len = tv->path_len;
+    for (uint32_t curr = item; curr != NO_ITEM; curr = getItem(tv, curr)->parent) {
+        size_t name_len;
+        getName(&tv->pool, getItem(tv, curr), &name_len);
+        len += name_len + 1;
+    }
+    if (len >= 1024)
+        return 0;
+
+    size_t w = len; // Written from the end
+    dst[w] = '\0';
+    for (uint32_t curr = item; curr != NO_ITEM; curr = getItem(tv, curr)->parent) {
+        size_t name_len;
+        const char *name = getName(&tv->pool, getItem(tv, curr), &name_len);
+        w -= name_len;
+        memcpy(dst + w, name, name_len);
+        dst[--w] = '/';
+    }
+    assert(w == tv->path_len);
+    memcpy(dst, tv->path, tv->path_len);
+    return len;
+}
 
-static int getVisibleSubtreeItemByIndex(Item *root, Item **stack, 
-                                        size_t *curr_i, size_t queried_i,
-                                        size_t *depth, size_t max_depth)
+/* Asks the scanner for the children of [dir],
+ * which is at [path], or to list them again if
+ * they were listed already. Directories the user
+ * just opened are urgent, the others are
+ * prefetched. */
+static bool requestScan(TreeView *tv, uint32_t dir,
+                        const char *path, size_t path_len,
+                        bool urgent)
 {
-    if ((*depth) + 2 >= max_depth)
-        return -1; // Error
-    stack[(*depth)++] = root;
-    
-    Item *child = root->children;
-    while (child != NULL) {
+    Item *item = getItem(tv, dir);
+    assert(item->type == ItemType_DIR && !isListing(item));
+
+    ScanTarget *target = malloc(sizeof(ScanTarget) + path_len + 1);
+    if (target == NULL)
+        return false;
+    target->dir = dir;
+    target->last_row = 0;
+    target->refresh = (item->scan == ItemScan_DONE);
+    target->listing = NULL;
+    target->path_len = path_len;
+    memcpy(target->path, path, path_len);
+    target->path[path_len] = '\0';
+
+    if (!DirScanner_request(tv->scanner, path, path_len, target, urgent)) {
+        free(target);
+        return false;
+    }
 
-        if (*curr_i == queried_i) {
-            stack[(*depth)++] = child;
-            return 1; // Found
+    target->prev = NULL;
+    target->next = tv->targets;
+    if (tv->targets != NULL)
+        tv->targets->prev = target;
+    tv->targets = target;
+
+    item->scan = ItemScan_PENDING;
+    return true;
+}
+
+static ItemType getItemType(DirEntryType type)
+{
+    switch (type) {
+        case DirEntryType_DIR:  return ItemType_DIR;
+        case DirEntryType_FILE: return ItemType_FILE;
+        default: break;
+    }
+    return ItemType_OTHER;
+}
+
+static void initItem(Item *item, uint32_t name,
+                     ItemType type, uint32_t parent)
+{
+    item->name = name;
+    item->type = type;
+    item->scan = ItemScan_NONE;
+    item->open = false;
+    item->parent = parent;
+    item->children = 0;
+    item->num_children = 0;
+}
+
+/* Returns the entry of [dir] in the crawled
+ * index, or FILEINDEX_NONE. */
+static uint32_t findIndexEntry(TreeView *tv, uint32_t dir)
+{
+    if (dir == ROOT_ITEM)
+        return 0;
+
+    uint32_t parent = findIndexEntry(tv, getItem(tv, dir)->parent);
+    if (parent == FILEINDEX_NONE)
+        return FILEINDEX_NONE;
+
+    size_t name_len;
+    const char *name = getName(&tv->pool, getItem(tv, dir), &name_len);
+    return FileIndex_findChild(tv->index, parent, name, name_len);
+}
+
+/* Gives [dir] the children it had when it was
+ * crawled, so that it doesn't wait on the scanner.
+ * They may be out of date, which is why opened
+ * directories are listed again anyway. Returns
+ * false if [dir] isn't in the index. */
+static bool listFromIndex(TreeView *tv, uint32_t dir)
+{
+    if (tv->index == NULL)
+        return false;
+
+    uint32_t entry = findIndexEntry(tv, dir);
+    if (entry == FILEINDEX_NONE)
+        return false;
+
+    const FileIndexEntry *e = &tv->index->entries[entry];
+    if (e->type != DirEntryType_DIR || e->failed || e->ignored)
+        return false;
+
+    uint32_t count = e->num_children;
+    if (count > 0) {
+        uint32_t first = appendChildren(tv, dir, count);
+        if (first == NO_ITEM)
+            return false;
+
+        uint32_t added = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            size_t name_len;
+            const char *name = FileIndex_getName(tv->index, e->children + i, &name_len);
+            uint32_t interned = ItemPool_intern(&tv->pool, name, name_len);
+            if (interned == 0)
+                break;
+            DirEntryType type = tv->index->entries[e->children + i].type;
+            initItem(getItem(tv, first + added), interned, getItemType(type), dir);
+            added++;
         }
-        (*curr_i)++;
-
-        if (child->type == ItemType_DIR && child->open == true) {
-            int status = getVisibleSubtreeItemByIndex(child, stack, curr_i, 
-                                                      queried_i, depth, 
-                                                      max_depth);
-            if (status != 0) 
-                return status; // Either error or found
+        tv->pool.num_items -= count - added;
+        getItem(tv, dir)->num_children -= count - added;
+
+        size_t hint = 0;
+        if (added > 0)
+            showNewEntries(tv, dir, first, added, &hint);
+    }
+    getItem(tv, dir)->scan = ItemScan_DONE;
+    return true;
+}
+
+static void prefetchItem(TreeView *tv, uint32_t index,
+                         const char *parent_path,
+                         size_t parent_path_len)
+{
+    Item *item = getItem(tv, index);
+    if (item->type != ItemType_DIR || item->scan != ItemScan_NONE)
+        return;
+
+    if (listFromIndex(tv, index))
+        return;
+    item = getItem(tv, index);
+
+    size_t name_len;
+    const char *name = getName(&tv->pool, item, &name_len);
+
+    char path[1024];
+    if (parent_path_len + name_len + 1 >= sizeof(path))
+        return;
+    memcpy(path, parent_path, parent_path_len);
+    path[parent_path_len] = '/';
+    memcpy(path + parent_path_len + 1, name, name_len);
+    requestScan(tv, index, path, parent_path_len + name_len + 1, false);
+}
+
+/* Makes sure the subdirectories of an open one
+ * are listed before the user gets to them. */
+static void prefetchChildren(TreeView *tv, uint32_t dir,
+                             const char *path, size_t path_len)
+{
+    // Filling a child from the index may move
+    // the pool, so the item is looked up again.
+    for (uint32_t i = 0; i < getItem(tv, dir)->num_children; i++)
+        prefetchItem(tv, getItem(tv, dir)->children + i, path, path_len);
+}
+
+/* Moves the listing of a directory that was
+ * being prefetched ahead of the others. If it
+ * started before the directory was watched, it
+ * may miss changes and is done again. */
+static void promoteScan(TreeView *tv, uint32_t dir)
+{
+    ScanTarget *target = tv->targets;
+    while (target != NULL && target->dir != dir)
+        target = target->next;
+    if (target != NULL && !DirScanner_promote(tv->scanner, target))
+        getItem(tv, dir)->scan = ItemScan_STALE;
+}
+
+/* Returns the child of [dir] with the interned
+ * [name], or NO_ITEM. */
+static uint32_t findChild(TreeView *tv, uint32_t dir, uint32_t name)
+{
+    Item *item = getItem(tv, dir);
+    for (uint32_t i = item->children; i < item->children + item->num_children; i++)
+        if (getItem(tv, i)->name == name)
+            return i;
+    return NO_ITEM;
+}
+
+/* Appends a child to [dir] and shows it if [dir]
+ * is visible. */
+static uint32_t addChild(TreeView *tv, uint32_t dir,
+                         uint32_t name, ItemType type)
+{
+    uint32_t index = appendChildren(tv, dir, 1);
+    if (index == NO_ITEM)
+        return NO_ITEM;
+    initItem(getItem(tv, index), name, type, dir);
+
+    size_t hint = 0;
+    showNewEntries(tv, dir, index, 1, &hint);
+    return index;
+}
+
+/* Removes the child [index] of [dir] along with
+ * its subtree, keeping the others in order. */
+static void removeChild(TreeView *tv, uint32_t dir, uint32_t index)
+{
+    size_t row = findRow(tv, index, 0);
+    if (row != SIZE_MAX)
+        removeRows(tv, row, getSubtreeEnd(tv, row) - row);
+
+    if (getItem(tv, index)->type == ItemType_DIR)
+        releaseChildren(tv, index);
+    getItem(tv, index)->type = ItemType_FREE;
+    dropReferences(tv);
+
+    ItemPool *pool = &tv->pool;
+    Item *parent = getItem(tv, dir);
+    uint32_t end = parent->children + parent->num_children;
+    memmove(pool->items + index, pool->items + index + 1,
+            (end - index - 1) * sizeof(Item));
+    for (uint32_t i = index; i < end - 1; i++) {
+        Item *child = &pool->items[i];
+        for (uint32_t j = 0; j < child->num_children; j++)
+            pool->items[child->children + j].parent = i;
+    }
+    remapRange(tv, index + 1, end - index - 1, index);
+
+    pool->items[end - 1].type = ItemType_FREE;
+    pool->num_free++;
+    parent->num_children--;
+    if (parent->num_children == 0)
+        parent->children = 0;
+}
+
+typedef struct {
+    uint32_t name;
+    uint8_t  type;
+} ListedEntry;
+
+static int compareListedEntries(const void *a, const void *b)
+{
+    uint32_t x = ((const ListedEntry*) a)->name;
+    uint32_t y = ((const ListedEntry*) b)->name;
+    return (x > y) - (x < y);
+}
+
+/* Brings the children of the directory of a
+ * completed refresh in line with what was listed.
+ * Since names are interned, they're compared by
+ * offset. */
+static void reconcileChildren(TreeView *tv, ScanTarget *target)
+{
+    size_t count = 0;
+    for (DirScanBatch *batch = target->listing; batch != NULL; batch = batch->next)
+        count += batch->count;
+
+    ListedEntry *listing = malloc(MAX(count, 1) * sizeof(ListedEntry));
+    if (listing == NULL)
+        return;
+
+    size_t num = 0;
+    for (DirScanBatch *batch = target->listing; batch != NULL; batch = batch->next)
+        for (size_t i = 0; i < batch->count; i++) {
+            DirEntry *entry = &batch->entries[i];
+            if (entry->name_len >= 256)
+                continue;
+            uint32_t name = ItemPool_intern(&tv->pool, batch->names + entry->name_off, entry->name_len);
+            if (name == 0) {
+                free(listing);
+                return;
+            }
+            listing[num++] = (ListedEntry) { name, getItemType(entry->type) };
         }
+    qsort(listing, num, sizeof(ListedEntry), compareListedEntries);
+
+    uint32_t dir = target->dir;
+    for (uint32_t i = getItem(tv, dir)->num_children; i-- > 0; ) {
+        uint32_t index = getItem(tv, dir)->children + i;
+        Item *child = getItem(tv, index);
+        ListedEntry key = { .name = child->name };
+        ListedEntry *found = bsearch(&key, listing, num, sizeof(ListedEntry),
+                                     compareListedEntries);
+        if (found != NULL && found->type == child->type)
+            found->type = ItemType_FREE; // Nothing to do
+        else
+            removeChild(tv, dir, index);
+    }
+
+    for (size_t i = 0; i < num; i++)
+        if (listing[i].type != ItemType_FREE)
+            addChild(tv, dir, listing[i].name, listing[i].type);
+    free(listing);
+}
 
-        child = child->next;
+/* Lists [dir] again, or makes sure it will be
+ * once the listing that's going on is over. */
+static void refreshDir(TreeView *tv, uint32_t dir)
+{
+    Item *item = getItem(tv, dir);
+    if (isListing(item))
+        item->scan = ItemScan_STALE;
+    else if (item->scan == ItemScan_DONE) {
+        char path[1024];
+        size_t len = getItemPath(tv, dir, path);
+        if (len > 0)
+            requestScan(tv, dir, path, len, true);
     }
+}
+
+/* Appends the entries of [batch] to the children
+ * of the directory of [target]. Returns how many
+ * were added, starting at [first]. */
+static uint32_t appendEntries(TreeView *tv, ScanTarget *target,
+                              DirScanBatch *batch, uint32_t *first)
+{
+    uint32_t count = 0;
+    for (size_t i = 0; i < batch->count; i++)
+        if (batch->entries[i].name_len < 256)
+            count++;
+    if (count == 0)
+        return 0;
+
+    uint32_t dir = target->dir;
+    uint32_t index = appendChildren(tv, dir, count);
+    if (index == NO_ITEM)
+        return 0;
+
+    uint32_t added = 0;
+    for (size_t i = 0; i < batch->count; i++) {
+
+        DirEntry *entry = &batch->entries[i];
+        if (entry->name_len >= 256)
+            continue;
 
-    (*depth)--;
-    return 0; // Not found
+        uint32_t name = ItemPool_intern(&tv->pool, batch->names + entry->name_off, entry->name_len);
+        if (name == 0)
+            break;
+
+        initItem(getItem(tv, index + added), name, getItemType(entry->type), dir);
+        added++;
+    }
+
+    // The new children are the last items of the
+    // pool, so the ones that weren't filled can be
+    // given back.
+    tv->pool.num_items -= count - added;
+    getItem(tv, dir)->num_children -= count - added;
+
+    *first = index;
+    return added;
 }
 
-static int getVisibleTreeItemByIndex(TreeView *tv, size_t queried_i, Item **stack, 
-                                     size_t *depth, size_t max_depth)
+/* Appends the entries listed by the scanner to
+ * their directories. Returns true if something
+ * visible changed. */
+static bool drainScanner(TreeView *tv)
 {
-    size_t curr_i = 0;
-    *depth = 0;
+    bool changed = false;
+    DirScanBatch *batch;
+    while ((batch = DirScanner_poll(tv->scanner)) != NULL) {
+
+        ScanTarget *target = batch->userp;
+        uint32_t dir = target->dir;
+
+        bool visible = (dir != NO_ITEM)
+                    && (dir == ROOT_ITEM || getItem(tv, dir)->open);
+
+        bool done = batch->done;
+        bool failed = batch->failed;
+        if (dir != NO_ITEM && target->refresh) {
+            batch->next = target->listing;
+            target->listing = batch;
+        } else {
+            if (dir != NO_ITEM) {
+                uint32_t first;
+                uint32_t added = appendEntries(tv, target, batch, &first);
+                if (visible && added > 0) {
+                    showNewEntries(tv, dir, first, added, &target->last_row);
+                    for (uint32_t i = 0; i < added; i++)
+                        prefetchItem(tv, first + i, target->path, target->path_len);
+                    changed = true;
+                }
+            }
+            DirScanBatch_free(batch);
+        }
 
-    if (queried_i == 0) {
-        if (max_depth == 0)
-            return -1;
-        stack[(*depth)++] = tv->tree;
-        return 1;
+        if (done) {
+            if (dir != NO_ITEM) {
+                if (failed)
+                    TraceLog(LOG_WARNING, "Couldn't list \"%s\"", target->path);
+                else if (target->refresh) {
+                    reconcileChildren(tv, target);
+                    changed |= visible;
+                }
+                Item *item = getItem(tv, dir);
+                bool stale = (item->scan == ItemScan_STALE);
+                item->scan = ItemScan_DONE;
+                if (visible && target->refresh)
+                    prefetchChildren(tv, dir, target->path, target->path_len);
+                if (stale)
+                    requestScan(tv, dir, target->path, target->path_len, true);
+            }
+            dropTarget(tv, target);
+        }
     }
+    if (changed)
+        collectGarbage(tv);
+    return changed;
+}
 
-    return getVisibleSubtreeItemByIndex(tv->tree, stack, &curr_i, 
-                                        queried_i, depth, max_depth);
+static Watch *findWatch(TreeView *tv, int wd)
+{
+    for (size_t i = 0; i < tv->num_watches; i++)
+        if (tv->watches[i].wd == wd)
+            return &tv->watches[i];
+    return NULL;
 }
 
-static size_t concatPath(const char *base, size_t base_len,
-                         Item **list, size_t count, 
-                         char dst[static 1024])
+/* Applies one entry being added or removed to a
+ * directory that was listed already. */
+static void applyEvent(TreeView *tv, uint32_t dir,
+                       DirEventBatch *batch, DirEvent *event)
 {
-    size_t w = 0; // Bytes written
+    Item *item = getItem(tv, dir);
+    if (isListing(item)) {
+        // The listing may or may not include this
+        item->scan = ItemScan_STALE;
+        return;
+    }
+    if (item->scan != ItemScan_DONE || event->name_len >= 256)
+        return;
 
-    memcpy(dst, base, base_len);
-    w += base_len;
-    dst[w++] = '/';
+    uint32_t name = ItemPool_intern(&tv->pool, batch->names + event->name_off, event->name_len);
+    if (name == 0) {
+        refreshDir(tv, dir);
+        return;
+    }
+    uint32_t child = findChild(tv, dir, name);
+
+    if (event->type == DirEventType_DELETED) {
+        if (child != NO_ITEM)
+            removeChild(tv, dir, child);
+    } else if (child == NO_ITEM) {
+        ItemType type = event->is_dir ? ItemType_DIR : ItemType_FILE;
+        child = addChild(tv, dir, name, type);
+        if (child != NO_ITEM && type == ItemType_DIR) {
+            char path[1024];
+            size_t len = getItemPath(tv, dir, path);
+            if (len > 0)
+                prefetchItem(tv, child, path, len);
+        }
+    }
+}
+
+/* Applies what the watcher reported since the
+ * last frame. A directory with more than this
+ * many events, or every one of them if some were
+ * lost, is listed again instead. */
+#define MAX_EVENTS_PER_DIR 64
 
-    for (size_t i = 0; i < count; i++) {
-        char  *src = list[i]->name;
-        size_t len = list[i]->name_len;
-        memcpy(dst + w, src, len);
-        w += len;
-        if (i+1 < count)
-            dst[w++] = '/';
+static bool applyEvents(TreeView *tv)
+{
+    if (tv->watcher == NULL)
+        return false;
+
+    DirEventBatch *batch = DirWatcher_poll(tv->watcher);
+    if (batch == NULL)
+        return false;
+
+    // Watches move around as directories are
+    // removed, so the busy ones are kept by
+    // descriptor.
+    size_t *counts = calloc(tv->num_watches + 1, sizeof(size_t));
+    int    *busy   = malloc((tv->num_watches + 1) * sizeof(int));
+    size_t num_busy = 0;
+
+    bool overflow = (counts == NULL || busy == NULL);
+    for (size_t i = 0; i < batch->count && !overflow; i++) {
+        DirEvent *event = &batch->events[i];
+        if (event->type == DirEventType_OVERFLOW)
+            overflow = true;
+        Watch *watch = findWatch(tv, event->wd);
+        if (watch != NULL)
+            counts[watch - tv->watches]++;
     }
-    dst[w] = '\0';
-    return w;
+
+    if (overflow) {
+        for (size_t i = 0; i < tv->num_watches; i++)
+            refreshDir(tv, tv->watches[i].dir);
+    } else {
+        for (size_t i = 0; i < tv->num_watches; i++)
+            if (counts[i] > MAX_EVENTS_PER_DIR)
+                busy[num_busy++] = tv->watches[i].wd;
+
+        for (size_t i = 0; i < batch->count; i++) {
+            DirEvent *event = &batch->events[i];
+            if (event->type != DirEventType_CREATED
+             && event->type != DirEventType_DELETED)
+                continue;
+
+            bool is_busy = false;
+            for (size_t j = 0; j < num_busy; j++)
+                if (busy[j] == event->wd)
+                    is_busy = true;
+
+            Watch *watch = findWatch(tv, event->wd);
+            if (watch != NULL && !is_busy)
+                applyEvent(tv, watch->dir, batch, event);
+        }
+
+        for (size_t i = 0; i < num_busy; i++) {
+            Watch *watch = findWatch(tv, busy[i]);
+            if (watch != NULL)
+                refreshDir(tv, watch->dir);
+        }
+    }
+    free(busy);
+    free(counts);
+    DirEventBatch_free(batch);
+
+    updateLogicalSize(tv);
+    collectGarbage(tv);
+    return true;
 }
 
-void printSubtree(FILE *stream, Item *root, size_t depth)
+static void freeCallback(GUIElement *elem)
 {
-    Item *child = root->children;
-    while (child != NULL) {
+    TreeView *tv = (TreeView*) elem;
+    if (tv->crawler != NULL)
+        DirCrawler_stop(tv->crawler);
+    if (tv->index != NULL)
+        FileIndex_free(tv->index);
+    if (tv->exclude != NULL)
+        IgnoreRules_free(tv->exclude);
+    if (tv->watcher != NULL)
+        DirWatcher_stop(tv->watcher);
+    free(tv->watches);
+    DirScanner_stop(tv->scanner);
+    while (tv->targets != NULL)
+        dropTarget(tv, tv->targets);
+    Scrollbar_free(&tv->v_scroll);
+    Scrollbar_free(&tv->h_scroll);
+    UnloadRenderTexture(tv->texture);
+    FontMetrics_unload(tv->font);
+    ItemPool_free(&tv->pool);
+    free(tv->rows);
+    free(elem);
+}
+
+static void onResizeCallback(GUIElement *elem, 
+                             Rectangle old_region)
+{
+    (void) old_region;
+    Rectangle region = GUIElement_getRegion(elem);
+    TreeView *tv = (TreeView*) elem;
+    UnloadRenderTexture(tv->texture);
+    tv->texture = LoadRenderTexture(region.width, region.height);
+}
+
+static void printSubtree(FILE *stream, TreeView *tv, uint32_t root, size_t depth)
+{
+    Item *item = getItem(tv, root);
+    for (uint32_t i = 0; i < item->num_children; i++) {
+
+        Item *child = getItem(tv, item->children + i);
         
         const char *typename;
         switch (child->type) {
             case ItemType_DIR: typename = "dir"; break;
             case ItemType_FILE: typename = "file"; break;
-            case ItemType_OTHER: typename = "other"; break;
+            default: typename = "other"; break;
         }
 
-        for (size_t i = 0; i < 2*depth; i++)
+        size_t name_len;
+        const char *name = getName(&tv->pool, child, &name_len);
+        for (size_t j = 0; j < 2*depth; j++)
             fprintf(stream, " ");
-        fprintf(stream, "[%s] (%s)\n", child->name, typename);
+        fprintf(stream, "[%.*s] (%s)\n", (int) name_len, name, typename);
 
         if (child->type == ItemType_DIR && child->open)
-            printSubtree(stream, child, depth+1);
-
-        child = child->next;
+            printSubtree(stream, tv, item->children + i, depth+1);
     }
 
 }
 
-void printTree(FILE *stream, Item *root)
+void printTree(FILE *stream, GUIElement *elem)
 {
+    TreeView *tv = (TreeView*) elem;
+    size_t name_len;
+    const char *name = getName(&tv->pool, getItem(tv, ROOT_ITEM), &name_len);
     fprintf(stream, "<start>\n");
-    fprintf(stream, "[%s] (dir)\n", root->name);
-    printSubtree(stream, root, 1);
+    fprintf(stream, "[%.*s] (dir)\n", (int) name_len, name);
+    printSubtree(stream, tv, ROOT_ITEM, 1);
     fprintf(stream, "<end>\n");
 }
 
@@ -383,20 +1332,44 @@ onClickDownCallback(GUIElement *elem,
         on_thumb = true;
     } else {
         on_thumb = false;
-        int i = (y - tv->style->padding_top) / getLineHeight(tv->style);
-        assert(i >= 0);
-
-        Item  *stack[32];
-        size_t depth;
-        int status = getVisibleTreeItemByIndex(tv, i, stack, &depth, sizeof(stack)/sizeof(stack[0]));
-
-        if (status == 1) {
-            Item *item = stack[depth-1];
-            if (item->type == ItemType_DIR)
+        size_t i;
+        if (getRowAt(tv, y, &i)) {
+            uint32_t index = tv->rows[i].item;
+            Item *item = getItem(tv, index);
+            char path[1024];
+            size_t len = getItemPath(tv, index, path);
+            if (item->type == ItemType_DIR) {
                 item->open = !item->open;
-            else {
-                char path[1024];
-                size_t len = concatPath(tv->path, tv->path_len, stack, depth, path);
+                if (item->open) {
+                    showChildren(tv, i);
+                    if (len > 0) {
+                        // What was listed before the watch was
+                        // added may be out of date
+                        watchDir(tv, index, path);
+                        switch (item->scan) {
+                            case ItemScan_PENDING:
+                            case ItemScan_STALE:
+                            promoteScan(tv, index);
+                            break;
+
+                            case ItemScan_NONE:
+                            if (!listFromIndex(tv, index)) {
+                                requestScan(tv, index, path, len, true);
+                                break;
+                            }
+                            /* fallthrough */
+
+                            case ItemScan_DONE:
+                            requestScan(tv, index, path, len, true);
+                            prefetchChildren(tv, index, path, len);
+                            break;
+                        }
+                    }
+                } else
+                    hideChildren(tv, i);
+                GUIElement_invalidateAll(elem);
+            }
+            else if (len > 0) {
                 if (tv->callback != NULL)
                     tv->callback(path, len, tv->userp);
             }
@@ -405,83 +1378,48 @@ onClickDownCallback(GUIElement *elem,
     return NULL;
 }
 
-static float drawChildren(Item *parent, size_t depth,
-                          size_t *visited_items, Font font,
-                          const TreeViewStyle *style,
-                          int x_scroll, int y_scroll)
+/* Only draws the rows that intersect [damage]. */
+static void renderTexture(TreeView *tv, Rectangle damage)
 {
-    size_t line_height = getLineHeight(style);
-
-    float max_w = 0;
-
-    Item *child = parent->children;
-    while (child != NULL) {
-        /*
-        switch (child->type) {
-            case ItemType_DIR:break;
-            case ItemType_FILE:break;
-            case ItemType_OTHER:break;
-        }
-        */
-
-        int off_x = style->padding_left + depth * style->subtree_padding_left;
-        int off_y = style->padding_top  + line_height * (*visited_items);
-        
-        int real_x = off_x - x_scroll;
-        int real_y = off_y - y_scroll;
-        float text_w = renderString(font, child->name, child->name_len,
-                                    real_x, real_y, style->font_size, 
-                                    style->fgcolor);
-        float line_w = off_x + text_w;
-        if (line_w > max_w)
-            max_w = line_w;
-
-        (*visited_items)++;
-        if (child->type == ItemType_DIR && child->open) {
-            float max_w2 = drawChildren(child, depth+1, visited_items, font, style,
-                                        x_scroll, y_scroll);
-            if (max_w2 > max_w)
-                max_w = max_w2;
-        }
-
-        child = child->next;
-    }
-    return max_w;
-}
-
-static float drawSubtree(Item *root, Font font, size_t *num,
-                         const TreeViewStyle *style,
-                          int x_scroll, int y_scroll)
-{
-    size_t visited_items = 0;
-    float max_w = drawChildren(root, 1, &visited_items, font, style, x_scroll, y_scroll);
-    *num = visited_items;
-    return max_w;
-}
-
-static void drawCallback(GUIElement *elem)
-{
-    TreeView *tv = (TreeView*) elem;
     BeginTextureMode(tv->texture);
+    BeginScissorMode(damage.x, damage.y, damage.width, damage.height);
     ClearBackground(tv->style->bgcolor);
 
+    const TreeViewStyle *style = tv->style;
     int x_scroll = Scrollbar_getValue(&tv->h_scroll);
     int y_scroll = Scrollbar_getValue(&tv->v_scroll);
-
-    size_t rows;
-    float logic_w = drawSubtree(tv->tree, tv->font, &rows, tv->style,
-                                x_scroll, y_scroll);
-
-    size_t line_height = getLineHeight(tv->style);
-    float logic_h = line_height * rows
-                  + tv->style->padding_top;
+    int line_height = getLineHeight(style);
+
+    int top    = damage.y + y_scroll - (int) style->padding_top;
+    int bottom = top + damage.height;
+    size_t first = (top > 0) ? (size_t) top / line_height : 0;
+    size_t last  = (bottom > 0) ? (size_t) bottom / line_height + 1 : 0;
+    last = MIN(last, tv->num_rows);
+
+    for (size_t i = first; i < last; i++) {
+        Row *row = &tv->rows[i];
+        size_t name_len;
+        const char *name = getName(&tv->pool, getItem(tv, row->item), &name_len);
+        int off_x = style->padding_left + row->depth * style->subtree_padding_left;
+        int off_y = style->padding_top  + line_height * i;
+        renderString(tv->font, name, name_len,
+                     off_x - x_scroll, off_y - y_scroll, style->font_size, 
+                     style->fgcolor);
+    }
 
     scrollbar_draw(&tv->v_scroll);
     scrollbar_draw(&tv->h_scroll);
+    EndScissorMode();
     EndTextureMode();
+}
+
+static void drawCallback(GUIElement *elem)
+{
+    TreeView *tv = (TreeView*) elem;
 
-    tv->logic_w = logic_w;
-    tv->logic_h = logic_h;
+    Rectangle damage;
+    if (GUIElement_takeDamage(elem, &damage))
+        renderTexture(tv, damage);
 
     {
         RenderTexture2D target = tv->texture;
@@ -501,9 +1439,50 @@ static void drawCallback(GUIElement *elem)
     }
 }
 
+/* Reports the file under the pointer once the
+ * pointer rested on it for long enough. */
+static void checkHover(TreeView *tv, uint64_t time_in_ms)
+{
+    if (tv->hovered_since == 0)
+        tv->hovered_since = time_in_ms;
+
+    uint64_t elapsed = time_in_ms - tv->hovered_since;
+    if (elapsed < HOVER_DELAY_MS) {
+        GUIElement_scheduleTick(HOVER_DELAY_MS - elapsed);
+        return;
+    }
+    tv->hover_reported = true;
+    if (getItem(tv, tv->hovered)->type != ItemType_FILE)
+        return; // Released since
+
+    char path[1024];
+    size_t len = getItemPath(tv, tv->hovered, path);
+    if (len > 0 && tv->hover_callback != NULL)
+        tv->hover_callback(path, len, tv->userp);
+}
+
 static void tickCallback(GUIElement *elem, uint64_t time_in_ms)
 {
     TreeView *tv = (TreeView*) elem;
+    if (tv->crawler != NULL) {
+        FileIndex *index = DirCrawler_poll(tv->crawler);
+        if (index != NULL) {
+            // The crawl may have been reading the
+            // snapshot, so it goes only now.
+            DirCrawler_stop(tv->crawler);
+            tv->crawler = NULL;
+            if (tv->index != NULL)
+                FileIndex_free(tv->index);
+            tv->index = index;
+            tv->index_version++;
+        }
+    }
+    if (tv->hovered != NO_ITEM && !tv->hover_reported)
+        checkHover(tv, time_in_ms);
+    bool changed = drainScanner(tv);
+    changed |= applyEvents(tv);
+    if (changed)
+        GUIElement_invalidateAll(elem);
     Scrollbar_tick(&tv->v_scroll, time_in_ms);
     Scrollbar_tick(&tv->h_scroll, time_in_ms);
 }
@@ -522,6 +1501,18 @@ static void onMouseMotionCallback(GUIElement *elem,
     if (Scrollbar_onMouseMotion(&tv->v_scroll, y)) {
     } else if (Scrollbar_onMouseMotion(&tv->h_scroll, x)) {
     }
+
+    uint32_t hovered = NO_ITEM;
+    size_t i;
+    if (x >= 0 && x < elem->region.width && y < elem->region.height && getRowAt(tv, y, &i)
+        && getItem(tv, tv->rows[i].item)->type == ItemType_FILE)
+        hovered = tv->rows[i].item;
+
+    if (hovered != tv->hovered) {
+        tv->hovered = hovered;
+        tv->hovered_since = 0;
+        tv->hover_reported = false;
+    }
 }
 
 static void clickUpCallback(GUIElement *elem, 
@@ -572,6 +1563,7 @@ GUIElement *TreeView_new(Rectangle region,
                          const char *name,
                          const char *full_path,
                          void (*callback)(const char*, size_t, void*),
+                         void (*hover_callback)(const char*, size_t, void*),
                          const TreeViewStyle *style,
                          void *userp)
 {
@@ -590,6 +1582,8 @@ GUIElement *TreeView_new(Rectangle region,
     const char *base = basename(full_path_copy2);
     size_t path_len = strlen(path);
     size_t base_len = strlen(base);
+    if (base_len >= 256)
+        return NULL;
 
     TreeView *tv = malloc(sizeof(TreeView));
     if (tv == NULL)
@@ -597,38 +1591,139 @@ GUIElement *TreeView_new(Rectangle region,
 
     tv->base.region = region;
     tv->base.methods = &methods;
+    tv->base.dirty = false;
     strncpy(tv->base.name, name, sizeof(tv->base.name));
     tv->base.name[sizeof(tv->base.name)-1] = '\0';
 
     strcpy(tv->path, path);
     tv->path_len = path_len;
+    tv->style = style;
 
     ItemPool *pool = &tv->pool;
     ItemPool_init(pool);
 
-    Item *tree = buildDirectoryTree(path, path_len,
-                                    base, base_len, 
-                                    8, pool);
-    if (tree == NULL) {
+    tv->font = FontMetrics_load(loadFont(style->baked_font, style->font_data, 
+                                         style->font_data_size, style->font_file, 
+                                         style->font_size));
+    if (tv->font == NULL) {
+        ItemPool_free(pool);
+        free(tv);
+        return NULL;
+    }
+
+    // The root is listed in the background like
+    // every other directory.
+    uint32_t root = ItemPool_alloc(pool, 1);
+    uint32_t root_name = ItemPool_intern(pool, base, base_len);
+    if (root == NO_ITEM || root_name == 0) {
+        FontMetrics_unload(tv->font);
         ItemPool_free(pool);
         free(tv);
         return NULL;
     }
-    printTree(stderr, tree);
-    tv->tree = tree;
-    if (style->font_data == NULL)
-        tv->font = LoadFontEx(style->font_file, style->font_size, NULL, 250);
+    assert(root == ROOT_ITEM);
+    Item *tree = getItem(tv, root);
+    tree->name = root_name;
+    tree->type = ItemType_DIR;
+    tree->scan = ItemScan_NONE;
+    tree->open = true;
+    tree->parent = NO_ITEM;
+    tree->children = 0;
+    tree->num_children = 0;
+    tv->targets = NULL;
+    tv->watches = NULL;
+    tv->num_watches = 0;
+    tv->max_watches = 0;
+    tv->crawler = NULL;
+    tv->index = NULL;
+    tv->index_version = 0;
+    tv->exclude = NULL;
+    tv->rows = NULL;
+    tv->num_rows = 0;
+    tv->max_rows = 0;
+    tv->logic_w = 0;
+    tv->logic_h = 0;
+    tv->hovered = NO_ITEM;
+    tv->hovered_since = 0;
+    tv->hover_reported = false;
+
+    tv->scanner = DirScanner_start(GUIElement_wakeUp);
+    if (tv->scanner == NULL) {
+        FontMetrics_unload(tv->font);
+        ItemPool_free(pool);
+        free(tv);
+        return NULL;
+    }
+
+    // The tree just won't update by itself if
+    // inotify isn't there. The watch is added
+    // before listing so that nothing is missed.
+    tv->watcher = DirWatcher_start(GUIElement_wakeUp);
+    if (tv->watcher == NULL)
+        TraceLog(LOG_WARNING, "Couldn't watch \"%s\" for changes", full_path);
     else
-        tv->font = LoadFontFromMemory(".ttf", style->font_data, style->font_data_size, 
-                                      style->font_size, NULL, 250);
-    tv->style = style;
+        watchDir(tv, root, full_path);
+
+    // The tree saved by the last session is shown
+    // right away, while the root is listed again.
+    char snapshot[1024];
+    bool has_snapshot = FileIndex_getSnapshotPath(full_path, snapshot, sizeof(snapshot));
+    if (has_snapshot)
+        tv->index = FileIndex_load(snapshot, full_path);
+    if (tv->index != NULL)
+        tv->index_version++;
+    bool restored = listFromIndex(tv, root);
+
+    if (!requestScan(tv, root, full_path, full_path_len, true)) {
+        if (tv->index != NULL)
+            FileIndex_free(tv->index);
+        if (tv->watcher != NULL)
+            DirWatcher_stop(tv->watcher);
+        free(tv->watches);
+        DirScanner_stop(tv->scanner);
+        free(tv->rows);
+        FontMetrics_unload(tv->font);
+        ItemPool_free(pool);
+        free(tv);
+        return NULL;
+    }
+    if (restored)
+        prefetchChildren(tv, root, full_path, full_path_len);
+
+    // The whole tree is indexed in the background
+    // so that directories can be shown without
+    // waiting for them to be listed. Only the ones
+    // modified since the snapshot are read, and
+    // the ignored ones aren't entered.
+    if (style->exclude != NULL) {
+        tv->exclude = IgnoreRules_compileList(style->exclude);
+        if (tv->exclude == NULL)
+            TraceLog(LOG_WARNING, "Couldn't compile the exclude list");
+    }
+    tv->crawler = DirCrawler_start(full_path, 0, tv->exclude, tv->index,
+                                   has_snapshot ? snapshot : NULL,
+                                   GUIElement_wakeUp);
+    if (tv->crawler == NULL)
+        TraceLog(LOG_WARNING, "Couldn't index \"%s\"", full_path);
+
     tv->texture = LoadRenderTexture(region.width, region.height);
     tv->userp = userp;
     tv->callback = callback;
-    tv->logic_w = 0;
-    tv->logic_h = 0;
+    tv->hover_callback = hover_callback;
     Scrollbar_init(&tv->v_scroll, ScrollbarDirection_VERTICAL,   (GUIElement*) tv, style->v_scroll);
     Scrollbar_init(&tv->h_scroll, ScrollbarDirection_HORIZONTAL, (GUIElement*) tv, style->h_scroll);
+    GUIElement_invalidateAll(&tv->base);
 
     return (GUIElement*) tv;
-}
\ No newline at end of file
+}
+
+/* Returns the index of the whole tree, or NULL if
+ * it's not ready. It's replaced when a crawl is
+ * over, which changes [version], so it must not be
+ * used past the next tick if it did. */
+const FileIndex *TreeView_getIndex(GUIElement *elem, uint32_t *version)
+{
+    TreeView *tv = (TreeView*) elem;
+    *version = tv->index_version;
+    return tv->index;
+}
@@ -1,9 +1,12 @@
 #include "scrollbar.h"
 #include "guielement.h"
+#include "bakedfont.h"
+#include "fileindex.h"
 
 typedef struct {
     Color bgcolor;
     Color fgcolor;
+    const BakedFont     *baked_font;
     const unsigned char *font_data;
     size_t               font_data_size;
     const char  *font_file;
@@ -15,11 +18,14 @@ typedef struct {
     size_t subtree_padding_left;
     ScrollbarStyle *v_scroll;
     ScrollbarStyle *h_scroll;
+    const char *const *exclude; // .gitignore style patterns ending with NULL, or NULL
 } TreeViewStyle;
 
 GUIElement *TreeView_new(Rectangle region,
                          const char *name,
                          const char *full_path,
                          void (*callback)(const char*, size_t, void*),
+                         void (*hover_callback)(const char*, size_t, void*),
                          const TreeViewStyle *style,
-                         void *userp);
\ No newline at end of file
+                         void *userp);
+const FileIndex *TreeView_getIndex(GUIElement *elem, uint32_t *version);
\ No newline at end of file
@@ -0,0 +1,397 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <raylib.h>
+#include "utils.h"
+#include "undo.h"
+
+#define UNDO_CHUNK_SIZE (64 * 1024)
+#define UNDO_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+enum {
+    UndoFlag_TYPED = 1 << 0, // Typed text that later keystrokes can extend
+};
+
+/* Followed by [length] bytes, then by padding and
+ * the size of the whole record, which is how the
+ * top of the stack is found. */
+typedef struct {
+    size_t offset; // Number of edits
+    size_t length;
+    size_t flags;
+} UndoRecord;
+
+/* Records hold as many of these as their offset
+ * says, followed by the bytes each of them inserts.
+ * Applied with GapBuffer_applyEdits, they revert
+ * the edits the record was made for. */
+typedef struct {
+    size_t offset;
+    size_t removed;
+    size_t inserted;
+} UndoEdit;
+
+struct UndoChunk {
+    UndoChunk *prev;
+    UndoChunk *next;
+    size_t size;
+    size_t used;
+    char   data[];
+};
+
+static size_t getRecordSize(size_t length)
+{
+    size_t size = sizeof(UndoRecord) + length;
+    size = (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+    return size + sizeof(size_t);
+}
+
+static void UndoStack_init(UndoStack *stack)
+{
+    stack->oldest = NULL;
+    stack->newest = NULL;
+    stack->memory = 0;
+}
+
+static void unlinkChunk(UndoStack *stack, UndoChunk *chunk)
+{
+    if (chunk->prev == NULL)
+        stack->oldest = chunk->next;
+    else
+        chunk->prev->next = chunk->next;
+
+    if (chunk->next == NULL)
+        stack->newest = chunk->prev;
+    else
+        chunk->next->prev = chunk->prev;
+
+    stack->memory -= sizeof(UndoChunk) + chunk->size;
+    free(chunk);
+}
+
+static void UndoStack_clear(UndoStack *stack)
+{
+    while (stack->oldest != NULL)
+        unlinkChunk(stack, stack->oldest);
+}
+
+static UndoRecord *UndoStack_top(UndoStack *stack)
+{
+    UndoChunk *chunk = stack->newest;
+    if (chunk == NULL)
+        return NULL;
+
+    // Chunks are freed as soon as they're empty
+    assert(chunk->used > 0);
+    size_t size = *(size_t*) (chunk->data + chunk->used - sizeof(size_t));
+    return (UndoRecord*) (chunk->data + chunk->used - size);
+}
+
+static void UndoStack_pop(UndoStack *stack)
+{
+    UndoChunk *chunk = stack->newest;
+    assert(chunk != NULL && chunk->used > 0);
+
+    size_t size = *(size_t*) (chunk->data + chunk->used - sizeof(size_t));
+    chunk->used -= size;
+    if (chunk->used == 0)
+        unlinkChunk(stack, chunk);
+}
+
+/* Records that don't fit in the default chunk
+ * size get a chunk of their own. */
+static UndoRecord *UndoStack_push(UndoStack *stack, size_t offset,
+                                  size_t length, size_t flags)
+{
+    size_t size = getRecordSize(length);
+
+    UndoChunk *chunk = stack->newest;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+
+        size_t chunk_size = MAX(size, UNDO_CHUNK_SIZE);
+        chunk = malloc(sizeof(UndoChunk) + chunk_size);
+        if (chunk == NULL)
+            return NULL;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = NULL;
+        chunk->prev = stack->newest;
+        if (stack->newest == NULL)
+            stack->oldest = chunk;
+        else
+            stack->newest->next = chunk;
+        stack->newest = chunk;
+        stack->memory += sizeof(UndoChunk) + chunk_size;
+    }
+
+    UndoRecord *record = (UndoRecord*) (chunk->data + chunk->used);
+    record->offset = offset;
+    record->length = length;
+    record->flags  = flags;
+    chunk->used += size;
+    *(size_t*) (chunk->data + chunk->used - sizeof(size_t)) = size;
+    return record;
+}
+
+static void copyFromBuffer(GapBuffer *buf, size_t offset,
+                           size_t length, char *dst)
+{
+    size_t copied = 0;
+    while (copied < length) {
+        size_t chunk_len;
+        const char *chunk = GapBuffer_getChunk(buf, offset + copied, &chunk_len);
+        assert(chunk != NULL);
+        chunk_len = MIN(chunk_len, length - copied);
+        memcpy(dst + copied, chunk, chunk_len);
+        copied += chunk_len;
+    }
+}
+
+void UndoJournal_init(UndoJournal *journal, size_t budget)
+{
+    UndoStack_init(&journal->undo);
+    UndoStack_init(&journal->redo);
+    journal->budget = (budget == 0) ? UNDO_DEFAULT_BUDGET : budget;
+    journal->typing = false;
+    journal->on_edit = NULL;
+    journal->userp = NULL;
+}
+
+void UndoJournal_free(UndoJournal *journal)
+{
+    UndoJournal_clear(journal);
+}
+
+void UndoJournal_clear(UndoJournal *journal)
+{
+    UndoStack_clear(&journal->undo);
+    UndoStack_clear(&journal->redo);
+    journal->typing = false;
+}
+
+size_t UndoJournal_getMemory(UndoJournal *journal)
+{
+    return journal->undo.memory + journal->redo.memory;
+}
+
+/* [on_edit] is called after every change with
+ * the range that was replaced and the length of
+ * the text that replaced it. */
+void UndoJournal_setListener(UndoJournal *journal,
+                             void (*on_edit)(size_t, size_t, size_t, void*),
+                             void *userp)
+{
+    journal->on_edit = on_edit;
+    journal->userp = userp;
+}
+
+static void notifyEdit(UndoJournal *journal, size_t offset,
+                       size_t removed, size_t inserted)
+{
+    if (journal->on_edit != NULL)
+        journal->on_edit(offset, removed, inserted, journal->userp);
+}
+
+/* Drops the oldest history until the budget is
+ * met, always keeping the latest edit. */
+static void trimHistory(UndoJournal *journal)
+{
+    UndoStack *undo = &journal->undo;
+    while (UndoJournal_getMemory(journal) > journal->budget
+        && undo->oldest != undo->newest)
+        unlinkChunk(undo, undo->oldest);
+}
+
+/* Called after an edit couldn't be recorded, so
+ * the history doesn't refer to the wrong text. */
+static void dropHistory(UndoJournal *journal)
+{
+    TraceLog(LOG_WARNING, "Not enough memory to record an edit, dropping the undo history");
+    UndoJournal_clear(journal);
+}
+
+/* Pushes the record that reverts [edits] once
+ * they're applied, capturing the bytes they are
+ * about to remove. */
+static UndoRecord *pushRecord(UndoStack *stack, size_t flags, GapBuffer *buf,
+                              const GapBufferEdit *edits, size_t count)
+{
+    size_t length = count * sizeof(UndoEdit);
+    for (size_t i = 0; i < count; i++)
+        length += edits[i].removed;
+
+    UndoRecord *record = UndoStack_push(stack, count, length, flags);
+    if (record == NULL)
+        return NULL;
+
+    UndoEdit *entries = (UndoEdit*) (record + 1);
+    char *text = (char*) (entries + count);
+    size_t shift = 0; // Wraps around when the text shrinks
+    for (size_t i = 0; i < count; i++) {
+        entries[i].offset = edits[i].offset + shift;
+        entries[i].removed = edits[i].inserted;
+        entries[i].inserted = edits[i].removed;
+        copyFromBuffer(buf, edits[i].offset, edits[i].removed, text);
+        text += edits[i].removed;
+        shift += edits[i].inserted - edits[i].removed;
+    }
+    return record;
+}
+
+/* Tells the listener of a single change spanning
+ * from the first of [edits] to the last one. */
+static void notifyEdits(UndoJournal *journal, const GapBufferEdit *edits, size_t count)
+{
+    if (count == 0)
+        return;
+    const GapBufferEdit *last = &edits[count-1];
+    size_t removed = last->offset + last->removed - edits[0].offset;
+    size_t inserted = removed;
+    for (size_t i = 0; i < count; i++)
+        inserted = inserted - edits[i].removed + edits[i].inserted;
+    notifyEdit(journal, edits[0].offset, removed, inserted);
+}
+
+/* Applies the edits of a record and pushes their
+ * inverse on [to]. */
+static bool moveRecord(UndoJournal *journal, UndoRecord *record,
+                       UndoStack *to, GapBuffer *buf)
+{
+    size_t count = record->offset;
+    GapBufferEdit *edits = malloc(count * sizeof(GapBufferEdit));
+    if (edits == NULL)
+        return false;
+
+    UndoEdit *entries = (UndoEdit*) (record + 1);
+    const char *text = (const char*) (entries + count);
+    for (size_t i = 0; i < count; i++) {
+        edits[i].offset = entries[i].offset;
+        edits[i].removed = entries[i].removed;
+        edits[i].str = text;
+        edits[i].inserted = entries[i].inserted;
+        text += entries[i].inserted;
+    }
+
+    bool done = pushRecord(to, 0, buf, edits, count) != NULL;
+    if (done && !GapBuffer_applyEdits(buf, edits, count, NULL, 0)) {
+        UndoStack_pop(to);
+        done = false;
+    }
+    if (done)
+        notifyEdits(journal, edits, count);
+    free(edits);
+    return done;
+}
+
+/* Applies a list of edits with GapBuffer_replaceAll
+ * and records them as one, which is undone with a
+ * single sweep over the text as well. The listener
+ * is told of one change that covers all of them. */
+bool UndoJournal_replaceAll(UndoJournal *journal, GapBuffer *buf,
+                            const GapBufferEdit *edits, size_t count)
+{
+    if (count == 0)
+        return true;
+
+    UndoRecord *record = pushRecord(&journal->undo, 0, buf, edits, count);
+    if (!GapBuffer_replaceAll(buf, edits, count)) {
+        if (record != NULL)
+            UndoStack_pop(&journal->undo);
+        return false;
+    }
+    if (record == NULL)
+        dropHistory(journal);
+    notifyEdits(journal, edits, count);
+    UndoStack_clear(&journal->redo);
+    trimHistory(journal);
+    journal->typing = false;
+    return true;
+}
+
+/* Returns true if [edits] insert right after every
+ * edit of the typed record [top], in which case
+ * they can be undone along with it. */
+static bool extendsRecord(UndoRecord *top, const GapBufferEdit *edits, size_t count)
+{
+    if (top == NULL || !(top->flags & UndoFlag_TYPED) || top->offset != count)
+        return false;
+
+    UndoEdit *entries = (UndoEdit*) (top + 1);
+    for (size_t i = 0; i < count; i++)
+        if (edits[i].removed > 0 || edits[i].offset != entries[i].offset + entries[i].removed)
+            return false;
+    return true;
+}
+
+/* Applies a list of edits with GapBuffer_applyEdits,
+ * moving [offsets] along with the text, and records
+ * them as one. Typed edits that continue each of
+ * the ones typed last extend their record, as
+ * typing with a single cursor does. */
+bool UndoJournal_applyEdits(UndoJournal *journal, GapBuffer *buf,
+                            const GapBufferEdit *edits, size_t count,
+                            size_t *offsets, size_t num_offsets, bool typed)
+{
+    if (count == 0)
+        return true;
+
+    UndoRecord *top = UndoStack_top(&journal->undo);
+    bool extend = typed && journal->typing && extendsRecord(top, edits, count);
+
+    UndoRecord *record = NULL;
+    if (!extend) {
+        size_t flags = typed ? UndoFlag_TYPED : 0;
+        record = pushRecord(&journal->undo, flags, buf, edits, count);
+    }
+    if (!GapBuffer_applyEdits(buf, edits, count, offsets, num_offsets)) {
+        if (record != NULL)
+            UndoStack_pop(&journal->undo);
+        return false;
+    }
+
+    if (extend) {
+        UndoEdit *entries = (UndoEdit*) (top + 1);
+        size_t shift = 0;
+        for (size_t i = 0; i < count; i++) {
+            entries[i].offset += shift;
+            entries[i].removed += edits[i].inserted;
+            shift += edits[i].inserted;
+        }
+    } else if (record == NULL)
+        dropHistory(journal);
+
+    notifyEdits(journal, edits, count);
+    UndoStack_clear(&journal->redo);
+    trimHistory(journal);
+    journal->typing = typed;
+    return true;
+}
+
+/* Reverts the record on top of [from] and pushes
+ * what's needed to apply it again on [to]. */
+static bool moveTop(UndoJournal *journal, UndoStack *from,
+                    UndoStack *to, GapBuffer *buf)
+{
+    UndoRecord *record = UndoStack_top(from);
+    if (record == NULL || !moveRecord(journal, record, to, buf))
+        return false;
+    UndoStack_pop(from);
+    return true;
+}
+
+bool UndoJournal_undo(UndoJournal *journal, GapBuffer *buf)
+{
+    bool done = moveTop(journal, &journal->undo, &journal->redo, buf);
+    trimHistory(journal);
+    journal->typing = false;
+    return done;
+}
+
+bool UndoJournal_redo(UndoJournal *journal, GapBuffer *buf)
+{
+    bool done = moveTop(journal, &journal->redo, &journal->undo, buf);
+    trimHistory(journal);
+    journal->typing = false;
+    return done;
+}
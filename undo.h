@@ -0,0 +1,54 @@
+#ifndef SNBPAD_UNDO_H
+#define SNBPAD_UNDO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "gap.h"
+
+typedef struct UndoChunk UndoChunk;
+
+/* A stack of records stored back to back in a
+ * list of chunks, from the oldest to the newest. */
+typedef struct {
+    UndoChunk *oldest;
+    UndoChunk *newest;
+    size_t     memory;
+} UndoStack;
+
+/* History of the edits made on a buffer. Every
+ * record lists the edits of one change, whether
+ * made at a single cursor, at many of them or by
+ * a bulk replacement, along with the bytes they
+ * removed, so an insertion only costs its offset
+ * and length until it's undone. Undoing and redoing
+ * moves the records between the two stacks,
+ * capturing the bytes that are about to be removed,
+ * and applies all the edits of a record in one pass.
+ *
+ * Consecutive typed insertions are merged. When
+ * the history uses more than [budget] bytes, the
+ * oldest records are dropped.
+ *
+ * Whoever keeps positions into the buffer can be
+ * told of every change made through the journal,
+ * undoing and redoing included, with [on_edit].
+ */
+typedef struct {
+    UndoStack undo;
+    UndoStack redo;
+    size_t    budget;
+    bool      typing; // The last edit was a typed insertion
+    void    (*on_edit)(size_t offset, size_t removed, size_t inserted, void *userp);
+    void     *userp;
+} UndoJournal;
+
+void UndoJournal_init(UndoJournal *journal, size_t budget);
+void UndoJournal_free(UndoJournal *journal);
+void UndoJournal_clear(UndoJournal *journal);
+void UndoJournal_setListener(UndoJournal *journal, void (*on_edit)(size_t, size_t, size_t, void*), void *userp);
+bool UndoJournal_replaceAll(UndoJournal *journal, GapBuffer *buf, const GapBufferEdit *edits, size_t count);
+bool UndoJournal_applyEdits(UndoJournal *journal, GapBuffer *buf, const GapBufferEdit *edits, size_t count, size_t *offsets, size_t num_offsets, bool typed);
+bool UndoJournal_undo(UndoJournal *journal, GapBuffer *buf);
+bool UndoJournal_redo(UndoJournal *journal, GapBuffer *buf);
+size_t UndoJournal_getMemory(UndoJournal *journal);
+#endif